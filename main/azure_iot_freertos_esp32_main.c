@@ -14,7 +14,6 @@
 #include "esp_wifi_default.h"
 #include "esp_err.h"
 #include "esp_netif.h"
-#include "esp_sntp.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -30,6 +29,16 @@
 
 #include "adc_config.h" // i created this
 #include "i2c_config.h"
+#include "sensors.h"
+
+#include "sample_azure_iot_pnp_data_if.h"
+#include "sample_azure_iot_duty_cycle.h"
+#include "sample_azure_iot_power.h"
+#include "sample_azure_iot_metrics.h"
+#include "sample_azure_iot_nvs.h"
+#include "sample_azure_iot_time.h"
+
+#include "esp_timer.h"
 
 #define GAS_CHANNEL    ADC_CHANNEL_0
 /*-----------------------------------------------------------*/
@@ -68,17 +77,41 @@
     #define SAMPLE_IOT_WIFI_SCAN_AUTH_MODE_THRESHOLD    WIFI_AUTH_WAPI_PSK
 #endif /* if CONFIG_SAMPLE_IOT_WIFI_AUTH_OPEN */
 
-#define SNTP_SERVER_FQDN                                "pool.ntp.org"
+#define WIFI_CACHE_NVS_KEY                              "wifi"
 /*-----------------------------------------------------------*/
 
 static const char * TAG = "sample_azureiot";
 
-static bool g_timeInitialized = false;
-
 static xSemaphoreHandle s_semph_get_ip_addrs;
 static esp_ip4_addr_t s_ip_addr;
 
 static bool s_is_connected_to_internet = false;
+
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+    /* Last successful association and IP configuration, persisted in NVS. */
+    typedef struct
+    {
+        uint8_t bssid[ 6 ];
+        uint8_t channel;
+        esp_netif_ip_info_t ip_info;
+        esp_netif_dns_info_t dns;
+    } wifi_cache_t;
+
+    static wifi_cache_t s_wifi_cache;
+    static bool s_wifi_cache_valid = false;
+#endif
+#if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+    /* A cached address the network no longer honours still yields IP_EVENT_STA_GOT_IP:
+     * without a hub connection within this time, it is dropped for DHCP and a full scan. */
+    #define WIFI_STATIC_IP_CHECK_TIMEOUT_US    ( 60 * 1000 * 1000LL )
+
+    static esp_timer_handle_t s_static_ip_timer = NULL;
+    static bool s_static_ip_in_use = false; /* the STA interface runs on the cached address */
+#endif
+static bool s_wifi_directed = false;    /* current attempts target the cached AP */
+static bool s_attempt_got_ip = false;   /* the current connection attempt reached an IP */
+static int64_t s_connect_start_us = 0;  /* start of the current time-to-IP measurement */
+static esp_netif_t * s_sta_netif = NULL;
 /*-----------------------------------------------------------*/
 
 extern void vStartDemoTask( void );
@@ -98,6 +131,116 @@ static bool is_our_netif( const char * prefix,
 }
 /*-----------------------------------------------------------*/
 
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+static void load_wifi_cache( void )
+{
+    size_t len = sizeof( s_wifi_cache );
+
+    s_wifi_cache_valid = ( xSampleNvs_GetBlob( WIFI_CACHE_NVS_KEY, &s_wifi_cache, &len ) == ESP_OK ) &&
+                         ( len == sizeof( s_wifi_cache ) ) && ( s_wifi_cache.channel != 0 );
+}
+/*-----------------------------------------------------------*/
+
+static void save_wifi_cache( const esp_netif_ip_info_t * ip_info )
+{
+    wifi_cache_t cache = { 0 };
+    wifi_ap_record_t ap;
+
+    if( esp_wifi_sta_get_ap_info( &ap ) != ESP_OK )
+    {
+        return;
+    }
+
+    memcpy( cache.bssid, ap.bssid, sizeof( cache.bssid ) );
+    cache.channel = ap.primary;
+    cache.ip_info = *ip_info;
+    ( void ) esp_netif_get_dns_info( s_sta_netif, ESP_NETIF_DNS_MAIN, &cache.dns );
+
+    /* Only write when something changed, to spare the flash. */
+    if( !s_wifi_cache_valid || ( memcmp( &cache, &s_wifi_cache, sizeof( cache ) ) != 0 ) )
+    {
+        s_wifi_cache = cache;
+        s_wifi_cache_valid = true;
+
+        if( xSampleNvs_SetBlob( WIFI_CACHE_NVS_KEY, &cache, sizeof( cache ) ) != ESP_OK )
+        {
+            ESP_LOGW( TAG, "Failed to persist the Wi-Fi cache" );
+        }
+    }
+}
+#endif /* CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT */
+/*-----------------------------------------------------------*/
+
+/* Directed association failed: forget the cached AP and go back to a scan with DHCP. */
+static void fall_back_to_scan( const char * reason )
+{
+    wifi_config_t wifi_config;
+
+    ESP_LOGW( TAG, "%s, falling back to a scan", reason );
+    s_wifi_directed = false;
+
+    if( esp_wifi_get_config( WIFI_IF_STA, &wifi_config ) == ESP_OK )
+    {
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = SAMPLE_IOT_WIFI_SCAN_METHOD;
+        ESP_ERROR_CHECK( esp_wifi_set_config( WIFI_IF_STA, &wifi_config ) );
+    }
+
+    #if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+        s_static_ip_in_use = false;
+        ( void ) esp_timer_stop( s_static_ip_timer );
+        ( void ) esp_netif_dhcpc_start( s_sta_netif );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+/* The cached address may be stale: erase the cache and reassociate after a scan, with DHCP.
+ * The cache is written again with the new lease. */
+static void drop_static_ip( const char * reason )
+{
+    s_wifi_cache_valid = false;
+    ( void ) xSampleNvs_Erase( WIFI_CACHE_NVS_KEY );
+    fall_back_to_scan( reason );
+
+    /* The disconnect handler reconnects with the configuration set above. */
+    s_is_connected_to_internet = false;
+    ( void ) esp_wifi_disconnect();
+}
+/*-----------------------------------------------------------*/
+
+static void on_static_ip_timeout( void * arg )
+{
+    if( s_static_ip_in_use )
+    {
+        drop_static_ip( "No hub connection over the cached static address" );
+    }
+}
+/*-----------------------------------------------------------*/
+#endif /* CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP */
+
+static void on_wifi_connected( void * arg,
+                               esp_event_base_t event_base,
+                               int32_t event_id,
+                               void * event_data )
+{
+    #if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+        if( s_wifi_directed && s_wifi_cache_valid )
+        {
+            /* The static configuration raises IP_EVENT_STA_GOT_IP right away. */
+            ( void ) esp_netif_dhcpc_stop( s_sta_netif );
+            ESP_ERROR_CHECK( esp_netif_set_ip_info( s_sta_netif, &s_wifi_cache.ip_info ) );
+            ( void ) esp_netif_set_dns_info( s_sta_netif, ESP_NETIF_DNS_MAIN, &s_wifi_cache.dns );
+
+            s_static_ip_in_use = true;
+            ( void ) esp_timer_stop( s_static_ip_timer );
+            ESP_ERROR_CHECK( esp_timer_start_once( s_static_ip_timer, WIFI_STATIC_IP_CHECK_TIMEOUT_US ) );
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
 static void on_got_ip( void * arg,
                        esp_event_base_t event_base,
                        int32_t event_id,
@@ -115,6 +258,18 @@ static void on_got_ip( void * arg,
     ESP_LOGI( TAG, "Got IPv4 event: Interface \"%s\" address: " IPSTR,
               esp_netif_get_desc( event->esp_netif ), IP2STR( &event->ip_info.ip ) );
     memcpy( &s_ip_addr, &event->ip_info.ip, sizeof( s_ip_addr ) );
+
+    uint32_t time_to_ip_ms = ( uint32_t ) ( ( esp_timer_get_time() - s_connect_start_us ) / 1000 );
+    vSampleMetrics_Record( eSampleMetricTimeToIpMs, time_to_ip_ms );
+    ESP_LOGI( TAG, "Time to IP: %u ms (%s)", ( unsigned ) time_to_ip_ms,
+              s_wifi_directed ? "cached access point" : "scan" );
+
+    s_attempt_got_ip = true;
+
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        save_wifi_cache( &event->ip_info );
+    #endif
+
     s_is_connected_to_internet = true;
     xSemaphoreGive( s_semph_get_ip_addrs );
 }
@@ -126,7 +281,22 @@ static void on_wifi_disconnect( void * arg,
                                 void * event_data )
 {
     ESP_LOGI( TAG, "Wi-Fi disconnected, trying to reconnect..." );
+
+    if( s_attempt_got_ip )
+    {
+        /* Connection lost: measure the outage until the next address. The cached AP is tried first. */
+        s_connect_start_us = esp_timer_get_time();
+        s_attempt_got_ip = false;
+    }
+    else if( s_wifi_directed )
+    {
+        fall_back_to_scan( "Could not join the cached access point" );
+    }
+
     s_is_connected_to_internet = false;
+
+    /* Wake the core task so it notices the lost connection without waiting for a timeout. */
+    vNotifyDemoTask( sampleazureiotEVENT_SERVICE );
     esp_err_t err = esp_wifi_connect();
 
     if( err == ESP_ERR_WIFI_NOT_STARTED )
@@ -175,11 +345,14 @@ static esp_netif_t * wifi_start( void )
     esp_netif_t * netif = esp_netif_create_wifi( WIFI_IF_STA, &esp_netif_config );
     free( desc );
     esp_wifi_set_default_wifi_sta_handlers();
+    s_sta_netif = netif;
 
     ESP_ERROR_CHECK( esp_event_handler_register( WIFI_EVENT,
                                                  WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL ) );
     ESP_ERROR_CHECK( esp_event_handler_register( IP_EVENT,
                                                  IP_EVENT_STA_GOT_IP, &on_got_ip, NULL ) );
+    ESP_ERROR_CHECK( esp_event_handler_register( WIFI_EVENT,
+                                                 WIFI_EVENT_STA_CONNECTED, &on_wifi_connected, NULL ) );
     #ifdef CONFIG_EXAMPLE_CONNECT_IPV6
         ESP_ERROR_CHECK( esp_event_handler_register( WIFI_EVENT,
                                                      WIFI_EVENT_STA_CONNECTED, &on_wifi_connect, netif ) );
@@ -198,12 +371,44 @@ static esp_netif_t * wifi_start( void )
             .sort_method        = SAMPLE_IOT_WIFI_CONNECT_AP_SORT_METHOD,
             .threshold.rssi     = CONFIG_SAMPLE_IOT_WIFI_SCAN_RSSI_THRESHOLD,
             .threshold.authmode = SAMPLE_IOT_WIFI_SCAN_AUTH_MODE_THRESHOLD,
+            .listen_interval    = usPower_WifiListenInterval(),
         },
     };
+
+    #if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+        const esp_timer_create_args_t timer_args =
+        {
+            .callback = on_static_ip_timeout,
+            .name     = "static_ip",
+        };
+
+        ESP_ERROR_CHECK( esp_timer_create( &timer_args, &s_static_ip_timer ) );
+    #endif
+
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        load_wifi_cache();
+
+        if( s_wifi_cache_valid )
+        {
+            /* Directed association: only the cached channel is probed. */
+            memcpy( wifi_config.sta.bssid, s_wifi_cache.bssid, sizeof( wifi_config.sta.bssid ) );
+            wifi_config.sta.bssid_set = true;
+            wifi_config.sta.channel = s_wifi_cache.channel;
+            wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+            s_wifi_directed = true;
+            ESP_LOGI( TAG, "Using cached access point " MACSTR " on channel %u",
+                      MAC2STR( s_wifi_cache.bssid ), s_wifi_cache.channel );
+        }
+    #endif
     ESP_LOGI( TAG, "Connecting to %s...", wifi_config.sta.ssid );
     ESP_ERROR_CHECK( esp_wifi_set_mode( WIFI_MODE_STA ) );
     ESP_ERROR_CHECK( esp_wifi_set_config( WIFI_IF_STA, &wifi_config ) );
+    s_connect_start_us = esp_timer_get_time();
     ESP_ERROR_CHECK( esp_wifi_start() );
+    #if CONFIG_SAMPLE_IOT_WIFI_MODEM_SLEEP
+        ESP_LOGI( TAG, "Wi-Fi modem sleep, listen interval %u beacons", wifi_config.sta.listen_interval );
+        ESP_ERROR_CHECK( esp_wifi_set_ps( WIFI_PS_MAX_MODEM ) );
+    #endif
     esp_wifi_connect();
     return netif;
 }
@@ -219,6 +424,8 @@ static void wifi_stop( void )
                                                    WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect ) );
     ESP_ERROR_CHECK( esp_event_handler_unregister( IP_EVENT,
                                                    IP_EVENT_STA_GOT_IP, &on_got_ip ) );
+    ESP_ERROR_CHECK( esp_event_handler_unregister( WIFI_EVENT,
+                                                   WIFI_EVENT_STA_CONNECTED, &on_wifi_connected ) );
     #ifdef CONFIG_EXAMPLE_CONNECT_IPV6
         ESP_ERROR_CHECK( esp_event_handler_unregister( IP_EVENT,
                                                        IP_EVENT_GOT_IP6, &on_got_ipv6 ) );
@@ -290,29 +497,33 @@ bool xAzureSample_IsConnectedToInternet()
 {
     return s_is_connected_to_internet;
 }
-
 /*-----------------------------------------------------------*/
 
-static void time_sync_notification_cb( struct timeval * tv )
+void vAzureSample_ReconnectWiFi( void )
 {
-    ESP_LOGI( TAG, "Notification of a time synchronization event" );
-    g_timeInitialized = true;
+    #if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+        if( s_static_ip_in_use )
+        {
+            drop_static_ip( "Hub unreachable over the cached static address" );
+            return;
+        }
+    #endif
+
+    ESP_LOGW( TAG, "Hub unreachable over the current association, reconnecting Wi-Fi" );
+
+    /* Cleared here rather than in on_wifi_disconnect, so the core task cannot race
+     * ahead on the old association; the handler then reconnects and measures the outage. */
+    s_is_connected_to_internet = false;
+    ( void ) esp_wifi_disconnect();
 }
 /*-----------------------------------------------------------*/
 
-static void initialize_time()
+void vAzureSample_NetworkConfirmed( void )
 {
-    sntp_setoperatingmode( SNTP_OPMODE_POLL );
-    sntp_setservername( 0, SNTP_SERVER_FQDN );
-    sntp_set_time_sync_notification_cb( time_sync_notification_cb );
-    sntp_init();
-
-    ESP_LOGI( TAG, "Waiting for time synchronization with SNTP server" );
-
-    while( !g_timeInitialized )
-    {
-        vTaskDelay( pdMS_TO_TICKS( 1000 ) );
-    }
+    #if CONFIG_SAMPLE_IOT_WIFI_CACHED_STATIC_IP
+        /* The hub was reached: the cached address is still valid. */
+        ( void ) esp_timer_stop( s_static_ip_timer );
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -320,25 +531,29 @@ static void initialize_time()
 
 
 
+
 void app_main( void )
 {
+    /* Arms the awake-time budget first so that it also covers Wi-Fi and SNTP. */
+    vDutyCycle_Begin();
+
     init_adc(); // i added this
     i2c_master_init(); // also this
+    sensors_init();
     ESP_ERROR_CHECK( nvs_flash_init() );
+    vPower_Init();
     ESP_ERROR_CHECK( esp_netif_init() );
     ESP_ERROR_CHECK( esp_event_loop_create_default() );
     /*Allow other core to finish initialization */
     vTaskDelay( pdMS_TO_TICKS( 100 ) );
 
-    
+    /* Neither step blocks on the network: the clock starts from RTC/NVS and SNTP
+     * corrects it in the background, and the demo task samples right away while
+     * it waits for connectivity. */
+    vSampleTime_Init();
+    vStartDemoTask();
 
     ( void ) example_connect();
-
-    initialize_time();
-
-
-
-    vStartDemoTask();
 }
 /*-----------------------------------------------------------*/
 
@@ -143,10 +143,22 @@ void i2c_scan(void)
 }
 
 #define TVOC_SENSOR_ADDR  0x1A
+#define TVOC_DATA_REG 0x00
+// compensation inputs: temperature in 1/64 K, then humidity in 1/512 %RH, 16 bits little endian each
+#define TVOC_COMPENSATION_REG 0x13
+
+static float tvoc_from_bytes(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | // combine 4 bytes into TVOC value
+           ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8)  |
+           ((uint32_t)data[3]);
+}
+
 esp_err_t read_tvoc(float *tvoc_ppb)
 {
     esp_err_t ret;
-    uint8_t TVOC_reg = 0x00; // TVOC register
+    uint8_t TVOC_reg = TVOC_DATA_REG; // TVOC register
     uint8_t data[5];      
 
     ret = i2c_master_write_slave(TVOC_SENSOR_ADDR, &TVOC_reg, 1); // select TVOC register
@@ -159,10 +171,43 @@ esp_err_t read_tvoc(float *tvoc_ppb)
         return ret;
     }
 
-    *tvoc_ppb = ((uint32_t)data[0] << 24) | // combine 4 bytes into TVOC value 
-                ((uint32_t)data[1] << 16) |
-                ((uint32_t)data[2] << 8)  |
-                ((uint32_t)data[3]);
+    *tvoc_ppb = tvoc_from_bytes(data);
+
+    return ESP_OK;
+}
+
+esp_err_t read_tvoc_compensated(float *tvoc_ppb, float temperature, float humidity)
+{
+    uint16_t temperature_raw = (uint16_t)((temperature + 273.15f) * 64.0f + 0.5f);
+    uint16_t humidity_raw = (uint16_t)((humidity < 0.0f ? 0.0f : humidity) * 512.0f + 0.5f);
+    uint8_t compensation[5] = {
+        TVOC_COMPENSATION_REG,
+        temperature_raw & 0xFF, temperature_raw >> 8,
+        humidity_raw & 0xFF, humidity_raw >> 8,
+    };
+    uint8_t data[5];
+
+    // one command link: write the compensation, then select and read the TVOC register
+    // behind repeated starts, so the bus is taken once
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (TVOC_SENSOR_ADDR << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write(cmd, compensation, sizeof(compensation), true);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (TVOC_SENSOR_ADDR << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, TVOC_DATA_REG, true);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (TVOC_SENSOR_ADDR << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, data, sizeof(data) - 1, I2C_MASTER_ACK);
+    i2c_master_read_byte(cmd, data + sizeof(data) - 1, I2C_MASTER_NACK);
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, pdMS_TO_TICKS(1000)); // execute
+    i2c_cmd_link_delete(cmd);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    *tvoc_ppb = tvoc_from_bytes(data);
 
     return ESP_OK;
 }
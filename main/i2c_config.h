@@ -20,6 +20,10 @@ void i2c_scan(void);
 
 esp_err_t read_tvoc(float *tvoc_ppb);
 
+// read_tvoc, with the temperature (C) and humidity (%RH) written to the sensor's
+// compensation registers in the same transaction
+esp_err_t read_tvoc_compensated(float *tvoc_ppb, float temperature, float humidity);
+
 
 
 #endif // I2C_CONFIG_H
\ No newline at end of file
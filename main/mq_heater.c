@@ -0,0 +1,277 @@
+#include "mq_heater.h"
+
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "MQ_HEATER";
+
+// PWM of the heater switches; RC_FAST keeps it running through light sleep
+#define HEATER_LEDC_MODE LEDC_LOW_SPEED_MODE
+#define HEATER_LEDC_TIMER LEDC_TIMER_0
+#define HEATER_LEDC_RESOLUTION LEDC_TIMER_10_BIT
+#define HEATER_LEDC_FREQ_HZ 1000
+#define HEATER_DUTY_FULL (1U << HEATER_LEDC_RESOLUTION)
+
+#define US_PER_SECOND 1000000LL
+
+// a cycle is a first phase then a second one, each at a fixed PWM duty; reads are valid
+// in [valid_from_us, valid_to_us) of the cycle
+typedef struct {
+    const char *name;
+    sensor_channel_t channel;
+    bool cycling;
+    int gpio;
+    ledc_channel_t ledc_channel;
+    int64_t first_us;
+    int64_t second_us;
+    uint32_t first_duty_pct;
+    uint32_t second_duty_pct;
+    int64_t valid_from_us;
+    int64_t valid_to_us;
+    uint32_t power_mw;      // at full duty
+    esp_timer_handle_t timer;
+    uint32_t valid_reads;
+    uint32_t skipped_reads;
+} heater_state_t;
+
+static heater_state_t heaters[MQ_HEATER_COUNT] = {
+    [MQ_HEATER_MQ7] = {
+        .name = "MQ7",
+        .channel = SENSOR_CO,
+        .power_mw = CONFIG_SAMPLE_IOT_MQ7_HEATER_POWER_MW,
+#if CONFIG_SAMPLE_IOT_MQ7_HEATER_CYCLE
+        // 5 V to burn off adsorbed gases, then about 1.4 V, at which CO is measured; the
+        // reading settles towards the end of the low phase
+        .cycling = true,
+        .gpio = CONFIG_SAMPLE_IOT_MQ7_HEATER_GPIO,
+        .ledc_channel = LEDC_CHANNEL_0,
+        .first_us = CONFIG_SAMPLE_IOT_MQ7_HIGH_SECONDS * US_PER_SECOND,
+        .second_us = CONFIG_SAMPLE_IOT_MQ7_LOW_SECONDS * US_PER_SECOND,
+        .first_duty_pct = 100,
+        .second_duty_pct = CONFIG_SAMPLE_IOT_MQ7_LOW_DUTY_PERCENT,
+        .valid_from_us = (CONFIG_SAMPLE_IOT_MQ7_HIGH_SECONDS + CONFIG_SAMPLE_IOT_MQ7_LOW_SECONDS -
+                          CONFIG_SAMPLE_IOT_MQ7_VALID_SECONDS) * US_PER_SECOND,
+        .valid_to_us = (CONFIG_SAMPLE_IOT_MQ7_HIGH_SECONDS + CONFIG_SAMPLE_IOT_MQ7_LOW_SECONDS) * US_PER_SECOND,
+#endif
+    },
+    [MQ_HEATER_MQ2] = {
+        .name = "MQ2",
+        .channel = SENSOR_FLAMMABLE_GAS,
+        .power_mw = CONFIG_SAMPLE_IOT_MQ2_HEATER_POWER_MW,
+#if CONFIG_SAMPLE_IOT_MQ2_HEATER_CYCLE
+        // on, valid once warmed up, then off until the next cycle
+        .cycling = true,
+        .gpio = CONFIG_SAMPLE_IOT_MQ2_HEATER_GPIO,
+        .ledc_channel = LEDC_CHANNEL_1,
+        .first_us = CONFIG_SAMPLE_IOT_MQ2_ON_SECONDS * US_PER_SECOND,
+        .second_us = CONFIG_SAMPLE_IOT_MQ2_OFF_SECONDS * US_PER_SECOND,
+        .first_duty_pct = 100,
+        .second_duty_pct = 0,
+        .valid_from_us = CONFIG_SAMPLE_IOT_MQ2_WARMUP_SECONDS * US_PER_SECOND,
+        .valid_to_us = CONFIG_SAMPLE_IOT_MQ2_ON_SECONDS * US_PER_SECOND,
+#endif
+    },
+};
+
+#if CONFIG_SAMPLE_IOT_MQ2_HEATER_CYCLE && (CONFIG_SAMPLE_IOT_MQ2_WARMUP_SECONDS >= CONFIG_SAMPLE_IOT_MQ2_ON_SECONDS)
+#error "The MQ2 warm-up must be shorter than its on time."
+#endif
+
+#if CONFIG_SAMPLE_IOT_MQ7_HEATER_CYCLE && (CONFIG_SAMPLE_IOT_MQ7_VALID_SECONDS > CONFIG_SAMPLE_IOT_MQ7_LOW_SECONDS)
+#error "The MQ7 valid window must fit in its low phase."
+#endif
+
+// all cycles start here, so that their phase follows from the time alone
+static int64_t cycle_start_us = 0;
+static portMUX_TYPE heater_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t cycle_us(const heater_state_t *heater) {
+    return heater->first_us + heater->second_us;
+}
+
+static int64_t cycle_position(const heater_state_t *heater, int64_t time_us) {
+    int64_t since_us = time_us - cycle_start_us;
+    return (since_us > 0) ? since_us % cycle_us(heater) : 0;
+}
+
+// duty-weighted heater time, in percent microseconds, from the start to elapsed_us
+static uint64_t duty_time(const heater_state_t *heater, int64_t elapsed_us) {
+    uint64_t per_cycle = heater->first_us * heater->first_duty_pct + heater->second_us * heater->second_duty_pct;
+    int64_t position = elapsed_us % cycle_us(heater);
+    uint64_t total = (uint64_t)(elapsed_us / cycle_us(heater)) * per_cycle;
+
+    if (position < heater->first_us) {
+        total += position * heater->first_duty_pct;
+    } else {
+        total += heater->first_us * heater->first_duty_pct + (position - heater->first_us) * heater->second_duty_pct;
+    }
+    return total;
+}
+
+static void set_duty(const heater_state_t *heater, uint32_t duty_pct) {
+    ledc_set_duty(HEATER_LEDC_MODE, heater->ledc_channel, duty_pct * HEATER_DUTY_FULL / 100);
+    ledc_update_duty(HEATER_LEDC_MODE, heater->ledc_channel);
+}
+
+// esp_timer callback at each phase change: sets the duty of the phase now running and arms
+// the next change; phases follow from the time, so a late callback does not shift the cycle
+static void on_phase(void *arg) {
+    heater_state_t *heater = (heater_state_t *)arg;
+    int64_t position = cycle_position(heater, esp_timer_get_time());
+    int64_t next_us;
+
+    if (position < heater->first_us) {
+        set_duty(heater, heater->first_duty_pct);
+        next_us = heater->first_us - position;
+    } else {
+        set_duty(heater, heater->second_duty_pct);
+        next_us = cycle_us(heater) - position;
+    }
+
+    esp_err_t err = esp_timer_start_once(heater->timer, next_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: failed to arm the phase timer: %s", heater->name, esp_err_to_name(err));
+    }
+}
+
+void mq_heater_init(void) {
+    ledc_timer_config_t timer_config = {
+        .speed_mode = HEATER_LEDC_MODE,
+        .duty_resolution = HEATER_LEDC_RESOLUTION,
+        .timer_num = HEATER_LEDC_TIMER,
+        .freq_hz = HEATER_LEDC_FREQ_HZ,
+        .clk_cfg = LEDC_USE_RC_FAST_CLK,
+    };
+    bool timer_configured = false;
+
+    cycle_start_us = esp_timer_get_time();
+
+    for (int i = 0; i < MQ_HEATER_COUNT; i++) {
+        heater_state_t *heater = &heaters[i];
+
+        if (!heater->cycling) {
+            ESP_LOGI(TAG, "%s heater always on", heater->name);
+            continue;
+        }
+
+        if (!timer_configured) {
+            ESP_ERROR_CHECK(ledc_timer_config(&timer_config));
+            timer_configured = true;
+        }
+
+        ledc_channel_config_t channel_config = {
+            .gpio_num = heater->gpio,
+            .speed_mode = HEATER_LEDC_MODE,
+            .channel = heater->ledc_channel,
+            .timer_sel = HEATER_LEDC_TIMER,
+            .duty = heater->first_duty_pct * HEATER_DUTY_FULL / 100,
+            .hpoint = 0,
+        };
+        ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
+
+        esp_timer_create_args_t timer_args = {
+            .callback = on_phase,
+            .arg = heater,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mq_heater",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &heater->timer));
+        ESP_ERROR_CHECK(esp_timer_start_once(heater->timer, heater->first_us));
+
+        ESP_LOGI(TAG, "%s heater: %lld s at %lu %%, %lld s at %lu %%, reads valid from %lld to %lld s",
+                 heater->name, heater->first_us / US_PER_SECOND, (unsigned long)heater->first_duty_pct,
+                 heater->second_us / US_PER_SECOND, (unsigned long)heater->second_duty_pct,
+                 heater->valid_from_us / US_PER_SECOND, heater->valid_to_us / US_PER_SECOND);
+    }
+}
+
+mq_heater_t mq_heater_of_channel(sensor_channel_t channel) {
+    for (int i = 0; i < MQ_HEATER_COUNT; i++) {
+        if (heaters[i].channel == channel) {
+            return (mq_heater_t)i;
+        }
+    }
+    return MQ_HEATER_NONE;
+}
+
+const char *mq_heater_name(mq_heater_t heater) {
+    return (heater < MQ_HEATER_COUNT) ? heaters[heater].name : "none";
+}
+
+bool mq_heater_valid(sensor_channel_t channel, int64_t time_us) {
+    mq_heater_t index = mq_heater_of_channel(channel);
+
+    if (index == MQ_HEATER_NONE || !heaters[index].cycling) {
+        return true;
+    }
+
+    int64_t position = cycle_position(&heaters[index], time_us);
+    return (position >= heaters[index].valid_from_us) && (position < heaters[index].valid_to_us);
+}
+
+int64_t mq_heater_next_valid_us(sensor_channel_t channel, int64_t after_us) {
+    mq_heater_t index = mq_heater_of_channel(channel);
+
+    if (mq_heater_valid(channel, after_us)) {
+        return after_us;
+    }
+
+    const heater_state_t *heater = &heaters[index];
+    int64_t position = cycle_position(heater, after_us);
+    int64_t window_us = after_us - position + heater->valid_from_us;
+    return (window_us > after_us) ? window_us : window_us + cycle_us(heater);
+}
+
+bool mq_heater_check_read(sensor_channel_t channel) {
+    mq_heater_t index = mq_heater_of_channel(channel);
+    bool valid = mq_heater_valid(channel, esp_timer_get_time());
+
+    if (index != MQ_HEATER_NONE) {
+        taskENTER_CRITICAL(&heater_lock);
+        if (valid) {
+            heaters[index].valid_reads++;
+        } else {
+            heaters[index].skipped_reads++;
+        }
+        taskEXIT_CRITICAL(&heater_lock);
+    }
+
+    if (!valid) {
+        ESP_LOGD(TAG, "%s read skipped outside of the valid window", heaters[index].name);
+    }
+    return valid;
+}
+
+void mq_heater_stats(mq_heater_t heater, mq_heater_stats_t *stats) {
+    const heater_state_t *state = &heaters[heater];
+    int64_t elapsed_us;
+
+    configASSERT(heater < MQ_HEATER_COUNT);
+    memset(stats, 0, sizeof(*stats));
+
+    taskENTER_CRITICAL(&heater_lock);
+    stats->valid_reads = state->valid_reads;
+    stats->skipped_reads = state->skipped_reads;
+    taskEXIT_CRITICAL(&heater_lock);
+
+    elapsed_us = esp_timer_get_time() - cycle_start_us;
+
+    // mW * us = nJ
+    stats->cycling = state->cycling;
+    stats->always_on_mw = state->power_mw;
+    stats->always_on_energy_uj = (uint64_t)elapsed_us * state->power_mw / 1000;
+    if (state->cycling) {
+        stats->energy_uj = duty_time(state, elapsed_us) / 100 * state->power_mw / 1000;
+    } else {
+        stats->energy_uj = stats->always_on_energy_uj;
+    }
+    if (elapsed_us > 0) {
+        stats->average_mw = (uint32_t)(stats->energy_uj * 1000 / elapsed_us);
+    }
+}
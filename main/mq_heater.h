@@ -0,0 +1,47 @@
+#ifndef MQ_HEATER_H
+#define MQ_HEATER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sensors.h"
+
+// heaters of the gas sensors; each runs a two-phase cycle, or stays on if not controlled
+typedef enum {
+    MQ_HEATER_MQ7 = 0,       // CO: 60 s at 5 V to clean the sensor, 90 s at 1.4 V to measure
+    MQ_HEATER_MQ2,           // flammable gas: optionally switched off between reports
+    MQ_HEATER_COUNT,
+    MQ_HEATER_NONE = MQ_HEATER_COUNT  // channel without a heater
+} mq_heater_t;
+
+// energy use and read validity of a heater since mq_heater_init
+typedef struct {
+    bool cycling;            // false if the heater is left on all the time
+    uint64_t energy_uj;
+    uint64_t always_on_energy_uj;  // the same with the heater on all the time
+    uint32_t average_mw;
+    uint32_t always_on_mw;
+    uint32_t valid_reads;    // reads inside the valid window
+    uint32_t skipped_reads;  // reads refused outside of it
+} mq_heater_stats_t;
+
+// set up the heater outputs and start the cycles; called by sensors_init
+void mq_heater_init(void);
+
+mq_heater_t mq_heater_of_channel(sensor_channel_t channel);
+
+const char *mq_heater_name(mq_heater_t heater);
+
+// whether a read of the channel at time_us (esp_timer time) gives a valid value;
+// always true for channels without a heater or with a heater left on
+bool mq_heater_valid(sensor_channel_t channel, int64_t time_us);
+
+// first time at or after after_us at which reads of the channel are valid
+int64_t mq_heater_next_valid_us(sensor_channel_t channel, int64_t after_us);
+
+// checks that a read of the channel now is valid, and counts it as valid or skipped
+bool mq_heater_check_read(sensor_channel_t channel);
+
+void mq_heater_stats(mq_heater_t heater, mq_heater_stats_t *stats);
+
+#endif // MQ_HEATER_H
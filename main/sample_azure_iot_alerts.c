@@ -0,0 +1,223 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_alerts.h"
+
+/* Standard includes. */
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_duty_cycle.h"
+#include "sample_azure_iot_event_queue.h"
+#include "sample_azure_iot_metrics.h"
+#include "sample_azure_iot_pnp_data_if.h"
+#include "sample_azure_iot_time.h"
+#include "sensors.h"
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_GAS_ALERTS
+
+    #if ( CONFIG_SAMPLE_IOT_CO_CLEAR_PPM >= CONFIG_SAMPLE_IOT_CO_ALARM_PPM ) || \
+    ( CONFIG_SAMPLE_IOT_FLAMMABLE_CLEAR_PPM >= CONFIG_SAMPLE_IOT_FLAMMABLE_ALARM_PPM )
+        #error "Alert clear thresholds must be below the alarm thresholds."
+    #endif
+
+/**
+ * @brief Crossings kept while they cannot be published; the oldest is dropped when full.
+ */
+    #define alertsQUEUE_DEPTH             ( 8U )
+
+/**
+ * @brief Alert payload. The acquisition time fields match the telemetry ones, so that
+ *        vPrepareTelemetryForSend corrects them the same way.
+ */
+    #define alertsMESSAGE                 "{\"Alert\":\"%s\",\"State\":\"%s\",\"Value\":%.2f,\"Threshold\":%d," \
+                                          "\"Timestamp\":%013lld,\"TimeValid\":%d}"
+
+/**
+ * @brief Message properties, so that the hub can route alerts apart from telemetry.
+ */
+    #define alertsPROPERTY_ALERT          "alert"
+    #define alertsPROPERTY_STATE          "state"
+    #define alertsPROPERTY_PRIORITY       "priority"
+    #define alertsPRIORITY_HIGH           "high"
+
+    #define alertsSTATE_ALARM             "alarm"
+    #define alertsSTATE_CLEAR             "clear"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Alarm and clear thresholds of one channel, in ppm.
+ */
+    typedef struct AlertThreshold
+    {
+        sensor_channel_t xChannel;
+        int32_t lAlarm; /**< Alarm raised at or above this value. */
+        int32_t lClear; /**< Alarm cleared at or below this value. */
+    } AlertThreshold_t;
+
+/**
+ * @brief One threshold crossing.
+ */
+    typedef struct AlertEvent
+    {
+        const AlertThreshold_t * pxThreshold;
+        bool xRaised;      /**< true for an alarm, false when it clears. */
+        float xValue;
+        int64_t llSampleUs; /**< esp_timer time of the sample that crossed the threshold. */
+    } AlertEvent_t;
+
+    static const AlertThreshold_t xThresholds[] =
+    {
+        { SENSOR_CO,            CONFIG_SAMPLE_IOT_CO_ALARM_PPM,        CONFIG_SAMPLE_IOT_CO_CLEAR_PPM        },
+        { SENSOR_FLAMMABLE_GAS, CONFIG_SAMPLE_IOT_FLAMMABLE_ALARM_PPM, CONFIG_SAMPLE_IOT_FLAMMABLE_CLEAR_PPM },
+    };
+
+    #define alertsTHRESHOLD_COUNT    ( sizeof( xThresholds ) / sizeof( xThresholds[ 0 ] ) )
+
+    /* Channels in alarm. Only the task that acquires the readings changes it; kept through
+     * deep sleep, so that an alarm is raised and cleared once across duty cycles. */
+    static sampleazureiotRETAINED uint32_t ulActiveMask = 0;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Builds the message of an alert, with its message properties.
+ */
+    static int prvFormatAlert( const void * pvEvent,
+                               char * pcPayload,
+                               size_t xPayloadSize,
+                               AzureIoTMessageProperties_t * pxProperties,
+                               int64_t * pllEventUs )
+    {
+        const AlertEvent_t * pxEvent = ( const AlertEvent_t * ) pvEvent;
+        const char * pcChannel = sensors_channel_name( pxEvent->pxThreshold->xChannel );
+        const char * pcState = pxEvent->xRaised ? alertsSTATE_ALARM : alertsSTATE_CLEAR;
+
+        if( ( AzureIoTMessage_PropertiesAppend( pxProperties,
+                                                ( const uint8_t * ) alertsPROPERTY_ALERT, sizeof( alertsPROPERTY_ALERT ) - 1,
+                                                ( const uint8_t * ) pcChannel, strlen( pcChannel ) ) != eAzureIoTSuccess ) ||
+            ( AzureIoTMessage_PropertiesAppend( pxProperties,
+                                                ( const uint8_t * ) alertsPROPERTY_STATE, sizeof( alertsPROPERTY_STATE ) - 1,
+                                                ( const uint8_t * ) pcState, strlen( pcState ) ) != eAzureIoTSuccess ) ||
+            ( AzureIoTMessage_PropertiesAppend( pxProperties,
+                                                ( const uint8_t * ) alertsPROPERTY_PRIORITY, sizeof( alertsPROPERTY_PRIORITY ) - 1,
+                                                ( const uint8_t * ) alertsPRIORITY_HIGH, sizeof( alertsPRIORITY_HIGH ) - 1 ) != eAzureIoTSuccess ) )
+        {
+            return -1;
+        }
+
+        *pllEventUs = pxEvent->llSampleUs;
+
+        return snprintf( pcPayload, xPayloadSize, alertsMESSAGE, pcChannel, pcState, pxEvent->xValue,
+                         ( int ) ( pxEvent->xRaised ? pxEvent->pxThreshold->lAlarm : pxEvent->pxThreshold->lClear ),
+                         ( long long ) llSampleTime_ToUnixMs( pxEvent->llSampleUs ),
+                         xSampleTime_IsSynchronized() ? 1 : 0 );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Records the latency from the sample that crossed a threshold to the PUBACK of its alert.
+ */
+    static void prvOnAlertAcknowledged( uint32_t ulEventToAckMs )
+    {
+        vSampleMetrics_Record( eSampleMetricAlertLatencyMs, ulEventToAckMs );
+    }
+/*-----------------------------------------------------------*/
+
+    /* Crossings not acknowledged yet, pushed by the task that acquires the readings and published
+     * by the core task; kept through deep sleep with the channels in alarm. */
+    static sampleazureiotRETAINED AlertEvent_t xEvents[ alertsQUEUE_DEPTH ];
+    static sampleazureiotRETAINED EventQueue_t xAlertQueue = eventqueueINIT( "alert", xEvents, sampleazureiotEVENT_ALERT,
+                                                                             prvFormatAlert, prvOnAlertAcknowledged );
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Compares a sample with the thresholds of its channel and queues a crossing.
+ *
+ * @return bool true if a crossing was queued.
+ */
+    static bool prvEvaluate( const AlertThreshold_t * pxThreshold,
+                             const sensor_reading_t * pxReading )
+    {
+        uint32_t ulChannelMask = SENSOR_MASK( pxThreshold->xChannel );
+        bool xActive = ( ulActiveMask & ulChannelMask ) != 0;
+        AlertEvent_t xEvent;
+
+        if( ( pxReading->valid_mask & ulChannelMask ) == 0 )
+        {
+            return false;
+        }
+
+        xEvent.pxThreshold = pxThreshold;
+        xEvent.xValue = pxReading->value[ pxThreshold->xChannel ];
+        xEvent.llSampleUs = pxReading->timestamp_us;
+
+        /* Between the two thresholds the state does not change, so a reading
+         * hovering around one threshold does not flood the hub. */
+        if( !xActive && ( xEvent.xValue >= ( float ) pxThreshold->lAlarm ) )
+        {
+            xEvent.xRaised = true;
+            ulActiveMask |= ulChannelMask;
+        }
+        else if( xActive && ( xEvent.xValue <= ( float ) pxThreshold->lClear ) )
+        {
+            xEvent.xRaised = false;
+            ulActiveMask &= ~ulChannelMask;
+        }
+        else
+        {
+            return false;
+        }
+
+        LogWarn( ( "%s %s: %.2f ppm", sensors_channel_name( pxThreshold->xChannel ),
+                   xEvent.xRaised ? alertsSTATE_ALARM : alertsSTATE_CLEAR, xEvent.xValue ) );
+
+        vEventQueue_Push( &xAlertQueue, &xEvent );
+
+        return true;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* CONFIG_SAMPLE_IOT_GAS_ALERTS */
+
+void vAlerts_Evaluate( const sensor_reading_t * pxReading )
+{
+    #if CONFIG_SAMPLE_IOT_GAS_ALERTS
+        bool xQueued = false;
+        uint32_t i;
+
+        for( i = 0; i < alertsTHRESHOLD_COUNT; i++ )
+        {
+            xQueued |= prvEvaluate( &xThresholds[ i ], pxReading );
+        }
+
+        if( xQueued )
+        {
+            vNotifyDemoTask( sampleazureiotEVENT_ALERT );
+        }
+    #else
+        ( void ) pxReading;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xAlerts_Publish( AzureIoTHubClient_t * pxClient )
+{
+    #if CONFIG_SAMPLE_IOT_GAS_ALERTS
+        return xEventQueue_Publish( &xAlertQueue, pxClient );
+    #else
+        ( void ) pxClient;
+
+        return eAzureIoTSuccess;
+    #endif
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Threshold alerts for CO and flammable gas.
+ *        Every reading is compared with alarm and clear thresholds (hysteresis): those of the
+ *        sampling task with rollups, so alerts follow the heater windows and the sampling
+ *        period of the MQ channels, otherwise the reading taken for each report or duty-cycle
+ *        wake-up. Each crossing is queued and wakes the core task, which publishes it at once
+ *        as an alert message tagged with message properties.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ALERTS_H
+#define SAMPLE_AZURE_IOT_ALERTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+#include "sensors.h"
+
+/**
+ * @brief Compares a reading with the thresholds of its valid channels and queues the
+ *        crossings. Does nothing unless CONFIG_SAMPLE_IOT_GAS_ALERTS is set.
+ *
+ * @remark Called by vHandleSensorReading for every reading, once the core task is created.
+ *
+ * @param[in] pxReading  The reading.
+ */
+void vAlerts_Evaluate( const sensor_reading_t * pxReading );
+
+/**
+ * @brief Publishes the queued alerts through the in-flight window, oldest first.
+ *
+ * @remark Must be called from the task that runs AzureIoTHubClient_ProcessLoop, while connected.
+ *         Alerts raised while offline stay queued until then.
+ *
+ * @param[in] pxClient  Connected hub client.
+ *
+ * @return AzureIoTResult_t Result of the failing publish, eAzureIoTSuccess otherwise.
+ */
+AzureIoTResult_t xAlerts_Publish( AzureIoTHubClient_t * pxClient );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_ALERTS_H */
@@ -0,0 +1,196 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_backlog.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_duty_cycle.h"
+/*-----------------------------------------------------------*/
+
+typedef struct BacklogEntry
+{
+    uint32_t ulId; /**< Non-zero, unique among queued entries. */
+    uint16_t usLength;
+    uint8_t ucPayload[ sampleazureiotMESSAGE_MAX_SIZE ];
+} BacklogEntry_t;
+
+typedef struct Backlog
+{
+    uint32_t ulHead;
+    uint32_t ulCount;
+    uint32_t ulDropped;
+    uint32_t ulLastId;
+    BacklogEntry_t xEntries[ CONFIG_SAMPLE_IOT_BACKLOG_DEPTH ];
+} Backlog_t;
+
+/* Kept in RTC memory in duty-cycle mode so undelivered messages survive deep sleep. */
+static sampleazureiotRETAINED Backlog_t xBacklog;
+
+/* Entries handed to the in-flight window, by position in xEntries. Kept in RAM:
+ * after a reset nothing is in flight any more, so every entry is sent again. */
+static bool xSent[ CONFIG_SAMPLE_IOT_BACKLOG_DEPTH ];
+
+/* RTC slow memory is 8 KB on the ESP32 and also holds the statistics, the sensor
+ * calibration and the acknowledged reported properties: leave 2 KB for those. */
+#define backlogRTC_BUDGET_BYTES    ( 6 * 1024 )
+
+#if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE && \
+    ( ( CONFIG_SAMPLE_IOT_BACKLOG_DEPTH * ( CONFIG_SAMPLE_IOT_MESSAGE_MAX_SIZE + 8 ) + 16 ) > backlogRTC_BUDGET_BYTES )
+    #error "In duty-cycle mode, BACKLOG_DEPTH x MESSAGE_MAX_SIZE must fit in 6 KB of RTC memory."
+#endif
+/*-----------------------------------------------------------*/
+
+static uint32_t prvPosition( uint32_t ulIndex )
+{
+    return ( xBacklog.ulHead + ulIndex ) % CONFIG_SAMPLE_IOT_BACKLOG_DEPTH;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Finds a queued entry.
+ *
+ * @return uint32_t Its index from the head, ulCount if it is no longer queued.
+ */
+static uint32_t prvFind( uint32_t ulEntryId )
+{
+    uint32_t i;
+
+    for( i = 0; i < xBacklog.ulCount; i++ )
+    {
+        if( xBacklog.xEntries[ prvPosition( i ) ].ulId == ulEntryId )
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Removes the entry at an index from the head, moving the newer entries up.
+ *        Acknowledgements mostly come in order, so this is usually the head.
+ */
+static void prvRemoveAt( uint32_t ulIndex )
+{
+    uint32_t i;
+
+    for( i = ulIndex; i > 0; i-- )
+    {
+        xBacklog.xEntries[ prvPosition( i ) ] = xBacklog.xEntries[ prvPosition( i - 1 ) ];
+        xSent[ prvPosition( i ) ] = xSent[ prvPosition( i - 1 ) ];
+    }
+
+    xSent[ xBacklog.ulHead ] = false;
+    xBacklog.ulHead = prvPosition( 1 );
+    xBacklog.ulCount--;
+}
+/*-----------------------------------------------------------*/
+
+bool xBacklog_Push( const uint8_t * pucPayload,
+                    uint32_t ulLength )
+{
+    BacklogEntry_t * pxEntry;
+    uint32_t ulPosition;
+
+    if( ulLength > sampleazureiotMESSAGE_MAX_SIZE )
+    {
+        LogError( ( "Backlog: payload of %u bytes is too large.", ( unsigned ) ulLength ) );
+        return false;
+    }
+
+    if( xBacklog.ulCount == CONFIG_SAMPLE_IOT_BACKLOG_DEPTH )
+    {
+        /* Keep the freshest data: drop the oldest entry. If it is in flight, its
+         * acknowledgement no longer matches any entry. */
+        prvRemoveAt( 0 );
+        xBacklog.ulDropped++;
+        LogWarn( ( "Backlog full, dropped oldest entry (%u dropped so far).", ( unsigned ) xBacklog.ulDropped ) );
+    }
+
+    if( ++xBacklog.ulLastId == 0 )
+    {
+        xBacklog.ulLastId = 1;
+    }
+
+    ulPosition = prvPosition( xBacklog.ulCount );
+    pxEntry = &xBacklog.xEntries[ ulPosition ];
+    ( void ) memcpy( pxEntry->ucPayload, pucPayload, ulLength );
+    pxEntry->usLength = ( uint16_t ) ulLength;
+    pxEntry->ulId = xBacklog.ulLastId;
+    xSent[ ulPosition ] = false;
+    xBacklog.ulCount++;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+bool xBacklog_Take( const uint8_t ** ppucPayload,
+                    uint32_t * pulLength,
+                    uint32_t * pulEntryId )
+{
+    const BacklogEntry_t * pxEntry;
+    uint32_t ulPosition;
+    uint32_t i;
+
+    for( i = 0; i < xBacklog.ulCount; i++ )
+    {
+        ulPosition = prvPosition( i );
+
+        if( !xSent[ ulPosition ] )
+        {
+            pxEntry = &xBacklog.xEntries[ ulPosition ];
+            *ppucPayload = pxEntry->ucPayload;
+            *pulLength = pxEntry->usLength;
+            *pulEntryId = pxEntry->ulId;
+            xSent[ ulPosition ] = true;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+/*-----------------------------------------------------------*/
+
+void vBacklog_Remove( uint32_t ulEntryId )
+{
+    uint32_t ulIndex = prvFind( ulEntryId );
+
+    if( ulIndex < xBacklog.ulCount )
+    {
+        prvRemoveAt( ulIndex );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vBacklog_Release( uint32_t ulEntryId )
+{
+    uint32_t ulIndex = prvFind( ulEntryId );
+
+    if( ulIndex < xBacklog.ulCount )
+    {
+        xSent[ prvPosition( ulIndex ) ] = false;
+    }
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulBacklog_Count( void )
+{
+    return xBacklog.ulCount;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulBacklog_Dropped( void )
+{
+    return xBacklog.ulDropped;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,71 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Bounded FIFO of telemetry payloads that could not be delivered yet.
+ *        When full, the oldest entry is dropped to make room for the newest one.
+ *        Entries stay queued while they are in flight, until their PUBACK arrives.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_BACKLOG_H
+#define SAMPLE_AZURE_IOT_BACKLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/**
+ * @brief Largest payload, in bytes, that can be queued.
+ */
+#define sampleazureiotMESSAGE_MAX_SIZE    ( CONFIG_SAMPLE_IOT_MESSAGE_MAX_SIZE )
+
+/**
+ * @brief Queues a payload at the tail of the backlog.
+ *
+ * @param[in] pucPayload  Payload to copy.
+ * @param[in] ulLength    Length of `pucPayload`, at most sampleazureiotMESSAGE_MAX_SIZE.
+ *
+ * @return bool false if the payload is too large, true otherwise (possibly after dropping the oldest entry).
+ */
+bool xBacklog_Push( const uint8_t * pucPayload,
+                    uint32_t ulLength );
+
+/**
+ * @brief Gets the oldest entry not sent yet and marks it as sent, without removing it.
+ *
+ * @param[out] ppucPayload  Set to the queued payload, valid until the next push or removal.
+ * @param[out] pulLength    Set to the payload length.
+ * @param[out] pulEntryId   Set to the identifier of the entry.
+ *
+ * @return bool false if every entry was sent already.
+ */
+bool xBacklog_Take( const uint8_t ** ppucPayload,
+                    uint32_t * pulLength,
+                    uint32_t * pulEntryId );
+
+/**
+ * @brief Removes a delivered entry. Does nothing if it was dropped meanwhile.
+ *
+ * @param[in] ulEntryId  Identifier returned by xBacklog_Take.
+ */
+void vBacklog_Remove( uint32_t ulEntryId );
+
+/**
+ * @brief Returns an entry that was not delivered, so that xBacklog_Take hands it out again.
+ *
+ * @param[in] ulEntryId  Identifier returned by xBacklog_Take.
+ */
+void vBacklog_Release( uint32_t ulEntryId );
+
+/**
+ * @brief Number of entries currently queued, those in flight included.
+ */
+uint32_t ulBacklog_Count( void );
+
+/**
+ * @brief Number of entries dropped because the backlog was full.
+ */
+uint32_t ulBacklog_Dropped( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_BACKLOG_H */
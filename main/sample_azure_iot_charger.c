@@ -0,0 +1,241 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_charger.h"
+
+/* Standard includes. */
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "sdkconfig.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_event_queue.h"
+#include "sample_azure_iot_pnp_data_if.h"
+#include "sample_azure_iot_time.h"
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_CHARGER_EVENTS
+
+/**
+ * @brief Charger status outputs, both active low: notCHG while charging, notPG while the
+ *        input supply is good.
+ */
+    #define chargerNOT_CHG_GPIO           GPIO_NUM_34
+    #define chargerNOT_PG_GPIO            GPIO_NUM_32
+
+/**
+ * @brief Edges waiting for the charger task; the edges of one bounce are folded into one change.
+ */
+    #define chargerEDGE_QUEUE_DEPTH       ( 8U )
+
+/**
+ * @brief Changes kept while they cannot be published; the oldest is dropped when full.
+ */
+    #define chargerQUEUE_DEPTH            ( 8U )
+
+    #define chargerDEBOUNCE_TICKS         ( pdMS_TO_TICKS( 50 ) )
+
+    #define chargerTASK_STACK_SIZE        ( 3072U )
+    #define chargerTASK_PRIORITY          ( tskIDLE_PRIORITY + 1 )
+
+/**
+ * @brief Event payload. The time fields match the telemetry ones, so that
+ *        vPrepareTelemetryForSend corrects them the same way.
+ */
+    #define chargerMESSAGE                "{\"Event\":\"Charger\",\"Charging\":%s,\"PowerGood\":%s," \
+                                          "\"Timestamp\":%013lld,\"TimeValid\":%d}"
+
+/**
+ * @brief Message properties, so that the hub can route charger events apart from telemetry.
+ */
+    #define chargerPROPERTY_EVENT         "event"
+    #define chargerEVENT_CHARGER          "charger"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief One change of the charger state.
+ */
+    typedef struct ChargerEvent
+    {
+        bool xCharging;
+        bool xPowerGood;
+        int64_t llEdgeUs; /**< esp_timer time of the first edge of the change. */
+    } ChargerEvent_t;
+
+    /* Edge times, from the pin interrupts to the charger task. */
+    static QueueHandle_t xEdgeQueue = NULL;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Makes the next change of a pin interrupt. The interrupt, like the light sleep
+ *        wake-up that gpio_wakeup_enable also sets, waits for the level opposite to the
+ *        current one: an edge interrupt that also works through light sleep.
+ */
+    static void prvArmPin( gpio_num_t xPin )
+    {
+        ( void ) gpio_wakeup_enable( xPin, gpio_get_level( xPin ) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL );
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvOnPinChange( void * pvArgument )
+    {
+        gpio_num_t xPin = ( gpio_num_t ) ( uintptr_t ) pvArgument;
+        int64_t llNowUs = esp_timer_get_time();
+        BaseType_t xWoken = pdFALSE;
+
+        prvArmPin( xPin );
+
+        /* When full, the edges queued already make the task read the pins anyway. */
+        ( void ) xQueueSendFromISR( xEdgeQueue, &llNowUs, &xWoken );
+        portYIELD_FROM_ISR( xWoken );
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvReadState( ChargerEvent_t * pxEvent )
+    {
+        pxEvent->xCharging = ( gpio_get_level( chargerNOT_CHG_GPIO ) == 0 );
+        pxEvent->xPowerGood = ( gpio_get_level( chargerNOT_PG_GPIO ) == 0 );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Builds the message of a change, with its message property.
+ */
+    static int prvFormatEvent( const void * pvEvent,
+                               char * pcPayload,
+                               size_t xPayloadSize,
+                               AzureIoTMessageProperties_t * pxProperties,
+                               int64_t * pllEventUs )
+    {
+        const ChargerEvent_t * pxEvent = ( const ChargerEvent_t * ) pvEvent;
+
+        if( AzureIoTMessage_PropertiesAppend( pxProperties,
+                                              ( const uint8_t * ) chargerPROPERTY_EVENT, sizeof( chargerPROPERTY_EVENT ) - 1,
+                                              ( const uint8_t * ) chargerEVENT_CHARGER, sizeof( chargerEVENT_CHARGER ) - 1 ) != eAzureIoTSuccess )
+        {
+            return -1;
+        }
+
+        *pllEventUs = pxEvent->llEdgeUs;
+
+        return snprintf( pcPayload, xPayloadSize, chargerMESSAGE,
+                         pxEvent->xCharging ? "true" : "false",
+                         pxEvent->xPowerGood ? "true" : "false",
+                         ( long long ) llSampleTime_ToUnixMs( pxEvent->llEdgeUs ),
+                         xSampleTime_IsSynchronized() ? 1 : 0 );
+    }
+/*-----------------------------------------------------------*/
+
+    /* Changes not published yet, pushed by the charger task and published by the core task. */
+    static ChargerEvent_t xEvents[ chargerQUEUE_DEPTH ];
+    static EventQueue_t xChargerQueue = eventqueueINIT( "charger", xEvents, sampleazureiotEVENT_CHARGER, prvFormatEvent, NULL );
+/*-----------------------------------------------------------*/
+
+    static void prvChargerTask( void * pvParameters )
+    {
+        ChargerEvent_t xLast;
+        ChargerEvent_t xEvent;
+        int64_t llEdgeUs;
+        int64_t llDiscardUs;
+
+        ( void ) pvParameters;
+
+        prvReadState( &xLast );
+
+        for( ; ; )
+        {
+            ( void ) xQueueReceive( xEdgeQueue, &llEdgeUs, portMAX_DELAY );
+
+            /* Let the pins settle, then fold the edges of the bounce into one change. */
+            vTaskDelay( chargerDEBOUNCE_TICKS );
+
+            while( xQueueReceive( xEdgeQueue, &llDiscardUs, 0 ) == pdTRUE )
+            {
+            }
+
+            prvReadState( &xEvent );
+
+            if( ( xEvent.xCharging == xLast.xCharging ) && ( xEvent.xPowerGood == xLast.xPowerGood ) )
+            {
+                continue;
+            }
+
+            xEvent.llEdgeUs = llEdgeUs;
+            xLast = xEvent;
+
+            LogInfo( ( "Charger: %s, %s.", xEvent.xPowerGood ? "input power good" : "no input power",
+                       xEvent.xCharging ? "charging" : "not charging" ) );
+
+            vEventQueue_Push( &xChargerQueue, &xEvent );
+            vNotifyDemoTask( sampleazureiotEVENT_CHARGER );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* CONFIG_SAMPLE_IOT_CHARGER_EVENTS */
+
+void vCharger_Start( void )
+{
+    #if CONFIG_SAMPLE_IOT_CHARGER_EVENTS
+        static const gpio_num_t xPins[] = { chargerNOT_CHG_GPIO, chargerNOT_PG_GPIO };
+        gpio_config_t xConfig =
+        {
+            .pin_bit_mask = ( 1ULL << chargerNOT_CHG_GPIO ) | ( 1ULL << chargerNOT_PG_GPIO ),
+            .mode         = GPIO_MODE_INPUT,
+            .intr_type    = GPIO_INTR_DISABLE,
+        };
+        BaseType_t xCreated;
+        esp_err_t xErr;
+        uint32_t i;
+
+        xEdgeQueue = xQueueCreate( chargerEDGE_QUEUE_DEPTH, sizeof( int64_t ) );
+        configASSERT( xEdgeQueue != NULL );
+
+        xCreated = xTaskCreate( prvChargerTask, "Charger", chargerTASK_STACK_SIZE, NULL, chargerTASK_PRIORITY, NULL );
+        configASSERT( xCreated == pdPASS );
+
+        /* Both pins are input only, pulled up on the board. */
+        configASSERT( gpio_config( &xConfig ) == ESP_OK );
+
+        /* Also installed by the TVOC data-ready driver. */
+        xErr = gpio_install_isr_service( 0 );
+        configASSERT( ( xErr == ESP_OK ) || ( xErr == ESP_ERR_INVALID_STATE ) );
+
+        for( i = 0; i < sizeof( xPins ) / sizeof( xPins[ 0 ] ); i++ )
+        {
+            configASSERT( gpio_isr_handler_add( xPins[ i ], prvOnPinChange, ( void * ) ( uintptr_t ) xPins[ i ] ) == ESP_OK );
+            prvArmPin( xPins[ i ] );
+        }
+
+        ( void ) esp_sleep_enable_gpio_wakeup();
+
+        LogInfo( ( "Charger events on notCHG (GPIO %d) and notPG (GPIO %d): %s, %s.",
+                   chargerNOT_CHG_GPIO, chargerNOT_PG_GPIO,
+                   ( gpio_get_level( chargerNOT_PG_GPIO ) == 0 ) ? "input power good" : "no input power",
+                   ( gpio_get_level( chargerNOT_CHG_GPIO ) == 0 ) ? "charging" : "not charging" ) );
+    #endif /* if CONFIG_SAMPLE_IOT_CHARGER_EVENTS */
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xCharger_Publish( AzureIoTHubClient_t * pxClient )
+{
+    #if CONFIG_SAMPLE_IOT_CHARGER_EVENTS
+        return xEventQueue_Publish( &xChargerQueue, pxClient );
+    #else
+        ( void ) pxClient;
+
+        return eAzureIoTSuccess;
+    #endif
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,41 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Charger status events.
+ *        The charger's notCHG (GPIO 34) and notPG (GPIO 32) outputs interrupt on every change.
+ *        The interrupt timestamps the change and hands it to a task, which debounces it, reads
+ *        both pins and queues the new state if it differs from the last one. The core task is
+ *        woken and publishes it at once as an event message tagged with message properties.
+ *        Nothing runs between changes.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_CHARGER_H
+#define SAMPLE_AZURE_IOT_CHARGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Sets up the pin interrupts and starts the charger task. Does nothing unless
+ *        CONFIG_SAMPLE_IOT_CHARGER_EVENTS is set.
+ *
+ * @remark Call after the core task is created, so that changes can wake it.
+ */
+void vCharger_Start( void );
+
+/**
+ * @brief Publishes the queued charger events through the in-flight window, oldest first.
+ *
+ * @remark Must be called from the task that runs AzureIoTHubClient_ProcessLoop, while connected.
+ *         Events raised while offline stay queued until then.
+ *
+ * @param[in] pxClient  Connected hub client.
+ *
+ * @return AzureIoTResult_t Result of the failing publish, eAzureIoTSuccess otherwise.
+ */
+AzureIoTResult_t xCharger_Publish( AzureIoTHubClient_t * pxClient );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_CHARGER_H */
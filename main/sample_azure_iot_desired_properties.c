@@ -0,0 +1,214 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_desired_properties.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+/*-----------------------------------------------------------*/
+
+#define sampleazureiotPROPERTY_DESIRED_TEXT    "desired"
+#define sampleazureiotPROPERTY_VERSION_TEXT    "$version"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Writable property handler: reads the value the reader is positioned on.
+ */
+typedef AzureIoTResult_t ( * WritablePropertyHandler_t )( AzureIoTJSONReader_t * pxReader,
+                                                          WritableProperties_t * pxOutProperties );
+
+typedef struct WritablePropertyEntry
+{
+    const char * pcName;
+    uint32_t ulNameLength;
+    WritablePropertyHandler_t xHandler;
+} WritablePropertyEntry_t;
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvReadTargetTemperature( AzureIoTJSONReader_t * pxReader,
+                                                  WritableProperties_t * pxOutProperties )
+{
+    AzureIoTResult_t xResult = AzureIoTJSONReader_GetTokenDouble( pxReader, &pxOutProperties->xTargetTemperature );
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "Error getting the target temperature: result 0x%08x", xResult ) );
+    }
+    else
+    {
+        pxOutProperties->xHasTargetTemperature = true;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvReadReportingInterval( AzureIoTJSONReader_t * pxReader,
+                                                  WritableProperties_t * pxOutProperties )
+{
+    if( AzureIoTJSONReader_GetTokenInt32( pxReader, &pxOutProperties->lReportingIntervalSeconds ) != eAzureIoTSuccess )
+    {
+        /* Not an integer: acknowledged as out of range. */
+        pxOutProperties->lReportingIntervalSeconds = -1;
+    }
+
+    pxOutProperties->xHasReportingInterval = true;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Writable properties of this device and their handlers.
+ */
+static const WritablePropertyEntry_t xWritableProperties[] =
+{
+    { sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT, sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1, prvReadTargetTemperature },
+    { sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT, sizeof( sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT ) - 1, prvReadReportingInterval },
+};
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Skips the property name the reader is positioned on and its value.
+ */
+static AzureIoTResult_t prvSkipPropertyAndValue( AzureIoTJSONReader_t * pxReader )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONReader_SkipChildren( pxReader ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONReader_NextToken( pxReader );
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Positions the reader on the first property name of the desired properties:
+ *        the root object of a writable property update, the "desired" object of a GET response.
+ */
+static AzureIoTResult_t prvEnterDesiredProperties( AzureIoTJSONReader_t * pxReader,
+                                                   bool xIsGetResponse )
+{
+    AzureIoTJSONTokenType_t xTokenType;
+    AzureIoTResult_t xResult;
+
+    if( ( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess ) ||
+        ( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess ) ||
+        !xIsGetResponse )
+    {
+        return xResult;
+    }
+
+    while( ( ( xResult = AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) ) == eAzureIoTSuccess ) &&
+           ( xTokenType == eAzureIoTJSONTokenPROPERTY_NAME ) )
+    {
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader,
+                                                 ( const uint8_t * ) sampleazureiotPROPERTY_DESIRED_TEXT,
+                                                 sizeof( sampleazureiotPROPERTY_DESIRED_TEXT ) - 1 ) )
+        {
+            /* Skip the name and the opening brace. */
+            if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess )
+            {
+                xResult = AzureIoTJSONReader_NextToken( pxReader );
+            }
+
+            return xResult;
+        }
+
+        /* "reported" is skipped without being parsed. */
+        if( ( xResult = prvSkipPropertyAndValue( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+
+    return ( xResult == eAzureIoTSuccess ) ? eAzureIoTErrorItemNotFound : xResult;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xDesiredProperties_Parse( const uint8_t * pucPayload,
+                                           uint32_t ulPayloadLength,
+                                           bool xIsGetResponse,
+                                           WritableProperties_t * pxOutProperties,
+                                           uint32_t * pulOutVersion )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONReader_t xReader;
+    AzureIoTJSONTokenType_t xTokenType;
+    const WritablePropertyEntry_t * pxEntry;
+    bool xHasVersion = false;
+    uint32_t i;
+
+    ( void ) memset( pxOutProperties, 0, sizeof( *pxOutProperties ) );
+
+    if( ( xResult = AzureIoTJSONReader_Init( &xReader, pucPayload, ulPayloadLength ) ) == eAzureIoTSuccess )
+    {
+        xResult = prvEnterDesiredProperties( &xReader, xIsGetResponse );
+    }
+
+    while( ( xResult == eAzureIoTSuccess ) &&
+           ( ( xResult = AzureIoTJSONReader_TokenType( &xReader, &xTokenType ) ) == eAzureIoTSuccess ) &&
+           ( xTokenType == eAzureIoTJSONTokenPROPERTY_NAME ) )
+    {
+        if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
+                                                 ( const uint8_t * ) sampleazureiotPROPERTY_VERSION_TEXT,
+                                                 sizeof( sampleazureiotPROPERTY_VERSION_TEXT ) - 1 ) )
+        {
+            if( ( ( xResult = AzureIoTJSONReader_NextToken( &xReader ) ) == eAzureIoTSuccess ) &&
+                ( ( xResult = AzureIoTJSONReader_GetTokenUInt32( &xReader, pulOutVersion ) ) == eAzureIoTSuccess ) )
+            {
+                xHasVersion = true;
+                xResult = AzureIoTJSONReader_NextToken( &xReader );
+            }
+
+            continue;
+        }
+
+        for( i = 0, pxEntry = NULL; i < sizeof( xWritableProperties ) / sizeof( xWritableProperties[ 0 ] ); i++ )
+        {
+            if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
+                                                     ( const uint8_t * ) xWritableProperties[ i ].pcName,
+                                                     xWritableProperties[ i ].ulNameLength ) )
+            {
+                pxEntry = &xWritableProperties[ i ];
+                break;
+            }
+        }
+
+        if( pxEntry == NULL )
+        {
+            LogInfo( ( "Unknown property arrived: skipping over it." ) );
+
+            /* Unknown property, component (there are none for this device) or metadata. */
+            xResult = prvSkipPropertyAndValue( &xReader );
+        }
+        else if( ( ( xResult = AzureIoTJSONReader_NextToken( &xReader ) ) == eAzureIoTSuccess ) &&
+                 ( ( xResult = pxEntry->xHandler( &xReader, pxOutProperties ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONReader_NextToken( &xReader );
+        }
+    }
+
+    if( ( xResult == eAzureIoTSuccess ) && !xHasVersion )
+    {
+        xResult = eAzureIoTErrorItemNotFound;
+    }
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "There was an error parsing the properties: result 0x%08x", xResult ) );
+    }
+    else
+    {
+        LogInfo( ( "Successfully parsed properties, version %u", ( unsigned ) *pulOutVersion ) );
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Single-pass parser of the desired properties.
+ *        One traversal of a properties document collects its version and the writable
+ *        properties of this device, entering the "desired" object of a GET response and
+ *        skipping "reported", unknown properties, components and metadata unparsed.
+ *
+ * @remark Depends on the JSON reader only, so that it also builds on the host
+ *         (see test/host).
+ */
+
+#ifndef SAMPLE_AZURE_IOT_DESIRED_PROPERTIES_H
+#define SAMPLE_AZURE_IOT_DESIRED_PROPERTIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_json_reader.h"
+
+/**
+ * @brief Writable properties of this device.
+ */
+#define sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT    "targetTemperature"
+#define sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT    "reportingIntervalSeconds"
+
+/**
+ * @brief Writable properties found in a properties document.
+ */
+typedef struct WritableProperties
+{
+    bool xHasTargetTemperature;
+    double xTargetTemperature;
+    bool xHasReportingInterval;
+    int32_t lReportingIntervalSeconds; /**< -1 if not an integer. */
+} WritableProperties_t;
+
+/**
+ * @brief Parses the desired properties of a properties document.
+ *
+ * @param[in]  pucPayload          The document.
+ * @param[in]  ulPayloadLength     Length of `pucPayload`.
+ * @param[in]  xIsGetResponse      true for the full document of a GET response, whose desired
+ *                                 properties are in its "desired" object; false for a
+ *                                 writable property update.
+ * @param[out] pxOutProperties     The writable properties found.
+ * @param[out] pulOutVersion       Version of the desired properties.
+ *
+ * @return AzureIoTResult_t eAzureIoTSuccess, eAzureIoTErrorItemNotFound if the document has
+ *         no version, or the error of the JSON reader.
+ */
+AzureIoTResult_t xDesiredProperties_Parse( const uint8_t * pucPayload,
+                                           uint32_t ulPayloadLength,
+                                           bool xIsGetResponse,
+                                           WritableProperties_t * pxOutProperties,
+                                           uint32_t * pulOutVersion );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_DESIRED_PROPERTIES_H */
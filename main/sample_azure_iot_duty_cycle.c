@@ -0,0 +1,141 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_duty_cycle.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_metrics.h"
+#include "sample_azure_iot_pnp_data_if.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Summary of one cycle, kept in RTC memory so the next cycle can report it.
+ */
+typedef struct DutyCycleRecord
+{
+    uint32_t ulAwakeMs;
+    uint32_t ulSleepMs;
+    uint32_t ulWakeToPublishMs; /**< 0 if nothing was acknowledged in the cycle. */
+    uint32_t ulEnergyUj;
+} DutyCycleRecord_t;
+
+static sampleazureiotRETAINED uint32_t ulCycleCount = 0;
+static sampleazureiotRETAINED uint64_t ullTotalEnergyUj = 0;
+static sampleazureiotRETAINED DutyCycleRecord_t xLastCycle;
+
+static uint32_t ulWakeToPublishMs = 0;
+
+#if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+    static esp_timer_handle_t xAwakeBudgetTimer = NULL;
+    static volatile bool xAwakeBudgetExpired = false;
+#endif
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+
+/**
+ * @brief Awake-time budget expired: asks the core task to give up on this cycle. The core
+ *        task owns the in-flight window and the backlog, so it sleeps at a point where both
+ *        are consistent (see xDutyCycle_BudgetExpired).
+ */
+    static void prvOnAwakeBudgetExpired( void * pvArg )
+    {
+        ( void ) pvArg;
+
+        LogWarn( ( "Cycle did not complete within %d s, going back to sleep.",
+                   CONFIG_SAMPLE_IOT_DUTY_CYCLE_MAX_AWAKE_SECONDS ) );
+        xAwakeBudgetExpired = true;
+        vNotifyDemoTask( sampleazureiotEVENT_SERVICE );
+    }
+#endif /* CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE */
+/*-----------------------------------------------------------*/
+
+void vDutyCycle_Begin( void )
+{
+    #if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+        const esp_timer_create_args_t xTimerArgs =
+        {
+            .callback = prvOnAwakeBudgetExpired,
+            .name     = "awake_budget"
+        };
+
+        if( esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER )
+        {
+            LogInfo( ( "Cycle %u: woke from deep sleep. Previous cycle awake %u ms, wake-to-publish %u ms, %u uJ",
+                       ( unsigned ) ( ulCycleCount + 1 ), ( unsigned ) xLastCycle.ulAwakeMs,
+                       ( unsigned ) xLastCycle.ulWakeToPublishMs, ( unsigned ) xLastCycle.ulEnergyUj ) );
+
+            /* Metrics live in RAM, so the previous cycle is recorded again after each wake-up. */
+            vSampleMetrics_Record( eSampleMetricCycleEnergyUj, xLastCycle.ulEnergyUj );
+        }
+        else
+        {
+            LogInfo( ( "Cold boot, starting duty cycle." ) );
+        }
+
+        if( ( esp_timer_create( &xTimerArgs, &xAwakeBudgetTimer ) != ESP_OK ) ||
+            ( esp_timer_start_once( xAwakeBudgetTimer, CONFIG_SAMPLE_IOT_DUTY_CYCLE_MAX_AWAKE_SECONDS * 1000000ULL ) != ESP_OK ) )
+        {
+            LogError( ( "Failed to arm the awake-time budget" ) );
+        }
+    #endif /* CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE */
+}
+/*-----------------------------------------------------------*/
+
+void vDutyCycle_MarkPublished( void )
+{
+    if( ulWakeToPublishMs == 0 )
+    {
+        /* esp_timer starts counting after the bootloader, which adds a few hundred ms before that. */
+        ulWakeToPublishMs = ( uint32_t ) ( esp_timer_get_time() / 1000 );
+        vSampleMetrics_Record( eSampleMetricWakeToPublishMs, ulWakeToPublishMs );
+        LogInfo( ( "First publish of the cycle acknowledged %u ms after wake-up", ( unsigned ) ulWakeToPublishMs ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vDutyCycle_Sleep( uint32_t ulSleepSeconds )
+{
+    uint32_t ulAwakeMs = ( uint32_t ) ( esp_timer_get_time() / 1000 );
+
+    xLastCycle.ulAwakeMs = ulAwakeMs;
+    xLastCycle.ulSleepMs = ulSleepSeconds * 1000U;
+    xLastCycle.ulWakeToPublishMs = ulWakeToPublishMs;
+    xLastCycle.ulEnergyUj = ulSampleMetrics_EnergyUj( ulAwakeMs, CONFIG_SAMPLE_IOT_ACTIVE_CURRENT_MA * 1000U ) +
+                            ulSampleMetrics_EnergyUj( xLastCycle.ulSleepMs, CONFIG_SAMPLE_IOT_DEEP_SLEEP_CURRENT_UA );
+    ullTotalEnergyUj += xLastCycle.ulEnergyUj;
+    ulCycleCount++;
+
+    LogInfo( ( "Cycle %u done after %u ms awake, ~%u uJ (%u mJ since power-on). Sleeping %u s.",
+               ( unsigned ) ulCycleCount, ( unsigned ) ulAwakeMs, ( unsigned ) xLastCycle.ulEnergyUj,
+               ( unsigned ) ( ullTotalEnergyUj / 1000U ), ( unsigned ) ulSleepSeconds ) );
+
+    ( void ) esp_sleep_enable_timer_wakeup( ulSleepSeconds * 1000000ULL );
+    esp_deep_sleep_start();
+}
+/*-----------------------------------------------------------*/
+
+bool xDutyCycle_BudgetExpired( void )
+{
+    #if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+        return xAwakeBudgetExpired;
+    #else
+        return false;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulDutyCycle_CycleCount( void )
+{
+    return ulCycleCount;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,58 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Deep-sleep duty cycle: wake, sample, connect, publish, sleep.
+ *        Also tracks wake-to-publish latency and the estimated energy of each cycle.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_DUTY_CYCLE_H
+#define SAMPLE_AZURE_IOT_DUTY_CYCLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+/**
+ * @brief Places state that must survive deep sleep in RTC memory when the duty cycle is enabled.
+ */
+#if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+    #define sampleazureiotRETAINED    RTC_DATA_ATTR
+#else
+    #define sampleazureiotRETAINED
+#endif
+
+/**
+ * @brief Starts a cycle. Call once, early in app_main.
+ *
+ * Logs the wake-up cause and the previous cycle, and arms the awake-time budget after which
+ * the device goes back to sleep even if the cycle did not complete. No-op when disabled.
+ */
+void vDutyCycle_Begin( void );
+
+/**
+ * @brief Whether the awake-time budget of the cycle ran out. The core task then requeues
+ *        its in-flight messages and calls vDutyCycle_Sleep. Always false when disabled.
+ */
+bool xDutyCycle_BudgetExpired( void );
+
+/**
+ * @brief Records the first acknowledged publish of the cycle (wake-to-publish latency).
+ */
+void vDutyCycle_MarkPublished( void );
+
+/**
+ * @brief Ends the cycle: accounts for its energy and enters deep sleep. Does not return.
+ *
+ * @param[in] ulSleepSeconds  Time to sleep before the next cycle.
+ */
+void vDutyCycle_Sleep( uint32_t ulSleepSeconds );
+
+/**
+ * @brief Number of completed cycles since power-on.
+ */
+uint32_t ulDutyCycle_CycleCount( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_DUTY_CYCLE_H */
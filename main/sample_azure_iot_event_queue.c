@@ -0,0 +1,211 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_event_queue.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_inflight.h"
+#include "sample_azure_iot_pnp_data_if.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Removes the oldest queued event.
+ *
+ * @return bool false if the queue is empty.
+ */
+static bool prvTake( EventQueue_t * pxQueue,
+                     void * pvEvent )
+{
+    bool xFound;
+
+    taskENTER_CRITICAL( &pxQueue->xLock );
+
+    xFound = ( pxQueue->ulCount > 0 );
+
+    if( xFound )
+    {
+        ( void ) memcpy( pvEvent, &pxQueue->pucEvents[ pxQueue->ulHead * pxQueue->xEventSize ], pxQueue->xEventSize );
+        pxQueue->ulHead = ( pxQueue->ulHead + 1 ) % pxQueue->ulDepth;
+        pxQueue->ulCount--;
+    }
+
+    taskEXIT_CRITICAL( &pxQueue->xLock );
+
+    return xFound;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Queues an event taken by prvTake again, ahead of the others. It is the oldest, so
+ *        it is the one dropped if the queue filled up meanwhile.
+ */
+static void prvPushFront( EventQueue_t * pxQueue,
+                          const void * pvEvent )
+{
+    bool xQueued;
+
+    taskENTER_CRITICAL( &pxQueue->xLock );
+
+    xQueued = ( pxQueue->ulCount < pxQueue->ulDepth );
+
+    if( xQueued )
+    {
+        pxQueue->ulHead = ( pxQueue->ulHead + pxQueue->ulDepth - 1 ) % pxQueue->ulDepth;
+        ( void ) memcpy( &pxQueue->pucEvents[ pxQueue->ulHead * pxQueue->xEventSize ], pvEvent, pxQueue->xEventSize );
+        pxQueue->ulCount++;
+    }
+
+    taskEXIT_CRITICAL( &pxQueue->xLock );
+
+    if( !xQueued )
+    {
+        LogWarn( ( "Event queue full (%s), oldest event dropped.", pxQueue->pcName ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief In-flight completion of an event message: reports the latency from the event to the
+ *        PUBACK, or queues the event again to be published with its message properties.
+ */
+static void prvOnMessageComplete( uint32_t ulMessageId,
+                                  bool xAcknowledged,
+                                  uint32_t ulLatencyMs,
+                                  void * pvContext )
+{
+    EventMessage_t * pxMessage = ( EventMessage_t * ) pvContext;
+    EventQueue_t * pxQueue = pxMessage->pxQueue;
+    uint32_t ulEventToAckMs;
+
+    ( void ) ulLatencyMs;
+
+    if( xAcknowledged )
+    {
+        ulEventToAckMs = ( uint32_t ) ( ( esp_timer_get_time() - pxMessage->llEventUs ) / 1000 );
+        LogInfo( ( "Event message %u (%s) acknowledged %u ms after the event.",
+                   ( unsigned ) ulMessageId, pxQueue->pcName, ( unsigned ) ulEventToAckMs ) );
+
+        if( pxQueue->xOnAcknowledged != NULL )
+        {
+            pxQueue->xOnAcknowledged( ulEventToAckMs );
+        }
+    }
+    else
+    {
+        LogWarn( ( "Event message %u (%s) not acknowledged, queued again.",
+                   ( unsigned ) ulMessageId, pxQueue->pcName ) );
+        prvPushFront( pxQueue, pxMessage->ullEvent );
+    }
+
+    pxMessage->xInUse = false;
+
+    if( !xAcknowledged )
+    {
+        vNotifyDemoTask( pxQueue->ulWakeEvent );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static EventMessage_t * prvGetFreeMessage( EventQueue_t * pxQueue )
+{
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( !pxQueue->xMessages[ i ].xInUse )
+        {
+            return &pxQueue->xMessages[ i ];
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+void vEventQueue_Push( EventQueue_t * pxQueue,
+                       const void * pvEvent )
+{
+    bool xDropped = false;
+
+    configASSERT( pxQueue->xEventSize <= eventqueueEVENT_MAX_SIZE );
+
+    taskENTER_CRITICAL( &pxQueue->xLock );
+
+    if( pxQueue->ulCount == pxQueue->ulDepth )
+    {
+        pxQueue->ulHead = ( pxQueue->ulHead + 1 ) % pxQueue->ulDepth;
+        pxQueue->ulCount--;
+        xDropped = true;
+    }
+
+    ( void ) memcpy( &pxQueue->pucEvents[ ( ( pxQueue->ulHead + pxQueue->ulCount ) % pxQueue->ulDepth ) * pxQueue->xEventSize ],
+                     pvEvent, pxQueue->xEventSize );
+    pxQueue->ulCount++;
+
+    taskEXIT_CRITICAL( &pxQueue->xLock );
+
+    if( xDropped )
+    {
+        LogWarn( ( "Event queue full (%s), oldest event dropped.", pxQueue->pcName ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xEventQueue_Publish( EventQueue_t * pxQueue,
+                                      AzureIoTHubClient_t * pxClient )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    uint8_t ucPayload[ eventqueueMESSAGE_MAX_SIZE ];
+    EventMessage_t * pxMessage;
+    int lLength;
+
+    /* Taken off the queue before publishing: a completion while the window is full may
+     * queue another event again meanwhile. */
+    while( ( ( pxMessage = prvGetFreeMessage( pxQueue ) ) != NULL ) && prvTake( pxQueue, pxMessage->ullEvent ) )
+    {
+        if( AzureIoTMessage_PropertiesInit( &pxMessage->xProperties, pxMessage->ucPropertyBuffer,
+                                            0, sizeof( pxMessage->ucPropertyBuffer ) ) != eAzureIoTSuccess )
+        {
+            lLength = -1;
+        }
+        else
+        {
+            lLength = pxQueue->xFormat( pxMessage->ullEvent, ( char * ) ucPayload, sizeof( ucPayload ),
+                                        &pxMessage->xProperties, &pxMessage->llEventUs );
+        }
+
+        if( ( lLength <= 0 ) || ( lLength >= ( int ) sizeof( ucPayload ) ) )
+        {
+            LogError( ( "Failed to build an event message (%s), dropping it.", pxQueue->pcName ) );
+            continue;
+        }
+
+        pxMessage->pxQueue = pxQueue;
+        pxMessage->xInUse = true;
+
+        xResult = xInFlight_SendTelemetry( pxClient, ucPayload, ( uint32_t ) lLength,
+                                           &pxMessage->xProperties, prvOnMessageComplete, pxMessage, NULL );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            /* Kept queued for the next connection. */
+            pxMessage->xInUse = false;
+            prvPushFront( pxQueue, pxMessage->ullEvent );
+            break;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,137 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Queue of events published at once, each as one message tagged with message properties.
+ *        A producer task queues events; the core task builds and publishes them through the
+ *        in-flight window, oldest first. Events raised while offline stay queued, the oldest
+ *        being dropped when full. An event not acknowledged, after its retries or when the
+ *        connection drops or the device sleeps, goes back to the front of its queue to be
+ *        published again with its message properties, instead of to the payload-only backlog.
+ *        Used by the gas alerts and the charger events.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_EVENT_QUEUE_H
+#define SAMPLE_AZURE_IOT_EVENT_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "sdkconfig.h"
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Largest payload of an event message.
+ */
+#define eventqueueMESSAGE_MAX_SIZE          ( 160U )
+
+/**
+ * @brief Largest event kept in a queue.
+ */
+#define eventqueueEVENT_MAX_SIZE            ( 32U )
+
+/**
+ * @brief Room for the message properties of one event.
+ */
+#define eventqueuePROPERTY_BUFFER_SIZE      ( 80U )
+
+struct EventQueue;
+
+/**
+ * @brief Builds the message of an event.
+ *
+ * @param[in]  pvEvent       The queued event.
+ * @param[out] pcPayload     Payload buffer of `xPayloadSize` bytes.
+ * @param[in]  xPayloadSize  Size of `pcPayload`.
+ * @param[in]  pxProperties  Empty message properties, to append to.
+ * @param[out] pllEventUs    esp_timer time of the event, for its latency.
+ *
+ * @return int Payload length, or a negative value if the message could not be built.
+ */
+typedef int ( * EventQueueFormatCallback_t )( const void * pvEvent,
+                                              char * pcPayload,
+                                              size_t xPayloadSize,
+                                              AzureIoTMessageProperties_t * pxProperties,
+                                              int64_t * pllEventUs );
+
+/**
+ * @brief Called when the PUBACK of an event arrives.
+ *
+ * @param[in] ulEventToAckMs  Time from the event to the PUBACK.
+ */
+typedef void ( * EventQueueAcknowledgedCallback_t )( uint32_t ulEventToAckMs );
+
+/**
+ * @brief An event being published. Its message properties must stay valid until completion.
+ */
+typedef struct EventMessage
+{
+    bool xInUse;
+    uint64_t ullEvent[ eventqueueEVENT_MAX_SIZE / sizeof( uint64_t ) ]; /**< Copy of the event, aligned for any event. */
+    int64_t llEventUs;
+    struct EventQueue * pxQueue;
+    AzureIoTMessageProperties_t xProperties;
+    uint8_t ucPropertyBuffer[ eventqueuePROPERTY_BUFFER_SIZE ];
+} EventMessage_t;
+
+/**
+ * @brief An event queue. Define it with eventqueueINIT and leave its fields alone.
+ */
+typedef struct EventQueue
+{
+    const char * pcName;                               /**< Event name for the logs, e.g. "alert". */
+    uint8_t * pucEvents;                               /**< ulDepth events of xEventSize bytes. */
+    size_t xEventSize;
+    uint32_t ulDepth;
+    EventQueueFormatCallback_t xFormat;
+    EventQueueAcknowledgedCallback_t xOnAcknowledged;  /**< May be NULL. */
+    uint32_t ulWakeEvent;                              /**< sampleazureiotEVENT_* posted when an event is queued again. */
+    uint32_t ulHead;                                   /**< Index of the oldest event. */
+    uint32_t ulCount;
+    portMUX_TYPE xLock;
+    EventMessage_t xMessages[ CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW ]; /**< Owned by the core task. */
+} EventQueue_t;
+
+/**
+ * @brief Static initializer of an event queue stored in the array `pxEvents`, which wakes
+ *        the core task with `ulEvent` when an event is queued again.
+ */
+#define eventqueueINIT( pcEventName, pxEvents, ulEvent, xFormatCallback, xAcknowledgedCallback ) \
+    {                                                                                            \
+        .pcName = ( pcEventName ),                                                               \
+        .pucEvents = ( uint8_t * ) ( pxEvents ),                                                 \
+        .xEventSize = sizeof( ( pxEvents )[ 0 ] ),                                               \
+        .ulDepth = sizeof( pxEvents ) / sizeof( ( pxEvents )[ 0 ] ),                             \
+        .xFormat = ( xFormatCallback ),                                                          \
+        .xOnAcknowledged = ( xAcknowledgedCallback ),                                            \
+        .ulWakeEvent = ( ulEvent ),                                                              \
+        .xLock = portMUX_INITIALIZER_UNLOCKED,                                                   \
+    }
+
+/**
+ * @brief Queues a copy of an event, dropping the oldest one if the queue is full.
+ *
+ * @remark Safe from any task, not from an interrupt.
+ */
+void vEventQueue_Push( EventQueue_t * pxQueue,
+                       const void * pvEvent );
+
+/**
+ * @brief Publishes the queued events through the in-flight window, oldest first. With every
+ *        message slot taken, the rest goes out as earlier events complete.
+ *
+ * @remark Must be called from the task that runs AzureIoTHubClient_ProcessLoop, while connected.
+ *
+ * @param[in] pxQueue   The queue.
+ * @param[in] pxClient  Connected hub client.
+ *
+ * @return AzureIoTResult_t Result of the failing publish, eAzureIoTSuccess otherwise.
+ */
+AzureIoTResult_t xEventQueue_Publish( EventQueue_t * pxQueue,
+                                      AzureIoTHubClient_t * pxClient );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_EVENT_QUEUE_H */
@@ -0,0 +1,268 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_exposure.h"
+
+/* Standard includes. */
+#include <math.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+/*-----------------------------------------------------------*/
+
+#define exposureUS_PER_MINUTE    ( 60LL * 1000000LL )
+
+/**
+ * @brief Window lengths, in minutes.
+ */
+#define exposureTWA_MINUTES      480U
+#define exposureSTEL_MINUTES     15U
+
+/**
+ * @brief Largest sub-index, returned above the last breakpoint.
+ */
+#define exposureINDEX_MAX        500U
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Ring of per-minute means with the running sums of a long and a short window ending
+ *        at the last closed minute, and the accumulator of the minute in progress.
+ */
+typedef struct ExposureWindow
+{
+    sensor_channel_t xChannel;
+    float * pxBuckets;    /**< One mean per minute, usLength entries. */
+    uint16_t usLength;    /**< Long window, in minutes. */
+    uint16_t usShort;     /**< Short window, in minutes, at most usLength. */
+    uint32_t ulClosed;    /**< Minutes closed since start; the last one is at ( ulClosed - 1 ) % usLength. */
+    double xLongSum;
+    double xShortSum;
+    double xMinuteSum;
+    uint32_t ulMinuteCount;
+    float xLastMean;
+} ExposureWindow_t;
+
+/**
+ * @brief Segment of a sub-index scale: concentrations in [xLow, xHigh] map linearly onto [usLow, usHigh].
+ */
+typedef struct ExposureBreakpoint
+{
+    float xLow;
+    float xHigh;
+    uint16_t usLow;
+    uint16_t usHigh;
+} ExposureBreakpoint_t;
+
+/* CO, ppm over 8 hours: the EPA AQI breakpoints, made contiguous. */
+static const ExposureBreakpoint_t xCoBreakpoints[] =
+{
+    { 0.0f,  4.4f,  0,   50  },
+    { 4.4f,  9.4f,  50,  100 },
+    { 9.4f,  12.4f, 100, 150 },
+    { 12.4f, 15.4f, 150, 200 },
+    { 15.4f, 30.4f, 200, 300 },
+    { 30.4f, 40.4f, 300, 400 },
+    { 40.4f, 50.4f, 400, 500 },
+};
+
+/* Flammable gas, ppm over 15 minutes: 5000 ppm is 10 % of the lower explosive limit of methane. */
+static const ExposureBreakpoint_t xFlammableBreakpoints[] =
+{
+    { 0.0f,    300.0f,   0,   50  },
+    { 300.0f,  1000.0f,  50,  100 },
+    { 1000.0f, 2500.0f,  100, 200 },
+    { 2500.0f, 5000.0f,  200, 300 },
+    { 5000.0f, 10000.0f, 300, 500 },
+};
+
+/* TVOC, ppb over 15 minutes: the usual indoor air quality levels. */
+static const ExposureBreakpoint_t xTvocBreakpoints[] =
+{
+    { 0.0f,    220.0f,  0,   50  },
+    { 220.0f,  660.0f,  50,  100 },
+    { 660.0f,  1430.0f, 100, 150 },
+    { 1430.0f, 2200.0f, 150, 200 },
+    { 2200.0f, 3300.0f, 200, 300 },
+    { 3300.0f, 5500.0f, 300, 500 },
+};
+
+static float xCoMinutes[ exposureTWA_MINUTES ];
+static float xFlammableMinutes[ exposureSTEL_MINUTES ];
+static float xTvocMinutes[ exposureSTEL_MINUTES ];
+
+static ExposureWindow_t xCoWindow = { SENSOR_CO, xCoMinutes, exposureTWA_MINUTES, exposureSTEL_MINUTES };
+static ExposureWindow_t xFlammableWindow = { SENSOR_FLAMMABLE_GAS, xFlammableMinutes, exposureSTEL_MINUTES, exposureSTEL_MINUTES };
+static ExposureWindow_t xTvocWindow = { SENSOR_TVOC, xTvocMinutes, exposureSTEL_MINUTES, exposureSTEL_MINUTES };
+
+static ExposureWindow_t * const pxWindows[] = { &xCoWindow, &xFlammableWindow, &xTvocWindow };
+
+#define exposureWINDOW_COUNT    ( sizeof( pxWindows ) / sizeof( pxWindows[ 0 ] ) )
+
+/* esp_timer minute in progress, -1 before the first sample. */
+static int64_t llCurrentMinute = -1;
+
+static portMUX_TYPE xExposureLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Moves the minute in progress into the ring and updates both window sums.
+ */
+static void prvCloseMinute( ExposureWindow_t * pxWindow )
+{
+    uint32_t ulSlot = pxWindow->ulClosed % pxWindow->usLength;
+    float xMean;
+
+    if( pxWindow->ulMinuteCount > 0 )
+    {
+        xMean = ( float ) ( pxWindow->xMinuteSum / pxWindow->ulMinuteCount );
+    }
+    else if( pxWindow->ulClosed > 0 )
+    {
+        /* No sample this minute: hold the previous mean. */
+        xMean = pxWindow->xLastMean;
+    }
+    else
+    {
+        /* Nothing to hold yet. */
+        return;
+    }
+
+    if( pxWindow->ulClosed >= pxWindow->usLength )
+    {
+        pxWindow->xLongSum -= pxWindow->pxBuckets[ ulSlot ];
+    }
+
+    if( pxWindow->ulClosed >= pxWindow->usShort )
+    {
+        pxWindow->xShortSum -= pxWindow->pxBuckets[ ( pxWindow->ulClosed - pxWindow->usShort ) % pxWindow->usLength ];
+    }
+
+    pxWindow->pxBuckets[ ulSlot ] = xMean;
+    pxWindow->xLongSum += xMean;
+    pxWindow->xShortSum += xMean;
+    pxWindow->ulClosed++;
+    pxWindow->xLastMean = xMean;
+    pxWindow->xMinuteSum = 0;
+    pxWindow->ulMinuteCount = 0;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCovered( const ExposureWindow_t * pxWindow,
+                            uint32_t ulLength )
+{
+    return ( pxWindow->ulClosed < ulLength ) ? pxWindow->ulClosed : ulLength;
+}
+/*-----------------------------------------------------------*/
+
+static float prvAverage( double xSum,
+                         uint32_t ulMinutes )
+{
+    /* Removing the oldest minute can leave a tiny negative rounding residue. */
+    return ( ( ulMinutes == 0 ) || ( xSum <= 0 ) ) ? 0.0f : ( float ) ( xSum / ulMinutes );
+}
+/*-----------------------------------------------------------*/
+
+static uint16_t prvSubIndex( const ExposureBreakpoint_t * pxBreakpoints,
+                             uint32_t ulCount,
+                             float xConcentration )
+{
+    const ExposureBreakpoint_t * pxSegment;
+    uint32_t i;
+
+    for( i = 0; i < ulCount; i++ )
+    {
+        pxSegment = &pxBreakpoints[ i ];
+
+        if( xConcentration <= pxSegment->xHigh )
+        {
+            return ( uint16_t ) lroundf( pxSegment->usLow + ( pxSegment->usHigh - pxSegment->usLow ) *
+                                         ( xConcentration - pxSegment->xLow ) / ( pxSegment->xHigh - pxSegment->xLow ) );
+        }
+    }
+
+    return exposureINDEX_MAX;
+}
+/*-----------------------------------------------------------*/
+
+void vExposure_Add( const sensor_reading_t * pxReading )
+{
+    int64_t llMinute = pxReading->timestamp_us / exposureUS_PER_MINUTE;
+    ExposureWindow_t * pxWindow;
+    uint32_t i;
+
+    taskENTER_CRITICAL( &xExposureLock );
+
+    if( llCurrentMinute < 0 )
+    {
+        llCurrentMinute = llMinute;
+    }
+
+    /* Close every minute up to this one, one minute per critical section so that a long gap
+     * does not hold interrupts off. A reading older than the minute in progress, from a slower
+     * task, is counted in it. */
+    while( llMinute > llCurrentMinute )
+    {
+        for( i = 0; i < exposureWINDOW_COUNT; i++ )
+        {
+            prvCloseMinute( pxWindows[ i ] );
+        }
+
+        llCurrentMinute++;
+
+        /* Beyond a full ring, further minutes would only hold the same mean. */
+        if( llMinute - llCurrentMinute > exposureTWA_MINUTES )
+        {
+            llCurrentMinute = llMinute - exposureTWA_MINUTES;
+        }
+
+        taskEXIT_CRITICAL( &xExposureLock );
+        taskENTER_CRITICAL( &xExposureLock );
+    }
+
+    for( i = 0; i < exposureWINDOW_COUNT; i++ )
+    {
+        pxWindow = pxWindows[ i ];
+
+        if( ( pxReading->valid_mask & SENSOR_MASK( pxWindow->xChannel ) ) != 0 )
+        {
+            pxWindow->xMinuteSum += pxReading->value[ pxWindow->xChannel ];
+            pxWindow->ulMinuteCount++;
+        }
+    }
+
+    taskEXIT_CRITICAL( &xExposureLock );
+}
+/*-----------------------------------------------------------*/
+
+void vExposure_Get( ExposureSummary_t * pxSummary )
+{
+    float xFlammable;
+    float xTvoc;
+
+    ( void ) memset( pxSummary, 0, sizeof( *pxSummary ) );
+
+    taskENTER_CRITICAL( &xExposureLock );
+
+    pxSummary->xValid = ( xCoWindow.ulClosed > 0 );
+    pxSummary->ulCoTwaMinutes = prvCovered( &xCoWindow, xCoWindow.usLength );
+    pxSummary->ulCoStelMinutes = prvCovered( &xCoWindow, xCoWindow.usShort );
+    pxSummary->xCoTwa = prvAverage( xCoWindow.xLongSum, pxSummary->ulCoTwaMinutes );
+    pxSummary->xCoStel = prvAverage( xCoWindow.xShortSum, pxSummary->ulCoStelMinutes );
+    xFlammable = prvAverage( xFlammableWindow.xShortSum, prvCovered( &xFlammableWindow, xFlammableWindow.usShort ) );
+    xTvoc = prvAverage( xTvocWindow.xShortSum, prvCovered( &xTvocWindow, xTvocWindow.usShort ) );
+
+    taskEXIT_CRITICAL( &xExposureLock );
+
+    pxSummary->usCoIndex = prvSubIndex( xCoBreakpoints, sizeof( xCoBreakpoints ) / sizeof( xCoBreakpoints[ 0 ] ),
+                                        pxSummary->xCoTwa );
+    pxSummary->usFlammableIndex = prvSubIndex( xFlammableBreakpoints, sizeof( xFlammableBreakpoints ) / sizeof( xFlammableBreakpoints[ 0 ] ),
+                                               xFlammable );
+    pxSummary->usTvocIndex = prvSubIndex( xTvocBreakpoints, sizeof( xTvocBreakpoints ) / sizeof( xTvocBreakpoints[ 0 ] ),
+                                          xTvoc );
+}
+/*-----------------------------------------------------------*/
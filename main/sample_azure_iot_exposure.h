@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Rolling exposure windows built on circular per-minute buckets.
+ *        Samples are averaged per minute; each closed minute enters a ring and the window sums
+ *        are updated in O(1), so memory does not depend on the sampling rate. From them come the
+ *        8-hour TWA and 15-minute STEL of CO, and AQI-style sub-indexes (0 to 500) for CO,
+ *        flammable gas and TVOC.
+ *
+ * A minute without any sample repeats the previous minute's mean. Until a window is full, its
+ * average is taken over the minutes covered so far. The windows live in RAM and restart on reset.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_EXPOSURE_H
+#define SAMPLE_AZURE_IOT_EXPOSURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/**
+ * @brief Exposure figures over the closed minutes.
+ */
+typedef struct ExposureSummary
+{
+    bool xValid;                 /**< false until the first minute with a CO sample has closed. */
+    float xCoTwa;                /**< CO 8-hour time-weighted average, ppm. */
+    float xCoStel;               /**< CO 15-minute short-term exposure, ppm. */
+    uint32_t ulCoTwaMinutes;     /**< Minutes covered by xCoTwa, 480 once the window is full. */
+    uint32_t ulCoStelMinutes;    /**< Minutes covered by xCoStel, 15 once the window is full. */
+    uint16_t usCoIndex;          /**< From the CO 8-hour average, EPA AQI breakpoints. */
+    uint16_t usFlammableIndex;   /**< From the 15-minute flammable gas average. */
+    uint16_t usTvocIndex;        /**< From the 15-minute TVOC average. */
+} ExposureSummary_t;
+
+/**
+ * @brief Adds the CO, flammable gas and TVOC values of a reading. Safe to call from any task.
+ *
+ * @param[in] pxReading  Reading; channels missing from its valid_mask are ignored.
+ */
+void vExposure_Add( const sensor_reading_t * pxReading );
+
+/**
+ * @brief Gets the exposure figures of the minutes closed so far.
+ *
+ * @param[out] pxSummary  Figures; all zero with xValid false if there is no data yet.
+ */
+void vExposure_Get( ExposureSummary_t * pxSummary );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_EXPOSURE_H */
@@ -0,0 +1,165 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_history.h"
+
+/* Standard includes. */
+#include <math.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_time.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Flag set in HistoryEntry_t::ucFlags when the timestamp is an estimate.
+ */
+#define historyFLAG_TIME_ESTIMATED    ( 0x80U )
+
+/**
+ * @brief Fixed-point encoding of one channel: raw = ( value + offset ) * scale, saturated to 16 bits.
+ */
+typedef struct HistoryEncoding
+{
+    float xOffset;
+    float xScale;
+} HistoryEncoding_t;
+
+static const HistoryEncoding_t xEncodings[ SENSOR_COUNT ] =
+{
+    [ SENSOR_TEMPERATURE ]     = { 40.0f, 100.0f },  /* -40 to 615 C, 0.01 C. */
+    [ SENSOR_HUMIDITY ]        = { 0.0f,  100.0f },  /* 0.01 %RH. */
+    [ SENSOR_FLAMMABLE_GAS ]   = { 0.0f,  1.0f   },  /* Up to 65535 ppm, 1 ppm. */
+    [ SENSOR_TVOC ]            = { 0.0f,  1.0f   },  /* Up to 65535 ppb, 1 ppb. */
+    [ SENSOR_CO ]              = { 0.0f,  10.0f  },  /* Up to 6553 ppm, 0.1 ppm. */
+    [ SENSOR_BATTERY_VOLTAGE ] = { 0.0f,  1000.0f }, /* 1 mV. */
+};
+
+typedef struct HistoryEntry
+{
+    uint32_t ulTimestampS;
+    uint8_t ucFlags; /**< Valid channel mask, plus historyFLAG_TIME_ESTIMATED. */
+    uint16_t usValue[ SENSOR_COUNT ];
+} HistoryEntry_t;
+
+static HistoryEntry_t xEntries[ CONFIG_SAMPLE_IOT_HISTORY_DEPTH ];
+static uint32_t ulNextSequence = 0;
+static uint32_t ulCount = 0;
+
+static portMUX_TYPE xHistoryLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+static uint16_t prvEncode( sensor_channel_t xChannel,
+                           float xValue )
+{
+    float xRaw = roundf( ( xValue + xEncodings[ xChannel ].xOffset ) * xEncodings[ xChannel ].xScale );
+
+    if( !( xRaw > 0.0f ) )
+    {
+        return 0; /* Also NaN. */
+    }
+
+    return ( xRaw >= 65535.0f ) ? UINT16_MAX : ( uint16_t ) xRaw;
+}
+/*-----------------------------------------------------------*/
+
+void vHistory_Add( const sensor_reading_t * pxReading )
+{
+    HistoryEntry_t xEntry;
+    uint32_t i;
+
+    xEntry.ulTimestampS = ( uint32_t ) ( llSampleTime_ToUnixMs( pxReading->timestamp_us ) / 1000 );
+    xEntry.ucFlags = ( uint8_t ) ( pxReading->valid_mask & SENSOR_MASK_ALL );
+
+    if( !xSampleTime_IsSynchronized() )
+    {
+        xEntry.ucFlags |= historyFLAG_TIME_ESTIMATED;
+    }
+
+    for( i = 0; i < SENSOR_COUNT; i++ )
+    {
+        xEntry.usValue[ i ] = prvEncode( ( sensor_channel_t ) i, pxReading->value[ i ] );
+    }
+
+    taskENTER_CRITICAL( &xHistoryLock );
+
+    xEntries[ ulNextSequence % CONFIG_SAMPLE_IOT_HISTORY_DEPTH ] = xEntry;
+    ulNextSequence++;
+
+    if( ulCount < CONFIG_SAMPLE_IOT_HISTORY_DEPTH )
+    {
+        ulCount++;
+    }
+
+    taskEXIT_CRITICAL( &xHistoryLock );
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulHistory_FirstSequence( void )
+{
+    uint32_t ulFirst;
+
+    taskENTER_CRITICAL( &xHistoryLock );
+    ulFirst = ulNextSequence - ulCount;
+    taskEXIT_CRITICAL( &xHistoryLock );
+
+    return ulFirst;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulHistory_NextSequence( void )
+{
+    return ulNextSequence;
+}
+/*-----------------------------------------------------------*/
+
+bool xHistory_Get( uint32_t ulSequence,
+                   HistorySample_t * pxSample )
+{
+    HistoryEntry_t xEntry;
+    bool xStored;
+    uint32_t i;
+
+    taskENTER_CRITICAL( &xHistoryLock );
+
+    /* Unsigned arithmetic keeps this right across wrap-around of the sequence. */
+    xStored = ( ulNextSequence - ulSequence - 1 ) < ulCount;
+
+    if( xStored )
+    {
+        xEntry = xEntries[ ulSequence % CONFIG_SAMPLE_IOT_HISTORY_DEPTH ];
+    }
+
+    taskEXIT_CRITICAL( &xHistoryLock );
+
+    if( !xStored )
+    {
+        return false;
+    }
+
+    pxSample->llTimestampS = xEntry.ulTimestampS;
+    pxSample->xTimeValid = ( xEntry.ucFlags & historyFLAG_TIME_ESTIMATED ) == 0;
+    pxSample->ulValidMask = xEntry.ucFlags & SENSOR_MASK_ALL;
+
+    if( !pxSample->xTimeValid && xSampleTime_IsSynchronized() )
+    {
+        pxSample->llTimestampS = llSampleTime_CorrectMs( pxSample->llTimestampS * 1000 ) / 1000;
+        pxSample->xTimeValid = true;
+    }
+
+    for( i = 0; i < SENSOR_COUNT; i++ )
+    {
+        pxSample->xValue[ i ] = ( float ) xEntry.usValue[ i ] / xEncodings[ i ].xScale - xEncodings[ i ].xOffset;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
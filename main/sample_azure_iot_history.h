@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Ring of the most recent sensor readings, kept in RAM at full sampling resolution.
+ *        Each reading is stored in 18 bytes: its time in seconds and one 16-bit fixed-point
+ *        value per channel. Readings are addressed by a sequence number that keeps growing
+ *        as older ones are overwritten, so a reader can page through the ring with a cursor.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_HISTORY_H
+#define SAMPLE_AZURE_IOT_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/**
+ * @brief A decoded reading.
+ */
+typedef struct HistorySample
+{
+    int64_t llTimestampS;           /**< Unix time of the acquisition, in seconds. */
+    bool xTimeValid;                /**< false if the time is an estimate taken before the clock was synchronized. */
+    uint32_t ulValidMask;           /**< SENSOR_MASK() of the channels holding a value. */
+    float xValue[ SENSOR_COUNT ];
+} HistorySample_t;
+
+/**
+ * @brief Stores a reading, overwriting the oldest one if the ring is full.
+ */
+void vHistory_Add( const sensor_reading_t * pxReading );
+
+/**
+ * @brief Sequence number of the oldest reading still stored.
+ */
+uint32_t ulHistory_FirstSequence( void );
+
+/**
+ * @brief Sequence number the next stored reading will get.
+ */
+uint32_t ulHistory_NextSequence( void );
+
+/**
+ * @brief Gets a stored reading. Timestamps estimated before the clock was synchronized
+ *        are corrected if it is synchronized now.
+ *
+ * @param[in]  ulSequence  Sequence number, in [ulHistory_FirstSequence, ulHistory_NextSequence).
+ * @param[out] pxSample    Decoded reading.
+ *
+ * @return bool false if `ulSequence` is not stored (overwritten or not taken yet).
+ */
+bool xHistory_Get( uint32_t ulSequence,
+                   HistorySample_t * pxSample );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_HISTORY_H */
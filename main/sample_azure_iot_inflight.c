@@ -0,0 +1,407 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_inflight.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_backlog.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief ProcessLoop timeout used while waiting for a free slot in the window.
+ */
+#define inflightPROCESS_LOOP_TIMEOUT_MS    ( 100U )
+
+/**
+ * @brief Time after which an unacknowledged publish is sent again.
+ */
+#define inflightPUBACK_TIMEOUT_TICKS       ( pdMS_TO_TICKS( CONFIG_SAMPLE_IOT_PUBACK_TIMEOUT_MS ) )
+
+/**
+ * @brief Packet identifiers remembered per message. The middleware cannot resend a publish
+ *        under its original packet identifier with the DUP flag, so each transmission gets a
+ *        new one, and a late PUBACK for any of them completes the message.
+ */
+#define inflightPACKET_IDS                 ( CONFIG_SAMPLE_IOT_PUBLISH_MAX_RETRIES + 1 )
+/*-----------------------------------------------------------*/
+
+typedef struct InFlightSlot
+{
+    bool xInUse;
+    uint16_t usPacketIds[ inflightPACKET_IDS ];
+    uint8_t ucTransmissions; /**< Also indexes usPacketIds, modulo inflightPACKET_IDS. */
+    uint8_t ucRetries;
+    uint32_t ulMessageId;
+    uint32_t ulBacklogId; /**< Backlog entry the message was taken from, 0 if none. */
+    TickType_t xFirstSentTick;
+    TickType_t xLastSentTick;
+    AzureIoTMessageProperties_t * pxProperties;
+    InFlightCompletionCallback_t xCallback;
+    void * pvContext;
+    uint32_t ulLength;
+    uint8_t ucPayload[ sampleazureiotMESSAGE_MAX_SIZE ];
+} InFlightSlot_t;
+
+static InFlightSlot_t xSlots[ CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW ];
+
+static uint32_t ulNextMessageId = 1;
+
+static InFlightPrepareCallback_t xPrepareCallback = NULL;
+
+static InFlightCompletionCallback_t xBacklogCallback = NULL;
+static void * pvBacklogContext = NULL;
+/*-----------------------------------------------------------*/
+
+static InFlightSlot_t * prvGetFreeSlot( void )
+{
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( !xSlots[ i ].xInUse )
+        {
+            return &xSlots[ i ];
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvTransmit( AzureIoTHubClient_t * pxClient,
+                                     InFlightSlot_t * pxSlot )
+{
+    AzureIoTResult_t xResult;
+    uint16_t usPacketId;
+
+    xResult = AzureIoTHubClient_SendTelemetry( pxClient,
+                                               pxSlot->ucPayload, pxSlot->ulLength,
+                                               pxSlot->pxProperties, eAzureIoTHubMessageQoS1,
+                                               &usPacketId );
+    pxSlot->xLastSentTick = xTaskGetTickCount();
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "Failed to publish message %u: result 0x%08x",
+                    ( unsigned ) pxSlot->ulMessageId, ( uint16_t ) xResult ) );
+    }
+    else
+    {
+        pxSlot->usPacketIds[ pxSlot->ucTransmissions % inflightPACKET_IDS ] = usPacketId;
+        pxSlot->ucTransmissions++;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Frees a slot. A message taken from the backlog leaves it once acknowledged, and
+ *        stays there to be sent again otherwise; other messages not acknowledged are queued,
+ *        except those with message properties, which the backlog cannot keep.
+ */
+static void prvComplete( InFlightSlot_t * pxSlot,
+                         bool xAcknowledged )
+{
+    uint32_t ulLatencyMs = ( uint32_t ) ( ( xTaskGetTickCount() - pxSlot->xFirstSentTick ) * portTICK_PERIOD_MS );
+
+    if( pxSlot->ulBacklogId == 0 )
+    {
+        if( !xAcknowledged && ( pxSlot->pxProperties == NULL ) )
+        {
+            ( void ) xBacklog_Push( pxSlot->ucPayload, pxSlot->ulLength );
+        }
+    }
+    else if( xAcknowledged )
+    {
+        vBacklog_Remove( pxSlot->ulBacklogId );
+    }
+    else
+    {
+        vBacklog_Release( pxSlot->ulBacklogId );
+    }
+
+    pxSlot->xInUse = false;
+
+    if( pxSlot->xCallback != NULL )
+    {
+        pxSlot->xCallback( pxSlot->ulMessageId, xAcknowledged, ulLatencyMs, pxSlot->pvContext );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvQueue( AzureIoTHubClient_t * pxClient,
+                                  const uint8_t * pucPayload,
+                                  uint32_t ulLength,
+                                  AzureIoTMessageProperties_t * pxProperties,
+                                  InFlightCompletionCallback_t xCallback,
+                                  void * pvContext,
+                                  uint32_t ulBacklogId,
+                                  InFlightSlot_t * pxSlot )
+{
+    AzureIoTResult_t xResult;
+
+    ( void ) memcpy( pxSlot->ucPayload, pucPayload, ulLength );
+    pxSlot->ulLength = ulLength;
+
+    if( xPrepareCallback != NULL )
+    {
+        xPrepareCallback( pxSlot->ucPayload, ulLength );
+    }
+
+    pxSlot->pxProperties = pxProperties;
+    pxSlot->xCallback = xCallback;
+    pxSlot->pvContext = pvContext;
+    pxSlot->ucTransmissions = 0;
+    pxSlot->ucRetries = 0;
+    pxSlot->ulBacklogId = ulBacklogId;
+    pxSlot->ulMessageId = ulNextMessageId++;
+    pxSlot->xFirstSentTick = xTaskGetTickCount();
+    pxSlot->xInUse = true;
+
+    if( ( xResult = prvTransmit( pxClient, pxSlot ) ) != eAzureIoTSuccess )
+    {
+        pxSlot->xInUse = false;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvCheckTimeouts( AzureIoTHubClient_t * pxClient )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    TickType_t xNow = xTaskGetTickCount();
+    InFlightSlot_t * pxSlot;
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        pxSlot = &xSlots[ i ];
+
+        if( !pxSlot->xInUse || ( ( xNow - pxSlot->xLastSentTick ) < inflightPUBACK_TIMEOUT_TICKS ) )
+        {
+            continue;
+        }
+
+        if( pxSlot->ucRetries < CONFIG_SAMPLE_IOT_PUBLISH_MAX_RETRIES )
+        {
+            pxSlot->ucRetries++;
+            LogWarn( ( "No PUBACK for message %u, retransmitting (attempt %u).",
+                       ( unsigned ) pxSlot->ulMessageId, ( unsigned ) pxSlot->ucRetries ) );
+
+            if( ( xResult = prvTransmit( pxClient, pxSlot ) ) != eAzureIoTSuccess )
+            {
+                break;
+            }
+        }
+        else
+        {
+            LogWarn( ( "Message %u not acknowledged, giving up on this transmission.",
+                       ( unsigned ) pxSlot->ulMessageId ) );
+            prvComplete( pxSlot, false );
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void vInFlight_HandlePubAck( uint16_t usPacketID )
+{
+    uint32_t ulSent;
+    uint32_t i;
+    uint32_t j;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( !xSlots[ i ].xInUse )
+        {
+            continue;
+        }
+
+        ulSent = ( xSlots[ i ].ucTransmissions < inflightPACKET_IDS ) ? xSlots[ i ].ucTransmissions : inflightPACKET_IDS;
+
+        /* A late PUBACK for an earlier transmission completes the message as well. */
+        for( j = 0; j < ulSent; j++ )
+        {
+            if( xSlots[ i ].usPacketIds[ j ] == usPacketID )
+            {
+                prvComplete( &xSlots[ i ], true );
+                return;
+            }
+        }
+    }
+
+    /* Typically the second PUBACK of a message that was retransmitted. */
+    LogDebug( ( "PUBACK for untracked packet id %u", usPacketID ) );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xInFlight_SendTelemetry( AzureIoTHubClient_t * pxClient,
+                                          const uint8_t * pucPayload,
+                                          uint32_t ulLength,
+                                          AzureIoTMessageProperties_t * pxProperties,
+                                          InFlightCompletionCallback_t xCallback,
+                                          void * pvContext,
+                                          uint32_t * pulMessageId )
+{
+    AzureIoTResult_t xResult;
+    InFlightSlot_t * pxSlot;
+
+    if( ( pucPayload == NULL ) || ( ulLength > sampleazureiotMESSAGE_MAX_SIZE ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    while( ( pxSlot = prvGetFreeSlot() ) == NULL )
+    {
+        /* Window full: service the connection until a PUBACK or a timeout frees a slot. */
+        if( ( ( xResult = AzureIoTHubClient_ProcessLoop( pxClient, inflightPROCESS_LOOP_TIMEOUT_MS ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = prvCheckTimeouts( pxClient ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+    }
+
+    xResult = prvQueue( pxClient, pucPayload, ulLength, pxProperties, xCallback, pvContext, 0, pxSlot );
+
+    if( ( xResult == eAzureIoTSuccess ) && ( pulMessageId != NULL ) )
+    {
+        *pulMessageId = pxSlot->ulMessageId;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void vInFlight_SetPrepareCallback( InFlightPrepareCallback_t xCallback )
+{
+    xPrepareCallback = xCallback;
+}
+/*-----------------------------------------------------------*/
+
+void vInFlight_SetBacklogCallback( InFlightCompletionCallback_t xCallback,
+                                   void * pvContext )
+{
+    xBacklogCallback = xCallback;
+    pvBacklogContext = pvContext;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xInFlight_Process( AzureIoTHubClient_t * pxClient )
+{
+    AzureIoTResult_t xResult;
+    InFlightSlot_t * pxSlot;
+    const uint8_t * pucPayload;
+    uint32_t ulLength;
+    uint32_t ulEntryId;
+
+    if( ( xResult = prvCheckTimeouts( pxClient ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    /* Drain the backlog through whatever room is left in the window. Entries stay
+     * in the backlog until acknowledged, so a reset before the PUBACK keeps them. */
+    while( ( ( pxSlot = prvGetFreeSlot() ) != NULL ) && xBacklog_Take( &pucPayload, &ulLength, &ulEntryId ) )
+    {
+        if( ( xResult = prvQueue( pxClient, pucPayload, ulLength, NULL, xBacklogCallback, pvBacklogContext, ulEntryId, pxSlot ) ) != eAzureIoTSuccess )
+        {
+            vBacklog_Release( ulEntryId );
+            break;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t xInFlight_ResendAll( AzureIoTHubClient_t * pxClient )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( xSlots[ i ].xInUse &&
+            ( ( xResult = prvTransmit( pxClient, &xSlots[ i ] ) ) != eAzureIoTSuccess ) )
+        {
+            break;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void vInFlight_RequeueAll( void )
+{
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( xSlots[ i ].xInUse )
+        {
+            prvComplete( &xSlots[ i ], false );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulInFlight_Count( void )
+{
+    uint32_t i;
+    uint32_t ulCount = 0;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( xSlots[ i ].xInUse )
+        {
+            ulCount++;
+        }
+    }
+
+    return ulCount;
+}
+/*-----------------------------------------------------------*/
+
+TickType_t xInFlight_NextTimeout( void )
+{
+    TickType_t xNow = xTaskGetTickCount();
+    TickType_t xNext = portMAX_DELAY;
+    TickType_t xElapsed;
+    uint32_t i;
+
+    for( i = 0; i < CONFIG_SAMPLE_IOT_INFLIGHT_WINDOW; i++ )
+    {
+        if( xSlots[ i ].xInUse )
+        {
+            xElapsed = xNow - xSlots[ i ].xLastSentTick;
+
+            if( xElapsed >= inflightPUBACK_TIMEOUT_TICKS )
+            {
+                return 0;
+            }
+
+            if( ( inflightPUBACK_TIMEOUT_TICKS - xElapsed ) < xNext )
+            {
+                xNext = inflightPUBACK_TIMEOUT_TICKS - xElapsed;
+            }
+        }
+    }
+
+    return xNext;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,123 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Pipelined QoS1 telemetry publisher.
+ *        Keeps a window of several unacknowledged publishes, matches PUBACKs to
+ *        messages, retransmits on timeout and re-queues messages into the backlog
+ *        when all retries are exhausted.
+ *
+ * @remark All functions must be called from the task that runs AzureIoTHubClient_ProcessLoop.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_INFLIGHT_H
+#define SAMPLE_AZURE_IOT_INFLIGHT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Called once per message when it is acknowledged or given up on.
+ *
+ * @param[in] ulMessageId     Identifier returned by xInFlight_SendTelemetry.
+ * @param[in] xAcknowledged   true if a PUBACK was received, false if the message was re-queued.
+ * @param[in] ulLatencyMs     Time from first transmission to completion.
+ * @param[in] pvContext       Context passed to xInFlight_SendTelemetry.
+ */
+typedef void ( * InFlightCompletionCallback_t )( uint32_t ulMessageId,
+                                                 bool xAcknowledged,
+                                                 uint32_t ulLatencyMs,
+                                                 void * pvContext );
+
+/**
+ * @brief PUBACK notification, to be set as AzureIoTHubClientOptions_t::xTelemetryCallback.
+ */
+void vInFlight_HandlePubAck( uint16_t usPacketID );
+
+/**
+ * @brief Publishes telemetry with QoS1 without waiting for its PUBACK.
+ *
+ * When the window is full, this function services the connection until a slot frees up.
+ *
+ * @param[in]  pxClient      Connected hub client.
+ * @param[in]  pucPayload    Payload, copied into the window.
+ * @param[in]  ulLength      Payload length.
+ * @param[in]  pxProperties  Message properties, must stay valid until completion. Can be NULL.
+ *                           A message with properties is not moved to the backlog, which keeps
+ *                           payloads only: its completion callback must queue it again.
+ * @param[in]  xCallback     Completion callback. Can be NULL.
+ * @param[in]  pvContext     Context for `xCallback`.
+ * @param[out] pulMessageId  Identifier of the message. Can be NULL.
+ *
+ * @return AzureIoTResult_t eAzureIoTSuccess if the message was handed to MQTT.
+ */
+AzureIoTResult_t xInFlight_SendTelemetry( AzureIoTHubClient_t * pxClient,
+                                          const uint8_t * pucPayload,
+                                          uint32_t ulLength,
+                                          AzureIoTMessageProperties_t * pxProperties,
+                                          InFlightCompletionCallback_t xCallback,
+                                          void * pvContext,
+                                          uint32_t * pulMessageId );
+
+/**
+ * @brief Callback invoked on a message's own copy of the payload right before its first transmission.
+ */
+typedef void (* InFlightPrepareCallback_t)( uint8_t * pucPayload,
+                                           uint32_t ulLength );
+
+/**
+ * @brief Sets the callback that finalizes payloads before their first transmission.
+ *
+ * @param[in] xCallback  Callback, or NULL for none.
+ */
+void vInFlight_SetPrepareCallback( InFlightPrepareCallback_t xCallback );
+
+/**
+ * @brief Sets the completion callback used for messages sent from the backlog.
+ *
+ * @param[in] xCallback  Callback, or NULL for none.
+ * @param[in] pvContext  Context passed to the callback.
+ */
+void vInFlight_SetBacklogCallback( InFlightCompletionCallback_t xCallback,
+                                   void * pvContext );
+
+/**
+ * @brief Retransmits timed-out messages and moves backlog entries into free slots.
+ *
+ * @param[in] pxClient  Connected hub client.
+ *
+ * @return AzureIoTResult_t Result of the last failing publish, eAzureIoTSuccess otherwise.
+ */
+AzureIoTResult_t xInFlight_Process( AzureIoTHubClient_t * pxClient );
+
+/**
+ * @brief Sends every in-flight message again, used after connecting without a kept session.
+ *
+ * @param[in] pxClient  Connected hub client.
+ */
+AzureIoTResult_t xInFlight_ResendAll( AzureIoTHubClient_t * pxClient );
+
+/**
+ * @brief Moves every unacknowledged message back into the backlog, e.g. before deep sleep.
+ *        Completion callbacks are invoked as not acknowledged, and queue the messages with
+ *        properties again themselves.
+ */
+void vInFlight_RequeueAll( void );
+
+/**
+ * @brief Number of messages waiting for a PUBACK.
+ */
+uint32_t ulInFlight_Count( void );
+
+/**
+ * @brief Earliest time, in ticks from now, at which a message in flight times out.
+ *
+ * @return TickType_t portMAX_DELAY if nothing is in flight.
+ */
+TickType_t xInFlight_NextTimeout( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_INFLIGHT_H */
@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_metrics.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+/*-----------------------------------------------------------*/
+
+static const char * const pcMetricNames[ eSampleMetricCount ] =
+{
+    "tlsConnectMs",
+    "tlsConnectResumedMs",
+    "reconnectMs",
+    "reconnectEnergyUj",
+    "sessionResumed",
+    "pubAckLatencyMs",
+    "wakeToPublishMs",
+    "cycleEnergyUj",
+    "averageCurrentUa",
+    "commandLatencyMs",
+    "timeToIpMs",
+    "mqttRecoveryMs",
+    "tlsRecoveryMs",
+    "wifiRecoveryMs",
+    "alertLatencyMs",
+    "sampleJitterUs",
+};
+
+static SampleMetricStat_t xMetrics[ eSampleMetricCount ];
+
+static portMUX_TYPE xMetricsLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+void vSampleMetrics_Record( SampleMetric_t xMetric,
+                            uint32_t ulValue )
+{
+    SampleMetricStat_t * pxStat;
+
+    configASSERT( xMetric < eSampleMetricCount );
+    pxStat = &xMetrics[ xMetric ];
+
+    taskENTER_CRITICAL( &xMetricsLock );
+
+    if( ( pxStat->ulCount == 0 ) || ( ulValue < pxStat->ulMin ) )
+    {
+        pxStat->ulMin = ulValue;
+    }
+
+    if( ( pxStat->ulCount == 0 ) || ( ulValue > pxStat->ulMax ) )
+    {
+        pxStat->ulMax = ulValue;
+    }
+
+    pxStat->ulLast = ulValue;
+    pxStat->ullSum += ulValue;
+    pxStat->ulCount++;
+
+    taskEXIT_CRITICAL( &xMetricsLock );
+}
+/*-----------------------------------------------------------*/
+
+const SampleMetricStat_t * pxSampleMetrics_Get( SampleMetric_t xMetric )
+{
+    configASSERT( xMetric < eSampleMetricCount );
+
+    return &xMetrics[ xMetric ];
+}
+/*-----------------------------------------------------------*/
+
+const char * pcSampleMetrics_Name( SampleMetric_t xMetric )
+{
+    configASSERT( xMetric < eSampleMetricCount );
+
+    return pcMetricNames[ xMetric ];
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulSampleMetrics_EnergyUj( uint32_t ulDurationMs,
+                                   uint32_t ulCurrentUa )
+{
+    /* ms * uA * mV = 1e-12 J, so divide by 1e6 to get microjoules. */
+    return ( uint32_t ) ( ( ( uint64_t ) ulDurationMs * ulCurrentUa *
+                            CONFIG_SAMPLE_IOT_SUPPLY_MILLIVOLTS ) / 1000000ULL );
+}
+/*-----------------------------------------------------------*/
+
+void vSampleMetrics_Log( void )
+{
+    uint32_t i;
+
+    for( i = 0; i < eSampleMetricCount; i++ )
+    {
+        if( xMetrics[ i ].ulCount > 0 )
+        {
+            LogInfo( ( "Metric %s: count=%u last=%u min=%u max=%u avg=%u",
+                       pcMetricNames[ i ],
+                       ( unsigned ) xMetrics[ i ].ulCount,
+                       ( unsigned ) xMetrics[ i ].ulLast,
+                       ( unsigned ) xMetrics[ i ].ulMin,
+                       ( unsigned ) xMetrics[ i ].ulMax,
+                       ( unsigned ) ( xMetrics[ i ].ullSum / xMetrics[ i ].ulCount ) ) );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Lightweight run-time metrics used to measure connection and power behaviour
+ *        of the sample (durations, counts and estimated energy).
+ */
+
+#ifndef SAMPLE_AZURE_IOT_METRICS_H
+#define SAMPLE_AZURE_IOT_METRICS_H
+
+#include <stdint.h>
+
+/**
+ * @brief Identifiers of the metrics tracked by the sample.
+ */
+typedef enum SampleMetric
+{
+    eSampleMetricTlsConnectMs = 0,        /**< TLS connect time with a full handshake. */
+    eSampleMetricTlsConnectResumedMs,     /**< TLS connect time when the server resumed the cached session. */
+    eSampleMetricReconnectMs,             /**< Time from TLS connect start to a usable MQTT session. */
+    eSampleMetricReconnectEnergyUj,       /**< Estimated energy spent on each (re)connect, in microjoules. */
+    eSampleMetricSessionResumed,          /**< 1 when the broker kept the MQTT session, 0 otherwise. */
+    eSampleMetricPubAckLatencyMs,         /**< Time from first transmission of a telemetry message to its PUBACK. */
+    eSampleMetricWakeToPublishMs,         /**< Duty cycle: time from wake-up to the first acknowledged publish. */
+    eSampleMetricCycleEnergyUj,           /**< Duty cycle: estimated energy of the previous cycle, sleep included. */
+    eSampleMetricAverageCurrentUa,        /**< Estimated average current over each reporting interval. */
+    eSampleMetricCommandLatencyMs,        /**< Time from incoming data waking the task to the command response being sent. */
+    eSampleMetricTimeToIpMs,              /**< Time from Wi-Fi start, or from a disconnect, to an IP address. */
+    eSampleMetricMqttRecoveryMs,          /**< Outage recovered by reconnecting MQTT over a resumed TLS session; count is the number of such reconnects. */
+    eSampleMetricTlsRecoveryMs,           /**< Outage recovered with a full TLS handshake; count is the number of such reconnects. */
+    eSampleMetricWifiRecoveryMs,          /**< Outage recovered after Wi-Fi was lost or reassociated; count is the number of such reconnects. */
+    eSampleMetricAlertLatencyMs,          /**< Time from the sample that crossed a gas threshold to the PUBACK of its alert. */
+    eSampleMetricSampleJitterUs,          /**< Delay from the scheduled time of an internal sample to the start of its read. */
+    eSampleMetricCount
+} SampleMetric_t;
+
+/**
+ * @brief Running statistics of a single metric.
+ */
+typedef struct SampleMetricStat
+{
+    uint32_t ulCount;
+    uint32_t ulLast;
+    uint32_t ulMin;
+    uint32_t ulMax;
+    uint64_t ullSum;
+} SampleMetricStat_t;
+
+/**
+ * @brief Adds a sample to a metric.
+ *
+ * @param[in] xMetric  Metric to update.
+ * @param[in] ulValue  Value to record.
+ */
+void vSampleMetrics_Record( SampleMetric_t xMetric,
+                            uint32_t ulValue );
+
+/**
+ * @brief Gets the running statistics of a metric.
+ *
+ * @param[in] xMetric  Metric to read.
+ *
+ * @return const SampleMetricStat_t* Statistics of the metric, never NULL.
+ */
+const SampleMetricStat_t * pxSampleMetrics_Get( SampleMetric_t xMetric );
+
+/**
+ * @brief Gets the name of a metric, as used in logs and diagnostics.
+ */
+const char * pcSampleMetrics_Name( SampleMetric_t xMetric );
+
+/**
+ * @brief Estimates the energy drawn over a period at a given current, using the configured supply voltage.
+ *
+ * @param[in] ulDurationMs   Length of the period in milliseconds.
+ * @param[in] ulCurrentUa    Average current in microamperes.
+ *
+ * @return uint32_t Estimated energy in microjoules.
+ */
+uint32_t ulSampleMetrics_EnergyUj( uint32_t ulDurationMs,
+                                   uint32_t ulCurrentUa );
+
+/**
+ * @brief Logs all metrics that have at least one sample.
+ */
+void vSampleMetrics_Log( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_METRICS_H */
@@ -0,0 +1,123 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_nvs.h"
+
+#include "nvs.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief NVS namespace holding every key written by the sample.
+ */
+#define samplenvsNAMESPACE    "azureiot"
+/*-----------------------------------------------------------*/
+
+esp_err_t xSampleNvs_GetU32( const char * pcKey,
+                             uint32_t * pulValue )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xErr;
+
+    if( ( xErr = nvs_open( samplenvsNAMESPACE, NVS_READONLY, &xHandle ) ) != ESP_OK )
+    {
+        return xErr;
+    }
+
+    xErr = nvs_get_u32( xHandle, pcKey, pulValue );
+    nvs_close( xHandle );
+
+    return xErr;
+}
+/*-----------------------------------------------------------*/
+
+esp_err_t xSampleNvs_SetU32( const char * pcKey,
+                             uint32_t ulValue )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xErr;
+
+    if( ( xErr = nvs_open( samplenvsNAMESPACE, NVS_READWRITE, &xHandle ) ) != ESP_OK )
+    {
+        return xErr;
+    }
+
+    if( ( xErr = nvs_set_u32( xHandle, pcKey, ulValue ) ) == ESP_OK )
+    {
+        xErr = nvs_commit( xHandle );
+    }
+
+    nvs_close( xHandle );
+
+    return xErr;
+}
+/*-----------------------------------------------------------*/
+
+esp_err_t xSampleNvs_GetBlob( const char * pcKey,
+                              void * pvValue,
+                              size_t * pxLength )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xErr;
+
+    if( ( xErr = nvs_open( samplenvsNAMESPACE, NVS_READONLY, &xHandle ) ) != ESP_OK )
+    {
+        return xErr;
+    }
+
+    xErr = nvs_get_blob( xHandle, pcKey, pvValue, pxLength );
+    nvs_close( xHandle );
+
+    return xErr;
+}
+/*-----------------------------------------------------------*/
+
+esp_err_t xSampleNvs_SetBlob( const char * pcKey,
+                              const void * pvValue,
+                              size_t xLength )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xErr;
+
+    if( ( xErr = nvs_open( samplenvsNAMESPACE, NVS_READWRITE, &xHandle ) ) != ESP_OK )
+    {
+        return xErr;
+    }
+
+    if( ( xErr = nvs_set_blob( xHandle, pcKey, pvValue, xLength ) ) == ESP_OK )
+    {
+        xErr = nvs_commit( xHandle );
+    }
+
+    nvs_close( xHandle );
+
+    return xErr;
+}
+/*-----------------------------------------------------------*/
+
+esp_err_t xSampleNvs_Erase( const char * pcKey )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xErr;
+
+    if( ( xErr = nvs_open( samplenvsNAMESPACE, NVS_READWRITE, &xHandle ) ) != ESP_OK )
+    {
+        return xErr;
+    }
+
+    xErr = nvs_erase_key( xHandle, pcKey );
+
+    if( xErr == ESP_ERR_NVS_NOT_FOUND )
+    {
+        xErr = ESP_OK;
+    }
+
+    if( xErr == ESP_OK )
+    {
+        xErr = nvs_commit( xHandle );
+    }
+
+    nvs_close( xHandle );
+
+    return xErr;
+}
+/*-----------------------------------------------------------*/
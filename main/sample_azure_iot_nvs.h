@@ -0,0 +1,54 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Small wrapper over the NVS flash API used by the sample to persist
+ *        settings and cached state across reboots. All keys live in one namespace.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_NVS_H
+#define SAMPLE_AZURE_IOT_NVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Reads a 32-bit value.
+ *
+ * @return esp_err_t ESP_OK, or ESP_ERR_NVS_NOT_FOUND if the key was never written.
+ */
+esp_err_t xSampleNvs_GetU32( const char * pcKey,
+                             uint32_t * pulValue );
+
+/**
+ * @brief Writes and commits a 32-bit value.
+ */
+esp_err_t xSampleNvs_SetU32( const char * pcKey,
+                             uint32_t ulValue );
+
+/**
+ * @brief Reads a binary value.
+ *
+ * @param[in]     pcKey     Key to read.
+ * @param[out]    pvValue   Buffer receiving the value.
+ * @param[in,out] pxLength  In: size of `pvValue`. Out: length of the stored value.
+ */
+esp_err_t xSampleNvs_GetBlob( const char * pcKey,
+                              void * pvValue,
+                              size_t * pxLength );
+
+/**
+ * @brief Writes and commits a binary value.
+ */
+esp_err_t xSampleNvs_SetBlob( const char * pcKey,
+                              const void * pvValue,
+                              size_t xLength );
+
+/**
+ * @brief Erases a key. Erasing a key that does not exist is not an error.
+ */
+esp_err_t xSampleNvs_Erase( const char * pcKey );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_NVS_H */
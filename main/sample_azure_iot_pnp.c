@@ -2,6 +2,7 @@
  * Licensed under the MIT License. */
 
 /* Standard includes. */
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -23,6 +24,7 @@
 
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
+#include "transport_tls_session.h"
 
 /* Crypto helper header. */
 #include "azure_sample_crypto.h"
@@ -36,6 +38,34 @@
 /* Data Interface Definition */
 #include "sample_azure_iot_pnp_data_if.h"
 
+/* Connection and power metrics. */
+#include "sample_azure_iot_metrics.h"
+
+/* Pipelined QoS1 publishing and offline backlog. */
+#include "sample_azure_iot_inflight.h"
+#include "sample_azure_iot_backlog.h"
+#include "sample_azure_iot_reported_properties.h"
+#include "sample_azure_iot_alerts.h"
+#include "sample_azure_iot_charger.h"
+#include "sample_azure_iot_rollup.h"
+
+/* Deep-sleep duty cycle and power management. */
+#include "sample_azure_iot_duty_cycle.h"
+#include "sample_azure_iot_power.h"
+
+/* Wall clock. */
+#include "sample_azure_iot_time.h"
+
+/* Persisted provisioning result. */
+#include "sample_azure_iot_nvs.h"
+
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "lwip/sockets.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 /*-----------------------------------------------------------*/
 
 /* Compile time error for undefined configs. */
@@ -93,6 +123,11 @@
  */
 #define sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS     ( pdMS_TO_TICKS( 5000U ) )
 
+/**
+ * @brief Polling period while waiting for connectivity and the first clock synchronization.
+ */
+#define sampleazureiotNETWORK_TIME_POLL_TICKS                 ( pdMS_TO_TICKS( 500U ) )
+
 /**
  * @brief Timeout for MQTT_ProcessLoop in milliseconds.
  */
@@ -107,6 +142,26 @@
  */
 #define sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS           ( pdMS_TO_TICKS( 2000U ) )
 
+/**
+ * @brief Timeout for ProcessLoop when woken by incoming data or a keep-alive deadline.
+ */
+#define sampleazureiotEVENT_PROCESS_LOOP_TIMEOUT_MS           ( 50U )
+
+#ifndef azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS
+    #define azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS          ( 60 * 4 )
+#endif
+
+/**
+ * @brief Longest time the idle wait goes without servicing the connection,
+ * so that MQTT PINGREQs are sent well within the broker's keep-alive grace period.
+ */
+#define sampleazureiotKEEP_ALIVE_SERVICE_TICKS                ( pdMS_TO_TICKS( azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS * 1000U / 4U ) )
+
+/**
+ * @brief Internal event: the hub socket has data to read.
+ */
+#define sampleazureiotEVENT_SOCKET_READABLE                   ( 1UL << 31 )
+
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
@@ -121,6 +176,63 @@
  * @brief Wait timeout for subscribe to finish.
  */
 #define sampleazureiotSUBSCRIBE_TIMEOUT                       ( 10 * 1000U )
+
+/**
+ * @brief Payload of a command response that has nothing to return.
+ */
+#define sampleazureiotCOMMAND_EMPTY_PAYLOAD                   "{}"
+
+/**
+ * @brief NVS key of the IoT Hub assignment obtained from the Provisioning service.
+ */
+#define sampleazureiotNVS_KEY_DPS_RESULT                      "dps"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief States of the connection to the IoT Hub.
+ *
+ * A failure is recovered at the lowest layer that failed: a broken MQTT connection is
+ * re-established over a resumed TLS session first, then with a full TLS handshake, and only
+ * then is Wi-Fi reassociated.
+ */
+typedef enum ConnectionState
+{
+    eConnectionStateWaitForNetwork = 0, /**< Waiting for an IP address and a synchronized clock. */
+    eConnectionStateProvision,          /**< Getting the IoT Hub assignment from DPS. */
+    eConnectionStateConnectTls,         /**< New TLS connection, then MQTT connect. */
+    eConnectionStateConnectMqtt,        /**< MQTT reconnect over a resumed TLS session, reusing the session kept by the broker. */
+    eConnectionStateConnected,          /**< Publishing and serving the connection. */
+    eConnectionStateCount
+} ConnectionState_t;
+
+/**
+ * @brief Retry policy of a connection state. Delays are drawn at random up to an
+ *        exponentially growing bound, so that devices do not retry in lockstep.
+ */
+typedef struct ConnectionRetryPolicy
+{
+    uint16_t usBaseBackoffMs; /**< Bound of the first delay. */
+    uint16_t usMaxBackoffMs;  /**< Cap of the bound. */
+    uint32_t ulMaxAttempts;   /**< Attempts before falling back to the layer below. */
+} ConnectionRetryPolicy_t;
+
+static const ConnectionRetryPolicy_t xRetryPolicies[ eConnectionStateCount ] =
+{
+    [ eConnectionStateWaitForNetwork ] = { 0U,                                  0U,                                       BACKOFF_ALGORITHM_RETRY_FOREVER },
+    [ eConnectionStateProvision ]      = { 2000U,                               60000U,                                   BACKOFF_ALGORITHM_RETRY_FOREVER },
+    [ eConnectionStateConnectTls ]     = { sampleazureiotRETRY_BACKOFF_BASE_MS, sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS, sampleazureiotRETRY_MAX_ATTEMPTS },
+    [ eConnectionStateConnectMqtt ]    = { 200U,                                2000U,                                    3U },
+    [ eConnectionStateConnected ]      = { 0U,                                  0U,                                       BACKOFF_ALGORITHM_RETRY_FOREVER },
+};
+
+static const char * const pcStateNames[ eConnectionStateCount ] =
+{
+    "WaitForNetwork",
+    "Provision",
+    "ConnectTls",
+    "ConnectMqtt",
+    "Connected",
+};
 /*-----------------------------------------------------------*/
 
 /**
@@ -129,6 +241,18 @@
  * @return Time in milliseconds.
  */
 uint64_t ullGetUnixTime( void );
+
+/**
+ * @brief Drops the Wi-Fi association and starts a new one. Connectivity reads as lost
+ *        until an IP address is obtained again.
+ */
+void vAzureSample_ReconnectWiFi( void );
+
+/**
+ * @brief Tells the network layer that the hub was reached, so that a cached static
+ *        address is kept rather than dropped for DHCP when its check times out.
+ */
+void vAzureSample_NetworkConfirmed( void );
 /*-----------------------------------------------------------*/
 
 /* Define buffer for IoT Hub info.  */
@@ -136,6 +260,17 @@ uint64_t ullGetUnixTime( void );
     static uint8_t ucSampleIotHubHostname[ 128 ];
     static uint8_t ucSampleIotHubDeviceId[ 128 ];
     static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
+
+/**
+ * @brief IoT Hub assignment as persisted in NVS.
+ */
+    typedef struct DpsResult
+    {
+        uint32_t ulHostnameLength;
+        uint32_t ulDeviceIdLength;
+        uint8_t ucHostname[ sizeof( ucSampleIotHubHostname ) ];
+        uint8_t ucDeviceId[ sizeof( ucSampleIotHubDeviceId ) ];
+    } DpsResult_t;
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
 /* Each compilation unit must define the NetworkContext struct. */
@@ -146,11 +281,29 @@ struct NetworkContext
 
 AzureIoTHubClient_t xAzureIoTHubClient;
 
+/* Hub client state kept across reconnects, see prvConnectHubClient. */
+static AzureIoTTransportInterface_t xTransport;
+static bool xHubClientInitialized = false;
+static bool xSubscribed = false;
+
+/* Handle of the sample core task, target of vNotifyDemoTask. */
+static TaskHandle_t xDemoTaskHandle = NULL;
+
+/* Event descriptor used to break the idle select() when the task is notified. */
+static int lWakeEventFd = -1;
+
+/* Time the hub socket last woke the task, start of the command-response latency. */
+static int64_t llSocketReadableUs = 0;
+
 /* Telemetry buffers */
 static uint8_t ucScratchBuffer[ 512 ];
 
 /* Command buffers */
-static uint8_t ucCommandResponsePayloadBuffer[ 256 ];
+static uint8_t ucCommandResponsePayloadBuffer[ CONFIG_SAMPLE_IOT_COMMAND_RESPONSE_MAX_SIZE ];
+
+/* Request id of the deferred command, for its response. */
+static uint8_t ucDeferredRequestId[ 64 ];
+static uint16_t usDeferredRequestIdLength = 0;
 
 /* Reported Properties buffers */
 static uint8_t ucReportedPropertiesUpdate[ 380 ];
@@ -175,6 +328,21 @@ static uint32_t ulReportedPropertiesUpdateLength;
                                       uint8_t ** ppucIothubDeviceId,
                                       uint32_t * pulIothubDeviceIdLength );
 
+/**
+ * @brief Gets the IoT Hub endpoint and deviceId saved by the last successful provisioning.
+ *
+ * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname
+ * @param[out] pulIothubHostnameLength  Length of hostname
+ * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId
+ * @param[out] pulIothubDeviceIdLength  Length of deviceId
+ *
+ * @return bool true if a valid assignment was found in NVS.
+ */
+    static bool prvIoTHubInfoLoad( uint8_t ** ppucIothubHostname,
+                                   uint32_t * pulIothubHostnameLength,
+                                   uint8_t ** ppucIothubDeviceId,
+                                   uint32_t * pulIothubDeviceIdLength );
+
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
 /**
@@ -184,24 +352,6 @@ static uint32_t ulReportedPropertiesUpdateLength;
  * used in this example.
  */
 static void prvAzureDemoTask( void * pvParameters );
-
-/**
- * @brief Connect to endpoint with reconnection retries.
- *
- * If connection fails, retry is attempted after a timeout.
- * Timeout value will exponentially increase until maximum
- * timeout value is reached or the number of attempts are exhausted.
- *
- * @param pcHostName Hostname of the endpoint to connect to.
- * @param ulPort Endpoint port.
- * @param pxNetworkCredentials Pointer to Network credentials.
- * @param pxNetworkContext Point to Network context created.
- * @return uint32_t The status of the final connection attempt.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t ulPort,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext );
 /*-----------------------------------------------------------*/
 
 /**
@@ -209,6 +359,68 @@ static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
  */
 static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
 
+/**
+ * @brief Completion callback for telemetry published through the in-flight window.
+ */
+static void prvOnTelemetryComplete( uint32_t ulMessageId,
+                                    bool xAcknowledged,
+                                    uint32_t ulLatencyMs,
+                                    void * pvContext )
+{
+    ( void ) pvContext;
+
+    if( xAcknowledged )
+    {
+        LogDebug( ( "Telemetry message %u acknowledged after %u ms",
+                    ( unsigned ) ulMessageId, ( unsigned ) ulLatencyMs ) );
+        vSampleMetrics_Record( eSampleMetricPubAckLatencyMs, ulLatencyMs );
+
+        #if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+            vDutyCycle_MarkPublished();
+        #endif
+    }
+    else
+    {
+        LogWarn( ( "Telemetry message %u re-queued after %u ms, %u message(s) in backlog",
+                   ( unsigned ) ulMessageId, ( unsigned ) ulLatencyMs, ( unsigned ) ulBacklog_Count() ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sends the response of a command from ucCommandResponsePayloadBuffer.
+ */
+static void prvSendCommandResponse( AzureIoTHubClient_t * pxHandle,
+                                    AzureIoTHubClientCommandRequest_t * pxMessage,
+                                    uint32_t ulResponseStatus,
+                                    uint32_t ulCommandResponsePayloadLength )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulLatencyMs;
+
+    if( ( xResult = AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
+                                                           ucCommandResponsePayloadBuffer,
+                                                           ulCommandResponsePayloadLength ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Error sending command response: result 0x%08x", ( uint16_t ) xResult ) );
+    }
+    else if( llSocketReadableUs == 0 )
+    {
+        LogInfo( ( "Successfully sent command response %d", ( int16_t ) ulResponseStatus ) );
+    }
+    else
+    {
+        /* From the wake-up on incoming data to the response being sent; the delivery delay
+         * of the access point, up to one listen interval, comes on top of this. */
+        ulLatencyMs = ( uint32_t ) ( ( esp_timer_get_time() - llSocketReadableUs ) / 1000 );
+        llSocketReadableUs = 0;
+        vSampleMetrics_Record( eSampleMetricCommandLatencyMs, ulLatencyMs );
+        LogInfo( ( "Successfully sent command response %d after %u ms",
+                   ( int16_t ) ulResponseStatus, ( unsigned ) ulLatencyMs ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Internal function for handling Command requests.
  *
@@ -219,24 +431,59 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
 {
     AzureIoTHubClient_t * pxHandle = ( AzureIoTHubClient_t * ) pvContext;
     uint32_t ulResponseStatus = 0;
-    AzureIoTResult_t xResult;
 
     uint32_t ulCommandResponsePayloadLength = ulHandleCommand( pxMessage,
                                                                &ulResponseStatus,
                                                                ucCommandResponsePayloadBuffer,
                                                                sizeof( ucCommandResponsePayloadBuffer ) );
 
-    if( ( xResult = AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
-                                                           ucCommandResponsePayloadBuffer,
-                                                           ulCommandResponsePayloadLength ) ) != eAzureIoTSuccess )
+    if( ulResponseStatus == sampleazureiotCOMMAND_STATUS_DEFERRED )
     {
-        LogError( ( "Error sending command response: result 0x%08x", ( uint16_t ) xResult ) );
+        if( pxMessage->usRequestIDLength <= sizeof( ucDeferredRequestId ) )
+        {
+            /* Answered by prvSendDeferredCommandResponse; the request only lives through this callback. */
+            ( void ) memcpy( ucDeferredRequestId, pxMessage->pucRequestID, pxMessage->usRequestIDLength );
+            usDeferredRequestIdLength = pxMessage->usRequestIDLength;
+            return;
+        }
+
+        /* The response could not be matched with its request later: answer now. */
+        LogError( ( "Command request id of %u bytes too long to defer the response.",
+                    ( unsigned ) pxMessage->usRequestIDLength ) );
+        vCancelDeferredCommand();
+
+        ulResponseStatus = AZ_IOT_STATUS_BAD_REQUEST;
+        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
+        ( void ) memcpy( ucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
     }
-    else
+
+    prvSendCommandResponse( pxHandle, pxMessage, ulResponseStatus, ulCommandResponsePayloadLength );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sends the response of the deferred command, once the sample has it.
+ */
+static void prvSendDeferredCommandResponse( AzureIoTHubClient_t * pxHandle )
+{
+    AzureIoTHubClientCommandRequest_t xRequest = { 0 };
+    uint32_t ulResponseStatus = 0;
+    uint32_t ulCommandResponsePayloadLength = ulCompleteDeferredCommand( &ulResponseStatus,
+                                                                         ucCommandResponsePayloadBuffer,
+                                                                         sizeof( ucCommandResponsePayloadBuffer ) );
+
+    if( ( ulCommandResponsePayloadLength == 0 ) || ( usDeferredRequestIdLength == 0 ) )
     {
-        LogInfo( ( "Successfully sent command response %d", ( int16_t ) ulResponseStatus ) );
+        return;
     }
+
+    xRequest.pucRequestID = ucDeferredRequestId;
+    xRequest.usRequestIDLength = usDeferredRequestIdLength;
+    usDeferredRequestIdLength = 0;
+
+    prvSendCommandResponse( pxHandle, &xRequest, ulResponseStatus, ulCommandResponsePayloadLength );
 }
+/*-----------------------------------------------------------*/
 
 
 static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t * pxMessage )
@@ -248,7 +495,7 @@ static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t *
 
     if( ulReportedPropertiesUpdateLength == 0 )
     {
-        LogError( ( "Failed to send response to writable properties update, length of response is zero." ) );
+        LogInfo( ( "No writable property to acknowledge." ) );
     }
     else
     {
@@ -256,7 +503,12 @@ static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t *
                                                                              ucReportedPropertiesUpdate,
                                                                              ulReportedPropertiesUpdateLength,
                                                                              NULL );
-        configASSERT( xResult == eAzureIoTSuccess );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            /* The next ProcessLoop reports the broken connection to the task. */
+            LogError( ( "Error sending the property acknowledgement: result 0x%08x", ( uint16_t ) xResult ) );
+        }
     }
 }
 /*-----------------------------------------------------------*/
@@ -289,6 +541,9 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 
         case eAzureIoTHubPropertiesReportedResponseMessage:
             LogDebug( ( "Device reported property response received" ) );
+            vReportedProperties_HandleResponse( pxMessage->ulRequestID,
+                                                ( pxMessage->xMessageStatus >= eAzureIoTStatusOk ) &&
+                                                ( pxMessage->xMessageStatus < eAzureIoTStatusBadRequest ) );
             break;
 
         default:
@@ -298,6 +553,369 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 }
 /*-----------------------------------------------------------*/
 
+void vNotifyDemoTask( uint32_t ulEvents )
+{
+    uint64_t ullSignal = 1;
+
+    if( xDemoTaskHandle == NULL )
+    {
+        return;
+    }
+
+    ( void ) xTaskNotify( xDemoTaskHandle, ulEvents, eSetBits );
+
+    if( lWakeEventFd >= 0 )
+    {
+        ( void ) write( lWakeEventFd, &ullSignal, sizeof( ullSignal ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Blocks until the hub socket is readable, the task is notified or the timeout expires.
+ *
+ * @return uint32_t Events that occurred, sampleazureiotEVENT_SOCKET_READABLE included.
+ */
+static uint32_t prvWaitForEvents( NetworkContext_t * pxNetworkContext,
+                                  TickType_t xTimeoutTicks )
+{
+    uint32_t ulEvents = 0;
+    uint32_t ulNotified = 0;
+    uint32_t ulTimeoutMs = xTimeoutTicks * portTICK_PERIOD_MS;
+    struct timeval xTimeout = { .tv_sec = ulTimeoutMs / 1000, .tv_usec = ( ulTimeoutMs % 1000 ) * 1000 };
+    int lSocket = TLS_Session_GetSocket( pxNetworkContext );
+    uint64_t ullDiscard;
+    fd_set xReadSet;
+    int lReady;
+
+    /* Idle: allow DFS and light sleep until something happens. */
+    vPower_Release( ePowerLockNetwork );
+
+    /* Data already decrypted by TLS does not show up on the socket. */
+    if( TLS_Session_HasPendingData( pxNetworkContext ) )
+    {
+        ulEvents |= sampleazureiotEVENT_SOCKET_READABLE;
+    }
+    else if( lSocket < 0 )
+    {
+        /* No connection to watch: wait on the notification alone, so events still wake the task. */
+        if( xTaskNotifyWait( 0, ULONG_MAX, &ulNotified, xTimeoutTicks ) == pdTRUE )
+        {
+            ulEvents |= ulNotified;
+        }
+    }
+    else
+    {
+        FD_ZERO( &xReadSet );
+        FD_SET( lSocket, &xReadSet );
+        FD_SET( lWakeEventFd, &xReadSet );
+
+        lReady = select( ( lSocket > lWakeEventFd ? lSocket : lWakeEventFd ) + 1,
+                         &xReadSet, NULL, NULL, &xTimeout );
+
+        if( lReady < 0 )
+        {
+            /* Let ProcessLoop surface the socket error. */
+            ulEvents |= sampleazureiotEVENT_SOCKET_READABLE;
+        }
+        else if( lReady > 0 )
+        {
+            if( FD_ISSET( lSocket, &xReadSet ) )
+            {
+                ulEvents |= sampleazureiotEVENT_SOCKET_READABLE;
+            }
+
+            if( FD_ISSET( lWakeEventFd, &xReadSet ) )
+            {
+                ( void ) read( lWakeEventFd, &ullDiscard, sizeof( ullDiscard ) );
+            }
+        }
+    }
+
+    vPower_Acquire( ePowerLockNetwork );
+
+    if( ( ulEvents & sampleazureiotEVENT_SOCKET_READABLE ) != 0 )
+    {
+        llSocketReadableUs = esp_timer_get_time();
+    }
+
+    if( xTaskNotifyWait( 0, ULONG_MAX, &ulNotified, 0 ) == pdTRUE )
+    {
+        ulEvents |= ulNotified;
+    }
+
+    return ulEvents;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Idles until the next report is due or an event asks for one.
+ *
+ * Instead of polling ProcessLoop every second, the task blocks on the hub socket, the wake
+ * event descriptor and the earliest deadline (report, keep-alive or PUBACK timeout), so the
+ * CPU and radio stay idle between real events and incoming commands are handled at once.
+ *
+ * @param[in]  pxNetworkContext  Connection to the hub.
+ * @param[in]  xLastReport       Tick count of the last report; the next one is due an interval later.
+ * @param[out] pxReportNow       Set when an event asked for a report before it was due.
+ *
+ * @return AzureIoTResult_t An error if the connection failed. Also returns, with success,
+ *         when connectivity is lost.
+ */
+static AzureIoTResult_t prvWaitUntilNextReport( NetworkContext_t * pxNetworkContext,
+                                                TickType_t xLastReport,
+                                                bool * pxReportNow )
+{
+    TickType_t xReportPeriodTicks;
+    TickType_t xStart = xLastReport;
+    TickType_t xLastServiced = xTaskGetTickCount();
+    TickType_t xElapsed;
+    TickType_t xWait;
+    TickType_t xDeadline;
+    uint32_t ulEvents;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    *pxReportNow = false;
+
+    while( xAzureSample_IsConnectedToInternet() )
+    {
+        /* Re-read on every wake-up so an interval change applies to the current wait. */
+        xReportPeriodTicks = pdMS_TO_TICKS( ulGetReportingIntervalSeconds() * 1000ULL );
+        xElapsed = xTaskGetTickCount() - xStart;
+
+        if( xElapsed >= xReportPeriodTicks )
+        {
+            break;
+        }
+
+        xWait = xReportPeriodTicks - xElapsed;
+        xElapsed = xTaskGetTickCount() - xLastServiced;
+        xDeadline = ( xElapsed < sampleazureiotKEEP_ALIVE_SERVICE_TICKS ) ? ( sampleazureiotKEEP_ALIVE_SERVICE_TICKS - xElapsed ) : 0;
+
+        if( xDeadline < xWait )
+        {
+            xWait = xDeadline;
+        }
+
+        xDeadline = xInFlight_NextTimeout();
+
+        if( xDeadline < xWait )
+        {
+            xWait = xDeadline;
+        }
+
+        ulEvents = prvWaitForEvents( pxNetworkContext, xWait );
+
+        if( ( ( ulEvents & sampleazureiotEVENT_SOCKET_READABLE ) != 0 ) ||
+            ( ( xTaskGetTickCount() - xLastServiced ) >= sampleazureiotKEEP_ALIVE_SERVICE_TICKS ) )
+        {
+            if( ( xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
+                                                           sampleazureiotEVENT_PROCESS_LOOP_TIMEOUT_MS ) ) != eAzureIoTSuccess )
+            {
+                LogError( ( "ProcessLoop failed: result 0x%08x", ( uint16_t ) xResult ) );
+                break;
+            }
+
+            xLastServiced = xTaskGetTickCount();
+        }
+
+        /* Also polled while a response is owed, in case its event was taken by another wait. */
+        if( ( ( ulEvents & sampleazureiotEVENT_COMMAND_DONE ) != 0 ) || ( usDeferredRequestIdLength != 0 ) )
+        {
+            prvSendDeferredCommandResponse( &xAzureIoTHubClient );
+        }
+
+        /* Alerts go out ahead of everything else waiting for a slot in the window. */
+        if( ( ( ulEvents & sampleazureiotEVENT_ALERT ) != 0 ) &&
+            ( ( xResult = xAlerts_Publish( &xAzureIoTHubClient ) ) != eAzureIoTSuccess ) )
+        {
+            LogError( ( "Publishing an alert failed: result 0x%08x", ( uint16_t ) xResult ) );
+            break;
+        }
+
+        if( ( ( ulEvents & sampleazureiotEVENT_CHARGER ) != 0 ) &&
+            ( ( xResult = xCharger_Publish( &xAzureIoTHubClient ) ) != eAzureIoTSuccess ) )
+        {
+            LogError( ( "Publishing a charger event failed: result 0x%08x", ( uint16_t ) xResult ) );
+            break;
+        }
+
+        if( ( xResult = xInFlight_Process( &xAzureIoTHubClient ) ) != eAzureIoTSuccess )
+        {
+            LogError( ( "Publishing failed: result 0x%08x", ( uint16_t ) xResult ) );
+            break;
+        }
+
+        if( ( ulEvents & sampleazureiotEVENT_REPORT_NOW ) != 0 )
+        {
+            *pxReportNow = true;
+            break;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+
+/**
+ * @brief Keeps whatever is still unacknowledged in the RTC-retained backlog and alert queue,
+ * disconnects and enters deep sleep.
+ *
+ * @param[in] xConnected  Whether the hub client is connected and must be disconnected first.
+ */
+    static void prvSleepUntilNextCycle( NetworkContext_t * pxNetworkContext,
+                                        bool xConnected )
+    {
+        vInFlight_RequeueAll();
+
+        if( ulBacklog_Count() > 0 )
+        {
+            LogWarn( ( "%u message(s) kept for the next cycle.", ( unsigned ) ulBacklog_Count() ) );
+        }
+
+        if( xConnected && xAzureSample_IsConnectedToInternet() )
+        {
+            ( void ) AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+        }
+
+        TLS_Session_Disconnect( pxNetworkContext );
+
+        vDutyCycle_Sleep( ulGetReportingIntervalSeconds() );
+    }
+
+/**
+ * @brief Ends a duty cycle: waits a bounded time for outstanding PUBACKs, then sleeps.
+ */
+    static void prvFinishDutyCycle( NetworkContext_t * pxNetworkContext )
+    {
+        TickType_t xStart = xTaskGetTickCount();
+        TickType_t xLimit = pdMS_TO_TICKS( CONFIG_SAMPLE_IOT_DUTY_CYCLE_ACK_WAIT_MS );
+        TickType_t xElapsed;
+        uint32_t ulEvents;
+
+        while( xAzureSample_IsConnectedToInternet() && !xDutyCycle_BudgetExpired() &&
+               ( ( ulInFlight_Count() > 0 ) || ( ulBacklog_Count() > 0 ) || xReportedProperties_InFlight() ) &&
+               ( ( xElapsed = xTaskGetTickCount() - xStart ) < xLimit ) )
+        {
+            ulEvents = prvWaitForEvents( pxNetworkContext, xLimit - xElapsed );
+
+            if( ( ulEvents & sampleazureiotEVENT_SOCKET_READABLE ) != 0 )
+            {
+                if( AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
+                                                   sampleazureiotEVENT_PROCESS_LOOP_TIMEOUT_MS ) != eAzureIoTSuccess )
+                {
+                    break;
+                }
+            }
+
+            if( xInFlight_Process( &xAzureIoTHubClient ) != eAzureIoTSuccess )
+            {
+                break;
+            }
+        }
+
+        prvSleepUntilNextCycle( pxNetworkContext, true );
+    }
+
+#else /* CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE */
+
+/**
+ * @brief Publishes the telemetry of a report, or queues what cannot be sent.
+ *        A report can be several payloads, e.g. one per rollup bucket.
+ *
+ * @param[in] xConnected  Whether the hub client is connected. If not, everything goes
+ *                        straight to the backlog, as for the sample taken at start-up.
+ */
+    static void prvPublishTelemetry( bool xConnected )
+    {
+        uint32_t ulScratchBufferLength = 0U;
+        AzureIoTResult_t xResult;
+
+        do
+        {
+            if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) != 0 ) ||
+                ( ulScratchBufferLength == 0 ) )
+            {
+                continue;
+            }
+
+            if( !xConnected )
+            {
+                ( void ) xBacklog_Push( ucScratchBuffer, ulScratchBufferLength );
+                continue;
+            }
+
+            /* Published without waiting for the PUBACK; the in-flight window
+             * tracks the acknowledgement and retransmits on timeout. */
+            xResult = xInFlight_SendTelemetry( &xAzureIoTHubClient,
+                                               ucScratchBuffer, ulScratchBufferLength,
+                                               NULL, prvOnTelemetryComplete, NULL, NULL );
+
+            if( xResult != eAzureIoTSuccess )
+            {
+                ( void ) xBacklog_Push( ucScratchBuffer, ulScratchBufferLength );
+            }
+        } while( xTelemetryPending() );
+    }
+#endif /* CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Idles for a number of ticks without holding the network PM lock.
+ */
+static void prvIdleDelay( TickType_t xTicks )
+{
+    vPower_Release( ePowerLockNetwork );
+    vTaskDelay( xTicks );
+    vPower_Acquire( ePowerLockNetwork );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Moves the connection state machine to a state and arms that state's retry policy.
+ */
+static void prvEnterState( ConnectionState_t * pxState,
+                           ConnectionState_t xNewState,
+                           BackoffAlgorithmContext_t * pxBackoff )
+{
+    const ConnectionRetryPolicy_t * pxPolicy = &xRetryPolicies[ xNewState ];
+
+    if( *pxState != xNewState )
+    {
+        LogInfo( ( "Connection state: %s -> %s", pcStateNames[ *pxState ], pcStateNames[ xNewState ] ) );
+    }
+
+    *pxState = xNewState;
+    BackoffAlgorithm_InitializeParams( pxBackoff, pxPolicy->usBaseBackoffMs,
+                                       pxPolicy->usMaxBackoffMs, pxPolicy->ulMaxAttempts );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Waits a jittered, exponentially growing delay before the next attempt in the current state.
+ *
+ * @return bool false once the state's attempts are exhausted; the caller falls back to the layer below.
+ */
+static bool prvBackoff( BackoffAlgorithmContext_t * pxBackoff,
+                        const char * pcWhat )
+{
+    uint16_t usDelayMs = 0;
+
+    if( BackoffAlgorithm_GetNextBackoff( pxBackoff, configRAND32(), &usDelayMs ) != BackoffAlgorithmSuccess )
+    {
+        LogError( ( "%s failed, all attempts exhausted.", pcWhat ) );
+        return false;
+    }
+
+    LogWarn( ( "%s failed, retrying in %u ms.", pcWhat, ( unsigned ) usDelayMs ) );
+    prvIdleDelay( pdMS_TO_TICKS( usDelayMs ) );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Setup transport credentials.
  */
@@ -318,28 +936,164 @@ static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCred
 }
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Connects the hub client over an open TLS connection: MQTT connect, subscriptions
+ *        unless the broker kept them, and retransmission of unacknowledged telemetry.
+ *
+ * The hub client, its MQTT context and the subscription callbacks are kept across
+ * reconnects so that a session kept by the broker can be reused.
+ *
+ * `pxRefused` is set when the hub refused the MQTT connect in its CONNACK (not authorized,
+ * bad credentials, unavailable for this device), as opposed to any transport failure.
+ */
+static AzureIoTResult_t prvConnectHubClient( NetworkContext_t * pxNetworkContext,
+                                             const uint8_t * pucIotHubHostname,
+                                             uint32_t ulIothubHostnameLength,
+                                             const uint8_t * pucIotHubDeviceId,
+                                             uint32_t ulIothubDeviceIdLength,
+                                             bool * pxSessionPresent,
+                                             bool * pxRefused )
+{
+    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    AzureIoTResult_t xResult;
+
+    *pxRefused = false;
+
+    if( !xHubClientInitialized )
+    {
+        /* Fill in Transport Interface send and receive function pointers. */
+        xTransport.pxNetworkContext = pxNetworkContext;
+        xTransport.xSend = TLS_Session_Send;
+        xTransport.xRecv = TLS_Session_Recv;
+
+        /* Init IoT Hub option */
+        xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
+        xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+        xHubOptions.pucModelID = ( const uint8_t * ) sampleazureiotMODEL_ID;
+        xHubOptions.ulModelIDLength = sizeof( sampleazureiotMODEL_ID ) - 1;
+        xHubOptions.xTelemetryCallback = vInFlight_HandlePubAck;
+
+        #ifdef democonfigPNP_COMPONENTS_LIST_LENGTH
+            #if democonfigPNP_COMPONENTS_LIST_LENGTH > 0
+                xHubOptions.pxComponentList = democonfigPNP_COMPONENTS_LIST;
+                xHubOptions.ulComponentListLength = democonfigPNP_COMPONENTS_LIST_LENGTH;
+            #endif /* > 0 */
+        #endif /* democonfigPNP_COMPONENTS_LIST_LENGTH */
+
+        xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
+                                          pucIotHubHostname, ulIothubHostnameLength,
+                                          pucIotHubDeviceId, ulIothubDeviceIdLength,
+                                          &xHubOptions,
+                                          ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                          ullGetUnixTime,
+                                          &xTransport );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        #ifdef democonfigDEVICE_SYMMETRIC_KEY
+            xResult = AzureIoTHubClient_SetSymmetricKey( &xAzureIoTHubClient,
+                                                         ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
+                                                         sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
+                                                         Crypto_HMAC );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
+
+        xHubClientInitialized = true;
+    }
+
+    /* Sends an MQTT Connect packet over the already established TLS connection,
+     * and waits for connection acknowledgment (CONNACK) packet. A persistent
+     * session is requested (clean session false). */
+    LogInfo( ( "Creating an MQTT connection to %s.\r\n", pucIotHubHostname ) );
+
+    if( ( xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient,
+                                               false, pxSessionPresent,
+                                               sampleazureiotCONNACK_RECV_TIMEOUT_MS ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "MQTT connect failed: result 0x%08x", ( uint16_t ) xResult ) );
+
+        /* The middleware reports a CONNACK refusal as a server error. */
+        *pxRefused = ( xResult == eAzureIoTErrorServerError );
+        return xResult;
+    }
+
+    /* The answer to a patch sent on the previous connection will not come. */
+    vReportedProperties_CancelPending();
+
+    if( *pxSessionPresent && xSubscribed )
+    {
+        /* The broker kept our subscriptions and the callbacks are still
+         * registered locally, so there is nothing to set up again. */
+        LogInfo( ( "Broker kept the MQTT session, skipping subscriptions and property GET." ) );
+    }
+    else if( ( xResult = AzureIoTHubClient_SubscribeCommand( &xAzureIoTHubClient, prvHandleCommand,
+                                                             &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Command subscription failed: result 0x%08x", ( uint16_t ) xResult ) );
+        return xResult;
+    }
+    else if( ( xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandleProperties,
+                                                                &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Properties subscription failed: result 0x%08x", ( uint16_t ) xResult ) );
+        return xResult;
+    }
+    /* Get property document after initial connection. The sample does not apply
+     * it again if its version was already applied (see vHandleWritableProperties). */
+    else if( ( xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Property document request failed: result 0x%08x", ( uint16_t ) xResult ) );
+        return xResult;
+    }
+    else
+    {
+        xSubscribed = true;
+    }
+
+    /* Messages left unacknowledged by the previous connection are sent again. */
+    return xInFlight_ResendAll( &xAzureIoTHubClient );
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Azure IoT demo task that gets started in the platform specific project.
  *  In this demo task, middleware API's are used to connect to Azure IoT Hub and
  *  function to adhere to the Plug and Play device convention.
+ *
+ *  The connection is driven by a state machine (see ConnectionState_t): network
+ *  errors are retried with jittered backoff and recovered at the lowest layer
+ *  that failed, instead of aborting the firmware.
  */
 static void prvAzureDemoTask( void * pvParameters )
 {
-    uint32_t ulScratchBufferLength = 0U;
     NetworkCredentials_t xNetworkCredentials = { 0 };
-    AzureIoTTransportInterface_t xTransport;
     NetworkContext_t xNetworkContext = { 0 };
-    TlsTransportParams_t xTlsTransportParams = { 0 };
+    TlsSessionParams_t xTlsTransportParams = { 0 };
+    TlsSessionStatus_t xTlsStatus;
     AzureIoTResult_t xResult;
     uint32_t ulStatus;
-    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    uint32_t ulRequestId;
     bool xSessionPresent;
+    bool xRefused;
+    int64_t llConnectStartUs;
+    uint32_t ulReconnectMs;
+    ConnectionState_t xState = eConnectionStateWaitForNetwork;
+    BackoffAlgorithmContext_t xBackoff;
+    SampleMetric_t xRecoveryMetric = eSampleMetricMqttRecoveryMs;
+    int64_t llOutageStartUs = 0;
+    uint32_t ulRecoveryMs;
+    TickType_t xLastReport;
+    bool xReportNow = false;
+    esp_vfs_eventfd_config_t xEventFdConfig = ESP_VFS_EVENTD_CONFIG_DEFAULT();
 
     #ifdef democonfigENABLE_DPS_SAMPLE
         uint8_t * pucIotHubHostname = NULL;
         uint8_t * pucIotHubDeviceId = NULL;
         uint32_t pulIothubHostnameLength = 0;
         uint32_t pulIothubDeviceIdLength = 0;
+        bool xIotHubInfoFromCache = false;
     #else
         uint8_t * pucIotHubHostname = ( uint8_t * ) democonfigHOSTNAME;
         uint8_t * pucIotHubDeviceId = ( uint8_t * ) democonfigDEVICE_ID;
@@ -349,6 +1103,29 @@ static void prvAzureDemoTask( void * pvParameters )
 
     ( void ) pvParameters;
 
+    /* The task only gives up its PM lock while it waits for events. */
+    vPower_Acquire( ePowerLockNetwork );
+
+    /* Event descriptor that lets vNotifyDemoTask break the idle select(). */
+    configASSERT( esp_vfs_eventfd_register( &xEventFdConfig ) == ESP_OK );
+    lWakeEventFd = eventfd( 0, 0 );
+    configASSERT( lWakeEventFd >= 0 );
+
+    {
+        uint32_t ulScratchBufferLength = 0U;
+
+        /* Sample first, without waiting for Wi-Fi or SNTP: the reading goes into the
+         * backlog and is published once connected, its timestamp corrected on the way
+         * out if the clock was not synchronized yet. */
+        if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) == 0 ) &&
+            ( ulScratchBufferLength > 0 ) )
+        {
+            ( void ) xBacklog_Push( ucScratchBuffer, ulScratchBufferLength );
+        }
+
+        xLastReport = xTaskGetTickCount();
+    }
+
     /* Initialize Azure IoT Middleware.  */
     configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
 
@@ -356,161 +1133,250 @@ static void prvAzureDemoTask( void * pvParameters )
     configASSERT( ulStatus == 0 );
 
     #ifdef democonfigENABLE_DPS_SAMPLE
-        /* Run DPS.  */
-        if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
-                                           &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                           &pulIothubDeviceIdLength ) ) != 0 )
+        /* Connect straight to the hub assigned on a previous boot; DPS only runs
+         * when there is none, or when that hub rejects the device. */
+        if( prvIoTHubInfoLoad( &pucIotHubHostname, &pulIothubHostnameLength,
+                               &pucIotHubDeviceId, &pulIothubDeviceIdLength ) )
         {
-            LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ( uint16_t ) ulStatus ) );
-            return;
+            xIotHubInfoFromCache = true;
+            LogInfo( ( "Using IoT Hub %.*s from the provisioning cache.",
+                       ( int ) pulIothubHostnameLength, pucIotHubHostname ) );
         }
     #endif /* democonfigENABLE_DPS_SAMPLE */
 
     xNetworkContext.pParams = &xTlsTransportParams;
 
+    /* Backlogged messages get the same acknowledgement accounting as fresh ones. */
+    vInFlight_SetBacklogCallback( prvOnTelemetryComplete, NULL );
+    vInFlight_SetPrepareCallback( vPrepareTelemetryForSend );
+
+    prvEnterState( &xState, eConnectionStateWaitForNetwork, &xBackoff );
+
     for( ; ; )
     {
-        // ADD DELAY HERE
-        // vTaskDelay((30000 * 15) / portTICK_PERIOD_MS);
+        #if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+            /* Checked here, between two steps of the state machine, so that neither the
+             * in-flight window nor the backlog is left half-updated. */
+            if( xDutyCycle_BudgetExpired() )
+            {
+                prvSleepUntilNextCycle( &xNetworkContext, xState == eConnectionStateConnected ); /* Does not return. */
+            }
+        #endif
 
-        if( xAzureSample_IsConnectedToInternet() )
+        #if !CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+            /* Sampling keeps its schedule whatever the state of the connection;
+             * readings that cannot be sent right away land in the backlog. */
+            if( xReportNow ||
+                ( ( xTaskGetTickCount() - xLastReport ) >= pdMS_TO_TICKS( ulGetReportingIntervalSeconds() * 1000ULL ) ) )
+            {
+                xLastReport = xTaskGetTickCount();
+                xReportNow = false;
+                prvPublishTelemetry( ( xState == eConnectionStateConnected ) && xAzureSample_IsConnectedToInternet() );
+            }
+        #endif /* !CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE */
+
+        if( ( xState != eConnectionStateWaitForNetwork ) && !xAzureSample_IsConnectedToInternet() )
         {
-            /* Attempt to establish TLS session with IoT Hub. If connection fails,
-             * retry after a timeout. Timeout value will be exponentially increased
-             * until  the maximum number of attempts are reached or the maximum timeout
-             * value is reached. The function returns a failure status if the TCP
-             * connection cannot be established to the IoT Hub after the configured
-             * number of attempts. */
-            ulStatus = prvConnectToServerWithBackoffRetries( ( const char * ) pucIotHubHostname,
-                                                             democonfigIOTHUB_PORT,
-                                                             &xNetworkCredentials, &xNetworkContext );
-            configASSERT( ulStatus == 0 );
+            /* Wi-Fi is gone, and with it whatever was open on top of it. */
+            if( xState == eConnectionStateConnected )
+            {
+                llOutageStartUs = esp_timer_get_time();
+            }
 
-            /* Fill in Transport Interface send and receive function pointers. */
-            xTransport.pxNetworkContext = &xNetworkContext;
-            xTransport.xSend = TLS_Socket_Send;
-            xTransport.xRecv = TLS_Socket_Recv;
+            xRecoveryMetric = eSampleMetricWifiRecoveryMs;
+            TLS_Session_Disconnect( &xNetworkContext );
+            prvEnterState( &xState, eConnectionStateWaitForNetwork, &xBackoff );
+        }
 
-            /* Init IoT Hub option */
-            xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
-            configASSERT( xResult == eAzureIoTSuccess );
+        switch( xState )
+        {
+            case eConnectionStateWaitForNetwork:
 
-            xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
-            xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
-            xHubOptions.pucModelID = ( const uint8_t * ) sampleazureiotMODEL_ID;
-            xHubOptions.ulModelIDLength = sizeof( sampleazureiotMODEL_ID ) - 1;
-
-            #ifdef democonfigPNP_COMPONENTS_LIST_LENGTH
-                #if democonfigPNP_COMPONENTS_LIST_LENGTH > 0
-                    xHubOptions.pxComponentList = democonfigPNP_COMPONENTS_LIST;
-                    xHubOptions.ulComponentListLength = democonfigPNP_COMPONENTS_LIST_LENGTH;
-                #endif /* > 0 */
-            #endif /* democonfigPNP_COMPONENTS_LIST_LENGTH */
-
-            xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
-                                              pucIotHubHostname, pulIothubHostnameLength,
-                                              pucIotHubDeviceId, pulIothubDeviceIdLength,
-                                              &xHubOptions,
-                                              ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
-                                              ullGetUnixTime,
-                                              &xTransport );
-            configASSERT( xResult == eAzureIoTSuccess );
+                /* SAS tokens and DPS registrations are signed with the current time, so
+                 * connecting with an estimated clock would only produce rejected attempts. */
+                if( !xAzureSample_IsConnectedToInternet() || !xSampleTime_IsSynchronized() )
+                {
+                    prvIdleDelay( sampleazureiotNETWORK_TIME_POLL_TICKS );
+                }
 
-            #ifdef democonfigDEVICE_SYMMETRIC_KEY
-                xResult = AzureIoTHubClient_SetSymmetricKey( &xAzureIoTHubClient,
-                                                             ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
-                                                             sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
-                                                             Crypto_HMAC );
-                configASSERT( xResult == eAzureIoTSuccess );
-            #endif /* democonfigDEVICE_SYMMETRIC_KEY */
-
-            /* Sends an MQTT Connect packet over the already established TLS connection,
-             * and waits for connection acknowledgment (CONNACK) packet. */
-            LogInfo( ( "Creating an MQTT connection to %s.\r\n", pucIotHubHostname ) );
-
-            xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient,
-                                                 false, &xSessionPresent,
-                                                 sampleazureiotCONNACK_RECV_TIMEOUT_MS );
-            configASSERT( xResult == eAzureIoTSuccess );
+                #ifdef democonfigENABLE_DPS_SAMPLE
+                    else if( pucIotHubHostname == NULL )
+                    {
+                        prvEnterState( &xState, eConnectionStateProvision, &xBackoff );
+                    }
+                #endif /* democonfigENABLE_DPS_SAMPLE */
+                else
+                {
+                    prvEnterState( &xState, eConnectionStateConnectTls, &xBackoff );
+                }
 
-            xResult = AzureIoTHubClient_SubscribeCommand( &xAzureIoTHubClient, prvHandleCommand,
-                                                          &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
-            configASSERT( xResult == eAzureIoTSuccess );
+                break;
+
+            #ifdef democonfigENABLE_DPS_SAMPLE
+                case eConnectionStateProvision:
+
+                    if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
+                                                       &pulIothubHostnameLength, &pucIotHubDeviceId,
+                                                       &pulIothubDeviceIdLength ) ) == 0 )
+                    {
+                        prvEnterState( &xState, eConnectionStateConnectTls, &xBackoff );
+                    }
+                    else
+                    {
+                        LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ( uint16_t ) ulStatus ) );
+                        ( void ) prvBackoff( &xBackoff, "Provisioning" );
+                    }
+
+                    break;
+            #endif /* democonfigENABLE_DPS_SAMPLE */
+
+            case eConnectionStateConnectTls:
+            case eConnectionStateConnectMqtt:
+                llConnectStartUs = esp_timer_get_time();
+                xResult = eAzureIoTErrorFailed;
+                xRefused = false;
+
+                /* A cached TLS session is offered when available. */
+                LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pucIotHubHostname, ( uint16_t ) democonfigIOTHUB_PORT ) );
+                xTlsStatus = TLS_Session_Connect( &xNetworkContext,
+                                                  ( const char * ) pucIotHubHostname, democonfigIOTHUB_PORT,
+                                                  &xNetworkCredentials,
+                                                  sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                                  sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+
+                if( xTlsStatus == eTlsSessionSuccess )
+                {
+                    xResult = prvConnectHubClient( &xNetworkContext,
+                                                   pucIotHubHostname, pulIothubHostnameLength,
+                                                   pucIotHubDeviceId, pulIothubDeviceIdLength,
+                                                   &xSessionPresent, &xRefused );
+                }
 
-            xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandleProperties,
-                                                             &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
-            configASSERT( xResult == eAzureIoTSuccess );
+                if( xResult == eAzureIoTSuccess )
+                {
+                    vAzureSample_NetworkConfirmed();
+
+                    ulReconnectMs = ( uint32_t ) ( ( esp_timer_get_time() - llConnectStartUs ) / 1000 );
+                    vSampleMetrics_Record( eSampleMetricSessionResumed, xSessionPresent ? 1 : 0 );
+                    vSampleMetrics_Record( eSampleMetricReconnectMs, ulReconnectMs );
+                    vSampleMetrics_Record( eSampleMetricReconnectEnergyUj,
+                                           ulSampleMetrics_EnergyUj( ulReconnectMs, CONFIG_SAMPLE_IOT_ACTIVE_CURRENT_MA * 1000U ) );
+
+                    if( llOutageStartUs != 0 )
+                    {
+                        ulRecoveryMs = ( uint32_t ) ( ( esp_timer_get_time() - llOutageStartUs ) / 1000 );
+                        vSampleMetrics_Record( xRecoveryMetric, ulRecoveryMs );
+                        LogInfo( ( "Connection recovered after %u ms.", ( unsigned ) ulRecoveryMs ) );
+                        llOutageStartUs = 0;
+                    }
+
+                    #ifdef democonfigENABLE_DPS_SAMPLE
+                        /* The hub accepted the assignment: later failures are not a reason to provision again. */
+                        xIotHubInfoFromCache = false;
+                    #endif
+
+                    vSampleMetrics_Log();
+                    prvEnterState( &xState, eConnectionStateConnected, &xBackoff );
+                    break;
+                }
 
-            /* Get property document after initial connection */
-            xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
-            configASSERT( xResult == eAzureIoTSuccess );
+                TLS_Session_Disconnect( &xNetworkContext );
+
+                #ifdef democonfigENABLE_DPS_SAMPLE
+                    if( xRefused && xIotHubInfoFromCache )
+                    {
+                        /* The device may have been deleted or re-assigned to another hub:
+                         * drop the cached assignment and provision again. */
+                        LogWarn( ( "IoT Hub rejected the cached assignment: result 0x%08x, running DPS.", ( uint16_t ) xResult ) );
+                        ( void ) xSampleNvs_Erase( sampleazureiotNVS_KEY_DPS_RESULT );
+                        xIotHubInfoFromCache = false;
+                        pucIotHubHostname = NULL;
+
+                        AzureIoTHubClient_Deinit( &xAzureIoTHubClient );
+                        xHubClientInitialized = false;
+                        xSubscribed = false;
+
+                        prvEnterState( &xState, eConnectionStateProvision, &xBackoff );
+                        break;
+                    }
+                #endif /* democonfigENABLE_DPS_SAMPLE */
+
+                /* Retry at the same layer until its attempts run out, then go one layer down. */
+                if( prvBackoff( &xBackoff, pcStateNames[ xState ] ) )
+                {
+                    break;
+                }
 
-            /* Publish messages with QoS1, send and process Keep alive messages. */
-            for( ; xAzureSample_IsConnectedToInternet(); )
-            {
-                /* send telemetry and reported properties as before */
-                // vTaskDelay((30000 * 2) / portTICK_PERIOD_MS);
-                if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) == 0 ) &&
-                    ( ulScratchBufferLength > 0 ) )
+                if( xState == eConnectionStateConnectMqtt )
                 {
-                    xResult = AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient,
-                                                               ucScratchBuffer, ulScratchBufferLength,
-                                                               NULL, eAzureIoTHubMessageQoS1, NULL );
-                    configASSERT( xResult == eAzureIoTSuccess );
+                    /* Resuming did not help: full handshake from a clean TLS state. */
+                    TLS_Session_ClearCache();
+                    xRecoveryMetric = eSampleMetricTlsRecoveryMs;
+                    prvEnterState( &xState, eConnectionStateConnectTls, &xBackoff );
                 }
+                else
+                {
+                    /* The hub cannot be reached over this association: start a new one. */
+                    xRecoveryMetric = eSampleMetricWifiRecoveryMs;
+                    vAzureSample_ReconnectWiFi();
+                    prvEnterState( &xState, eConnectionStateWaitForNetwork, &xBackoff );
+                }
+
+                break;
 
-                ulReportedPropertiesUpdateLength = ulCreateReportedPropertiesUpdate( ucReportedPropertiesUpdate, sizeof( ucReportedPropertiesUpdate ) );
+            case eConnectionStateConnected:
 
-                if( ulReportedPropertiesUpdateLength > 0 )
+                /* Alerts and charger events raised while offline first, then anything queued
+                 * while offline or re-queued after timeouts, including the sample taken at start-up. */
+                if( ( ( xResult = xAlerts_Publish( &xAzureIoTHubClient ) ) == eAzureIoTSuccess ) &&
+                    ( ( xResult = xCharger_Publish( &xAzureIoTHubClient ) ) == eAzureIoTSuccess ) )
                 {
-                    xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate, ulReportedPropertiesUpdateLength, NULL );
-                    configASSERT( xResult == eAzureIoTSuccess );
+                    xResult = xInFlight_Process( &xAzureIoTHubClient );
                 }
 
+                if( xResult == eAzureIoTSuccess )
+                {
+                    /* Only the properties that changed since the hub last acknowledged them. */
+                    ulReportedPropertiesUpdateLength = ulCreateReportedPropertiesUpdate( ucReportedPropertiesUpdate, sizeof( ucReportedPropertiesUpdate ) );
+
+                    if( ( ulReportedPropertiesUpdateLength > 0 ) &&
+                        ( ( xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate,
+                                                                                ulReportedPropertiesUpdateLength, &ulRequestId ) ) == eAzureIoTSuccess ) )
+                    {
+                        vReportedProperties_Sent( ulRequestId );
+                    }
+                }
 
-                const uint32_t IDLE_TOTAL_MS = (15 * 1000 * 60); // delay for 15 minutes        
-                const uint32_t PROCESS_LOOP_SLICE_MS = 1000; // ping every second           
-
-                uint32_t ulElapsedMs = 0;
+                #if CONFIG_SAMPLE_IOT_DUTY_CYCLE_MODE
+                    if( xResult == eAzureIoTSuccess )
+                    {
+                        prvFinishDutyCycle( &xNetworkContext ); /* Does not return. */
+                    }
+                #endif
 
-                while((ulElapsedMs < IDLE_TOTAL_MS) && xAzureSample_IsConnectedToInternet()) // delay loop 
+                if( xResult == eAzureIoTSuccess )
                 {
-                    xResult = AzureIoTHubClient_ProcessLoop(&xAzureIoTHubClient, // ping iothub
-                                                            sampleazureiotPROCESS_LOOP_TIMEOUT_MS);
-                    configASSERT(xResult == eAzureIoTSuccess);
+                    vSampleMetrics_Record( eSampleMetricAverageCurrentUa, ulPower_AverageCurrentUa() );
 
-                    vTaskDelay(pdMS_TO_TICKS(PROCESS_LOOP_SLICE_MS)); // micro delay
-                    ulElapsedMs += PROCESS_LOOP_SLICE_MS; 
+                    xResult = prvWaitUntilNextReport( &xNetworkContext, xLastReport, &xReportNow );
                 }
 
-            }
-
-            if( xAzureSample_IsConnectedToInternet() )
-            {
-                xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
-                configASSERT( xResult == eAzureIoTSuccess );
-
-                xResult = AzureIoTHubClient_UnsubscribeCommand( &xAzureIoTHubClient );
-                configASSERT( xResult == eAzureIoTSuccess );
-
-                /* Send an MQTT Disconnect packet over the already connected TLS over
-                 * TCP connection. There is no corresponding response for the disconnect
-                 * packet. After sending disconnect, client must close the network
-                 * connection. */
-                xResult = AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
-                configASSERT( xResult == eAzureIoTSuccess );
-            }
+                if( xResult != eAzureIoTSuccess )
+                {
+                    /* The MQTT connection broke: reconnect it over a resumed TLS session,
+                     * the broker still holds the MQTT session and its subscriptions. */
+                    llOutageStartUs = esp_timer_get_time();
+                    xRecoveryMetric = eSampleMetricMqttRecoveryMs;
+                    TLS_Session_Disconnect( &xNetworkContext );
+                    prvEnterState( &xState, eConnectionStateConnectMqtt, &xBackoff );
+                }
 
-            /* Close the network connection.  */
-            TLS_Socket_Disconnect( &xNetworkContext );
+                break;
 
-            /* Wait for some time between two iterations to ensure that we do not
-             * bombard the IoT Hub. */
-            LogInfo( ( "Demo completed successfully.\r\n" ) );
+            default:
+                configASSERT( false );
+                break;
         }
-
-        LogInfo( ( "Short delay before starting the next iteration.... \r\n\r\n" ) );
-        vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
     }
 }
 /*-----------------------------------------------------------*/
@@ -528,24 +1394,30 @@ static void prvAzureDemoTask( void * pvParameters )
                                       uint32_t * pulIothubDeviceIdLength )
     {
         NetworkContext_t xNetworkContext = { 0 };
-        TlsTransportParams_t xTlsTransportParams = { 0 };
+        TlsSessionParams_t xTlsTransportParams = { 0 };
         AzureIoTResult_t xResult;
         AzureIoTTransportInterface_t xTransport;
         uint32_t ucSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname );
         uint32_t ucSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId );
-        uint32_t ulStatus;
+        static DpsResult_t xDpsResult;
 
         /* Set the pParams member of the network context with desired transport. */
         xNetworkContext.pParams = &xTlsTransportParams;
 
-        ulStatus = prvConnectToServerWithBackoffRetries( democonfigENDPOINT, democonfigIOTHUB_PORT,
-                                                         pXNetworkCredentials, &xNetworkContext );
-        configASSERT( ulStatus == 0 );
+        /* A single attempt: the connection state machine retries with backoff. */
+        if( TLS_Session_Connect( &xNetworkContext, democonfigENDPOINT, democonfigIOTHUB_PORT,
+                                 pXNetworkCredentials,
+                                 sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                 sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS ) != eTlsSessionSuccess )
+        {
+            LogError( ( "Failed to connect to the Provisioning service." ) );
+            return 1;
+        }
 
         /* Fill in Transport Interface send and receive function pointers. */
         xTransport.pxNetworkContext = &xNetworkContext;
-        xTransport.xSend = TLS_Socket_Send;
-        xTransport.xRecv = TLS_Socket_Recv;
+        xTransport.xSend = TLS_Session_Send;
+        xTransport.xRecv = TLS_Session_Recv;
 
         #ifdef democonfigUSE_HSM
 
@@ -555,7 +1427,7 @@ static void prvAzureDemoTask( void * pvParameters )
             /* We use a pointer instead of a buffer so that the getRegistrationId
              * function can allocate the necessary memory depending on the HSM */
             char * registration_id = NULL;
-            ulStatus = getRegistrationId( &registration_id );
+            uint32_t ulStatus = getRegistrationId( &registration_id );
             configASSERT( ulStatus == 0 );
 #undef democonfigREGISTRATION_ID
         #define democonfigREGISTRATION_ID    registration_id
@@ -603,89 +1475,86 @@ static void prvAzureDemoTask( void * pvParameters )
         else
         {
             LogInfo( ( "Error geting IoT Hub name and Device ID: 0x%08x", ( uint16_t ) xResult ) );
+            AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
+            TLS_Session_Disconnect( &xNetworkContext );
+            return 1;
         }
 
-        configASSERT( xResult == eAzureIoTSuccess );
+        /* Clear what a previous assignment left, the hostname is used as a C string. */
+        ( void ) memset( ucSampleIotHubHostname, 0, sizeof( ucSampleIotHubHostname ) );
+        ( void ) memset( ucSampleIotHubDeviceId, 0, sizeof( ucSampleIotHubDeviceId ) );
+        ucSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname ) - 1;
+        ucSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId ) - 1;
 
         xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
                                                               ucSampleIotHubHostname, &ucSamplepIothubHostnameLength,
                                                               ucSampleIotHubDeviceId, &ucSamplepIothubDeviceIdLength );
-        configASSERT( xResult == eAzureIoTSuccess );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            LogError( ( "Error reading the IoT Hub assignment: 0x%08x", ( uint16_t ) xResult ) );
+            AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
+            TLS_Session_Disconnect( &xNetworkContext );
+            return 1;
+        }
 
         AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
 
         /* Close the network connection.  */
-        TLS_Socket_Disconnect( &xNetworkContext );
+        TLS_Session_Disconnect( &xNetworkContext );
 
         *ppucIothubHostname = ucSampleIotHubHostname;
         *pulIothubHostnameLength = ucSamplepIothubHostnameLength;
         *ppucIothubDeviceId = ucSampleIotHubDeviceId;
         *pulIothubDeviceIdLength = ucSamplepIothubDeviceIdLength;
 
+        /* Keep the assignment so that later boots skip provisioning. */
+        ( void ) memset( &xDpsResult, 0, sizeof( xDpsResult ) );
+        xDpsResult.ulHostnameLength = ucSamplepIothubHostnameLength;
+        xDpsResult.ulDeviceIdLength = ucSamplepIothubDeviceIdLength;
+        ( void ) memcpy( xDpsResult.ucHostname, ucSampleIotHubHostname, ucSamplepIothubHostnameLength );
+        ( void ) memcpy( xDpsResult.ucDeviceId, ucSampleIotHubDeviceId, ucSamplepIothubDeviceIdLength );
+
+        if( xSampleNvs_SetBlob( sampleazureiotNVS_KEY_DPS_RESULT, &xDpsResult, sizeof( xDpsResult ) ) != ESP_OK )
+        {
+            LogWarn( ( "Failed to persist the provisioning result" ) );
+        }
+
         return 0;
     }
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
 /*-----------------------------------------------------------*/
 
-/**
- * @brief Connect to server with backoff retries.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t port,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext )
-{
-    TlsTransportStatus_t xNetworkStatus;
-    BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
-    BackoffAlgorithmContext_t xReconnectParams;
-    uint16_t usNextRetryBackOff = 0U;
-
-    /* Initialize reconnect attempts and interval. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       sampleazureiotRETRY_BACKOFF_BASE_MS,
-                                       sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS,
-                                       sampleazureiotRETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to IoT Hub. If connection fails, retry after
-     * a timeout. Timeout value will exponentially increase till maximum
-     * attempts are reached.
-     */
-    do
-    {
-        LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pcHostName, ( uint16_t ) port ) );
-        /* Attempt to create a mutually authenticated TLS connection. */
-        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
-                                             pcHostName, port,
-                                             pxNetworkCredentials,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
-
-        if( xNetworkStatus != eTLSTransportSuccess )
+    static bool prvIoTHubInfoLoad( uint8_t ** ppucIothubHostname,
+                                   uint32_t * pulIothubHostnameLength,
+                                   uint8_t ** ppucIothubDeviceId,
+                                   uint32_t * pulIothubDeviceIdLength )
+    {
+        DpsResult_t xDpsResult;
+        size_t xLength = sizeof( xDpsResult );
+
+        if( ( xSampleNvs_GetBlob( sampleazureiotNVS_KEY_DPS_RESULT, &xDpsResult, &xLength ) != ESP_OK ) ||
+            ( xLength != sizeof( xDpsResult ) ) ||
+            ( xDpsResult.ulHostnameLength == 0 ) || ( xDpsResult.ulHostnameLength >= sizeof( ucSampleIotHubHostname ) ) ||
+            ( xDpsResult.ulDeviceIdLength == 0 ) || ( xDpsResult.ulDeviceIdLength >= sizeof( ucSampleIotHubDeviceId ) ) )
         {
-            /* Generate a random number and calculate backoff value (in milliseconds) for
-             * the next connection retry.
-             * Note: It is recommended to seed the random number generator with a device-specific
-             * entropy source so that possibility of multiple devices retrying failed network operations
-             * at similar intervals can be avoided. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, configRAND32(), &usNextRetryBackOff );
-
-            if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
-            {
-                LogError( ( "Connection to the IoT Hub failed, all attempts exhausted." ) );
-            }
-            else if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
-            {
-                LogWarn( ( "Connection to the IoT Hub failed [%d]. "
-                           "Retrying connection with backoff and jitter [%d]ms.",
-                           xNetworkStatus, usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
-            }
+            return false;
         }
-    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
 
-    return xNetworkStatus == eTLSTransportSuccess ? 0 : 1;
-}
+        /* The hostname is also used as a C string by the TLS transport. */
+        ( void ) memset( ucSampleIotHubHostname, 0, sizeof( ucSampleIotHubHostname ) );
+        ( void ) memset( ucSampleIotHubDeviceId, 0, sizeof( ucSampleIotHubDeviceId ) );
+        ( void ) memcpy( ucSampleIotHubHostname, xDpsResult.ucHostname, xDpsResult.ulHostnameLength );
+        ( void ) memcpy( ucSampleIotHubDeviceId, xDpsResult.ucDeviceId, xDpsResult.ulDeviceIdLength );
+
+        *ppucIothubHostname = ucSampleIotHubHostname;
+        *pulIothubHostnameLength = xDpsResult.ulHostnameLength;
+        *ppucIothubDeviceId = ucSampleIotHubDeviceId;
+        *pulIothubDeviceIdLength = xDpsResult.ulDeviceIdLength;
+
+        return true;
+    }
+
+#endif /* democonfigENABLE_DPS_SAMPLE */
 /*-----------------------------------------------------------*/
 
 /*
@@ -700,6 +1569,10 @@ void vStartDemoTask( void )
                  democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
                  NULL,                     /* Task parameter - not used in this case. */
                  tskIDLE_PRIORITY,         /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
-                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+                 &xDemoTaskHandle );       /* Used by vNotifyDemoTask to wake the task. */
+
+    /* Wake the task above with sampleazureiotEVENT_ALERT and sampleazureiotEVENT_CHARGER. */
+    vCharger_Start();
+    vRollup_Start();
 }
 /*-----------------------------------------------------------*/
@@ -15,14 +15,41 @@
 
 #include "azure_iot_hub_client_properties.h"
 #include "demo_config.h"
+#include "sensors.h"
 
 /**
  * @brief The payload to send to the Device Provisioning Service (DO NOT MODIFY)
  */
 #define sampleazureiotPROVISIONING_PAYLOAD    "{\"modelId\":\"" sampleazureiotMODEL_ID "\"}"
 
+/**
+ * @brief Events that wake the sample core task out of its idle wait.
+ */
+#define sampleazureiotEVENT_REPORT_NOW          ( 1UL << 0 ) /**< Build and publish telemetry without waiting for the interval. */
+#define sampleazureiotEVENT_SERVICE             ( 1UL << 1 ) /**< Service the connection (backlog, connectivity change). */
+#define sampleazureiotEVENT_INTERVAL_CHANGED    ( 1UL << 2 ) /**< The reporting interval was changed. */
+#define sampleazureiotEVENT_ALERT               ( 1UL << 3 ) /**< A gas alert was queued (sample_azure_iot_alerts.h). */
+#define sampleazureiotEVENT_CHARGER             ( 1UL << 4 ) /**< A charger change was queued (sample_azure_iot_charger.h). */
+#define sampleazureiotEVENT_COMMAND_DONE        ( 1UL << 5 ) /**< A deferred command has its response ready (ulCompleteDeferredCommand). */
+
+/**
+ * @brief Response status with which ulHandleCommand defers the response: none is sent, the
+ *        sample posts sampleazureiotEVENT_COMMAND_DONE once ulCompleteDeferredCommand has it.
+ */
+#define sampleazureiotCOMMAND_STATUS_DEFERRED    ( 0U )
+
 extern AzureIoTHubClient_t xAzureIoTHubClient;
 
+/**
+ * @brief Wakes the sample core task with a set of events.
+ *
+ * @remark Implemented by sample_azure_iot_pnp.c. Safe to call from any task; events
+ *         posted before the core task is running are discarded.
+ *
+ * @param[in] ulEvents  Bitwise OR of sampleazureiotEVENT_* values.
+ */
+void vNotifyDemoTask( uint32_t ulEvents );
+
 /**
  * @brief Provides the payload to be sent as telemetry to the Azure IoT Hub.
  *
@@ -40,6 +67,39 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
                             uint32_t ulTelemetryDataSize,
                             uint32_t * pulTelemetryDataLength );
 
+/**
+ * @brief Tells whether another telemetry payload is ready for the same report.
+ *
+ * @remark This function must be implemented by the specific sample. After each report the
+ *         sample core task calls `ulCreateTelemetry` again as long as this returns true, e.g.
+ *         to send every rollup bucket that closed since the previous report.
+ */
+bool xTelemetryPending( void );
+
+/**
+ * @brief Handles a reading taken by the internal sampling task (sample_azure_iot_rollup.h).
+ *
+ * @remark This function must be implemented by the specific sample. It is called from the
+ *         sampling task, not from the sample core task, for every reading it takes.
+ *
+ * @param[in] pxReading  The reading.
+ */
+void vHandleSensorReading( const sensor_reading_t * pxReading );
+
+/**
+ * @brief Finalizes a telemetry payload right before it is published.
+ *
+ * @remark This function must be implemented by the specific sample. It is called on every
+ *         payload, including ones queued while offline, and may rewrite the payload in place
+ *         without changing its length, e.g. to correct timestamps taken before the clock
+ *         was synchronized.
+ *
+ * @param[in,out] pucTelemetryData       Payload previously built by ulCreateTelemetry.
+ * @param[in]     ulTelemetryDataLength  Length of `pucTelemetryData`.
+ */
+void vPrepareTelemetryForSend( uint8_t * pucTelemetryData,
+                               uint32_t ulTelemetryDataLength );
+
 /**
  * @brief Provides the payload to be sent as reported properties update to the Azure IoT Hub.
  *
@@ -47,7 +107,9 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
  *         `ulCreateReportedPropertiesUpdate` is called periodically by the sample
  *         core task (the task created by `vStartDemoTask`).
  *         If the sample does not have any properties to update, just return zero to inform no
- *         update should be sent.
+ *         update should be sent. Samples should only report what changed, typically with
+ *         ulReportedProperties_BuildPatch (sample_azure_iot_reported_properties.h); the core
+ *         task reports each patch's outcome to that module.
  *
  * @param[out] pucPropertiesData    Pointer to uint8_t* that will contain the reported properties payload.
  * @param[in]  ulPropertiesDataSize Size of `pucPropertiesData`
@@ -57,6 +119,17 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
 uint32_t ulCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
                                            uint32_t ulPropertiesDataSize );
 
+/**
+ * @brief Provides the interval between two telemetry reports.
+ *
+ * @remark This function must be implemented by the specific sample.
+ *         The sample core task reads it on every wake-up, so a change takes effect
+ *         immediately when followed by vNotifyDemoTask( sampleazureiotEVENT_INTERVAL_CHANGED ).
+ *
+ * @return uint32_t Reporting interval in seconds.
+ */
+uint32_t ulGetReportingIntervalSeconds( void );
+
 /**
  * @brief Handles a Command received from the Azure IoT Hub.
  *
@@ -74,6 +147,30 @@ uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
                           uint8_t * pucCommandResponsePayloadBuffer,
                           uint32_t ulCommandResponsePayloadBufferSize );
 
+/**
+ * @brief Provides the response of the command deferred last by ulHandleCommand.
+ *
+ * @remark This function must be implemented by the specific sample. Called by the sample core
+ *         task after sampleazureiotEVENT_COMMAND_DONE; one command is deferred at a time.
+ *
+ * @param[out] pulResponseStatus                  Status code to be sent as response for Command request.
+ * @param[out] pucCommandResponsePayloadBuffer    Buffer in which to write a payload for the Command response.
+ * @param[in]  ulCommandResponsePayloadBufferSize Total size of `ucCommandResponsePayloadBuffer`.
+ *
+ * @return uint32_t Number of bytes written to `ucCommandResponsePayloadBuffer`, 0 if no response is ready.
+ */
+uint32_t ulCompleteDeferredCommand( uint32_t * pulResponseStatus,
+                                    uint8_t * pucCommandResponsePayloadBuffer,
+                                    uint32_t ulCommandResponsePayloadBufferSize );
+
+/**
+ * @brief Drops the response of the command deferred last by ulHandleCommand, when it cannot
+ *        be sent, e.g. because its request id does not fit.
+ *
+ * @remark This function must be implemented by the specific sample.
+ */
+void vCancelDeferredCommand( void );
+
 /**
  * @brief Handles a properties message received from the Azure IoT Hub (writable or get response).
  *
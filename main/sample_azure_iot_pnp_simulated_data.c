@@ -6,6 +6,7 @@
 /* Standard includes. */
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 /* Azure JSON includes */
 #include "azure_iot_json_reader.h"
@@ -26,11 +27,31 @@
 
 #include "driver/i2c.h"
 #include "i2c_config.h"
+#include "mq_heater.h"
 
-#include "esp_sleep.h"
-
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
 #include "esp_timer.h"
 
+#include "sdkconfig.h"
+
+#include "sample_azure_iot_alerts.h"
+#include "sample_azure_iot_backlog.h"
+#include "sample_azure_iot_desired_properties.h"
+#include "sample_azure_iot_duty_cycle.h"
+#include "sample_azure_iot_exposure.h"
+#include "sample_azure_iot_history.h"
+#include "sample_azure_iot_inflight.h"
+#include "sample_azure_iot_metrics.h"
+#include "sample_azure_iot_nvs.h"
+#include "sample_azure_iot_reported_properties.h"
+#include "sample_azure_iot_rollup.h"
+#include "sample_azure_iot_sampling.h"
+#include "sample_azure_iot_time.h"
+#include "sensors.h"
+
 // #include "driver/i2c_master.h"
 
 // #include "esp_driver/i2c.h"
@@ -48,6 +69,19 @@
  * @brief Command values
  */
 #define sampleazureiotCOMMAND_MAX_MIN_REPORT              "getMaxMinReport"
+#define sampleazureiotCOMMAND_FORCE_SAMPLE                "forceSample"
+#define sampleazureiotCOMMAND_SET_INTERVAL                "setInterval"
+#define sampleazureiotCOMMAND_GET_STATS                   "getStats"
+#define sampleazureiotCOMMAND_GET_DIAGNOSTICS             "getDiagnostics"
+#define sampleazureiotCOMMAND_RECALIBRATE                 "recalibrate"
+#define sampleazureiotCOMMAND_FLUSH_BACKLOG               "flushBacklog"
+#define sampleazureiotCOMMAND_GET_HISTORY                 "getHistory"
+#define sampleazureiotCOMMAND_GET_EXPOSURE                "getExposure"
+#define sampleazureiotCOMMAND_GET_SAMPLING                "getSampling"
+#define sampleazureiotCOMMAND_GET_POWER                   "getPower"
+#define sampleazureiotCOMMAND_SINCE                       "since"
+#define sampleazureiotCOMMAND_CHANNELS                    "channels"
+#define sampleazureiotCOMMAND_CURSOR                      "cursor"
 #define sampleazureiotCOMMAND_MAX_TEMP                    "maxTemp"
 #define sampleazureiotCOMMAND_MIN_TEMP                    "minTemp"
 #define sampleazureiotCOMMAND_TEMP_VERSION                "avgTemp"
@@ -56,6 +90,68 @@
 #define sampleazureiotCOMMAND_EMPTY_PAYLOAD               "{}"
 #define sampleazureiotCOMMAND_FAKE_END_TIME               "2023-01-10T10:00:00Z"
 
+/**
+ * @brief Command response fields
+ */
+#define sampleazureiotRESPONSE_TIMESTAMP                  "timestamp"
+#define sampleazureiotRESPONSE_TIME_VALID                 "timeValid"
+#define sampleazureiotRESPONSE_VALUES                     "values"
+#define sampleazureiotRESPONSE_LATENCY                    "latencyUs"
+#define sampleazureiotRESPONSE_COUNT                      "count"
+#define sampleazureiotRESPONSE_MIN                        "min"
+#define sampleazureiotRESPONSE_MAX                        "max"
+#define sampleazureiotRESPONSE_MEAN                       "mean"
+#define sampleazureiotRESPONSE_UPTIME                     "uptimeSeconds"
+#define sampleazureiotRESPONSE_FREE_HEAP                  "freeHeap"
+#define sampleazureiotRESPONSE_MIN_FREE_HEAP              "minFreeHeap"
+#define sampleazureiotRESPONSE_QUEUED                     "queued"
+#define sampleazureiotRESPONSE_DROPPED                    "dropped"
+#define sampleazureiotRESPONSE_IN_FLIGHT                  "inFlight"
+#define sampleazureiotRESPONSE_METRICS                    "metrics"
+#define sampleazureiotRESPONSE_ROWS                       "rows"
+#define sampleazureiotRESPONSE_NEXT                       "next"
+#define sampleazureiotRESPONSE_MORE                       "more"
+#define sampleazureiotRESPONSE_VALID                      "valid"
+#define sampleazureiotRESPONSE_CO_TWA                     "coTwaPpm"
+#define sampleazureiotRESPONSE_CO_TWA_MINUTES             "coTwaMinutes"
+#define sampleazureiotRESPONSE_CO_STEL                    "coStelPpm"
+#define sampleazureiotRESPONSE_CO_STEL_MINUTES            "coStelMinutes"
+#define sampleazureiotRESPONSE_INDEXES                    "indexes"
+#define sampleazureiotRESPONSE_ADAPTIVE                   "adaptive"
+#define sampleazureiotRESPONSE_PERIOD                     "periodMs"
+#define sampleazureiotRESPONSE_SAMPLES                    "samples"
+#define sampleazureiotRESPONSE_ENERGY_PER_SAMPLE          "energyPerSampleUj"
+#define sampleazureiotRESPONSE_ENERGY                     "energyMj"
+#define sampleazureiotRESPONSE_FIXED_RATE_ENERGY          "fixedRateEnergyMj"
+#define sampleazureiotRESPONSE_EXCURSIONS                 "excursions"
+#define sampleazureiotRESPONSE_MISSED_AT_FIXED_RATE       "missedAtFixedRate"
+#define sampleazureiotRESPONSE_RAILS                      "rails"
+#define sampleazureiotRESPONSE_GATED                      "gated"
+#define sampleazureiotRESPONSE_POWER_CYCLES               "powerCycles"
+#define sampleazureiotRESPONSE_POWERED_PERCENT            "poweredPercent"
+#define sampleazureiotRESPONSE_CURRENT                    "currentUa"
+#define sampleazureiotRESPONSE_ALWAYS_ON_CURRENT          "alwaysOnCurrentUa"
+#define sampleazureiotRESPONSE_HEATERS                    "heaters"
+#define sampleazureiotRESPONSE_CYCLING                    "cycling"
+#define sampleazureiotRESPONSE_POWER                      "powerMw"
+#define sampleazureiotRESPONSE_ALWAYS_ON_POWER            "alwaysOnPowerMw"
+#define sampleazureiotRESPONSE_HEATER_ENERGY              "energyJ"
+#define sampleazureiotRESPONSE_ALWAYS_ON_ENERGY           "alwaysOnEnergyJ"
+#define sampleazureiotRESPONSE_VALID_READS                "validReads"
+#define sampleazureiotRESPONSE_SKIPPED_READS              "skippedReads"
+
+/**
+ * @brief Decimals of history values; the stored resolution is never finer than this
+ *        and trailing zeros are not written.
+ */
+#define sampleazureiotHISTORY_DECIMAL_PLACE_DIGITS        3
+
+/**
+ * @brief Size of the command lookup index, a power of two at least twice the number of commands.
+ */
+#define sampleazureiotCOMMAND_INDEX_SIZE                  32
+#define sampleazureiotCOMMAND_INDEX_EMPTY                 0xFF
+
 /**
  * @brief Device values
  */
@@ -68,8 +164,35 @@
  */
 #define sampleazureiotPROPERTY_STATUS_SUCCESS             200
 #define sampleazureiotPROPERTY_SUCCESS                    "success"
-#define sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT    "targetTemperature"
 #define sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT       "maxTempSinceLastReboot"
+#define sampleazureiotPROPERTY_ACTIVE_INTERVAL_TEXT       "activeReportingIntervalSeconds"
+#define sampleazureiotPROPERTY_FIRMWARE_VERSION_TEXT      "firmwareVersion"
+#define sampleazureiotPROPERTY_CALIBRATION_TEXT           "calibration"
+#define sampleazureiotPROPERTY_MQ2_R0_TEXT                "mq2R0"
+#define sampleazureiotPROPERTY_MQ7_R0_TEXT                "mq7R0"
+#define sampleazureiotPROPERTY_STATUS_BAD_REQUEST         400
+#define sampleazureiotPROPERTY_OUT_OF_RANGE               "out of range"
+
+/**
+ * @brief Reporting interval bounds, from an investigation cadence to a conservation cadence.
+ */
+#define sampleazureiotREPORTING_INTERVAL_MIN_SECONDS      10
+#define sampleazureiotREPORTING_INTERVAL_MAX_SECONDS      ( 24 * 60 * 60 )
+
+/**
+ * @brief Stack of the one-shot task that takes the forceSample reading.
+ */
+#define sampleazureiotFORCE_SAMPLE_STACK_SIZE             ( 4096U )
+
+/**
+ * @brief NVS key of the persisted reporting interval.
+ */
+#define sampleazureiotNVS_KEY_REPORTING_INTERVAL          "interval"
+
+/**
+ * @brief NVS key of the last applied desired properties (DesiredState_t).
+ */
+#define sampleazureiotNVS_KEY_DESIRED_STATE               "desired"
 
 /**
  * @brief Telemetry values
@@ -81,19 +204,119 @@
  */
 #define sampleazureiotMESSAGE                             "{\"" sampleazureiotTELEMETRY_NAME "\":%0.2f}"
 
+/**
+ * @brief Acquisition time fields. The timestamp is printed at a fixed width (Unix milliseconds
+ *        stay 13 digits until 2286) so it can be corrected in place once the clock is synchronized.
+ */
+#define sampleazureiotTELEMETRY_TIMESTAMP                 "\"Timestamp\":"
+#define sampleazureiotTELEMETRY_TIMESTAMP_DIGITS          13
+#define sampleazureiotTELEMETRY_TIME_ESTIMATED            "\"TimeValid\":0"
+
+
+/**
+ * @brief Running statistics of one sensor channel since power-on.
+ */
+typedef struct SensorChannelStats
+{
+    uint32_t ulCount;
+    float xMin;
+    float xMax;
+    double xSum;
+} SensorChannelStats_t;
+
+/* Device values. Statistics and the telemetry sequence number are kept in RTC
+ * memory in duty-cycle mode so that they carry over deep sleep; they reset on power-on. */
+static sampleazureiotRETAINED double xDeviceCurrentTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static sampleazureiotRETAINED double xDeviceMaximumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static sampleazureiotRETAINED double xDeviceMinimumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static sampleazureiotRETAINED double xDeviceTemperatureSummation = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static sampleazureiotRETAINED uint32_t ulDeviceTemperatureCount = sampleazureiotDEFAULT_START_TEMP_COUNT;
+static sampleazureiotRETAINED double xDeviceAverageTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static sampleazureiotRETAINED SensorChannelStats_t xChannelStats[ SENSOR_COUNT ];
+static sampleazureiotRETAINED uint32_t ulTelemetrySequence = 0;
+
+/* Guards xChannelStats, updated by the sampling task and read by commands. */
+static portMUX_TYPE xChannelStatsLock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Reporting interval, loaded from NVS on first use. */
+static uint32_t ulReportingIntervalSeconds = 0;
+
+/**
+ * @brief Desired properties applied last, persisted so that a properties document that
+ *        was already applied is not parsed again after a reconnect or a reboot.
+ *        The reporting interval has its own key.
+ */
+typedef struct DesiredState
+{
+    uint32_t ulVersion; /**< $version of the desired properties, 0 if none was applied. */
+    bool xHasTargetTemperature;
+    double xTargetTemperature;
+} DesiredState_t;
 
-/* Device values */
-static double xDeviceCurrentTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceMaximumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceMinimumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceTemperatureSummation = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static uint32_t ulDeviceTemperatureCount = sampleazureiotDEFAULT_START_TEMP_COUNT;
-static double xDeviceAverageTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static DesiredState_t xDesiredState;
+static bool xDesiredStateLoaded = false;
 
 /* Command buffers */
 static uint8_t ucCommandStartTimeValueBuffer[ 32 ];
 /*-----------------------------------------------------------*/
 
+uint32_t ulGetReportingIntervalSeconds( void )
+{
+    uint32_t ulStored;
+
+    if( ulReportingIntervalSeconds == 0 )
+    {
+        if( ( xSampleNvs_GetU32( sampleazureiotNVS_KEY_REPORTING_INTERVAL, &ulStored ) == ESP_OK ) &&
+            ( ulStored >= sampleazureiotREPORTING_INTERVAL_MIN_SECONDS ) &&
+            ( ulStored <= sampleazureiotREPORTING_INTERVAL_MAX_SECONDS ) )
+        {
+            ulReportingIntervalSeconds = ulStored;
+        }
+        else
+        {
+            ulReportingIntervalSeconds = CONFIG_SAMPLE_IOT_REPORTING_INTERVAL_SECONDS;
+        }
+    }
+
+    return ulReportingIntervalSeconds;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Validates, applies and persists a new reporting interval.
+ *
+ * @return bool false if the value is out of range, in which case nothing changes.
+ */
+static bool prvSetReportingInterval( int32_t lSeconds )
+{
+    if( ( lSeconds < sampleazureiotREPORTING_INTERVAL_MIN_SECONDS ) ||
+        ( lSeconds > sampleazureiotREPORTING_INTERVAL_MAX_SECONDS ) )
+    {
+        LogError( ( "Rejected reporting interval %d s, allowed range is [%d, %d]",
+                    ( int ) lSeconds, sampleazureiotREPORTING_INTERVAL_MIN_SECONDS,
+                    sampleazureiotREPORTING_INTERVAL_MAX_SECONDS ) );
+        return false;
+    }
+
+    if( ( uint32_t ) lSeconds != ulGetReportingIntervalSeconds() )
+    {
+        ulReportingIntervalSeconds = ( uint32_t ) lSeconds;
+
+        if( xSampleNvs_SetU32( sampleazureiotNVS_KEY_REPORTING_INTERVAL, ulReportingIntervalSeconds ) != ESP_OK )
+        {
+            LogError( ( "Failed to persist the reporting interval" ) );
+        }
+
+        LogInfo( ( "Reporting interval set to %u s", ( unsigned ) ulReportingIntervalSeconds ) );
+
+        /* Let the idle wait pick up the new deadline right away. */
+        vNotifyDemoTask( sampleazureiotEVENT_INTERVAL_CHANGED );
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Generate max min payload.
  */
@@ -219,76 +442,163 @@ static void prvUpdateLocalProperties( double xNewTemperatureValue,
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Gets the reported properties payload with the maximum temperature value.
+ * @brief Reported property producer: the maximum temperature since the last reboot.
  */
-static uint32_t prvGetNewMaxTemp( double xUpdatedTemperature,
-                                  uint8_t * ucReportedPropertyPayloadBuffer,
-                                  uint32_t ulReportedPropertyPayloadBufferSize )
+static AzureIoTResult_t prvGetNewMaxTemp( AzureIoTJSONWriter_t * pxWriter )
 {
-    AzureIoTResult_t xResult;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lBytesWritten;
+    return AzureIoTJSONWriter_AppendDouble( pxWriter, xDeviceMaximumTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
+}
+/*-----------------------------------------------------------*/
 
-    /* Initialize the JSON writer with the buffer to which we will write the payload with the new temperature. */
-    xResult = AzureIoTJSONWriter_Init( &xWriter, ucReportedPropertyPayloadBuffer, ulReportedPropertyPayloadBufferSize );
-    configASSERT( xResult == eAzureIoTSuccess );
+/**
+ * @brief Reported property producer: the application version, from the app description.
+ */
+static AzureIoTResult_t prvGetFirmwareVersion( AzureIoTJSONWriter_t * pxWriter )
+{
+    const char * pcVersion = esp_app_get_description()->version;
 
-    xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    return AzureIoTJSONWriter_AppendString( pxWriter, ( const uint8_t * ) pcVersion, strlen( pcVersion ) );
+}
+/*-----------------------------------------------------------*/
 
-    xResult = AzureIoTJSONWriter_AppendPropertyName( &xWriter, ( const uint8_t * ) sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT,
-                                                     sizeof( sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+/**
+ * @brief Reported property producer: the MQ sensor baselines.
+ */
+static AzureIoTResult_t prvGetCalibration( AzureIoTJSONWriter_t * pxWriter )
+{
+    const sensor_calibration_t * pxCalibration = sensors_get_calibration();
+    AzureIoTResult_t xResult;
 
-    xResult = AzureIoTJSONWriter_AppendDouble( &xWriter, xUpdatedTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxWriter ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) sampleazureiotPROPERTY_MQ2_R0_TEXT,
+                                                                        sizeof( sampleazureiotPROPERTY_MQ2_R0_TEXT ) - 1,
+                                                                        pxCalibration->mq2_r0, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) sampleazureiotPROPERTY_MQ7_R0_TEXT,
+                                                                        sizeof( sampleazureiotPROPERTY_MQ7_R0_TEXT ) - 1,
+                                                                        pxCalibration->mq7_r0, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxWriter );
+    }
 
-    xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    return xResult;
+}
+/*-----------------------------------------------------------*/
 
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
-    configASSERT( lBytesWritten > 0 );
+/**
+ * @brief Reported property producer: the reporting interval in use. Unlike the acknowledgement
+ *        of the writable property, it is reported even when no desired value was ever set.
+ */
+static AzureIoTResult_t prvGetActiveInterval( AzureIoTJSONWriter_t * pxWriter )
+{
+    return AzureIoTJSONWriter_AppendInt32( pxWriter, ( int32_t ) ulGetReportingIntervalSeconds() );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read-only properties of this device, in a fixed order.
+ */
+static const ReportedProperty_t xReportedProperties[] =
+{
+    { sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT,  prvGetNewMaxTemp      },
+    { sampleazureiotPROPERTY_FIRMWARE_VERSION_TEXT, prvGetFirmwareVersion },
+    { sampleazureiotPROPERTY_CALIBRATION_TEXT,      prvGetCalibration     },
+    { sampleazureiotPROPERTY_ACTIVE_INTERVAL_TEXT,  prvGetActiveInterval  },
+};
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Appends the acknowledgement of one writable property; the caller appends the value
+ *        between this call and AzureIoTHubClientProperties_BuilderEndResponseStatus.
+ */
+static void prvBeginPropertyAck( AzureIoTJSONWriter_t * pxWriter,
+                                 const char * pcPropertyName,
+                                 uint32_t ulPropertyNameLength,
+                                 int32_t lStatus,
+                                 uint32_t ulVersion,
+                                 const char * pcDescription,
+                                 uint32_t ulDescriptionLength )
+{
+    AzureIoTResult_t xResult;
 
-    return lBytesWritten;
+    xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
+                                                                      pxWriter,
+                                                                      ( const uint8_t * ) pcPropertyName,
+                                                                      ulPropertyNameLength,
+                                                                      lStatus,
+                                                                      ulVersion,
+                                                                      ( const uint8_t * ) pcDescription,
+                                                                      ulDescriptionLength );
+    configASSERT( xResult == eAzureIoTSuccess );
 }
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Generate an update for the device's target temperature property online,
- *        acknowledging the update from the IoT Hub.
+ * @brief Generate the acknowledgement for the writable properties received from the IoT Hub,
+ *        one response status per property present in the document.
  */
-static uint32_t prvGenerateAckForIncomingTemperature( double xUpdatedTemperature,
-                                                      uint32_t ulVersion,
-                                                      uint8_t * pucResponseBuffer,
-                                                      uint32_t ulResponseBufferSize )
+static uint32_t prvGenerateAckForWritableProperties( const WritableProperties_t * pxProperties,
+                                                     bool xReportingIntervalAccepted,
+                                                     uint32_t ulVersion,
+                                                     uint8_t * pucResponseBuffer,
+                                                     uint32_t ulResponseBufferSize )
 {
     AzureIoTResult_t xResult;
     AzureIoTJSONWriter_t xWriter;
     int32_t lBytesWritten;
 
-    /* Building the acknowledgement payload for the temperature property to signal we successfully received and accept it. */
+    if( !pxProperties->xHasTargetTemperature && !pxProperties->xHasReportingInterval )
+    {
+        return 0;
+    }
+
     xResult = AzureIoTJSONWriter_Init( &xWriter, pucResponseBuffer, ulResponseBufferSize );
     configASSERT( xResult == eAzureIoTSuccess );
 
     xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
     configASSERT( xResult == eAzureIoTSuccess );
 
-    xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
-                                                                      &xWriter,
-                                                                      ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
-                                                                      sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1,
-                                                                      sampleazureiotPROPERTY_STATUS_SUCCESS,
-                                                                      ulVersion,
-                                                                      ( const uint8_t * ) sampleazureiotPROPERTY_SUCCESS,
-                                                                      sizeof( sampleazureiotPROPERTY_SUCCESS ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( pxProperties->xHasTargetTemperature )
+    {
+        /* Building the acknowledgement payload for the temperature property to signal we successfully received and accept it. */
+        prvBeginPropertyAck( &xWriter,
+                             sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
+                             sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1,
+                             sampleazureiotPROPERTY_STATUS_SUCCESS, ulVersion,
+                             sampleazureiotPROPERTY_SUCCESS, sizeof( sampleazureiotPROPERTY_SUCCESS ) - 1 );
+
+        xResult = AzureIoTJSONWriter_AppendDouble( &xWriter, pxProperties->xTargetTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
+        configASSERT( xResult == eAzureIoTSuccess );
 
-    xResult = AzureIoTJSONWriter_AppendDouble( &xWriter, xUpdatedTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
-    configASSERT( xResult == eAzureIoTSuccess );
+        xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
 
-    xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
-                                                                    &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( pxProperties->xHasReportingInterval )
+    {
+        /* A rejected value is answered with the interval actually in use. */
+        if( xReportingIntervalAccepted )
+        {
+            prvBeginPropertyAck( &xWriter,
+                                 sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT,
+                                 sizeof( sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT ) - 1,
+                                 sampleazureiotPROPERTY_STATUS_SUCCESS, ulVersion,
+                                 sampleazureiotPROPERTY_SUCCESS, sizeof( sampleazureiotPROPERTY_SUCCESS ) - 1 );
+        }
+        else
+        {
+            prvBeginPropertyAck( &xWriter,
+                                 sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT,
+                                 sizeof( sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT ) - 1,
+                                 sampleazureiotPROPERTY_STATUS_BAD_REQUEST, ulVersion,
+                                 sampleazureiotPROPERTY_OUT_OF_RANGE, sizeof( sampleazureiotPROPERTY_OUT_OF_RANGE ) - 1 );
+        }
+
+        xResult = AzureIoTJSONWriter_AppendInt32( &xWriter, ( int32_t ) ulGetReportingIntervalSeconds() );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
 
     xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
     configASSERT( xResult == eAzureIoTSuccess );
@@ -301,92 +611,83 @@ static uint32_t prvGenerateAckForIncomingTemperature( double xUpdatedTemperature
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Properties callback handler
+ * @brief Loads the last applied desired properties on first use and restores the device
+ *        state they set.
  */
-static AzureIoTResult_t prvProcessProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
-                                              AzureIoTHubClientPropertyType_t xPropertyType,
-                                              double * pxOutTemperature,
-                                              uint32_t * ulOutVersion )
+static void prvLoadDesiredState( void )
 {
-    AzureIoTResult_t xResult;
-    AzureIoTJSONReader_t xReader;
-    const uint8_t * pucComponentName = NULL;
-    uint32_t ulComponentNameLength = 0;
-
-    *pxOutTemperature = 0.0;
+    size_t xLength = sizeof( xDesiredState );
 
-    xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( xDesiredStateLoaded )
+    {
+        return;
+    }
 
-    xResult = AzureIoTHubClientProperties_GetPropertiesVersion( &xAzureIoTHubClient, &xReader, pxMessage->xMessageType, ulOutVersion );
+    xDesiredStateLoaded = true;
 
-    if( xResult != eAzureIoTSuccess )
+    if( ( xSampleNvs_GetBlob( sampleazureiotNVS_KEY_DESIRED_STATE, &xDesiredState, &xLength ) != ESP_OK ) ||
+        ( xLength != sizeof( xDesiredState ) ) )
     {
-        LogError( ( "Error getting the property version: result 0x%08x", xResult ) );
+        ( void ) memset( &xDesiredState, 0, sizeof( xDesiredState ) );
+        return;
     }
-    else
-    {
-        /* Reset JSON reader to the beginning */
-        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
 
-        while( ( xResult = AzureIoTHubClientProperties_GetNextComponentProperty( &xAzureIoTHubClient, &xReader,
-                                                                                 pxMessage->xMessageType, xPropertyType,
-                                                                                 &pucComponentName, &ulComponentNameLength ) ) == eAzureIoTSuccess )
-        {
-            if( ulComponentNameLength > 0 )
-            {
-                LogInfo( ( "Unknown component name received" ) );
+    LogInfo( ( "Desired properties version %u restored from NVS", ( unsigned ) xDesiredState.ulVersion ) );
 
-                /* Unknown component name arrived (there are none for this device).
-                 * We have to skip over the property and value to continue iterating */
-                prvSkipPropertyAndValue( &xReader );
-            }
-            else if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
-                                                          ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
-                                                          sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1 ) )
-            {
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
+    if( xDesiredState.xHasTargetTemperature )
+    {
+        xDeviceCurrentTemperature = xDesiredState.xTargetTemperature;
+    }
+}
+/*-----------------------------------------------------------*/
 
-                /* Get desired temperature */
-                xResult = AzureIoTJSONReader_GetTokenDouble( &xReader, pxOutTemperature );
+/**
+ * @brief Records the desired properties just applied.
+ */
+static void prvSaveDesiredState( uint32_t ulVersion,
+                                 const WritableProperties_t * pxApplied )
+{
+    xDesiredState.ulVersion = ulVersion;
 
-                if( xResult != eAzureIoTSuccess )
-                {
-                    LogError( ( "Error getting the property version: result 0x%08x", xResult ) );
-                    break;
-                }
+    if( pxApplied->xHasTargetTemperature )
+    {
+        xDesiredState.xHasTargetTemperature = true;
+        xDesiredState.xTargetTemperature = pxApplied->xTargetTemperature;
+    }
 
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
-            }
-            else
-            {
-                LogInfo( ( "Unknown property arrived: skipping over it." ) );
+    if( xSampleNvs_SetBlob( sampleazureiotNVS_KEY_DESIRED_STATE, &xDesiredState, sizeof( xDesiredState ) ) != ESP_OK )
+    {
+        LogError( ( "Failed to persist the desired properties" ) );
+    }
+}
+/*-----------------------------------------------------------*/
 
-                /* Unknown property arrived. We have to skip over the property and value to continue iterating. */
-                prvSkipPropertyAndValue( &xReader );
-            }
-        }
+/**
+ * @brief Whether a properties document with `ulVersion` was already applied.
+ *
+ * A document from a GET with a lower version than the applied one means the device twin was
+ * recreated: it is applied again. A writable property update is never older than what is applied.
+ */
+static bool prvIsDesiredVersionApplied( AzureIoTHubMessageType_t xMessageType,
+                                        uint32_t ulVersion )
+{
+    if( xDesiredState.ulVersion == 0 )
+    {
+        return false;
+    }
 
-        if( xResult != eAzureIoTErrorEndOfProperties )
-        {
-            LogError( ( "There was an error parsing the properties: result 0x%08x", xResult ) );
-        }
-        else
-        {
-            LogInfo( ( "Successfully parsed properties" ) );
-            xResult = eAzureIoTSuccess;
-        }
+    if( xMessageType == eAzureIoTHubPropertiesRequestedMessage )
+    {
+        return ulVersion == xDesiredState.ulVersion;
     }
 
-    return xResult;
+    return ulVersion <= xDesiredState.ulVersion;
 }
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Property message callback handler
+ * @brief Property message callback handler. Documents whose version was already applied
+ *        are neither applied nor acknowledged again.
  */
 void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
                                 uint8_t * pucWritablePropertyResponseBuffer,
@@ -394,20 +695,43 @@ void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessag
                                 uint32_t * pulWritablePropertyResponseBufferLength )
 {
     AzureIoTResult_t xResult;
-    double xIncomingTemperature;
+    WritableProperties_t xIncoming;
     uint32_t ulVersion;
     bool xWasMaxTemperatureChanged = false;
+    bool xIntervalAccepted = false;
 
-    xResult = prvProcessProperties( pxMessage, eAzureIoTHubClientPropertyWritable, &xIncomingTemperature, &ulVersion );
+    *pulWritablePropertyResponseBufferLength = 0;
 
-    if( xResult == eAzureIoTSuccess )
+    prvLoadDesiredState();
+
+    xResult = xDesiredProperties_Parse( ( const uint8_t * ) pxMessage->pvMessagePayload, pxMessage->ulPayloadLength,
+                                        pxMessage->xMessageType == eAzureIoTHubPropertiesRequestedMessage,
+                                        &xIncoming, &ulVersion );
+
+    if( ( xResult == eAzureIoTSuccess ) && prvIsDesiredVersionApplied( pxMessage->xMessageType, ulVersion ) )
+    {
+        LogInfo( ( "Desired properties version %u already applied, skipping.", ( unsigned ) ulVersion ) );
+    }
+    else if( xResult == eAzureIoTSuccess )
     {
-        prvUpdateLocalProperties( xIncomingTemperature, ulVersion, &xWasMaxTemperatureChanged );
-        *pulWritablePropertyResponseBufferLength = prvGenerateAckForIncomingTemperature(
-            xIncomingTemperature,
+        if( xIncoming.xHasTargetTemperature )
+        {
+            prvUpdateLocalProperties( xIncoming.xTargetTemperature, ulVersion, &xWasMaxTemperatureChanged );
+        }
+
+        if( xIncoming.xHasReportingInterval )
+        {
+            xIntervalAccepted = prvSetReportingInterval( xIncoming.lReportingIntervalSeconds );
+        }
+
+        *pulWritablePropertyResponseBufferLength = prvGenerateAckForWritableProperties(
+            &xIncoming,
+            xIntervalAccepted,
             ulVersion,
             pucWritablePropertyResponseBuffer,
             ulWritablePropertyResponseBufferSize );
+
+        prvSaveDesiredState( ulVersion, &xIncoming );
     }
     else
     {
@@ -417,370 +741,1479 @@ void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessag
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Command message callback handler
+ * @brief Command handler. Reads the request payload from `pxRequest` and writes the
+ *        response payload to `pxResponse`.
+ *
+ * @param[out] pulStatus  Preset to AZ_IOT_STATUS_OK; set to another status to reject the request.
+ *
+ * @return AzureIoTResult_t A failure is answered with an empty payload and status 501.
  */
-uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
-                          uint32_t * pulResponseStatus,
-                          uint8_t * pucCommandResponsePayloadBuffer,
-                          uint32_t ulCommandResponsePayloadBufferSize )
-{
-    AzureIoTResult_t xResult;
-    AzureIoTJSONReader_t xReader;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lCommandNameLength;
-    int32_t ulCommandResponsePayloadLength;
+typedef AzureIoTResult_t ( * CommandHandler_t )( AzureIoTJSONReader_t * pxRequest,
+                                                 AzureIoTJSONWriter_t * pxResponse,
+                                                 uint32_t * pulStatus );
 
-    LogInfo( ( "Command payload : %.*s \r\n",
-               ( int16_t ) pxMessage->ulPayloadLength,
-               ( const char * ) pxMessage->pvMessagePayload ) );
+typedef struct CommandEntry
+{
+    const char * pcName;
+    uint32_t ulNameLength;
+    uint32_t ulHash; /**< FNV-1a of the name, checked when the index is built. */
+    CommandHandler_t xHandler;
+} CommandEntry_t;
 
-    lCommandNameLength = sizeof( sampleazureiotCOMMAND_MAX_MIN_REPORT ) - 1;
+#define sampleazureiotCOMMAND_ENTRY( pcName, ulHash, xHandler )    { pcName, sizeof( pcName ) - 1, ulHash, xHandler }
+/*-----------------------------------------------------------*/
 
-    if( ( lCommandNameLength == pxMessage->usCommandNameLength ) &&
-        ( strncmp( sampleazureiotCOMMAND_MAX_MIN_REPORT, ( const char * ) pxMessage->pucCommandName, lCommandNameLength ) == 0 ) )
-    {
-        /* Is for max min report */
+static AzureIoTResult_t prvCommandMaxMinReport( AzureIoTJSONReader_t * pxRequest,
+                                                AzureIoTJSONWriter_t * pxResponse,
+                                                uint32_t * pulStatus )
+{
+    ( void ) pulStatus;
 
-        /*Initialize the reader from which we pull the "since". */
-        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
+    return prvInvokeMaxMinCommand( pxRequest, pxResponse );
+}
+/*-----------------------------------------------------------*/
 
-        /* Initialize the JSON writer with a buffer to which we will write the response payload. */
-        xResult = AzureIoTJSONWriter_Init( &xWriter, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
-        configASSERT( xResult == eAzureIoTSuccess );
+/**
+ * @brief Appends an object with one member per valid channel of `pxReading`: its value,
+ *        or its read latency if `xLatency` is set.
+ */
+static AzureIoTResult_t prvAppendChannels( AzureIoTJSONWriter_t * pxWriter,
+                                           const char * pcName,
+                                           uint32_t ulNameLength,
+                                           const sensor_reading_t * pxReading,
+                                           bool xLatency )
+{
+    const char * pcChannel;
+    AzureIoTResult_t xResult;
+    uint32_t i;
 
-        /* Read from the writer the "since" value and use it to construct the response payload in the writer. */
-        xResult = prvInvokeMaxMinCommand( &xReader, &xWriter );
+    if( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxWriter, ( const uint8_t * ) pcName, ulNameLength ) ) == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( pxWriter );
+    }
 
-        if( xResult == eAzureIoTSuccess )
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( ( pxReading->valid_mask & SENSOR_MASK( i ) ) == 0 )
         {
-            ulCommandResponsePayloadLength = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+            continue;
+        }
 
-            *pulResponseStatus = AZ_IOT_STATUS_OK;
+        pcChannel = sensors_channel_name( ( sensor_channel_t ) i );
+
+        if( xLatency )
+        {
+            xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxWriter, ( const uint8_t * ) pcChannel, strlen( pcChannel ),
+                                                                       ( int32_t ) pxReading->latency_us[ i ] );
         }
         else
         {
-            LogError( ( "Error generating command payload: result 0x%08x", xResult ) );
-
-            *pulResponseStatus = 501;
-            ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
-            configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-            ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+            xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) pcChannel, strlen( pcChannel ),
+                                                                        pxReading->value[ i ], sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
         }
     }
-    else
-    {
-        /* Not for max min report (not for this device) */
-        LogInfo( ( "Received command is not for this device: %.*s",
-                   pxMessage->usCommandNameLength,
-                   pxMessage->pucCommandName ) );
 
-        *pulResponseStatus = AZ_IOT_STATUS_NOT_FOUND;
-        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
-        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxWriter );
     }
 
-    return ulCommandResponsePayloadLength;
+    return xResult;
 }
 /*-----------------------------------------------------------*/
 
-// MY CODE BEGINS HERE
-
+/* Reading of forceSample, taken by prvForceSampleTask and answered by ulCompleteDeferredCommand. */
+static sensor_reading_t xForcedReading;
+static volatile bool xForcedReadingBusy = false;
+static volatile bool xForcedReadingReady = false;
+static bool xForcedReadingCancelled = false;
+static portMUX_TYPE xForcedReadingLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
 
+/**
+ * @brief Takes the forceSample reading away from the core task, whose ProcessLoop the
+ *        read would block for over a second, then wakes it to send the response.
+ */
+static void prvForceSampleTask( void * pvParameters )
+{
+    ( void ) pvParameters;
 
-float calculate_soc(float vcell) {
-    float soc = 0;
-    if (vcell >= 4.1617) {
-        soc = 100;
-    }
-    else if (vcell >= 4.0913) {
-        soc = 95.03;
+    if( sensors_read_on_demand( SENSOR_MASK_ALL, &xForcedReading ) != ESP_OK )
+    {
+        LogWarn( ( "forceSample: some sensors could not be read (valid mask 0x%02x)", ( unsigned ) xForcedReading.valid_mask ) );
     }
-    else if (vcell >= 4.0749) {
-        soc = 90.07;
+
+    taskENTER_CRITICAL( &xForcedReadingLock );
+    xForcedReadingReady = !xForcedReadingCancelled;
+    xForcedReadingCancelled = false;
+    xForcedReadingBusy = false;
+    taskEXIT_CRITICAL( &xForcedReadingLock );
+
+    if( xForcedReadingReady )
+    {
+        vNotifyDemoTask( sampleazureiotEVENT_COMMAND_DONE );
     }
-    else if (vcell >= 4.0606) {
-        soc = 85.10;
+
+    vTaskDelete( NULL );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Reads every sensor and answers with the reading, its acquisition time and the read
+ *        latency of each sensor. The read runs on its own task and the response is deferred
+ *        until it is done. The reading is not published, does not enter the running
+ *        statistics, leaves the reporting schedule alone and does not take a TVOC conversion
+ *        from the scheduled reads.
+ */
+static AzureIoTResult_t prvCommandForceSample( AzureIoTJSONReader_t * pxRequest,
+                                               AzureIoTJSONWriter_t * pxResponse,
+                                               uint32_t * pulStatus )
+{
+    AzureIoTResult_t xResult;
+
+    ( void ) pxRequest;
+
+    if( xForcedReadingBusy || xForcedReadingReady )
+    {
+        *pulStatus = AZ_IOT_STATUS_THROTTLED;
     }
-    else if (vcell >= 4.0153) {
-        soc = 80.13;
+    else
+    {
+        xForcedReadingBusy = true;
+
+        if( xTaskCreate( prvForceSampleTask, "ForceSample", sampleazureiotFORCE_SAMPLE_STACK_SIZE,
+                         NULL, tskIDLE_PRIORITY, NULL ) == pdPASS )
+        {
+            *pulStatus = sampleazureiotCOMMAND_STATUS_DEFERRED;
+            return eAzureIoTSuccess;
+        }
+
+        xForcedReadingBusy = false;
+        *pulStatus = AZ_IOT_STATUS_SERVER_ERROR;
     }
-    else if (vcell >= 3.9592) {
-        soc = 75.17;
+
+    if( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.9164) {
-        soc = 70.20;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Builds the forceSample response from its reading.
+ */
+static AzureIoTResult_t prvWriteForcedReading( AzureIoTJSONWriter_t * pxResponse,
+                                               const sensor_reading_t * pxReading )
+{
+    AzureIoTResult_t xResult;
+
+    /* Unix milliseconds stay exact in a double. */
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_TIMESTAMP,
+                                                                        sizeof( sampleazureiotRESPONSE_TIMESTAMP ) - 1,
+                                                                        ( double ) llSampleTime_ToUnixMs( pxReading->timestamp_us ), 0 ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_TIME_VALID,
+                                                                      sizeof( sampleazureiotRESPONSE_TIME_VALID ) - 1,
+                                                                      xSampleTime_IsSynchronized() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = prvAppendChannels( pxResponse, sampleazureiotRESPONSE_VALUES, sizeof( sampleazureiotRESPONSE_VALUES ) - 1,
+                                         pxReading, false ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = prvAppendChannels( pxResponse, sampleazureiotRESPONSE_LATENCY, sizeof( sampleazureiotRESPONSE_LATENCY ) - 1,
+                                         pxReading, true ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.8587) {
-        soc = 65.24;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sets the reporting interval from a number of seconds; answers with the interval in use.
+ */
+static AzureIoTResult_t prvCommandSetInterval( AzureIoTJSONReader_t * pxRequest,
+                                               AzureIoTJSONWriter_t * pxResponse,
+                                               uint32_t * pulStatus )
+{
+    AzureIoTResult_t xResult;
+    int32_t lSeconds = -1;
+
+    if( ( AzureIoTJSONReader_NextToken( pxRequest ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONReader_GetTokenInt32( pxRequest, &lSeconds ) != eAzureIoTSuccess ) ||
+        !prvSetReportingInterval( lSeconds ) )
+    {
+        *pulStatus = AZ_IOT_STATUS_BAD_REQUEST;
     }
-    else if (vcell >= 3.8163) {
-        soc = 60.27;
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT,
+                                                                       sizeof( sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT ) - 1,
+                                                                       ( int32_t ) ulGetReportingIntervalSeconds() ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.7535) {
-        soc = 55.30;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Running statistics of every channel that has samples.
+ */
+static AzureIoTResult_t prvCommandGetStats( AzureIoTJSONReader_t * pxRequest,
+                                            AzureIoTJSONWriter_t * pxResponse,
+                                            uint32_t * pulStatus )
+{
+    SensorChannelStats_t xStats[ SENSOR_COUNT ];
+    const SensorChannelStats_t * pxStats;
+    const char * pcName;
+    AzureIoTResult_t xResult;
+    uint32_t i;
+
+    ( void ) pxRequest;
+    ( void ) pulStatus;
+
+    taskENTER_CRITICAL( &xChannelStatsLock );
+    ( void ) memcpy( xStats, xChannelStats, sizeof( xStats ) );
+    taskEXIT_CRITICAL( &xChannelStatsLock );
+
+    xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse );
+
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        pxStats = &xStats[ i ];
+        pcName = sensors_channel_name( ( sensor_channel_t ) i );
+
+        if( pxStats->ulCount == 0 )
+        {
+            continue;
+        }
+
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ) ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_COUNT,
+                                                                           sizeof( sampleazureiotRESPONSE_COUNT ) - 1,
+                                                                           ( int32_t ) pxStats->ulCount ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_MIN,
+                                                                            sizeof( sampleazureiotRESPONSE_MIN ) - 1,
+                                                                            pxStats->xMin, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_MAX,
+                                                                            sizeof( sampleazureiotRESPONSE_MAX ) - 1,
+                                                                            pxStats->xMax, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_MEAN,
+                                                                            sizeof( sampleazureiotRESPONSE_MEAN ) - 1,
+                                                                            pxStats->xSum / pxStats->ulCount,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+        }
     }
-    else if (vcell >= 3.7317) {
-        soc = 50.34;
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.6892) {
-        soc = 45.37;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Uptime, heap, publishing queues and every metric that has samples,
+ *        each as [count, last, min, max, mean].
+ */
+static AzureIoTResult_t prvCommandGetDiagnostics( AzureIoTJSONReader_t * pxRequest,
+                                                  AzureIoTJSONWriter_t * pxResponse,
+                                                  uint32_t * pulStatus )
+{
+    const SampleMetricStat_t * pxStat;
+    const char * pcName;
+    AzureIoTResult_t xResult;
+    uint32_t i;
+
+    ( void ) pxRequest;
+    ( void ) pulStatus;
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_UPTIME,
+                                                                       sizeof( sampleazureiotRESPONSE_UPTIME ) - 1,
+                                                                       ( int32_t ) ( esp_timer_get_time() / 1000000 ) ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_FREE_HEAP,
+                                                                       sizeof( sampleazureiotRESPONSE_FREE_HEAP ) - 1,
+                                                                       ( int32_t ) esp_get_free_heap_size() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_MIN_FREE_HEAP,
+                                                                       sizeof( sampleazureiotRESPONSE_MIN_FREE_HEAP ) - 1,
+                                                                       ( int32_t ) esp_get_minimum_free_heap_size() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_QUEUED,
+                                                                       sizeof( sampleazureiotRESPONSE_QUEUED ) - 1,
+                                                                       ( int32_t ) ulBacklog_Count() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_DROPPED,
+                                                                       sizeof( sampleazureiotRESPONSE_DROPPED ) - 1,
+                                                                       ( int32_t ) ulBacklog_Dropped() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_IN_FLIGHT,
+                                                                       sizeof( sampleazureiotRESPONSE_IN_FLIGHT ) - 1,
+                                                                       ( int32_t ) ulInFlight_Count() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_METRICS,
+                                                             sizeof( sampleazureiotRESPONSE_METRICS ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse );
     }
-    else if (vcell >= 3.6396) {
-        soc = 40.40;
+
+    for( i = 0; ( i < eSampleMetricCount ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        pxStat = pxSampleMetrics_Get( ( SampleMetric_t ) i );
+        pcName = pcSampleMetrics_Name( ( SampleMetric_t ) i );
+
+        if( pxStat->ulCount == 0 )
+        {
+            continue;
+        }
+
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ) ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginArray( pxResponse ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendInt32( pxResponse, ( int32_t ) pxStat->ulCount ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendInt32( pxResponse, ( int32_t ) pxStat->ulLast ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendInt32( pxResponse, ( int32_t ) pxStat->ulMin ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendInt32( pxResponse, ( int32_t ) pxStat->ulMax ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendInt32( pxResponse, ( int32_t ) ( pxStat->ullSum / pxStat->ulCount ) ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONWriter_AppendEndArray( pxResponse );
+        }
     }
-    else if (vcell >= 3.5677) {
-        soc = 35.43;
+
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.5208) {
-        soc = 30.46;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Measures new MQ baselines; the device must be in clean air. The new values are
+ *        also reported through the calibration property. A sensor whose heater is not in its
+ *        valid window is measured at its next valid read: the answer is then 202, with the
+ *        baselines in use so far.
+ */
+static AzureIoTResult_t prvCommandRecalibrate( AzureIoTJSONReader_t * pxRequest,
+                                               AzureIoTJSONWriter_t * pxResponse,
+                                               uint32_t * pulStatus )
+{
+    sensor_calibration_t xCalibration;
+
+    ( void ) pxRequest;
+
+    switch( sensors_calibrate( &xCalibration ) )
+    {
+        case ESP_OK:
+            break;
+
+        case ESP_ERR_NOT_FINISHED:
+            *pulStatus = AZ_IOT_STATUS_ACCEPTED;
+            break;
+
+        default:
+            *pulStatus = AZ_IOT_STATUS_SERVER_ERROR;
+            break;
     }
-    else if (vcell >= 3.4712) {
-        soc = 25.40;
+
+    /* Answers with the calibration in use, the previous one if measuring failed. */
+    return prvGetCalibration( pxResponse );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sends the offline backlog now rather than at the next wake-up; answers with its state.
+ */
+static AzureIoTResult_t prvCommandFlushBacklog( AzureIoTJSONReader_t * pxRequest,
+                                                AzureIoTJSONWriter_t * pxResponse,
+                                                uint32_t * pulStatus )
+{
+    AzureIoTResult_t xResult;
+
+    ( void ) pxRequest;
+    ( void ) pulStatus;
+
+    vNotifyDemoTask( sampleazureiotEVENT_SERVICE );
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_QUEUED,
+                                                                       sizeof( sampleazureiotRESPONSE_QUEUED ) - 1,
+                                                                       ( int32_t ) ulBacklog_Count() ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_DROPPED,
+                                                                       sizeof( sampleazureiotRESPONSE_DROPPED ) - 1,
+                                                                       ( int32_t ) ulBacklog_Dropped() ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
     }
-    else if (vcell >= 3.386) {
-        soc = 20.53;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Arguments of getHistory.
+ */
+typedef struct HistoryRequest
+{
+    double xSince;        /**< Unix time in seconds; older readings are left out. */
+    uint32_t ulChannels;  /**< SENSOR_MASK() of the channels to return. */
+    uint32_t ulCursor;    /**< Sequence number to resume from, "next" of the previous response. */
+} HistoryRequest_t;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Parses {"since":<s>,"channels":["CO",...],"cursor":<n>}; every member is optional.
+ */
+static AzureIoTResult_t prvParseHistoryRequest( AzureIoTJSONReader_t * pxReader,
+                                                HistoryRequest_t * pxRequest )
+{
+    AzureIoTJSONTokenType_t xTokenType;
+    AzureIoTResult_t xResult;
+    uint32_t i;
+
+    pxRequest->xSince = 0;
+    pxRequest->ulChannels = SENSOR_MASK_ALL;
+    pxRequest->ulCursor = ulHistory_FirstSequence();
+
+    /* An empty payload, or "null", takes the defaults. */
+    if( ( AzureIoTJSONReader_NextToken( pxReader ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) != eAzureIoTSuccess ) ||
+        ( xTokenType != eAzureIoTJSONTokenBEGIN_OBJECT ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    xResult = AzureIoTJSONReader_NextToken( pxReader );
+
+    while( ( xResult == eAzureIoTSuccess ) &&
+           ( ( xResult = AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) ) == eAzureIoTSuccess ) &&
+           ( xTokenType == eAzureIoTJSONTokenPROPERTY_NAME ) )
+    {
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleazureiotCOMMAND_SINCE,
+                                                 sizeof( sampleazureiotCOMMAND_SINCE ) - 1 ) )
+        {
+            if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess )
+            {
+                xResult = AzureIoTJSONReader_GetTokenDouble( pxReader, &pxRequest->xSince );
+            }
+        }
+        else if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleazureiotCOMMAND_CURSOR,
+                                                      sizeof( sampleazureiotCOMMAND_CURSOR ) - 1 ) )
+        {
+            if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess )
+            {
+                xResult = AzureIoTJSONReader_GetTokenUInt32( pxReader, &pxRequest->ulCursor );
+            }
+        }
+        else if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleazureiotCOMMAND_CHANNELS,
+                                                      sizeof( sampleazureiotCOMMAND_CHANNELS ) - 1 ) )
+        {
+            pxRequest->ulChannels = 0;
+
+            /* Skip the name and the opening bracket, then read names up to the closing one. */
+            if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess )
+            {
+                xResult = AzureIoTJSONReader_NextToken( pxReader );
+            }
+
+            while( ( xResult == eAzureIoTSuccess ) &&
+                   ( ( xResult = AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) ) == eAzureIoTSuccess ) &&
+                   ( xTokenType == eAzureIoTJSONTokenSTRING ) )
+            {
+                for( i = 0; i < SENSOR_COUNT; i++ )
+                {
+                    if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sensors_channel_name( ( sensor_channel_t ) i ),
+                                                             strlen( sensors_channel_name( ( sensor_channel_t ) i ) ) ) )
+                    {
+                        pxRequest->ulChannels |= SENSOR_MASK( i );
+                    }
+                }
+
+                xResult = AzureIoTJSONReader_NextToken( pxReader );
+            }
+        }
+        else
+        {
+            prvSkipPropertyAndValue( pxReader );
+            continue;
+        }
+
+        if( xResult == eAzureIoTSuccess )
+        {
+            xResult = AzureIoTJSONReader_NextToken( pxReader );
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Closes a getHistory response.
+ */
+static AzureIoTResult_t prvAppendHistoryTail( AzureIoTJSONWriter_t * pxWriter,
+                                              uint32_t ulNext,
+                                              bool xMore )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendEndArray( pxWriter ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxWriter, ( const uint8_t * ) sampleazureiotRESPONSE_NEXT,
+                                                                       sizeof( sampleazureiotRESPONSE_NEXT ) - 1,
+                                                                       ( int32_t ) ulNext ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxWriter, ( const uint8_t * ) sampleazureiotRESPONSE_MORE,
+                                                                      sizeof( sampleazureiotRESPONSE_MORE ) - 1,
+                                                                      xMore ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxWriter );
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Appends one [time, value, ...] row with the requested channels; missing values are null.
+ */
+static AzureIoTResult_t prvAppendHistoryRow( AzureIoTJSONWriter_t * pxWriter,
+                                             const HistorySample_t * pxSample,
+                                             uint32_t ulChannels )
+{
+    AzureIoTResult_t xResult;
+    uint32_t i;
+
+    if( ( xResult = AzureIoTJSONWriter_AppendBeginArray( pxWriter ) ) == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendDouble( pxWriter, ( double ) pxSample->llTimestampS, 0 );
+    }
+
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( ( ulChannels & SENSOR_MASK( i ) ) == 0 )
+        {
+            continue;
+        }
+
+        if( ( pxSample->ulValidMask & SENSOR_MASK( i ) ) == 0 )
+        {
+            xResult = AzureIoTJSONWriter_AppendNull( pxWriter );
+        }
+        else
+        {
+            xResult = AzureIoTJSONWriter_AppendDouble( pxWriter, pxSample->xValue[ i ], sampleazureiotHISTORY_DECIMAL_PLACE_DIGITS );
+        }
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndArray( pxWriter );
     }
-    else if (vcell >= 3.288) {
-        soc = 15.56;
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Returns the stored readings from a cursor, as many as fit in one response:
+ *        {"channels":[...],"rows":[[time,value,...],...],"next":<cursor>,"more":<bool>}.
+ *        The caller repeats the command with "cursor" set to "next" while "more" is true.
+ */
+static AzureIoTResult_t prvCommandGetHistory( AzureIoTJSONReader_t * pxRequest,
+                                              AzureIoTJSONWriter_t * pxResponse,
+                                              uint32_t * pulStatus )
+{
+    HistoryRequest_t xRequest;
+    HistorySample_t xSample;
+    AzureIoTJSONWriter_t xBeforeRow;
+    AzureIoTJSONWriter_t xTrial;
+    AzureIoTResult_t xResult;
+    const char * pcChannel;
+    uint32_t ulFirst = ulHistory_FirstSequence();
+    uint32_t ulNext = ulHistory_NextSequence();
+    uint32_t ulSequence;
+    uint32_t i;
+
+    if( prvParseHistoryRequest( pxRequest, &xRequest ) != eAzureIoTSuccess )
+    {
+        *pulStatus = AZ_IOT_STATUS_BAD_REQUEST;
+        xRequest.xSince = 0;
+        xRequest.ulChannels = 0;
+        xRequest.ulCursor = ulNext;
     }
-    else if (vcell >= 3.2017) {
-        soc = 10.59;
+
+    /* Readings overwritten since the previous page are lost; resume at the oldest one left. */
+    if( ( xRequest.ulCursor - ulFirst ) > ( ulNext - ulFirst ) )
+    {
+        xRequest.ulCursor = ulFirst;
     }
-    else if (vcell >= 3.0747) {
-        soc = 5.63;
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotCOMMAND_CHANNELS,
+                                                             sizeof( sampleazureiotCOMMAND_CHANNELS ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginArray( pxResponse );
     }
-    else {
-        soc = 0;
+
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( ( xRequest.ulChannels & SENSOR_MASK( i ) ) != 0 )
+        {
+            pcChannel = sensors_channel_name( ( sensor_channel_t ) i );
+            xResult = AzureIoTJSONWriter_AppendString( pxResponse, ( const uint8_t * ) pcChannel, strlen( pcChannel ) );
+        }
     }
 
-    return soc;
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendEndArray( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ROWS,
+                                                             sizeof( sampleazureiotRESPONSE_ROWS ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginArray( pxResponse );
+    }
 
+    for( ulSequence = xRequest.ulCursor; ( ulSequence != ulNext ) && ( xResult == eAzureIoTSuccess ); ulSequence++ )
+    {
+        if( !xHistory_Get( ulSequence, &xSample ) || ( ( double ) xSample.llTimestampS < xRequest.xSince ) )
+        {
+            continue;
+        }
+
+        /* Keep the row only if the response can still be closed after it; the writer is
+         * a plain struct, so a copy restores the position. */
+        xBeforeRow = *pxResponse;
+
+        if( prvAppendHistoryRow( pxResponse, &xSample, xRequest.ulChannels ) == eAzureIoTSuccess )
+        {
+            xTrial = *pxResponse;
+
+            if( prvAppendHistoryTail( &xTrial, INT32_MAX, true ) == eAzureIoTSuccess )
+            {
+                continue;
+            }
+        }
+
+        *pxResponse = xBeforeRow;
+        break;
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = prvAppendHistoryTail( pxResponse, ulSequence, ulSequence != ulNext );
+    }
+
+    return xResult;
 }
+/*-----------------------------------------------------------*/
 
-// PPM CURVE CONSTANTS - general form RsR0 = Ax^k 
-// flammable gas: A = 19.5, k = -0.43
-// CO: A = 24.9, k = -0.7
+/**
+ * @brief Rolling CO exposure and the sub-indexes of the gas and TVOC channels, over the minutes
+ *        closed so far: {"valid":<bool>,"coTwaPpm":..,"coTwaMinutes":..,"coStelPpm":..,
+ *        "coStelMinutes":..,"indexes":{"CO":..,"FlammableGases":..,"TVOC":..}}.
+ */
+static AzureIoTResult_t prvCommandGetExposure( AzureIoTJSONReader_t * pxRequest,
+                                               AzureIoTJSONWriter_t * pxResponse,
+                                               uint32_t * pulStatus )
+{
+    ExposureSummary_t xExposure;
+    AzureIoTResult_t xResult;
+    const char * pcName;
+    uint16_t usIndex[ SENSOR_COUNT ] = { 0 };
+    uint32_t i;
+
+    ( void ) pxRequest;
+    ( void ) pulStatus;
+
+    vExposure_Get( &xExposure );
+
+    usIndex[ SENSOR_CO ] = xExposure.usCoIndex;
+    usIndex[ SENSOR_FLAMMABLE_GAS ] = xExposure.usFlammableIndex;
+    usIndex[ SENSOR_TVOC ] = xExposure.usTvocIndex;
+
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_VALID,
+                                                                      sizeof( sampleazureiotRESPONSE_VALID ) - 1,
+                                                                      xExposure.xValid ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CO_TWA,
+                                                                        sizeof( sampleazureiotRESPONSE_CO_TWA ) - 1,
+                                                                        xExposure.xCoTwa, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CO_TWA_MINUTES,
+                                                                       sizeof( sampleazureiotRESPONSE_CO_TWA_MINUTES ) - 1,
+                                                                       ( int32_t ) xExposure.ulCoTwaMinutes ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CO_STEL,
+                                                                        sizeof( sampleazureiotRESPONSE_CO_STEL ) - 1,
+                                                                        xExposure.xCoStel, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CO_STEL_MINUTES,
+                                                                       sizeof( sampleazureiotRESPONSE_CO_STEL_MINUTES ) - 1,
+                                                                       ( int32_t ) xExposure.ulCoStelMinutes ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_INDEXES,
+                                                             sizeof( sampleazureiotRESPONSE_INDEXES ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse );
+    }
 
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( ( i != SENSOR_CO ) && ( i != SENSOR_FLAMMABLE_GAS ) && ( i != SENSOR_TVOC ) )
+        {
+            continue;
+        }
 
+        pcName = sensors_channel_name( ( sensor_channel_t ) i );
+        xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ),
+                                                                   ( int32_t ) usIndex[ i ] );
+    }
 
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+    }
 
-#include <math.h>
-float ppm_curve(float A, float k, float y) {
-    float x = pow((y / A), (1 / k)); // solve for gas concentration x
-    return x; // ppm
+    return xResult;
 }
+/*-----------------------------------------------------------*/
 
-#define MQ2TAG "MQ2_SENSOR"
-#define MQ7TAG "MQ7_SENSOR"
-#define TAG_RSOC "TAG_RSOC"
-#define TVOC_TAG "TVOC_TAG"
+/**
+ * @brief Acquisition schedule and its cost, per channel: {"adaptive":<bool>,"<channel>":
+ *        {"periodMs":..,"samples":..,"energyPerSampleUj":..,"energyMj":..,"fixedRateEnergyMj":..,
+ *        "excursions":..,"missedAtFixedRate":..},...}. Channels are left out when the internal
+ *        sampling does not run. The power of the sensor supplies is reported by getPower.
+ */
+static AzureIoTResult_t prvCommandGetSampling( AzureIoTJSONReader_t * pxRequest,
+                                               AzureIoTJSONWriter_t * pxResponse,
+                                               uint32_t * pulStatus )
+{
+    SamplingChannelStats_t xStats;
+    const char * pcName;
+    AzureIoTResult_t xResult;
+    uint32_t i;
 
+    ( void ) pxRequest;
+    ( void ) pulStatus;
 
+    if( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ADAPTIVE,
+                                                                  sizeof( sampleazureiotRESPONSE_ADAPTIVE ) - 1,
+                                                                  xSampling_Adaptive() );
+    }
+
+    for( i = 0; ( i < SENSOR_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( !xSampling_GetStats( ( sensor_channel_t ) i, &xStats ) )
+        {
+            break;
+        }
 
-// read sensor a_out voltage
-int analog_read(adc_oneshot_unit_handle_t adc_handle, adc_channel_t sensor) {
-    int raw = 0;
-    adc_oneshot_read(adc_handle, sensor, &raw); // get raw adc value 
+        pcName = sensors_channel_name( ( sensor_channel_t ) i );
+
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ) ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_PERIOD,
+                                                                           sizeof( sampleazureiotRESPONSE_PERIOD ) - 1,
+                                                                           ( int32_t ) xStats.ulPeriodMs ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_SAMPLES,
+                                                                           sizeof( sampleazureiotRESPONSE_SAMPLES ) - 1,
+                                                                           ( int32_t ) xStats.ulSamples ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ENERGY_PER_SAMPLE,
+                                                                           sizeof( sampleazureiotRESPONSE_ENERGY_PER_SAMPLE ) - 1,
+                                                                           ( int32_t ) xStats.ulEnergyPerSampleUj ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ENERGY,
+                                                                            sizeof( sampleazureiotRESPONSE_ENERGY ) - 1,
+                                                                            ( double ) xStats.ullEnergyUj / 1000.0,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_FIXED_RATE_ENERGY,
+                                                                            sizeof( sampleazureiotRESPONSE_FIXED_RATE_ENERGY ) - 1,
+                                                                            ( double ) xStats.ullFixedRateEnergyUj / 1000.0,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_EXCURSIONS,
+                                                                           sizeof( sampleazureiotRESPONSE_EXCURSIONS ) - 1,
+                                                                           ( int32_t ) xStats.ulExcursions ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_MISSED_AT_FIXED_RATE,
+                                                                           sizeof( sampleazureiotRESPONSE_MISSED_AT_FIXED_RATE ) - 1,
+                                                                           ( int32_t ) xStats.ulMissedAtFixedRate ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+        }
+    }
 
-    int voltageMV = 0;
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+    }
 
-    adc_cali_raw_to_voltage(adc1_cali_handle, raw,&voltageMV); // convert raw value to calibrated voltage
-    return voltageMV;
+    return xResult;
 }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Estimated power of the sensor supplies and gas sensor heaters:
+ *        {"rails":{"<rail>":{"gated":<bool>,"powerCycles":..,"poweredPercent":..,"currentUa":..,
+ *        "alwaysOnCurrentUa":..},...},"heaters":{"<heater>":{"cycling":<bool>,"powerMw":..,
+ *        "alwaysOnPowerMw":..,"energyJ":..,"alwaysOnEnergyJ":..,"validReads":..,"skippedReads":..},...}}.
+ *        Each figure is set against the same supply or heater left on all the time; skipped
+ *        reads fell outside the valid window of the heater cycle.
+ */
+static AzureIoTResult_t prvCommandGetPower( AzureIoTJSONReader_t * pxRequest,
+                                            AzureIoTJSONWriter_t * pxResponse,
+                                            uint32_t * pulStatus )
+{
+    sensor_rail_stats_t xRail;
+    mq_heater_stats_t xHeater;
+    const char * pcName;
+    AzureIoTResult_t xResult;
+    uint32_t i;
+
+    ( void ) pxRequest;
+    ( void ) pulStatus;
 
+    if( ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_RAILS,
+                                                             sizeof( sampleazureiotRESPONSE_RAILS ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse );
+    }
 
+    for( i = 0; ( i < SENSOR_RAIL_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        sensors_rail_stats( ( sensor_rail_t ) i, &xRail );
+        pcName = sensors_rail_name( ( sensor_rail_t ) i );
+
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ) ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_GATED,
+                                                                          sizeof( sampleazureiotRESPONSE_GATED ) - 1,
+                                                                          xRail.gated ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_POWER_CYCLES,
+                                                                           sizeof( sampleazureiotRESPONSE_POWER_CYCLES ) - 1,
+                                                                           ( int32_t ) xRail.power_cycles ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_POWERED_PERCENT,
+                                                                            sizeof( sampleazureiotRESPONSE_POWERED_PERCENT ) - 1,
+                                                                            ( xRail.elapsed_us > 0 ) ? 100.0 * xRail.powered_us / xRail.elapsed_us : 0.0,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CURRENT,
+                                                                           sizeof( sampleazureiotRESPONSE_CURRENT ) - 1,
+                                                                           ( int32_t ) xRail.average_ua ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ALWAYS_ON_CURRENT,
+                                                                           sizeof( sampleazureiotRESPONSE_ALWAYS_ON_CURRENT ) - 1,
+                                                                           ( int32_t ) xRail.always_on_ua ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+        }
+    }
 
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_HEATERS,
+                                                             sizeof( sampleazureiotRESPONSE_HEATERS ) - 1 ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse );
+    }
 
+    for( i = 0; ( i < MQ_HEATER_COUNT ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        mq_heater_stats( ( mq_heater_t ) i, &xHeater );
+        pcName = mq_heater_name( ( mq_heater_t ) i );
+
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxResponse, ( const uint8_t * ) pcName, strlen( pcName ) ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxResponse ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithBoolValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_CYCLING,
+                                                                          sizeof( sampleazureiotRESPONSE_CYCLING ) - 1,
+                                                                          xHeater.cycling ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_POWER,
+                                                                           sizeof( sampleazureiotRESPONSE_POWER ) - 1,
+                                                                           ( int32_t ) xHeater.average_mw ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ALWAYS_ON_POWER,
+                                                                           sizeof( sampleazureiotRESPONSE_ALWAYS_ON_POWER ) - 1,
+                                                                           ( int32_t ) xHeater.always_on_mw ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_HEATER_ENERGY,
+                                                                            sizeof( sampleazureiotRESPONSE_HEATER_ENERGY ) - 1,
+                                                                            ( double ) xHeater.energy_uj / 1000000.0,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_ALWAYS_ON_ENERGY,
+                                                                            sizeof( sampleazureiotRESPONSE_ALWAYS_ON_ENERGY ) - 1,
+                                                                            ( double ) xHeater.always_on_energy_uj / 1000000.0,
+                                                                            sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_VALID_READS,
+                                                                           sizeof( sampleazureiotRESPONSE_VALID_READS ) - 1,
+                                                                           ( int32_t ) xHeater.valid_reads ) ) == eAzureIoTSuccess ) &&
+            ( ( xResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( pxResponse, ( const uint8_t * ) sampleazureiotRESPONSE_SKIPPED_READS,
+                                                                           sizeof( sampleazureiotRESPONSE_SKIPPED_READS ) - 1,
+                                                                           ( int32_t ) xHeater.skipped_reads ) ) == eAzureIoTSuccess ) )
+        {
+            xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+        }
+    }
 
+    if( ( xResult == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( pxResponse );
+    }
 
+    return xResult;
+}
+/*-----------------------------------------------------------*/
 
 /**
- * @brief Implements the sample interface for generating Telemetry payload.
+ * @brief Commands of this device. The hashes are precomputed; adding a command only takes
+ *        a new entry, the index below is built from this table.
  */
-uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
-                            uint32_t ulTelemetryDataSize,
-                            uint32_t * ulTelemetryDataLength )
+static const CommandEntry_t xCommands[] =
 {
-    i2c_scan();
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_MAX_MIN_REPORT,  0x70DAA077UL, prvCommandMaxMinReport ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_FORCE_SAMPLE,    0x88ABBC2EUL, prvCommandForceSample ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_SET_INTERVAL,    0x9FFD5E8AUL, prvCommandSetInterval ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_STATS,       0x141D149AUL, prvCommandGetStats ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_DIAGNOSTICS, 0xE7B8923DUL, prvCommandGetDiagnostics ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_RECALIBRATE,     0x1E9C2BFDUL, prvCommandRecalibrate ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_FLUSH_BACKLOG,   0x40E73320UL, prvCommandFlushBacklog ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_HISTORY,     0xFF191889UL, prvCommandGetHistory ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_EXPOSURE,    0x13EBAEC6UL, prvCommandGetExposure ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_SAMPLING,    0x48374D5EUL, prvCommandGetSampling ),
+    sampleazureiotCOMMAND_ENTRY( sampleazureiotCOMMAND_GET_POWER,       0xE42E8D88UL, prvCommandGetPower ),
+};
+
+#define sampleazureiotCOMMAND_COUNT    ( sizeof( xCommands ) / sizeof( xCommands[ 0 ] ) )
+
+/* Open-addressing index from hash to entry of xCommands, built on first use. */
+static uint8_t ucCommandIndex[ sampleazureiotCOMMAND_INDEX_SIZE ];
+static bool xCommandIndexBuilt = false;
+/*-----------------------------------------------------------*/
 
-    // FLYING FISH MODULE COMPONENT VALUES //
-    float RL = 1000; // ohms 
-    float Vc = 5; // volts
-    float R0 = 1000; //ohms
+/**
+ * @brief 32-bit FNV-1a hash.
+ */
+static uint32_t prvFnv1a( const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulHash = 2166136261UL;
+    uint32_t i;
 
+    for( i = 0; i < ulLength; i++ )
+    {
+        ulHash = ( ulHash ^ pucData[ i ] ) * 16777619UL;
+    }
 
-    // get MQ2 flammable gas sensor value //
-    int MQ2Aout = analog_read(adc1_handle, MQ2); // get calibrated a_out voltage 
-    float MQ2Aoutf = (float)MQ2Aout / 1000.0; // mv to V 
-    float Rs = ((Vc - MQ2Aoutf) * RL) / MQ2Aoutf; // get Rs resistance 
-    float y = Rs / R0; // resistance ratio (y value on characteristic curve)
-    float flammableGases = ppm_curve(19.5, -0.43, y); // plug resistance ratio into characteristic curve
+    return ulHash;
+}
+/*-----------------------------------------------------------*/
 
+/**
+ * @brief Checks the precomputed hashes and builds the lookup index.
+ */
+static void prvBuildCommandIndex( void )
+{
+    uint32_t ulSlot;
+    uint32_t i;
 
+    configASSERT( sampleazureiotCOMMAND_COUNT * 2 <= sampleazureiotCOMMAND_INDEX_SIZE );
 
-    ESP_LOGI(MQ2TAG, "flammable gas (ppm): %0.2f", flammableGases);
+    ( void ) memset( ucCommandIndex, sampleazureiotCOMMAND_INDEX_EMPTY, sizeof( ucCommandIndex ) );
 
+    for( i = 0; i < sampleazureiotCOMMAND_COUNT; i++ )
+    {
+        /* A wrong constant in the table would make the command unreachable. */
+        configASSERT( prvFnv1a( ( const uint8_t * ) xCommands[ i ].pcName, xCommands[ i ].ulNameLength ) == xCommands[ i ].ulHash );
 
-    // get MQ7 CO sensor value //
-    int MQ7Aout = analog_read(adc1_handle, MQ7); // get calibrated a_out voltage 
-    float MQ7Aoutf = (float)MQ7Aout / 1000.0; // mv to V 
-    float Rs2 = ((Vc - MQ7Aoutf) * RL) / MQ7Aoutf; // get Rs resistance 
-    float y2 = Rs2 / R0; // resistance ratio (y value on characteristic curve)
-    float co = ppm_curve(24.9, -0.7, y2); // plug resistance ratio into characteristic curve
+        ulSlot = xCommands[ i ].ulHash & ( sampleazureiotCOMMAND_INDEX_SIZE - 1 );
 
+        while( ucCommandIndex[ ulSlot ] != sampleazureiotCOMMAND_INDEX_EMPTY )
+        {
+            ulSlot = ( ulSlot + 1 ) & ( sampleazureiotCOMMAND_INDEX_SIZE - 1 );
+        }
 
-    ESP_LOGI(MQ7TAG, "co (ppm): %0.2f", co);
+        ucCommandIndex[ ulSlot ] = ( uint8_t ) i;
+    }
 
+    xCommandIndexBuilt = true;
+}
+/*-----------------------------------------------------------*/
 
+static const CommandEntry_t * prvFindCommand( const uint8_t * pucName,
+                                              uint32_t ulNameLength )
+{
+    const CommandEntry_t * pxEntry;
+    uint32_t ulHash = prvFnv1a( pucName, ulNameLength );
+    uint32_t ulSlot = ulHash & ( sampleazureiotCOMMAND_INDEX_SIZE - 1 );
 
+    if( !xCommandIndexBuilt )
+    {
+        prvBuildCommandIndex();
+    }
 
+    while( ucCommandIndex[ ulSlot ] != sampleazureiotCOMMAND_INDEX_EMPTY )
+    {
+        pxEntry = &xCommands[ ucCommandIndex[ ulSlot ] ];
+
+        if( ( pxEntry->ulHash == ulHash ) &&
+            ( pxEntry->ulNameLength == ulNameLength ) &&
+            ( memcmp( pxEntry->pcName, pucName, ulNameLength ) == 0 ) )
+        {
+            return pxEntry;
+        }
 
+        ulSlot = ( ulSlot + 1 ) & ( sampleazureiotCOMMAND_INDEX_SIZE - 1 );
+    }
 
+    return NULL;
+}
+/*-----------------------------------------------------------*/
 
-    // Example placeholder values for now
-    float temperature = 100.0f;     // Celsius
-    float humidity = 50.0f;        // %
-    // float flammableGases = 120.0f; // ppm or arbitrary unit
-    float tvoc = 100.0f;            // mg/m³ or arbitrary unit
-    // float co = MQ2Aout;               // ppm
+/**
+ * @brief Command message callback handler
+ */
+uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
+                          uint32_t * pulResponseStatus,
+                          uint8_t * pucCommandResponsePayloadBuffer,
+                          uint32_t ulCommandResponsePayloadBufferSize )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONReader_t xReader;
+    AzureIoTJSONWriter_t xWriter;
+    const CommandEntry_t * pxCommand;
+    int32_t ulCommandResponsePayloadLength;
 
+    LogInfo( ( "Command payload : %.*s \r\n",
+               ( int16_t ) pxMessage->ulPayloadLength,
+               ( const char * ) pxMessage->pvMessagePayload ) );
 
+    pxCommand = prvFindCommand( pxMessage->pucCommandName, pxMessage->usCommandNameLength );
 
+    if( pxCommand != NULL )
+    {
+        /*Initialize the reader from which the handler pulls its arguments. */
+        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+        configASSERT( xResult == eAzureIoTSuccess );
 
+        /* Initialize the JSON writer with a buffer to which we will write the response payload. */
+        xResult = AzureIoTJSONWriter_Init( &xWriter, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+        configASSERT( xResult == eAzureIoTSuccess );
 
-    // i2c read temp humidity
-    // calculate averages
-    
-    // make containers
-    float temp_values[10];
-    float humidity_values[10];
+        *pulResponseStatus = AZ_IOT_STATUS_OK;
 
-    // average of 10 measurements
-    for (int i = 0; i < 10; i++) {
+        xResult = pxCommand->xHandler( &xReader, &xWriter, pulResponseStatus );
 
-        esp_err_t ret = read_TH(&temperature, &humidity);
-        if (ret == ESP_OK) {
-        } else {
-            ESP_LOGE("ADA_FRUIT_SENSOR", "Failed to read sensor");
+        if( xResult == eAzureIoTSuccess )
+        {
+            ulCommandResponsePayloadLength = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
         }
-        // fill containers 
-        temp_values[i] = temperature;
-        humidity_values[i] = humidity;
+        else
+        {
+            LogError( ( "Error generating command payload: result 0x%08x", xResult ) );
 
-        vTaskDelay(pdMS_TO_TICKS(100));
+            *pulResponseStatus = 501;
+            ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
+            configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
+            ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+        }
     }
+    else
+    {
+        /* Not a command of this device */
+        LogInfo( ( "Received command is not for this device: %.*s",
+                   pxMessage->usCommandNameLength,
+                   pxMessage->pucCommandName ) );
 
-    float avg_temp = 0;
-    float avg_humidity = 0;
+        *pulResponseStatus = AZ_IOT_STATUS_NOT_FOUND;
+        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
+        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
+        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+    }
+
+    return ulCommandResponsePayloadLength;
+}
+/*-----------------------------------------------------------*/
 
-    // take average of containers
-    for (int i = 0; i < 10; i++) {
-        avg_temp += temp_values[i] / 10;
-        avg_humidity += humidity_values[i] / 10;
+uint32_t ulCompleteDeferredCommand( uint32_t * pulResponseStatus,
+                                    uint8_t * pucCommandResponsePayloadBuffer,
+                                    uint32_t ulCommandResponsePayloadBufferSize )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONWriter_t xWriter;
+    uint32_t ulCommandResponsePayloadLength;
+
+    if( !xForcedReadingReady )
+    {
+        return 0;
     }
 
-    temperature = avg_temp;
-    humidity = avg_humidity;
+    xResult = AzureIoTJSONWriter_Init( &xWriter, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+    configASSERT( xResult == eAzureIoTSuccess );
 
-    ESP_LOGI("ADAFRUIT_SENSOR", "Temperature: %.2f °C, Humidity: %.2f %%", temperature, humidity);
+    *pulResponseStatus = ( xForcedReading.valid_mask != 0 ) ? AZ_IOT_STATUS_OK : AZ_IOT_STATUS_SERVER_ERROR;
 
+    if( ( xResult = prvWriteForcedReading( &xWriter, &xForcedReading ) ) == eAzureIoTSuccess )
+    {
+        ulCommandResponsePayloadLength = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+    }
+    else
+    {
+        LogError( ( "Error generating command payload: result 0x%08x", xResult ) );
 
+        *pulResponseStatus = 501;
+        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
+        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
+        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+    }
+
+    xForcedReadingReady = false;
+
+    return ulCommandResponsePayloadLength;
+}
+/*-----------------------------------------------------------*/
+
+void vCancelDeferredCommand( void )
+{
+    /* A reading under way still completes, and is dropped. */
+    taskENTER_CRITICAL( &xForcedReadingLock );
+
+    if( xForcedReadingBusy )
+    {
+        xForcedReadingCancelled = true;
+    }
+
+    xForcedReadingReady = false;
+
+    taskEXIT_CRITICAL( &xForcedReadingLock );
+}
+/*-----------------------------------------------------------*/
+
+// MY CODE BEGINS HERE
 
+#define TAG_RSOC "TAG_RSOC"
 
-    float soc = 0.0f;
-    float soc_ocv = 0.0f;
+/**
+ * @brief Adds a reading to the running statistics of its channels.
+ */
+static void prvUpdateChannelStats( const sensor_reading_t * pxReading )
+{
+    SensorChannelStats_t * pxStats;
+    uint32_t i;
 
-    float max_voltage = 3.5f;
+    taskENTER_CRITICAL( &xChannelStatsLock );
 
+    for( i = 0; i < SENSOR_COUNT; i++ )
+    {
+        if( ( pxReading->valid_mask & SENSOR_MASK( i ) ) == 0 )
+        {
+            continue;
+        }
 
+        pxStats = &xChannelStats[ i ];
 
+        if( ( pxStats->ulCount == 0 ) || ( pxReading->value[ i ] < pxStats->xMin ) )
+        {
+            pxStats->xMin = pxReading->value[ i ];
+        }
 
-    float battery_voltage = 0.0f;
+        if( ( pxStats->ulCount == 0 ) || ( pxReading->value[ i ] > pxStats->xMax ) )
+        {
+            pxStats->xMax = pxReading->value[ i ];
+        }
 
-    if (read_VCELL(&battery_voltage) == ESP_OK) {
-        // printf("Battery voltage: %.2f%%\n", battery_voltage);
-    } 
-    else {
-        printf("Failed to read battery voltage\n");
+        pxStats->xSum += pxReading->value[ i ];
+        pxStats->ulCount++;
     }
 
-    int64_t time_us = esp_timer_get_time();   // microseconds since boot
-    double time_s = time_us / 1e6;            // convert to seconds
-    printf("Uptime: %.3f seconds\n", time_s);
+    taskEXIT_CRITICAL( &xChannelStatsLock );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for acquired readings: statistics, history, exposure
+ *        and alerts.
+ */
+void vHandleSensorReading( const sensor_reading_t * pxReading )
+{
+    prvUpdateChannelStats( pxReading );
+    vHistory_Add( pxReading );
+    vExposure_Add( pxReading );
+    vAlerts_Evaluate( pxReading );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Formats the exposure telemetry fields, each followed by a comma, or nothing until
+ *        the first minute has closed.
+ */
+static void prvFormatExposure( char * pcBuffer,
+                               size_t xBufferSize )
+{
+    ExposureSummary_t xExposure;
 
-    soc_ocv = calculate_soc(battery_voltage);
+    pcBuffer[ 0 ] = '\0';
+    vExposure_Get( &xExposure );
 
-    printf("Battery Life: %.2f%%\n", soc_ocv);
-    
+    if( xExposure.xValid )
+    {
+        ( void ) snprintf( pcBuffer, xBufferSize,
+                           "\"COTWA\":%.2f,\"COSTEL\":%.2f,\"COIndex\":%u,\"FlammableIndex\":%u,\"TVOCIndex\":%u,",
+                           xExposure.xCoTwa, xExposure.xCoStel, ( unsigned ) xExposure.usCoIndex,
+                           ( unsigned ) xExposure.usFlammableIndex, ( unsigned ) xExposure.usTvocIndex );
+    }
+}
+/*-----------------------------------------------------------*/
 
+/**
+ * @brief Formats one rollup bucket: each channel as [min,max,mean,last], channels without
+ *        samples left out, with the time of the start of its minute.
+ */
+static int prvFormatRollup( const RollupBucket_t * pxBucket,
+                            const char * pcExposure,
+                            char * pcBuffer,
+                            size_t xBufferSize )
+{
+    const RollupChannel_t * pxChannel;
+    const RollupChannel_t * pxBattery = &pxBucket->xChannels[ SENSOR_BATTERY_VOLTAGE ];
+    size_t xLength;
+    int lWritten;
+    uint32_t i;
+
+    lWritten = snprintf( pcBuffer, xBufferSize, "{" );
+
+    for( i = 0; ( i < SENSOR_COUNT ) && ( lWritten >= 0 ) && ( ( size_t ) lWritten < xBufferSize ); i++ )
+    {
+        pxChannel = &pxBucket->xChannels[ i ];
+
+        if( pxChannel->usCount == 0 )
+        {
+            continue;
+        }
+
+        xLength = ( size_t ) lWritten;
+        lWritten = snprintf( &pcBuffer[ xLength ], xBufferSize - xLength, "\"%s\":[%.2f,%.2f,%.2f,%.2f],",
+                             sensors_channel_name( ( sensor_channel_t ) i ),
+                             pxChannel->xMin, pxChannel->xMax, pxChannel->xSum / pxChannel->usCount, pxChannel->xLast );
+        lWritten = ( lWritten < 0 ) ? lWritten : ( int ) xLength + lWritten;
+    }
+
+    if( ( lWritten >= 0 ) && ( ( size_t ) lWritten < xBufferSize ) )
+    {
+        xLength = ( size_t ) lWritten;
+        lWritten = snprintf( &pcBuffer[ xLength ], xBufferSize - xLength,
+                             "\"BatteryLife\":%.2f,"
+                             "%s"
+                             "\"Seconds\":%d,"
+                             "\"Seq\":%u,"
+                             sampleazureiotTELEMETRY_TIMESTAMP "%013lld,"
+                             "\"TimeValid\":%d"
+                             "}",
+                             ( pxBattery->usCount > 0 ) ? calculate_soc( pxBattery->xLast ) : 0.0f,
+                             pcExposure,
+                             sampleazureiotROLLUP_SECONDS,
+                             ( unsigned ) ulTelemetrySequence,
+                             ( long long ) llSampleTime_ToUnixMs( pxBucket->llStartUs ),
+                             xSampleTime_IsSynchronized() ? 1 : 0 );
+        lWritten = ( lWritten < 0 ) ? lWritten : ( int ) xLength + lWritten;
+    }
+
+    return lWritten;
+}
+/*-----------------------------------------------------------*/
 
-    // float batteryLife = (battery_voltage / max_voltage) * 100;
+/**
+ * @brief Formats one reading taken now: channels that could not be read are left out, as
+ *        is the battery life when the fuel gauge could not be read.
+ */
+static int prvFormatReading( const sensor_reading_t * pxReading,
+                             const char * pcExposure,
+                             char * pcBuffer,
+                             size_t xBufferSize )
+{
+    size_t xLength;
+    int lWritten;
+    uint32_t i;
 
-    // printf("Battery charge: %.2f%%\n", batteryLife);
+    lWritten = snprintf( pcBuffer, xBufferSize, "{" );
 
+    for( i = 0; ( i < SENSOR_COUNT ) && ( lWritten >= 0 ) && ( ( size_t ) lWritten < xBufferSize ); i++ )
+    {
+        if( ( pxReading->valid_mask & SENSOR_MASK( i ) ) == 0 )
+        {
+            continue;
+        }
 
+        xLength = ( size_t ) lWritten;
+        lWritten = snprintf( &pcBuffer[ xLength ], xBufferSize - xLength, "\"%s\":%.2f,",
+                             sensors_channel_name( ( sensor_channel_t ) i ), pxReading->value[ i ] );
+        lWritten = ( lWritten < 0 ) ? lWritten : ( int ) xLength + lWritten;
+    }
 
+    if( ( pxReading->valid_mask & SENSOR_MASK( SENSOR_BATTERY_VOLTAGE ) ) &&
+        ( lWritten >= 0 ) && ( ( size_t ) lWritten < xBufferSize ) )
+    {
+        xLength = ( size_t ) lWritten;
+        lWritten = snprintf( &pcBuffer[ xLength ], xBufferSize - xLength, "\"BatteryLife\":%.2f,",
+                             calculate_soc( pxReading->value[ SENSOR_BATTERY_VOLTAGE ] ) );
+        lWritten = ( lWritten < 0 ) ? lWritten : ( int ) xLength + lWritten;
+    }
 
-    esp_err_t tvoc_ret = read_tvoc(&tvoc); // read tvoc
-    if (tvoc_ret == ESP_OK) {
-        ESP_LOGI(TVOC_TAG, "TVOC concentration: %.2f ppb", tvoc);
-    } else {
-        ESP_LOGE(TVOC_TAG, "Failed to read TVOC (err=0x%x: %s)",
-        tvoc_ret, esp_err_to_name(tvoc_ret));
+    if( ( lWritten >= 0 ) && ( ( size_t ) lWritten < xBufferSize ) )
+    {
+        xLength = ( size_t ) lWritten;
+        lWritten = snprintf( &pcBuffer[ xLength ], xBufferSize - xLength,
+                             "%s"
+                             "\"Seq\":%u,"
+                             sampleazureiotTELEMETRY_TIMESTAMP "%013lld,"
+                             "\"TimeValid\":%d"
+                             "}",
+                             pcExposure,
+                             ( unsigned ) ulTelemetrySequence,
+                             ( long long ) llSampleTime_ToUnixMs( pxReading->timestamp_us ),
+                             xSampleTime_IsSynchronized() ? 1 : 0 );
+        lWritten = ( lWritten < 0 ) ? lWritten : ( int ) xLength + lWritten;
     }
 
+    return lWritten;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for generating Telemetry payload: the oldest closed
+ *        rollup bucket when the rollup engine runs, otherwise a reading taken now.
+ */
+uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
+                            uint32_t ulTelemetryDataSize,
+                            uint32_t * ulTelemetryDataLength )
+{
+    sensor_reading_t xReading;
+    RollupBucket_t xBucket;
+    char cExposure[ 112 ];
+    int result;
 
+    *ulTelemetryDataLength = 0;
 
+    if( xRollup_Enabled() )
+    {
+        if( !xRollup_Pop( &xBucket ) )
+        {
+            return 0;
+        }
 
+        prvFormatExposure( cExposure, sizeof( cExposure ) );
+        result = prvFormatRollup( &xBucket, cExposure, ( char * ) pucTelemetryData, ulTelemetryDataSize );
+    }
+    else
+    {
+        if( sensors_read( SENSOR_MASK_ALL, &xReading ) != ESP_OK )
+        {
+            LogWarn( ( "Some sensors could not be read, leaving them out (valid mask 0x%02x)",
+                       ( unsigned ) xReading.valid_mask ) );
+        }
 
+        vHandleSensorReading( &xReading );
+        prvFormatExposure( cExposure, sizeof( cExposure ) );
 
+        if( xReading.valid_mask & SENSOR_MASK( SENSOR_BATTERY_VOLTAGE ) )
+        {
+            ESP_LOGI( TAG_RSOC, "Battery Life: %.2f%%", calculate_soc( xReading.value[ SENSOR_BATTERY_VOLTAGE ] ) );
+        }
 
-    
-    int result = snprintf((char *)pucTelemetryData, ulTelemetryDataSize,
-                          "{"
-                          "\"Temperature\":%.2f,"
-                          "\"Humidity\":%.2f,"
-                          "\"FlammableGases\":%.2f,"
-                          "\"TVOC\":%.2f,"
-                          "\"CO\":%.2f,"
-                          "\"BatteryLife\":%.2f,"
-                          "\"VCELL\":%.2f"
-                          "}",
-                          temperature, humidity, flammableGases, tvoc, co, soc_ocv, battery_voltage);
+        result = prvFormatReading( &xReading, cExposure, ( char * ) pucTelemetryData, ulTelemetryDataSize );
+    }
 
     if( ( result >= 0 ) && ( result < ulTelemetryDataSize ) )
     {
         *ulTelemetryDataLength = result;
+        ulTelemetrySequence++;
         result = 0;
     }
     else
     {
         result = 1;
     }
-    //T I M E 
 
-    // vTaskDelay(pdMS_TO_TICKS(1000 * 9));
+    return result;
+}
+/*-----------------------------------------------------------*/
 
-    // eeepyy sleepy sleepy
+/**
+ * @brief Implements the sample interface telling whether more telemetry is ready: rollup
+ *        buckets that closed and were not reported yet.
+ */
+bool xTelemetryPending( void )
+{
+    return ulRollup_Count() > 0;
+}
+/*-----------------------------------------------------------*/
 
-    // esp_sleep_enable_timer_wakeup(30 * 1000000); // wake after 30 sec
-    // esp_light_sleep_start();
+/**
+ * @brief Finds a string in a payload that is not NUL-terminated.
+ */
+static uint8_t * prvFind( uint8_t * pucData,
+                          uint32_t ulLength,
+                          const char * pcNeedle )
+{
+    uint32_t ulNeedleLength = strlen( pcNeedle );
+    uint32_t i;
 
-    return result;
+    for( i = 0; i + ulNeedleLength <= ulLength; i++ )
+    {
+        if( memcmp( &pucData[ i ], pcNeedle, ulNeedleLength ) == 0 )
+        {
+            return &pucData[ i ];
+        }
+    }
 
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for finalizing a telemetry payload: rewrites
+ *        timestamps estimated before the first clock synchronization.
+ */
+void vPrepareTelemetryForSend( uint8_t * pucTelemetryData,
+                               uint32_t ulTelemetryDataLength )
+{
+    char cDigits[ sampleazureiotTELEMETRY_TIMESTAMP_DIGITS + 1 ];
+    uint8_t * pucFlag;
+    uint8_t * pucTimestamp;
+    int64_t llTimestampMs;
+
+    if( !xSampleTime_IsSynchronized() ||
+        ( ( pucFlag = prvFind( pucTelemetryData, ulTelemetryDataLength, sampleazureiotTELEMETRY_TIME_ESTIMATED ) ) == NULL ) )
+    {
+        return;
+    }
 
+    pucTimestamp = prvFind( pucTelemetryData, ulTelemetryDataLength, sampleazureiotTELEMETRY_TIMESTAMP );
+
+    if( ( pucTimestamp != NULL ) &&
+        ( pucTimestamp + sizeof( sampleazureiotTELEMETRY_TIMESTAMP ) - 1 + sampleazureiotTELEMETRY_TIMESTAMP_DIGITS <=
+          pucTelemetryData + ulTelemetryDataLength ) )
+    {
+        pucTimestamp += sizeof( sampleazureiotTELEMETRY_TIMESTAMP ) - 1;
+        ( void ) memcpy( cDigits, pucTimestamp, sampleazureiotTELEMETRY_TIMESTAMP_DIGITS );
+        cDigits[ sampleazureiotTELEMETRY_TIMESTAMP_DIGITS ] = '\0';
+
+        llTimestampMs = llSampleTime_CorrectMs( strtoll( cDigits, NULL, 10 ) );
+
+        if( ( llTimestampMs >= 0 ) &&
+            ( snprintf( cDigits, sizeof( cDigits ), "%013lld", ( long long ) llTimestampMs ) == sampleazureiotTELEMETRY_TIMESTAMP_DIGITS ) )
+        {
+            ( void ) memcpy( pucTimestamp, cDigits, sampleazureiotTELEMETRY_TIMESTAMP_DIGITS );
+            pucFlag[ sizeof( sampleazureiotTELEMETRY_TIME_ESTIMATED ) - 2 ] = '1';
+        }
+    }
 }
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Implements the sample interface for generating reported properties payload.
+ * @brief Implements the sample interface for generating reported properties payload:
+ *        a patch with the properties that changed since the hub last acknowledged them.
  */
 uint32_t ulCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
                                            uint32_t ulPropertiesDataSize )
 {
-    return prvGetNewMaxTemp( xDeviceCurrentTemperature, pucPropertiesData, ulPropertiesDataSize );
+    return ulReportedProperties_BuildPatch( xReportedProperties,
+                                            sizeof( xReportedProperties ) / sizeof( xReportedProperties[ 0 ] ),
+                                            pucPropertiesData, ulPropertiesDataSize );
 }
 
 /*-----------------------------------------------------------*/
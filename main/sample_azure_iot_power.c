@@ -0,0 +1,190 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_power.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* For azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS. */
+#include "azure_iot_hub_client.h"
+/*-----------------------------------------------------------*/
+
+#ifndef azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS
+    #define azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS    ( 60 * 4 )
+#endif
+
+/**
+ * @brief Beacon interval assumed for the listen interval, 100 TU.
+ */
+#define powerBEACON_INTERVAL_US                         ( 102400U )
+
+/**
+ * @brief Longest listen interval allowed: a quarter of the keep-alive, the period at which
+ *        the network task services the connection.
+ */
+#define powerMAX_LISTEN_INTERVAL                        ( ( azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS * 1000000ULL / 4U ) / powerBEACON_INTERVAL_US )
+
+#if CONFIG_SAMPLE_IOT_WIFI_MODEM_SLEEP && ( CONFIG_SAMPLE_IOT_WIFI_LISTEN_INTERVAL > powerMAX_LISTEN_INTERVAL )
+    #error "The Wi-Fi listen interval must not exceed a quarter of the MQTT keep-alive."
+#endif
+/*-----------------------------------------------------------*/
+
+#if CONFIG_PM_ENABLE
+    static esp_pm_lock_handle_t xPmLocks[ ePowerLockCount ];
+
+    static const char * const pcLockNames[ ePowerLockCount ] =
+    {
+        "sensors",
+        "network",
+    };
+#endif
+
+static uint32_t ulBusyCount = 0;
+static int64_t llBusySinceUs = 0;
+static int64_t llBusyAccumulatedUs = 0;
+static int64_t llWindowStartUs = 0;
+
+static portMUX_TYPE xPowerLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+void vPower_Init( void )
+{
+    #if CONFIG_PM_ENABLE
+        uint32_t i;
+        esp_err_t xErr;
+
+        #if CONFIG_SAMPLE_IOT_PM_PROFILE
+            esp_pm_config_t xPmConfig =
+            {
+                .max_freq_mhz       = CONFIG_SAMPLE_IOT_PM_MAX_CPU_FREQ_MHZ,
+                .min_freq_mhz       = CONFIG_SAMPLE_IOT_PM_MIN_CPU_FREQ_MHZ,
+                #if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+                    .light_sleep_enable = true
+                #else
+                    .light_sleep_enable = false
+                #endif
+            };
+
+            if( ( xErr = esp_pm_configure( &xPmConfig ) ) != ESP_OK )
+            {
+                LogError( ( "esp_pm_configure failed: %s", esp_err_to_name( xErr ) ) );
+            }
+            else
+            {
+                LogInfo( ( "Power management: %d-%d MHz, light sleep %s",
+                           CONFIG_SAMPLE_IOT_PM_MIN_CPU_FREQ_MHZ, CONFIG_SAMPLE_IOT_PM_MAX_CPU_FREQ_MHZ,
+                           xPmConfig.light_sleep_enable ? "on" : "off (needs FREERTOS_USE_TICKLESS_IDLE)" ) );
+            }
+        #endif /* CONFIG_SAMPLE_IOT_PM_PROFILE */
+
+        for( i = 0; i < ePowerLockCount; i++ )
+        {
+            if( ( xErr = esp_pm_lock_create( ESP_PM_CPU_FREQ_MAX, 0, pcLockNames[ i ], &xPmLocks[ i ] ) ) != ESP_OK )
+            {
+                LogError( ( "Failed to create PM lock %s: %s", pcLockNames[ i ], esp_err_to_name( xErr ) ) );
+                xPmLocks[ i ] = NULL;
+            }
+        }
+    #else /* CONFIG_PM_ENABLE */
+        LogWarn( ( "CONFIG_PM_ENABLE is not set, running without power management." ) );
+    #endif /* CONFIG_PM_ENABLE */
+
+    llWindowStartUs = esp_timer_get_time();
+}
+/*-----------------------------------------------------------*/
+
+void vPower_Acquire( PowerLock_t xLock )
+{
+    configASSERT( xLock < ePowerLockCount );
+
+    #if CONFIG_PM_ENABLE
+        if( xPmLocks[ xLock ] != NULL )
+        {
+            ( void ) esp_pm_lock_acquire( xPmLocks[ xLock ] );
+        }
+    #endif
+
+    taskENTER_CRITICAL( &xPowerLock );
+
+    if( ulBusyCount++ == 0 )
+    {
+        llBusySinceUs = esp_timer_get_time();
+    }
+
+    taskEXIT_CRITICAL( &xPowerLock );
+}
+/*-----------------------------------------------------------*/
+
+void vPower_Release( PowerLock_t xLock )
+{
+    configASSERT( xLock < ePowerLockCount );
+
+    taskENTER_CRITICAL( &xPowerLock );
+
+    if( ( ulBusyCount > 0 ) && ( --ulBusyCount == 0 ) )
+    {
+        llBusyAccumulatedUs += esp_timer_get_time() - llBusySinceUs;
+    }
+
+    taskEXIT_CRITICAL( &xPowerLock );
+
+    #if CONFIG_PM_ENABLE
+        if( xPmLocks[ xLock ] != NULL )
+        {
+            ( void ) esp_pm_lock_release( xPmLocks[ xLock ] );
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+uint16_t usPower_WifiListenInterval( void )
+{
+    #if CONFIG_SAMPLE_IOT_WIFI_MODEM_SLEEP
+        return ( uint16_t ) CONFIG_SAMPLE_IOT_WIFI_LISTEN_INTERVAL;
+    #else
+        return 0;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulPower_AverageCurrentUa( void )
+{
+    int64_t llNowUs;
+    int64_t llWindowUs;
+    int64_t llBusyUs;
+
+    taskENTER_CRITICAL( &xPowerLock );
+
+    llNowUs = esp_timer_get_time();
+    llBusyUs = llBusyAccumulatedUs;
+
+    if( ulBusyCount > 0 )
+    {
+        llBusyUs += llNowUs - llBusySinceUs;
+        llBusySinceUs = llNowUs;
+    }
+
+    llWindowUs = llNowUs - llWindowStartUs;
+    llWindowStartUs = llNowUs;
+    llBusyAccumulatedUs = 0;
+
+    taskEXIT_CRITICAL( &xPowerLock );
+
+    if( llWindowUs <= 0 )
+    {
+        return 0;
+    }
+
+    return ( uint32_t ) ( ( llBusyUs * CONFIG_SAMPLE_IOT_ACTIVE_CURRENT_MA * 1000LL +
+                            ( llWindowUs - llBusyUs ) * ( int64_t ) CONFIG_SAMPLE_IOT_IDLE_CURRENT_UA ) / llWindowUs );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Power-management profile: dynamic frequency scaling, automatic light sleep and
+ *        Wi-Fi modem sleep, with PM locks held by the sensor and network paths only while busy.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_POWER_H
+#define SAMPLE_AZURE_IOT_POWER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Activities that keep the CPU at full speed and out of light sleep while they run.
+ */
+typedef enum PowerLock
+{
+    ePowerLockSensors = 0, /**< Sensor acquisition. */
+    ePowerLockNetwork,     /**< Connection handling, publishing and message processing. */
+    ePowerLockCount
+} PowerLock_t;
+
+/**
+ * @brief Configures esp_pm and creates the PM locks. Call once from app_main, before Wi-Fi starts.
+ *
+ * Without CONFIG_PM_ENABLE the locks are still tracked for the current estimate, but have no effect.
+ */
+void vPower_Init( void );
+
+/**
+ * @brief Marks an activity busy. Calls nest; each must be matched by vPower_Release().
+ */
+void vPower_Acquire( PowerLock_t xLock );
+
+/**
+ * @brief Marks an activity idle again.
+ */
+void vPower_Release( PowerLock_t xLock );
+
+/**
+ * @brief Wi-Fi listen interval, in beacon intervals, for modem sleep.
+ *
+ * The configured value, capped so that traffic buffered by the access point is fetched
+ * well within the MQTT keep-alive period. 0 (driver default) when modem sleep is disabled.
+ */
+uint16_t usPower_WifiListenInterval( void );
+
+/**
+ * @brief Estimates the average current since the previous call (or since boot).
+ *
+ * Time during which any lock was held is counted at the active current, the rest at the
+ * configured idle current (light sleep or modem sleep).
+ *
+ * @return uint32_t Average current in microamperes.
+ */
+uint32_t ulPower_AverageCurrentUa( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_POWER_H */
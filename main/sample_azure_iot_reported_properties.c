@@ -0,0 +1,175 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_reported_properties.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_duty_cycle.h"
+/*-----------------------------------------------------------*/
+
+typedef struct ReportedValue
+{
+    uint8_t ucLength; /**< 0 if there is no value. */
+    uint8_t ucValue[ sampleazureiotREPORTED_PROPERTY_VALUE_MAX_SIZE ];
+} ReportedValue_t;
+
+/* Values the hub acknowledged. Kept in RTC memory in duty-cycle mode so that
+ * unchanged properties are not sent again on every wake-up. */
+static sampleazureiotRETAINED ReportedValue_t xAcknowledged[ sampleazureiotREPORTED_PROPERTIES_MAX ];
+
+/* Values of the last built patch, and which properties it carries. */
+static ReportedValue_t xPending[ sampleazureiotREPORTED_PROPERTIES_MAX ];
+static uint32_t ulPendingMask = 0;
+
+static bool xPatchInFlight = false;
+static uint32_t ulInFlightRequestId = 0;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Serializes the current value of a property into `pxValue`.
+ */
+static bool prvProduceValue( const ReportedProperty_t * pxProperty,
+                             ReportedValue_t * pxValue )
+{
+    AzureIoTJSONWriter_t xWriter;
+    int32_t lBytesWritten;
+
+    pxValue->ucLength = 0;
+
+    if( ( AzureIoTJSONWriter_Init( &xWriter, pxValue->ucValue, sizeof( pxValue->ucValue ) ) != eAzureIoTSuccess ) ||
+        ( pxProperty->xProducer( &xWriter ) != eAzureIoTSuccess ) ||
+        ( ( lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter ) ) <= 0 ) )
+    {
+        LogError( ( "Failed to produce reported property %s", pxProperty->pcName ) );
+        return false;
+    }
+
+    pxValue->ucLength = ( uint8_t ) lBytesWritten;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulReportedProperties_BuildPatch( const ReportedProperty_t * pxProperties,
+                                          uint32_t ulCount,
+                                          uint8_t * pucPayload,
+                                          uint32_t ulPayloadSize )
+{
+    AzureIoTJSONWriter_t xWriter;
+    AzureIoTResult_t xResult;
+    int32_t lBytesWritten;
+    uint32_t i;
+
+    configASSERT( ulCount <= sampleazureiotREPORTED_PROPERTIES_MAX );
+
+    /* Values that change while a patch is in flight go into the next one. */
+    if( xPatchInFlight )
+    {
+        return 0;
+    }
+
+    ulPendingMask = 0;
+
+    xResult = AzureIoTJSONWriter_Init( &xWriter, pucPayload, ulPayloadSize );
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
+    }
+
+    for( i = 0; ( i < ulCount ) && ( xResult == eAzureIoTSuccess ); i++ )
+    {
+        if( !prvProduceValue( &pxProperties[ i ], &xPending[ i ] ) ||
+            ( ( xPending[ i ].ucLength == xAcknowledged[ i ].ucLength ) &&
+              ( memcmp( xPending[ i ].ucValue, xAcknowledged[ i ].ucValue, xPending[ i ].ucLength ) == 0 ) ) )
+        {
+            continue;
+        }
+
+        if( ( xResult = AzureIoTJSONWriter_AppendPropertyName( &xWriter, ( const uint8_t * ) pxProperties[ i ].pcName,
+                                                               strlen( pxProperties[ i ].pcName ) ) ) == eAzureIoTSuccess )
+        {
+            xResult = AzureIoTJSONWriter_AppendJSONText( &xWriter, xPending[ i ].ucValue, xPending[ i ].ucLength );
+        }
+
+        ulPendingMask |= ( 1UL << i );
+    }
+
+    if( ( xResult == eAzureIoTSuccess ) && ( ulPendingMask != 0 ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
+    }
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "Failed to build the reported properties patch: result 0x%08x", ( uint16_t ) xResult ) );
+        ulPendingMask = 0;
+    }
+
+    if( ( ulPendingMask == 0 ) || ( ( lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter ) ) <= 0 ) )
+    {
+        return 0;
+    }
+
+    return ( uint32_t ) lBytesWritten;
+}
+/*-----------------------------------------------------------*/
+
+void vReportedProperties_Sent( uint32_t ulRequestId )
+{
+    xPatchInFlight = true;
+    ulInFlightRequestId = ulRequestId;
+}
+/*-----------------------------------------------------------*/
+
+void vReportedProperties_HandleResponse( uint32_t ulRequestId,
+                                         bool xAccepted )
+{
+    uint32_t i;
+
+    if( !xPatchInFlight || ( ulRequestId != ulInFlightRequestId ) )
+    {
+        /* Answer to the acknowledgement of a writable property, or to a cancelled patch. */
+        return;
+    }
+
+    if( xAccepted )
+    {
+        for( i = 0; i < sampleazureiotREPORTED_PROPERTIES_MAX; i++ )
+        {
+            if( ( ulPendingMask & ( 1UL << i ) ) != 0 )
+            {
+                xAcknowledged[ i ] = xPending[ i ];
+            }
+        }
+    }
+    else
+    {
+        LogWarn( ( "Reported properties patch %u rejected, it will be sent again.", ( unsigned ) ulRequestId ) );
+    }
+
+    xPatchInFlight = false;
+    ulPendingMask = 0;
+}
+/*-----------------------------------------------------------*/
+
+bool xReportedProperties_InFlight( void )
+{
+    return xPatchInFlight;
+}
+/*-----------------------------------------------------------*/
+
+void vReportedProperties_CancelPending( void )
+{
+    xPatchInFlight = false;
+    ulPendingMask = 0;
+}
+/*-----------------------------------------------------------*/
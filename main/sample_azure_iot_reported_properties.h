@@ -0,0 +1,87 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Reported properties sent as diffs.
+ *        Remembers the last value the hub acknowledged for each property, coalesces the
+ *        properties whose value changed into a single patch, and keeps at most one patch
+ *        in flight until the hub answers it.
+ *
+ * @remark All functions must be called from the task that runs AzureIoTHubClient_ProcessLoop.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_REPORTED_PROPERTIES_H
+#define SAMPLE_AZURE_IOT_REPORTED_PROPERTIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_json_writer.h"
+
+/**
+ * @brief Largest number of reported properties tracked.
+ */
+#define sampleazureiotREPORTED_PROPERTIES_MAX            6
+
+/**
+ * @brief Largest serialized value of one property, in bytes.
+ */
+#define sampleazureiotREPORTED_PROPERTY_VALUE_MAX_SIZE    48
+
+/**
+ * @brief Appends the current value of a property (any JSON value) to `pxWriter`.
+ */
+typedef AzureIoTResult_t ( * ReportedPropertyProducer_t )( AzureIoTJSONWriter_t * pxWriter );
+
+/**
+ * @brief One reported property: its name in the properties document and the producer of its value.
+ */
+typedef struct ReportedProperty
+{
+    const char * pcName;
+    ReportedPropertyProducer_t xProducer;
+} ReportedProperty_t;
+
+/**
+ * @brief Builds a patch with the properties whose value differs from the last acknowledged one.
+ *
+ * @param[in]  pxProperties  Table of properties, always passed in the same order.
+ * @param[in]  ulCount       Number of entries in `pxProperties`, at most sampleazureiotREPORTED_PROPERTIES_MAX.
+ * @param[out] pucPayload    Buffer receiving the patch.
+ * @param[in]  ulPayloadSize Size of `pucPayload`.
+ *
+ * @return uint32_t Length of the patch, 0 if nothing changed or a patch is still in flight.
+ */
+uint32_t ulReportedProperties_BuildPatch( const ReportedProperty_t * pxProperties,
+                                          uint32_t ulCount,
+                                          uint8_t * pucPayload,
+                                          uint32_t ulPayloadSize );
+
+/**
+ * @brief Marks the last built patch as published.
+ *
+ * @param[in] ulRequestId  Request ID returned by AzureIoTHubClient_SendPropertiesReported.
+ */
+void vReportedProperties_Sent( uint32_t ulRequestId );
+
+/**
+ * @brief Handles the hub's answer to a reported properties patch.
+ *
+ * @param[in] ulRequestId  Request ID of the answered patch.
+ * @param[in] xAccepted    true if the hub stored the patch, in which case its values become
+ *                         the acknowledged ones. A rejected patch is built again next time.
+ */
+void vReportedProperties_HandleResponse( uint32_t ulRequestId,
+                                         bool xAccepted );
+
+/**
+ * @brief Whether a patch was published and is waiting for the hub's answer.
+ */
+bool xReportedProperties_InFlight( void );
+
+/**
+ * @brief Forgets the patch in flight, whose answer is lost with the connection.
+ */
+void vReportedProperties_CancelPending( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_REPORTED_PROPERTIES_H */
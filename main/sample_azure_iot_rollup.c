@@ -0,0 +1,186 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_rollup.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_pnp_data_if.h"
+#include "sample_azure_iot_sampling.h"
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_ROLLUPS
+
+    #define rollupUS_PER_BUCKET    ( sampleazureiotROLLUP_SECONDS * 1000000LL )
+
+/* Closed buckets, oldest at ulHead. */
+    static RollupBucket_t xBuckets[ CONFIG_SAMPLE_IOT_ROLLUP_DEPTH ];
+    static uint32_t ulHead = 0;
+    static uint32_t ulCount = 0;
+    static uint32_t ulDropped = 0;
+
+/* Bucket in progress. */
+    static RollupBucket_t xCurrent;
+    static bool xCurrentOpen = false;
+
+/* Guards the ring and the bucket in progress, filled by both sampling workers. */
+    static portMUX_TYPE xRollupLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Moves the bucket in progress into the ring. Called with xRollupLock held.
+ */
+    static void prvCloseBucket( void )
+    {
+        if( ulCount == CONFIG_SAMPLE_IOT_ROLLUP_DEPTH )
+        {
+            ulHead = ( ulHead + 1 ) % CONFIG_SAMPLE_IOT_ROLLUP_DEPTH;
+            ulCount--;
+            ulDropped++;
+        }
+
+        xBuckets[ ( ulHead + ulCount ) % CONFIG_SAMPLE_IOT_ROLLUP_DEPTH ] = xCurrent;
+        ulCount++;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Folds a reading into the bucket of its minute, closing the previous bucket first.
+ *        A reading that started before the minute in progress, e.g. a slow read finishing
+ *        after a faster one, is counted in it.
+ */
+    static void prvAdd( const sensor_reading_t * pxReading )
+    {
+        int64_t llStartUs = pxReading->timestamp_us - ( pxReading->timestamp_us % rollupUS_PER_BUCKET );
+        RollupChannel_t * pxChannel;
+        float xValue;
+        uint32_t i;
+
+        taskENTER_CRITICAL( &xRollupLock );
+
+        if( xCurrentOpen && ( llStartUs > xCurrent.llStartUs ) )
+        {
+            prvCloseBucket();
+            xCurrentOpen = false;
+        }
+
+        if( !xCurrentOpen )
+        {
+            ( void ) memset( &xCurrent, 0, sizeof( xCurrent ) );
+            xCurrent.llStartUs = llStartUs;
+            xCurrentOpen = true;
+        }
+
+        for( i = 0; i < SENSOR_COUNT; i++ )
+        {
+            if( ( pxReading->valid_mask & SENSOR_MASK( i ) ) == 0 )
+            {
+                continue;
+            }
+
+            pxChannel = &xCurrent.xChannels[ i ];
+            xValue = pxReading->value[ i ];
+
+            if( ( pxChannel->usCount == 0 ) || ( xValue < pxChannel->xMin ) )
+            {
+                pxChannel->xMin = xValue;
+            }
+
+            if( ( pxChannel->usCount == 0 ) || ( xValue > pxChannel->xMax ) )
+            {
+                pxChannel->xMax = xValue;
+            }
+
+            pxChannel->xSum += xValue;
+            pxChannel->xLast = xValue;
+            pxChannel->usCount++;
+        }
+
+        taskEXIT_CRITICAL( &xRollupLock );
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvOnReading( const sensor_reading_t * pxReading )
+    {
+        prvAdd( pxReading );
+        vHandleSensorReading( pxReading );
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* CONFIG_SAMPLE_IOT_ROLLUPS */
+
+void vRollup_Start( void )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        vSampling_Start( prvOnReading );
+
+        LogInfo( ( "Sampling every %d s%s, battery every %d s, into %d s rollups, %d kept.",
+                   CONFIG_SAMPLE_IOT_SAMPLE_PERIOD_SECONDS, xSampling_Adaptive() ? " (gas and TVOC adaptive)" : "",
+                   CONFIG_SAMPLE_IOT_BATTERY_PERIOD_SECONDS, sampleazureiotROLLUP_SECONDS, CONFIG_SAMPLE_IOT_ROLLUP_DEPTH ) );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+bool xRollup_Enabled( void )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        return true;
+    #else
+        return false;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+bool xRollup_Pop( RollupBucket_t * pxBucket )
+{
+    bool xFound = false;
+
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        taskENTER_CRITICAL( &xRollupLock );
+
+        if( ulCount > 0 )
+        {
+            *pxBucket = xBuckets[ ulHead ];
+            ulHead = ( ulHead + 1 ) % CONFIG_SAMPLE_IOT_ROLLUP_DEPTH;
+            ulCount--;
+            xFound = true;
+        }
+
+        taskEXIT_CRITICAL( &xRollupLock );
+    #else
+        ( void ) pxBucket;
+    #endif
+
+    return xFound;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulRollup_Count( void )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        return ulCount;
+    #else
+        return 0;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulRollup_Dropped( void )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        return ulDropped;
+    #else
+        return 0;
+    #endif
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,75 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Internal sampling and 1-minute rollups.
+ *        Each channel is read on its own timer-driven schedule (sample_azure_iot_sampling.h)
+ *        and the readings are folded into one bucket per minute (min, max, mean, last). Closed buckets wait in a fixed ring until the next report drains them, so
+ *        sensing resolution does not depend on the reporting interval and memory stays
+ *        bounded; when the ring is full the oldest bucket is dropped.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ROLLUP_H
+#define SAMPLE_AZURE_IOT_ROLLUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/**
+ * @brief Length of a bucket, in seconds.
+ */
+#define sampleazureiotROLLUP_SECONDS    60
+
+/**
+ * @brief Statistics of one channel over a bucket.
+ */
+typedef struct RollupChannel
+{
+    float xMin;
+    float xMax;
+    float xSum;
+    float xLast;
+    uint16_t usCount; /**< Samples in the bucket, 0 if the channel could not be read. */
+} RollupChannel_t;
+
+/**
+ * @brief One closed bucket.
+ */
+typedef struct RollupBucket
+{
+    int64_t llStartUs; /**< esp_timer time at which the bucket's minute started. */
+    RollupChannel_t xChannels[ SENSOR_COUNT ];
+} RollupBucket_t;
+
+/**
+ * @brief Starts the sampling task. Does nothing unless CONFIG_SAMPLE_IOT_ROLLUPS is set.
+ */
+void vRollup_Start( void );
+
+/**
+ * @brief Whether the rollup engine is enabled, in which case telemetry carries rollups.
+ */
+bool xRollup_Enabled( void );
+
+/**
+ * @brief Removes the oldest closed bucket.
+ *
+ * @param[out] pxBucket  The bucket.
+ *
+ * @return bool false if no bucket has closed since the last call.
+ */
+bool xRollup_Pop( RollupBucket_t * pxBucket );
+
+/**
+ * @brief Number of closed buckets waiting to be reported.
+ */
+uint32_t ulRollup_Count( void );
+
+/**
+ * @brief Number of buckets dropped because the ring was full.
+ */
+uint32_t ulRollup_Dropped( void );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_ROLLUP_H */
@@ -0,0 +1,648 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_sampling.h"
+
+/* Standard includes. */
+#include <math.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sdkconfig.h"
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "mq_heater.h"
+#include "sample_azure_iot_metrics.h"
+#include "sample_azure_iot_time.h"
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_ROLLUPS
+
+    #define samplingBASE_PERIOD_US         ( CONFIG_SAMPLE_IOT_SAMPLE_PERIOD_SECONDS * 1000000LL )
+    #define samplingBATTERY_PERIOD_US      ( CONFIG_SAMPLE_IOT_BATTERY_PERIOD_SECONDS * 1000000LL )
+
+    #if CONFIG_SAMPLE_IOT_ADAPTIVE_SAMPLING
+        #if ( CONFIG_SAMPLE_IOT_ADAPTIVE_MIN_PERIOD_MS > CONFIG_SAMPLE_IOT_SAMPLE_PERIOD_SECONDS * 1000 ) || \
+        ( CONFIG_SAMPLE_IOT_ADAPTIVE_MAX_PERIOD_SECONDS < CONFIG_SAMPLE_IOT_SAMPLE_PERIOD_SECONDS )
+            #error "The adaptive sampling bounds must include the sampling period."
+        #endif
+
+        #define samplingMIN_PERIOD_US      ( CONFIG_SAMPLE_IOT_ADAPTIVE_MIN_PERIOD_MS * 1000LL )
+        #define samplingMAX_PERIOD_US      ( CONFIG_SAMPLE_IOT_ADAPTIVE_MAX_PERIOD_SECONDS * 1000000LL )
+    #else
+        #define samplingMIN_PERIOD_US      samplingBASE_PERIOD_US
+        #define samplingMAX_PERIOD_US      samplingBASE_PERIOD_US
+    #endif
+
+/**
+ * @brief Time constant of the baseline and variance, so that they do not depend on the period.
+ */
+    #define samplingBASELINE_TAU_SECONDS   ( 120.0f )
+
+/**
+ * @brief Consecutive flat samples before the period is doubled.
+ */
+    #define samplingQUIET_SAMPLES          ( 4U )
+
+    #define samplingWORKER_STACK_SIZE      ( 4096U )
+    #define samplingWORKER_PRIORITY        ( tskIDLE_PRIORITY + 1 )
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Worker tasks, one per bus; sensors.c serialises reads per bus only.
+ */
+    typedef enum SamplingWorker
+    {
+        eSamplingWorkerAdc = 0, /**< MQ2 and MQ7. */
+        eSamplingWorkerI2c,     /**< Temperature and humidity, TVOC, fuel gauge. */
+        eSamplingWorkerCount
+    } SamplingWorker_t;
+
+/**
+ * @brief Channels read together, on a schedule of their own. Reads happen when the wall clock,
+ *        minus the phase, is a multiple of the period.
+ */
+    typedef struct SamplingSource
+    {
+        uint32_t ulMask;
+        SamplingWorker_t xWorker;
+        int64_t llPhaseUs;
+        int64_t llBasePeriodUs;  /**< Fixed-rate period, and the period to start with. */
+        int64_t llPeriodUs;      /**< Current period, changed by the adaptation. */
+        int64_t llDueUs;         /**< esp_timer time of the next read. */
+        int64_t llDueUnixUs;     /**< The same, as the wall-clock boundary it was computed from. */
+        esp_timer_handle_t xTimer;
+        sensor_rail_t xRail;     /**< Supply of the sensor, SENSOR_RAIL_NONE if always on. */
+        int64_t llSettleUs;      /**< Lead time to power the sensor up before a read, 0 if not gated. */
+        bool xPowered;           /**< Whether this source holds its rail on. */
+    } SamplingSource_t;
+
+/**
+ * @brief Schedule, signal state and counters of one channel.
+ */
+    typedef struct SamplingChannel
+    {
+        float xStep;                 /**< Smallest significant change; 0 for channels at a fixed period. */
+        int64_t llLastUs;            /**< Time of the last sample, 0 before the first. */
+        float xLast;
+        float xBaseline;
+        float xVariance;
+        uint32_t ulQuiet;
+        bool xInExcursion;
+        int64_t llExcursionStartUs;  /**< Scheduled wall-clock time of the first sample of the excursion. */
+        int64_t llExcursionEndUs;    /**< Scheduled wall-clock time of its last sample so far. */
+        uint32_t ulSamples;
+        uint64_t ullEnergyUj;
+        uint32_t ulExcursions;
+        uint32_t ulMissedAtFixedRate;
+    } SamplingChannel_t;
+
+/* Phases stagger the reads of each bus, so that they do not queue behind each other. */
+    static SamplingSource_t xSources[] =
+    {
+        {
+            .ulMask = SENSOR_MASK( SENSOR_TEMPERATURE ) | SENSOR_MASK( SENSOR_HUMIDITY ),
+            .xWorker = eSamplingWorkerI2c, .llPhaseUs = 0, .llBasePeriodUs = samplingBASE_PERIOD_US
+        },
+        {
+            .ulMask = SENSOR_MASK( SENSOR_TVOC ),
+            .xWorker = eSamplingWorkerI2c, .llPhaseUs = 250000, .llBasePeriodUs = samplingBASE_PERIOD_US
+        },
+        {
+            .ulMask = SENSOR_MASK( SENSOR_BATTERY_VOLTAGE ),
+            .xWorker = eSamplingWorkerI2c, .llPhaseUs = 500000, .llBasePeriodUs = samplingBATTERY_PERIOD_US
+        },
+        {
+            .ulMask = SENSOR_MASK( SENSOR_FLAMMABLE_GAS ),
+            .xWorker = eSamplingWorkerAdc, .llPhaseUs = 0, .llBasePeriodUs = samplingBASE_PERIOD_US
+        },
+        {
+            .ulMask = SENSOR_MASK( SENSOR_CO ),
+            .xWorker = eSamplingWorkerAdc, .llPhaseUs = 100000, .llBasePeriodUs = samplingBASE_PERIOD_US
+        },
+    };
+
+    #define samplingSOURCE_COUNT    ( sizeof( xSources ) / sizeof( xSources[ 0 ] ) )
+
+/* Steps of the gas and TVOC channels, about a tenth of their alert levels. */
+    static SamplingChannel_t xChannels[ SENSOR_COUNT ] =
+    {
+        [ SENSOR_FLAMMABLE_GAS ] = { .xStep = 100.0f }, /* ppm */
+        [ SENSOR_TVOC ]          = { .xStep = 50.0f },  /* ppb */
+        [ SENSOR_CO ]            = { .xStep = 5.0f },   /* ppm */
+    };
+
+    static TaskHandle_t xWorkers[ eSamplingWorkerCount ];
+    static SamplingReadingCallback_t xReadingCallback = NULL;
+
+/* Start of the counters, for the fixed-rate estimates. */
+    static int64_t llStartUs = 0;
+
+    static portMUX_TYPE xSamplingLock = portMUX_INITIALIZER_UNLOCKED;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief First boundary of a period strictly after a given time.
+ *
+ * @param[in] pxSource     Source, for its phase.
+ * @param[in] llAfterUs    esp_timer time.
+ * @param[in] llPeriodUs   Period.
+ * @param[out] pllUnixUs   The boundary, in wall-clock time.
+ *
+ * @return int64_t The boundary, in esp_timer time.
+ */
+    static int64_t prvNextBoundary( const SamplingSource_t * pxSource,
+                                    int64_t llAfterUs,
+                                    int64_t llPeriodUs,
+                                    int64_t * pllUnixUs )
+    {
+        int64_t llOffsetUs = llSampleTime_ToUnixMs( llAfterUs ) * 1000 - llAfterUs;
+        int64_t llSincePhaseUs = llAfterUs + llOffsetUs - pxSource->llPhaseUs;
+
+        *pllUnixUs = ( llSincePhaseUs / llPeriodUs + 1 ) * llPeriodUs + pxSource->llPhaseUs;
+
+        return *pllUnixUs - llOffsetUs;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Moves the next read of a gas source to the start of the valid window of its heater
+ *        cycle if it falls outside, so that reads are not spent on invalid values.
+ */
+    static void prvAlignToHeater( SamplingSource_t * pxSource )
+    {
+        int64_t llValidUs;
+        uint32_t i;
+
+        for( i = 0; i < SENSOR_COUNT; i++ )
+        {
+            if( ( pxSource->ulMask & SENSOR_MASK( i ) ) == 0 )
+            {
+                continue;
+            }
+
+            llValidUs = mq_heater_next_valid_us( ( sensor_channel_t ) i, pxSource->llDueUs );
+
+            if( llValidUs > pxSource->llDueUs )
+            {
+                pxSource->llDueUnixUs += llValidUs - pxSource->llDueUs;
+                pxSource->llDueUs = llValidUs;
+            }
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvArmAt( SamplingSource_t * pxSource,
+                          int64_t llTimeUs )
+    {
+        int64_t llDelayUs = llTimeUs - esp_timer_get_time();
+        esp_err_t xErr;
+
+        xErr = esp_timer_start_once( pxSource->xTimer, ( llDelayUs > 0 ) ? ( uint64_t ) llDelayUs : 1U );
+
+        if( xErr != ESP_OK )
+        {
+            LogError( ( "Failed to arm sampling timer: %s", esp_err_to_name( xErr ) ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Arms the timer of a source for its next read. A gated sensor is powered down until
+ *        its settle time before the read, or kept on if that time is already here.
+ */
+    static void prvArm( SamplingSource_t * pxSource )
+    {
+        int64_t llWakeUs = pxSource->llDueUs - pxSource->llSettleUs;
+
+        if( pxSource->llSettleUs > 0 )
+        {
+            if( llWakeUs > esp_timer_get_time() )
+            {
+                if( pxSource->xPowered )
+                {
+                    sensors_rail_release( pxSource->xRail );
+                    pxSource->xPowered = false;
+                }
+
+                prvArmAt( pxSource, llWakeUs );
+
+                return;
+            }
+
+            if( !pxSource->xPowered )
+            {
+                sensors_rail_acquire( pxSource->xRail );
+                pxSource->xPowered = true;
+            }
+        }
+
+        prvArmAt( pxSource, pxSource->llDueUs );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Counts an excursion once its run of samples away from the baseline has ended.
+ *        A fixed-rate schedule samples on the boundaries of the base period; if none of them
+ *        falls within the run, it would have missed it.
+ */
+    static void prvTrackExcursion( SamplingChannel_t * pxChannel,
+                                   const SamplingSource_t * pxSource,
+                                   bool xAway,
+                                   int64_t llScheduledUnixUs )
+    {
+        if( xAway )
+        {
+            if( !pxChannel->xInExcursion )
+            {
+                pxChannel->xInExcursion = true;
+                pxChannel->ulExcursions++;
+                pxChannel->llExcursionStartUs = llScheduledUnixUs;
+            }
+
+            pxChannel->llExcursionEndUs = llScheduledUnixUs;
+        }
+        else if( pxChannel->xInExcursion )
+        {
+            pxChannel->xInExcursion = false;
+
+            if( ( ( pxChannel->llExcursionEndUs - pxSource->llPhaseUs ) / pxSource->llBasePeriodUs ) ==
+                ( ( pxChannel->llExcursionStartUs - pxSource->llPhaseUs - 1 ) / pxSource->llBasePeriodUs ) )
+            {
+                pxChannel->ulMissedAtFixedRate++;
+            }
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Halves the period while the channel moves, doubles it after a run of flat samples.
+ *        Without CONFIG_SAMPLE_IOT_ADAPTIVE_SAMPLING both bounds are the fixed period.
+ */
+    static void prvAdapt( SamplingChannel_t * pxChannel,
+                          SamplingSource_t * pxSource,
+                          float xRate,
+                          bool xAway )
+    {
+        /* Change the channel would go through, at this rate, between two samples at the longest period. */
+        float xChange = xRate * ( float ) samplingMAX_PERIOD_US / 1000000.0f;
+        float xDeviation = sqrtf( pxChannel->xVariance );
+
+        if( xAway || ( xChange >= pxChannel->xStep ) || ( xDeviation >= pxChannel->xStep ) )
+        {
+            pxSource->llPeriodUs = ( pxSource->llPeriodUs / 2 > samplingMIN_PERIOD_US ) ?
+                                   pxSource->llPeriodUs / 2 : samplingMIN_PERIOD_US;
+            pxChannel->ulQuiet = 0;
+        }
+        else if( ( xChange < pxChannel->xStep / 2 ) && ( xDeviation < pxChannel->xStep / 2 ) )
+        {
+            if( ++pxChannel->ulQuiet >= samplingQUIET_SAMPLES )
+            {
+                pxSource->llPeriodUs = ( pxSource->llPeriodUs * 2 < samplingMAX_PERIOD_US ) ?
+                                       pxSource->llPeriodUs * 2 : samplingMAX_PERIOD_US;
+                pxChannel->ulQuiet = 0;
+            }
+        }
+        else
+        {
+            pxChannel->ulQuiet = 0;
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvAccountSample( SamplingChannel_t * pxChannel,
+                                  SamplingSource_t * pxSource,
+                                  float xValue,
+                                  int64_t llTimeUs,
+                                  int64_t llScheduledUnixUs,
+                                  uint32_t ulLatencyUs )
+    {
+        float xSeconds;
+        float xAlpha;
+        float xDeviation;
+        float xRate;
+        bool xAway;
+
+        /* us * mA * mV = 1e-12 J. Temperature and humidity share one read, each is charged for it. */
+        pxChannel->ullEnergyUj += ( ( uint64_t ) ulLatencyUs * CONFIG_SAMPLE_IOT_SENSOR_READ_CURRENT_MA *
+                                    CONFIG_SAMPLE_IOT_SUPPLY_MILLIVOLTS ) / 1000000ULL;
+        pxChannel->ulSamples++;
+
+        if( pxChannel->xStep <= 0.0f )
+        {
+            return;
+        }
+
+        if( pxChannel->llLastUs == 0 )
+        {
+            pxChannel->xBaseline = xValue;
+        }
+        else
+        {
+            xSeconds = ( float ) ( llTimeUs - pxChannel->llLastUs ) / 1000000.0f;
+            xRate = fabsf( xValue - pxChannel->xLast ) / xSeconds;
+            xDeviation = xValue - pxChannel->xBaseline;
+            xAway = fabsf( xDeviation ) >= pxChannel->xStep;
+
+            xAlpha = xSeconds / ( xSeconds + samplingBASELINE_TAU_SECONDS );
+            pxChannel->xBaseline += xAlpha * xDeviation;
+            pxChannel->xVariance = ( 1.0f - xAlpha ) * ( pxChannel->xVariance + xAlpha * xDeviation * xDeviation );
+
+            prvTrackExcursion( pxChannel, pxSource, xAway, llScheduledUnixUs );
+            prvAdapt( pxChannel, pxSource, xRate, xAway );
+        }
+
+        pxChannel->xLast = xValue;
+        pxChannel->llLastUs = llTimeUs;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Accounts for the read of a source, then arms its timer for the next boundary
+ *        of its period, skipping any that passed while reading, or the start of the valid
+ *        window of its heater if later.
+ */
+    static void prvCompleteSource( SamplingSource_t * pxSource,
+                                   const sensor_reading_t * pxReading )
+    {
+        int64_t llScheduledUs = pxSource->llDueUs;
+        int64_t llPeriodUs;
+        uint32_t i;
+
+        taskENTER_CRITICAL( &xSamplingLock );
+
+        for( i = 0; i < SENSOR_COUNT; i++ )
+        {
+            if( ( pxSource->ulMask & pxReading->valid_mask & SENSOR_MASK( i ) ) != 0 )
+            {
+                prvAccountSample( &xChannels[ i ], pxSource, pxReading->value[ i ], pxReading->timestamp_us,
+                                  pxSource->llDueUnixUs, pxReading->latency_us[ i ] );
+            }
+        }
+
+        llPeriodUs = pxSource->llPeriodUs;
+
+        taskEXIT_CRITICAL( &xSamplingLock );
+
+        vSampleMetrics_Record( eSampleMetricSampleJitterUs,
+                               ( pxReading->timestamp_us > llScheduledUs ) ? ( uint32_t ) ( pxReading->timestamp_us - llScheduledUs ) : 0 );
+
+        /* Only this source's worker touches its due times. */
+        pxSource->llDueUs = prvNextBoundary( pxSource, esp_timer_get_time(), llPeriodUs, &pxSource->llDueUnixUs );
+        prvAlignToHeater( pxSource );
+        prvArm( pxSource );
+    }
+/*-----------------------------------------------------------*/
+
+    static sensor_rail_t prvRailOf( const SamplingSource_t * pxSource )
+    {
+        uint32_t i;
+
+        for( i = 0; i < SENSOR_COUNT; i++ )
+        {
+            if( ( pxSource->ulMask & SENSOR_MASK( i ) ) != 0 )
+            {
+                return sensors_channel_rail( ( sensor_channel_t ) i );
+            }
+        }
+
+        return SENSOR_RAIL_NONE;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Runs in the esp_timer task: powers a gated sensor up ahead of its read, or hands
+ *        the read over to the worker. Never blocks.
+ */
+    static void prvOnTimer( void * pvArgument )
+    {
+        uint32_t ulSource = ( uint32_t ) ( uintptr_t ) pvArgument;
+        SamplingSource_t * pxSource = &xSources[ ulSource ];
+
+        if( ( pxSource->llSettleUs > 0 ) && !pxSource->xPowered )
+        {
+            sensors_rail_acquire( pxSource->xRail );
+            pxSource->xPowered = true;
+            prvArmAt( pxSource, pxSource->llDueUs );
+
+            return;
+        }
+
+        ( void ) xTaskNotify( xWorkers[ pxSource->xWorker ], 1UL << ulSource, eSetBits );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Whether a source notified to its worker is to be read now: its due time has come
+ *        and each of its sensors has a value not read yet. A sensor with a data-ready line
+ *        notifies the worker itself; until then, the timer notification is dropped.
+ */
+    static bool prvSourceReady( const SamplingSource_t * pxSource )
+    {
+        uint32_t i;
+
+        if( esp_timer_get_time() < pxSource->llDueUs )
+        {
+            return false;
+        }
+
+        for( i = 0; i < SENSOR_COUNT; i++ )
+        {
+            if( ( ( pxSource->ulMask & SENSOR_MASK( i ) ) != 0 ) && !sensors_data_fresh( ( sensor_channel_t ) i ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Reads the sources whose timers fired, or whose sensors signalled new data, together,
+ *        then passes the reading on.
+ */
+    static void prvWorkerTask( void * pvParameters )
+    {
+        sensor_reading_t xReading;
+        uint32_t ulSources;
+        uint32_t ulMask;
+        uint32_t i;
+
+        ( void ) pvParameters;
+
+        for( ; ; )
+        {
+            ( void ) xTaskNotifyWait( 0, UINT32_MAX, &ulSources, portMAX_DELAY );
+
+            ulMask = 0;
+
+            for( i = 0; i < samplingSOURCE_COUNT; i++ )
+            {
+                if( ( ulSources & ( 1UL << i ) ) == 0 )
+                {
+                    continue;
+                }
+
+                if( prvSourceReady( &xSources[ i ] ) )
+                {
+                    ulMask |= xSources[ i ].ulMask;
+                }
+                else
+                {
+                    ulSources &= ~( 1UL << i );
+                }
+            }
+
+            if( ulMask == 0 )
+            {
+                continue;
+            }
+
+            if( sensors_read( ulMask, &xReading ) != ESP_OK )
+            {
+                LogDebug( ( "Some sensors could not be read (mask 0x%02x, valid 0x%02x)",
+                            ( unsigned ) ulMask, ( unsigned ) xReading.valid_mask ) );
+            }
+
+            for( i = 0; i < samplingSOURCE_COUNT; i++ )
+            {
+                if( ( ulSources & ( 1UL << i ) ) != 0 )
+                {
+                    prvCompleteSource( &xSources[ i ], &xReading );
+                }
+            }
+
+            xReadingCallback( &xReading );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* CONFIG_SAMPLE_IOT_ROLLUPS */
+
+void vSampling_Start( SamplingReadingCallback_t xCallback )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        static const char * const pcWorkerNames[ eSamplingWorkerCount ] = { "SampleAdc", "SampleI2c" };
+        esp_timer_create_args_t xTimerArgs =
+        {
+            .callback        = prvOnTimer,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name            = "sampling",
+        };
+        SamplingSource_t * pxSource;
+        BaseType_t xCreated;
+        esp_err_t xErr;
+        uint32_t i;
+        uint32_t j;
+
+        configASSERT( xCallback != NULL );
+        xReadingCallback = xCallback;
+
+        for( i = 0; i < eSamplingWorkerCount; i++ )
+        {
+            xCreated = xTaskCreate( prvWorkerTask, pcWorkerNames[ i ], samplingWORKER_STACK_SIZE, NULL,
+                                    samplingWORKER_PRIORITY, &xWorkers[ i ] );
+            configASSERT( xCreated == pdPASS );
+        }
+
+        llStartUs = esp_timer_get_time();
+
+        for( i = 0; i < samplingSOURCE_COUNT; i++ )
+        {
+            pxSource = &xSources[ i ];
+            pxSource->xRail = prvRailOf( pxSource );
+            pxSource->llSettleUs = sensors_rail_settle_ms( pxSource->xRail ) * 1000LL;
+            pxSource->llPeriodUs = pxSource->llBasePeriodUs;
+            pxSource->llDueUs = prvNextBoundary( pxSource, llStartUs, pxSource->llPeriodUs, &pxSource->llDueUnixUs );
+            prvAlignToHeater( pxSource );
+
+            xTimerArgs.arg = ( void * ) ( uintptr_t ) i;
+            xErr = esp_timer_create( &xTimerArgs, &pxSource->xTimer );
+            configASSERT( xErr == ESP_OK );
+
+            for( j = 0; j < SENSOR_COUNT; j++ )
+            {
+                if( ( ( pxSource->ulMask & SENSOR_MASK( j ) ) != 0 ) &&
+                    sensors_notify_data_ready( ( sensor_channel_t ) j, xWorkers[ pxSource->xWorker ], 1UL << i ) )
+                {
+                    LogInfo( ( "%s read on data-ready.", sensors_channel_name( ( sensor_channel_t ) j ) ) );
+                }
+            }
+
+            prvArm( pxSource );
+        }
+    #else
+        ( void ) xCallback;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+bool xSampling_Adaptive( void )
+{
+    #if CONFIG_SAMPLE_IOT_ADAPTIVE_SAMPLING
+        return true;
+    #else
+        return false;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+bool xSampling_GetStats( sensor_channel_t xChannel,
+                         SamplingChannelStats_t * pxStats )
+{
+    #if CONFIG_SAMPLE_IOT_ROLLUPS
+        const SamplingSource_t * pxSource = NULL;
+        SamplingChannel_t xCopy;
+        int64_t llPeriodUs;
+        int64_t llElapsedUs;
+        uint32_t i;
+
+        configASSERT( xChannel < SENSOR_COUNT );
+
+        for( i = 0; i < samplingSOURCE_COUNT; i++ )
+        {
+            if( ( xSources[ i ].ulMask & SENSOR_MASK( xChannel ) ) != 0 )
+            {
+                pxSource = &xSources[ i ];
+            }
+        }
+
+        configASSERT( pxSource != NULL );
+
+        taskENTER_CRITICAL( &xSamplingLock );
+        xCopy = xChannels[ xChannel ];
+        llPeriodUs = pxSource->llPeriodUs;
+        taskEXIT_CRITICAL( &xSamplingLock );
+
+        llElapsedUs = esp_timer_get_time() - llStartUs;
+
+        ( void ) memset( pxStats, 0, sizeof( *pxStats ) );
+        pxStats->ulPeriodMs = ( uint32_t ) ( llPeriodUs / 1000 );
+        pxStats->ulSamples = xCopy.ulSamples;
+        pxStats->ullEnergyUj = xCopy.ullEnergyUj;
+        pxStats->ulExcursions = xCopy.ulExcursions;
+        pxStats->ulMissedAtFixedRate = xCopy.ulMissedAtFixedRate;
+
+        if( xCopy.ulSamples > 0 )
+        {
+            pxStats->ulEnergyPerSampleUj = ( uint32_t ) ( xCopy.ullEnergyUj / xCopy.ulSamples );
+            pxStats->ullFixedRateEnergyUj = ( uint64_t ) pxStats->ulEnergyPerSampleUj *
+                                            ( uint64_t ) ( llElapsedUs / pxSource->llBasePeriodUs );
+        }
+
+        return true;
+    #else
+        ( void ) xChannel;
+        ( void ) pxStats;
+
+        return false;
+    #endif
+}
+/*-----------------------------------------------------------*/
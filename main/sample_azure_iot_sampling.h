@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Timer-driven acquisition schedule of the internal sampling (sample_azure_iot_rollup.h).
+ *        Each sensor read (temperature and humidity share one) has its own period and phase and
+ *        an esp_timer that fires on the wall-clock boundaries of that period, so that samples
+ *        land on the same instants of every minute. The timer callback only hands the read to
+ *        the worker task of the sensor's bus, ADC or I2C; a slow read on one bus never delays
+ *        the other. A sensor on a gated supply (sensors_rail_acquire()) is powered up its
+ *        settle time ahead of each read, and down again after it unless the next read is
+ *        closer than that.
+ *
+ * Temperature and humidity run at CONFIG_SAMPLE_IOT_SAMPLE_PERIOD_SECONDS, the battery at
+ * CONFIG_SAMPLE_IOT_BATTERY_PERIOD_SECONDS. The gas and TVOC channels start at the sampling
+ * period; with CONFIG_SAMPLE_IOT_ADAPTIVE_SAMPLING their period follows the signal: halved down
+ * to the minimum while the channel moves quickly or away from its baseline, doubled up to the
+ * maximum once it stays flat.
+ *
+ * Rate of change, baseline (exponential mean) and variance are tracked per channel either way,
+ * as are the energy of each read and the excursions seen, so that the same counters can be
+ * compared between the adaptive and the fixed-rate mode.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_SAMPLING_H
+#define SAMPLE_AZURE_IOT_SAMPLING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/**
+ * @brief Receives every reading. Called from the worker tasks, possibly from two at once.
+ *
+ * @param[in] pxReading  Reading; holds only the channels that were due.
+ */
+typedef void ( * SamplingReadingCallback_t )( const sensor_reading_t * pxReading );
+
+/**
+ * @brief Counters of one channel since start.
+ */
+typedef struct SamplingChannelStats
+{
+    uint32_t ulPeriodMs;            /**< Current sampling period. */
+    uint32_t ulSamples;             /**< Samples taken. */
+    uint32_t ulEnergyPerSampleUj;   /**< Mean estimated energy of one read. */
+    uint64_t ullEnergyUj;           /**< Estimated energy of all reads. */
+    uint64_t ullFixedRateEnergyUj;  /**< Estimated energy of the reads a fixed-rate schedule would have taken. */
+    uint32_t ulExcursions;          /**< Excursions seen: runs of samples at least one step away from the baseline. */
+    uint32_t ulMissedAtFixedRate;   /**< Excursions seen that began and ended between two fixed-rate samples. */
+} SamplingChannelStats_t;
+
+/**
+ * @brief Creates the worker tasks and arms the timers. Does nothing unless
+ *        CONFIG_SAMPLE_IOT_ROLLUPS is set.
+ *
+ * @param[in] xCallback  Receives the readings.
+ */
+void vSampling_Start( SamplingReadingCallback_t xCallback );
+
+/**
+ * @brief Whether the gas and TVOC sampling periods adapt to the signal.
+ */
+bool xSampling_Adaptive( void );
+
+/**
+ * @brief Gets the counters of a channel. Safe to call from any task.
+ *
+ * @param[in] xChannel  Channel.
+ * @param[out] pxStats  Counters.
+ *
+ * @return bool false if the sampling does not run (no CONFIG_SAMPLE_IOT_ROLLUPS).
+ */
+bool xSampling_GetStats( sensor_channel_t xChannel,
+                         SamplingChannelStats_t * pxStats );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_SAMPLING_H */
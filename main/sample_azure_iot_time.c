@@ -0,0 +1,156 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_time.h"
+
+/* Standard includes. */
+#include <sys/time.h>
+#include <time.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_attr.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_nvs.h"
+/*-----------------------------------------------------------*/
+
+#define sampletimeSNTP_SERVER_FQDN      "pool.ntp.org"
+
+/**
+ * @brief Any earlier clock value means the clock was never set (2024-01-01T00:00:00Z).
+ */
+#define sampletimeMIN_VALID_UNIX_TIME    ( 1704067200LL )
+
+/**
+ * @brief How often the clock is persisted, bounding how far a restored clock lags behind.
+ */
+#define sampletimePERSIST_PERIOD_US      ( 60 * 60 * 1000000LL )
+
+#define sampletimeNVS_KEY_CLOCK          "clock"
+/*-----------------------------------------------------------*/
+
+/* Kept in RTC memory: the RTC keeps the clock running through deep sleep. */
+static RTC_DATA_ATTR volatile bool xSynchronized = false;
+static RTC_DATA_ATTR int64_t llCorrectionMs = 0;
+
+/* Wall clock minus esp_timer while unsynchronized; constant as long as nobody sets the clock. */
+static int64_t llUnsyncedOffsetUs = 0;
+
+static esp_timer_handle_t xPersistTimer = NULL;
+/*-----------------------------------------------------------*/
+
+static int64_t prvWallClockUs( void )
+{
+    struct timeval xNow;
+
+    ( void ) gettimeofday( &xNow, NULL );
+
+    return ( int64_t ) xNow.tv_sec * 1000000LL + xNow.tv_usec;
+}
+/*-----------------------------------------------------------*/
+
+static void prvPersistClock( void * pvArg )
+{
+    ( void ) pvArg;
+
+    if( xSynchronized &&
+        ( xSampleNvs_SetU32( sampletimeNVS_KEY_CLOCK, ( uint32_t ) time( NULL ) ) != ESP_OK ) )
+    {
+        LogWarn( ( "Failed to persist the clock" ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief SNTP notification. The first synchronization steps the clock, so that it is right
+ *        as soon as it is reported as synchronized; a clock restored from NVS can be off by
+ *        up to sampletimePERSIST_PERIOD_US plus the time spent powered off, and slewing that
+ *        away would take hours. Later updates are small and slewed.
+ */
+static void prvOnTimeSync( struct timeval * pxTime )
+{
+    int64_t llSyncedMs = ( int64_t ) pxTime->tv_sec * 1000LL + pxTime->tv_usec / 1000;
+
+    if( !xSynchronized )
+    {
+        /* Offset between the estimated clock that stamped earlier samples and real time. */
+        llCorrectionMs = llSyncedMs - ( llUnsyncedOffsetUs + esp_timer_get_time() ) / 1000;
+        xSynchronized = true;
+        sntp_set_sync_mode( SNTP_SYNC_MODE_SMOOTH );
+        LogInfo( ( "Clock synchronized, estimate was off by %lld ms", ( long long ) llCorrectionMs ) );
+        prvPersistClock( NULL );
+    }
+    else
+    {
+        LogDebug( ( "SNTP update received" ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vSampleTime_Init( void )
+{
+    const esp_timer_create_args_t xTimerArgs =
+    {
+        .callback = prvPersistClock,
+        .name     = "persist_clock"
+    };
+    struct timeval xRestored = { 0 };
+    uint32_t ulStored;
+
+    if( time( NULL ) < sampletimeMIN_VALID_UNIX_TIME )
+    {
+        /* Power-on: the RTC lost the time. Start from the last persisted value. */
+        xSynchronized = false;
+
+        if( xSampleNvs_GetU32( sampletimeNVS_KEY_CLOCK, &ulStored ) == ESP_OK )
+        {
+            xRestored.tv_sec = ( time_t ) ulStored;
+            ( void ) settimeofday( &xRestored, NULL );
+            LogInfo( ( "Clock restored from NVS: %u (estimate until SNTP syncs)", ( unsigned ) ulStored ) );
+        }
+        else
+        {
+            LogWarn( ( "No persisted clock, timestamps are unusable until SNTP syncs" ) );
+        }
+    }
+
+    llUnsyncedOffsetUs = prvWallClockUs() - esp_timer_get_time();
+
+    sntp_setoperatingmode( SNTP_OPMODE_POLL );
+    sntp_setservername( 0, sampletimeSNTP_SERVER_FQDN );
+    sntp_set_sync_mode( xSynchronized ? SNTP_SYNC_MODE_SMOOTH : SNTP_SYNC_MODE_IMMED );
+    sntp_set_time_sync_notification_cb( prvOnTimeSync );
+    sntp_init();
+
+    if( ( esp_timer_create( &xTimerArgs, &xPersistTimer ) != ESP_OK ) ||
+        ( esp_timer_start_periodic( xPersistTimer, sampletimePERSIST_PERIOD_US ) != ESP_OK ) )
+    {
+        LogError( ( "Failed to start the clock persistence timer" ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool xSampleTime_IsSynchronized( void )
+{
+    return xSynchronized;
+}
+/*-----------------------------------------------------------*/
+
+int64_t llSampleTime_ToUnixMs( int64_t llMonotonicUs )
+{
+    return ( prvWallClockUs() - ( esp_timer_get_time() - llMonotonicUs ) ) / 1000;
+}
+/*-----------------------------------------------------------*/
+
+int64_t llSampleTime_CorrectMs( int64_t llEstimatedMs )
+{
+    return xSynchronized ? ( llEstimatedMs + llCorrectionMs ) : llEstimatedMs;
+}
+/*-----------------------------------------------------------*/
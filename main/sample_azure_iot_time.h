@@ -0,0 +1,47 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Wall-clock handling that never blocks start-up.
+ *
+ * The clock starts from the RTC (after deep sleep) or from the last timestamp persisted in NVS,
+ * and SNTP corrects it in the background with slew. Timestamps taken before the first
+ * synchronization are estimates; llSampleTime_CorrectMs() turns them into synchronized time
+ * once the offset is known.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_TIME_H
+#define SAMPLE_AZURE_IOT_TIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Restores the clock if it is not valid and starts SNTP. Returns immediately.
+ */
+void vSampleTime_Init( void );
+
+/**
+ * @brief Whether SNTP synchronized the clock since power-on (deep sleep included).
+ */
+bool xSampleTime_IsSynchronized( void );
+
+/**
+ * @brief Converts an esp_timer timestamp taken during this boot to Unix time.
+ *
+ * @param[in] llMonotonicUs  Value returned by esp_timer_get_time().
+ *
+ * @return int64_t Unix time in milliseconds, an estimate until xSampleTime_IsSynchronized().
+ */
+int64_t llSampleTime_ToUnixMs( int64_t llMonotonicUs );
+
+/**
+ * @brief Corrects a timestamp that was estimated before the first synchronization.
+ *
+ * @param[in] llEstimatedMs  Unix time in milliseconds obtained before synchronization.
+ *
+ * @return int64_t The corrected time, or `llEstimatedMs` unchanged if not synchronized yet.
+ */
+int64_t llSampleTime_CorrectMs( int64_t llEstimatedMs );
+
+#endif /* ifndef SAMPLE_AZURE_IOT_TIME_H */
@@ -0,0 +1,768 @@
+#include "sensors.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "adc_config.h"
+#include "i2c_config.h"
+#include "mq_heater.h"
+#include "sample_azure_iot_power.h"
+
+static const char *TAG = "SENSORS";
+
+#define MQ2TAG "MQ2_SENSOR"
+#define MQ7TAG "MQ7_SENSOR"
+#define TVOC_TAG "TVOC_TAG"
+
+// FLYING FISH MODULE COMPONENT VALUES //
+#define MQ_LOAD_RESISTANCE 1000.0f  // ohms
+#define MQ_SUPPLY_VOLTAGE 5.0f      // volts
+#define MQ_DEFAULT_R0 1000.0f       // ohms, used until the sensors are calibrated
+
+// Rs/R0 in clean air, read off the datasheet curves
+#define MQ2_CLEAN_AIR_RATIO 9.83f
+#define MQ7_CLEAN_AIR_RATIO 27.5f
+
+// baselines are the average of this many reads
+#define CALIBRATION_SAMPLES 10
+#define CALIBRATION_SAMPLE_DELAY_MS 50
+
+// PPM CURVE CONSTANTS - general form RsR0 = Ax^k
+// flammable gas: A = 19.5, k = -0.43
+// CO: A = 24.9, k = -0.7
+#define MQ2_CURVE_A 19.5f
+#define MQ2_CURVE_K -0.43f
+#define MQ7_CURVE_A 24.9f
+#define MQ7_CURVE_K -0.7f
+
+// switches of the I2C sensor supplies, SHTC3_ctrl and ENS_ctrl on the prototype board
+#define TH_RAIL_GPIO GPIO_NUM_12
+#define TVOC_RAIL_GPIO GPIO_NUM_27
+
+#if CONFIG_SAMPLE_IOT_SENSOR_POWER_ACTIVE_LOW
+#define RAIL_ON_LEVEL 0
+#else
+#define RAIL_ON_LEVEL 1
+#endif
+
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+// interrupt line of the TVOC sensor, held low from a new conversion until it is read
+#define TVOC_READY_GPIO CONFIG_SAMPLE_IOT_TVOC_DATA_READY_GPIO
+// with no conversion signalled this long after the line is armed, the sensor's interrupt
+// output is taken as not set up and the sensor is polled until the line asserts
+#define TVOC_READY_TIMEOUT_US (30 * 1000000LL)
+#endif
+
+// temperature/humidity is the average of this many reads
+#define TH_SAMPLES 10
+#define TH_SAMPLE_DELAY_MS 100
+
+// RTC_DATA_ATTR: initialised on power-up, survives deep sleep
+static RTC_DATA_ATTR sensor_calibration_t calibration = {
+    .mq2_r0 = MQ_DEFAULT_R0,
+    .mq7_r0 = MQ_DEFAULT_R0,
+};
+
+// the ADC unit and the I2C bus are shared by the sampling workers and the command handlers;
+// each has its own lock so that a slow read on one does not hold up the other
+static SemaphoreHandle_t adc_mutex = NULL;
+static StaticSemaphore_t adc_mutex_buffer;
+static SemaphoreHandle_t i2c_mutex = NULL;
+static StaticSemaphore_t i2c_mutex_buffer;
+
+typedef struct {
+    gpio_num_t gpio;
+    uint32_t channels;      // channels powered by the rail
+    const char *name;
+    bool gated;             // switched off while unused, otherwise always on
+    uint32_t settle_ms;     // from switch-on to the first valid read
+    uint32_t current_ua;    // drawn while powered
+    uint32_t users;
+    uint32_t power_cycles;
+    int64_t on_since_us;    // when the rail was last switched on
+    int64_t powered_us;     // powered time, up to on_since_us while on
+} sensor_rail_state_t;
+
+static sensor_rail_state_t rails[SENSOR_RAIL_COUNT] = {
+    [SENSOR_RAIL_TH] = {
+        .gpio = TH_RAIL_GPIO,
+        .channels = SENSOR_MASK(SENSOR_TEMPERATURE) | SENSOR_MASK(SENSOR_HUMIDITY),
+        .name = "TH",
+#if CONFIG_SAMPLE_IOT_GATE_TH_RAIL
+        .gated = true,
+        .settle_ms = CONFIG_SAMPLE_IOT_TH_SETTLE_MS,
+#endif
+        .current_ua = CONFIG_SAMPLE_IOT_TH_RAIL_CURRENT_UA,
+    },
+    [SENSOR_RAIL_TVOC] = {
+        .gpio = TVOC_RAIL_GPIO,
+        .channels = SENSOR_MASK(SENSOR_TVOC),
+        .name = "TVOC",
+#if CONFIG_SAMPLE_IOT_GATE_TVOC_RAIL
+        .gated = true,
+        .settle_ms = CONFIG_SAMPLE_IOT_TVOC_SETTLE_MS,
+#endif
+        .current_ua = CONFIG_SAMPLE_IOT_TVOC_RAIL_CURRENT_UA,
+    },
+};
+
+static int64_t rails_start_us = 0;
+static portMUX_TYPE rails_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// set by the data-ready interrupt, cleared when the conversion is read or the sensor is
+// switched off
+static volatile bool tvoc_fresh = false;
+static volatile bool tvoc_ready_timed_out = false;
+static int64_t tvoc_armed_us = 0;   // under rails_lock
+static TaskHandle_t tvoc_notify_task = NULL;
+static uint32_t tvoc_notify_bits = 0;
+
+// last temperature and humidity, written to the TVOC sensor with each read
+static float compensation_temperature = 0;
+static float compensation_humidity = 0;
+static bool compensation_valid = false;
+static portMUX_TYPE compensation_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// gas channels whose baseline was asked for outside their heater's valid window; measured
+// at their next valid read, under adc_mutex
+static uint32_t calibration_pending = 0;
+
+static const char *channel_names[SENSOR_COUNT] = {
+    [SENSOR_TEMPERATURE] = "Temperature",
+    [SENSOR_HUMIDITY] = "Humidity",
+    [SENSOR_FLAMMABLE_GAS] = "FlammableGases",
+    [SENSOR_TVOC] = "TVOC",
+    [SENSOR_CO] = "CO",
+    [SENSOR_BATTERY_VOLTAGE] = "VCELL",
+};
+
+
+float calculate_soc(float vcell) {
+    float soc = 0;
+    if (vcell >= 4.1617) {
+        soc = 100;
+    }
+    else if (vcell >= 4.0913) {
+        soc = 95.03;
+    }
+    else if (vcell >= 4.0749) {
+        soc = 90.07;
+    }
+    else if (vcell >= 4.0606) {
+        soc = 85.10;
+    }
+    else if (vcell >= 4.0153) {
+        soc = 80.13;
+    }
+    else if (vcell >= 3.9592) {
+        soc = 75.17;
+    }
+    else if (vcell >= 3.9164) {
+        soc = 70.20;
+    }
+    else if (vcell >= 3.8587) {
+        soc = 65.24;
+    }
+    else if (vcell >= 3.8163) {
+        soc = 60.27;
+    }
+    else if (vcell >= 3.7535) {
+        soc = 55.30;
+    }
+    else if (vcell >= 3.7317) {
+        soc = 50.34;
+    }
+    else if (vcell >= 3.6892) {
+        soc = 45.37;
+    }
+    else if (vcell >= 3.6396) {
+        soc = 40.40;
+    }
+    else if (vcell >= 3.5677) {
+        soc = 35.43;
+    }
+    else if (vcell >= 3.5208) {
+        soc = 30.46;
+    }
+    else if (vcell >= 3.4712) {
+        soc = 25.40;
+    }
+    else if (vcell >= 3.386) {
+        soc = 20.53;
+    }
+    else if (vcell >= 3.288) {
+        soc = 15.56;
+    }
+    else if (vcell >= 3.2017) {
+        soc = 10.59;
+    }
+    else if (vcell >= 3.0747) {
+        soc = 5.63;
+    }
+    else {
+        soc = 0;
+    }
+
+    return soc;
+
+}
+
+static float ppm_curve(float A, float k, float y) {
+    float x = pow((y / A), (1 / k)); // solve for gas concentration x
+    return x; // ppm
+}
+
+// read sensor a_out voltage
+static int analog_read(adc_oneshot_unit_handle_t adc_handle, adc_channel_t sensor) {
+    int raw = 0;
+    adc_oneshot_read(adc_handle, sensor, &raw); // get raw adc value
+
+    int voltageMV = 0;
+
+    adc_cali_raw_to_voltage(adc1_cali_handle, raw, &voltageMV); // convert raw value to calibrated voltage
+    return voltageMV;
+}
+
+// MQ module output voltage -> sensing resistance Rs
+static float read_mq_resistance(adc_channel_t channel) {
+    float aout = (float)analog_read(adc1_handle, channel) / 1000.0f; // mv to V
+    return ((MQ_SUPPLY_VOLTAGE - aout) * MQ_LOAD_RESISTANCE) / aout; // get Rs resistance
+}
+
+// MQ module output voltage -> ppm
+static float read_mq_ppm(adc_channel_t channel, float r0, float A, float k) {
+    float rs = read_mq_resistance(channel);
+    return ppm_curve(A, k, rs / r0); // plug resistance ratio into characteristic curve
+}
+
+static esp_err_t read_th_average(float *temperature, float *humidity) {
+    float temp_sum = 0;
+    float humidity_sum = 0;
+    int good = 0;
+
+    for (int i = 0; i < TH_SAMPLES; i++) {
+        float t, h;
+        // the bus is released between samples, other I2C reads fit in the gaps
+        xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+        esp_err_t ret = read_TH(&t, &h);
+        xSemaphoreGive(i2c_mutex);
+        if (ret == ESP_OK) {
+            temp_sum += t;
+            humidity_sum += h;
+            good++;
+        } else {
+            ESP_LOGE("ADA_FRUIT_SENSOR", "Failed to read sensor");
+        }
+        // let the CPU slow down / light sleep between samples
+        vPower_Release(ePowerLockSensors);
+        vTaskDelay(pdMS_TO_TICKS(TH_SAMPLE_DELAY_MS));
+        vPower_Acquire(ePowerLockSensors);
+    }
+
+    if (good == 0) {
+        return ESP_FAIL;
+    }
+
+    *temperature = temp_sum / good;
+    *humidity = humidity_sum / good;
+    return ESP_OK;
+}
+
+static uint32_t elapsed_us(int64_t start_us) {
+    return (uint32_t)(esp_timer_get_time() - start_us);
+}
+
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+static bool rail_powered(sensor_rail_t rail) {
+    return !rails[rail].gated || rails[rail].users > 0;
+}
+
+// the line stays low until the conversion is read: the interrupt and the light sleep wake-up
+// are level triggered, and switched off here until tvoc_ready_rearm, so that a conversion
+// waiting for its scheduled read neither storms the CPU nor keeps it awake
+static void tvoc_ready_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+
+    (void)arg;
+    gpio_intr_disable(TVOC_READY_GPIO);
+    gpio_wakeup_disable(TVOC_READY_GPIO);
+    tvoc_fresh = true;
+    tvoc_ready_timed_out = false;
+    if (tvoc_notify_task != NULL) {
+        xTaskNotifyFromISR(tvoc_notify_task, tvoc_notify_bits, eSetBits, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// called with rails_lock held; the line floats while the sensor is off, so it is only armed
+// while the TVOC rail is powered
+static void tvoc_ready_rearm(void) {
+    tvoc_armed_us = esp_timer_get_time();
+    if (rail_powered(SENSOR_RAIL_TVOC)) {
+        gpio_wakeup_enable(TVOC_READY_GPIO, GPIO_INTR_LOW_LEVEL);
+        gpio_intr_enable(TVOC_READY_GPIO);
+    }
+}
+
+// called with rails_lock held when the TVOC rail is switched off
+static void tvoc_ready_mask(void) {
+    gpio_intr_disable(TVOC_READY_GPIO);
+    gpio_wakeup_disable(TVOC_READY_GPIO);
+    tvoc_fresh = false;
+}
+
+static void tvoc_ready_init(void) {
+    // GPIO 34-39 have no internal pull-up, an external one is needed there
+    gpio_config_t config = {
+        .pin_bit_mask = 1ULL << TVOC_READY_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_LOW_LEVEL,
+    };
+    ESP_ERROR_CHECK(gpio_config(&config));
+
+    // may already be installed by another driver
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(TVOC_READY_GPIO, tvoc_ready_isr, NULL));
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+    taskENTER_CRITICAL(&rails_lock);
+    tvoc_ready_rearm();
+    taskEXIT_CRITICAL(&rails_lock);
+    ESP_LOGI(TAG, "TVOC data-ready on GPIO %d", TVOC_READY_GPIO);
+}
+#endif
+
+bool sensors_notify_data_ready(sensor_channel_t channel, TaskHandle_t task, uint32_t bits) {
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+    if (channel == SENSOR_TVOC) {
+        taskENTER_CRITICAL(&rails_lock);
+        gpio_intr_disable(TVOC_READY_GPIO);
+        tvoc_notify_task = task;
+        tvoc_notify_bits = bits;
+        if (rail_powered(SENSOR_RAIL_TVOC)) {
+            gpio_intr_enable(TVOC_READY_GPIO);
+        }
+        taskEXIT_CRITICAL(&rails_lock);
+        return true;
+    }
+#else
+    (void)task;
+    (void)bits;
+#endif
+    (void)channel;
+    return false;
+}
+
+bool sensors_data_fresh(sensor_channel_t channel) {
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+    if (channel == SENSOR_TVOC) {
+        bool timed_out = false;
+
+        taskENTER_CRITICAL(&rails_lock);
+        if (!tvoc_fresh && !tvoc_ready_timed_out && rail_powered(SENSOR_RAIL_TVOC) &&
+            esp_timer_get_time() - tvoc_armed_us > TVOC_READY_TIMEOUT_US) {
+            tvoc_ready_timed_out = timed_out = true;
+        }
+        taskEXIT_CRITICAL(&rails_lock);
+
+        if (timed_out) {
+            ESP_LOGW(TVOC_TAG, "no data-ready for %lld s, polling the sensor: is its interrupt output set up?",
+                     TVOC_READY_TIMEOUT_US / 1000000LL);
+        }
+        return tvoc_fresh || tvoc_ready_timed_out;
+    }
+#endif
+    (void)channel;
+    return true;
+}
+
+// read the TVOC sensor, compensated for the last temperature and humidity read. an on-demand
+// read leaves the fresh flag and the data-ready line to the scheduled reads
+static esp_err_t read_tvoc_with_compensation(float *tvoc_ppb, bool scheduled) {
+    float temperature, humidity;
+    bool compensate;
+    esp_err_t ret;
+
+    taskENTER_CRITICAL(&compensation_lock);
+#if CONFIG_SAMPLE_IOT_TVOC_COMPENSATION
+    compensate = compensation_valid;
+#else
+    compensate = false;
+#endif
+    temperature = compensation_temperature;
+    humidity = compensation_humidity;
+    taskEXIT_CRITICAL(&compensation_lock);
+
+    // cleared ahead of the read, so that a conversion finishing meanwhile is not lost
+    if (scheduled) {
+        tvoc_fresh = false;
+    }
+
+    xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+    if (compensate) {
+        ret = read_tvoc_compensated(tvoc_ppb, temperature, humidity);
+    } else {
+        ret = read_tvoc(tvoc_ppb);
+    }
+    xSemaphoreGive(i2c_mutex);
+
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+    if (scheduled) {
+        taskENTER_CRITICAL(&rails_lock);
+        tvoc_ready_rearm();
+        taskEXIT_CRITICAL(&rails_lock);
+    }
+#endif
+    return ret;
+}
+
+void sensors_init(void) {
+    adc_mutex = xSemaphoreCreateMutexStatic(&adc_mutex_buffer);
+    i2c_mutex = xSemaphoreCreateMutexStatic(&i2c_mutex_buffer);
+
+    rails_start_us = esp_timer_get_time();
+
+    for (int i = 0; i < SENSOR_RAIL_COUNT; i++) {
+        gpio_config_t config = {
+            .pin_bit_mask = 1ULL << rails[i].gpio,
+            .mode = GPIO_MODE_OUTPUT,
+        };
+        // set the level first so that an ungated rail never glitches off
+        gpio_set_level(rails[i].gpio, rails[i].gated ? !RAIL_ON_LEVEL : RAIL_ON_LEVEL);
+        ESP_ERROR_CHECK(gpio_config(&config));
+        rails[i].on_since_us = rails_start_us;
+        ESP_LOGI(TAG, "%s sensor supply %s", rails[i].name, rails[i].gated ? "gated" : "always on");
+    }
+
+    mq_heater_init();
+
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+    tvoc_ready_init();
+#endif
+}
+
+sensor_rail_t sensors_channel_rail(sensor_channel_t channel) {
+    for (int i = 0; i < SENSOR_RAIL_COUNT; i++) {
+        if (rails[i].channels & SENSOR_MASK(channel)) {
+            return (sensor_rail_t)i;
+        }
+    }
+    return SENSOR_RAIL_NONE;
+}
+
+uint32_t sensors_rail_settle_ms(sensor_rail_t rail) {
+    return (rail < SENSOR_RAIL_COUNT && rails[rail].gated) ? rails[rail].settle_ms : 0;
+}
+
+void sensors_rail_acquire(sensor_rail_t rail) {
+    if (rail >= SENSOR_RAIL_COUNT || !rails[rail].gated) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&rails_lock);
+    if (rails[rail].users++ == 0) {
+        gpio_set_level(rails[rail].gpio, RAIL_ON_LEVEL);
+        rails[rail].on_since_us = esp_timer_get_time();
+        rails[rail].power_cycles++;
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+        if (rail == SENSOR_RAIL_TVOC) {
+            tvoc_ready_rearm();
+        }
+#endif
+    }
+    taskEXIT_CRITICAL(&rails_lock);
+}
+
+void sensors_rail_release(sensor_rail_t rail) {
+    if (rail >= SENSOR_RAIL_COUNT || !rails[rail].gated) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&rails_lock);
+    if (rails[rail].users > 0 && --rails[rail].users == 0) {
+#if CONFIG_SAMPLE_IOT_TVOC_DATA_READY
+        if (rail == SENSOR_RAIL_TVOC) {
+            tvoc_ready_mask();
+        }
+#endif
+        gpio_set_level(rails[rail].gpio, !RAIL_ON_LEVEL);
+        rails[rail].powered_us += esp_timer_get_time() - rails[rail].on_since_us;
+    }
+    taskEXIT_CRITICAL(&rails_lock);
+}
+
+const char *sensors_rail_name(sensor_rail_t rail) {
+    return (rail < SENSOR_RAIL_COUNT) ? rails[rail].name : "none";
+}
+
+void sensors_rail_stats(sensor_rail_t rail, sensor_rail_stats_t *stats) {
+    sensor_rail_state_t *state = &rails[rail];
+    int64_t now_us;
+
+    configASSERT(rail < SENSOR_RAIL_COUNT);
+    memset(stats, 0, sizeof(*stats));
+
+    taskENTER_CRITICAL(&rails_lock);
+    now_us = esp_timer_get_time();
+    stats->gated = state->gated;
+    stats->power_cycles = state->power_cycles;
+    stats->powered_us = state->powered_us;
+    if (!state->gated || state->users > 0) {
+        stats->powered_us += now_us - state->on_since_us;
+    }
+    taskEXIT_CRITICAL(&rails_lock);
+
+    stats->elapsed_us = now_us - rails_start_us;
+    stats->always_on_ua = state->current_ua;
+    if (stats->elapsed_us > 0) {
+        stats->average_ua = (uint32_t)((stats->powered_us * state->current_ua) / stats->elapsed_us);
+    }
+}
+
+// power the rails of channel_mask and wait for them to settle; returns the rails to release
+static uint32_t rails_acquire(uint32_t channel_mask) {
+    uint32_t acquired = 0;
+    int64_t ready_us = 0;
+
+    for (int i = 0; i < SENSOR_RAIL_COUNT; i++) {
+        if (!(rails[i].channels & channel_mask) || !rails[i].gated) {
+            continue;
+        }
+        sensors_rail_acquire((sensor_rail_t)i);
+        acquired |= 1UL << i;
+        // already on when the sampling scheduler powered it ahead of time
+        if (rails[i].on_since_us + rails[i].settle_ms * 1000LL > ready_us) {
+            ready_us = rails[i].on_since_us + rails[i].settle_ms * 1000LL;
+        }
+    }
+
+    int64_t wait_us = ready_us - esp_timer_get_time();
+    if (wait_us > 0) {
+        vTaskDelay(pdMS_TO_TICKS(wait_us / 1000) + 1);
+    }
+    return acquired;
+}
+
+static void rails_release(uint32_t acquired) {
+    for (int i = 0; i < SENSOR_RAIL_COUNT; i++) {
+        if (acquired & (1UL << i)) {
+            sensors_rail_release((sensor_rail_t)i);
+        }
+    }
+}
+
+// with the sensor in clean air, R0 = Rs / the clean-air ratio, averaged over a short burst
+static float measure_r0(adc_channel_t channel, float clean_air_ratio) {
+    float sum = 0;
+
+    vPower_Acquire(ePowerLockSensors);
+    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+        sum += read_mq_resistance(channel);
+        vPower_Release(ePowerLockSensors);
+        vTaskDelay(pdMS_TO_TICKS(CALIBRATION_SAMPLE_DELAY_MS));
+        vPower_Acquire(ePowerLockSensors);
+    }
+    vPower_Release(ePowerLockSensors);
+
+    return sum / CALIBRATION_SAMPLES / clean_air_ratio;
+}
+
+// whether the whole calibration burst of a gas channel fits in its heater's valid window
+static bool calibration_window_open(sensor_channel_t channel) {
+    int64_t now_us = esp_timer_get_time();
+
+    return mq_heater_valid(channel, now_us) &&
+           mq_heater_valid(channel, now_us + CALIBRATION_SAMPLES * CALIBRATION_SAMPLE_DELAY_MS * 1000LL);
+}
+
+// measures the pending baselines whose heater window is open, with adc_mutex held; a channel
+// outside its window stays pending until its next valid read. ESP_ERR_NOT_FINISHED while any
+// is pending
+static esp_err_t calibrate_pending(void) {
+    sensor_calibration_t measured = calibration;
+    bool failed = false;
+
+    if ((calibration_pending & SENSOR_MASK(SENSOR_FLAMMABLE_GAS)) && calibration_window_open(SENSOR_FLAMMABLE_GAS)) {
+        measured.mq2_r0 = measure_r0(MQ2, MQ2_CLEAN_AIR_RATIO);
+        calibration_pending &= ~SENSOR_MASK(SENSOR_FLAMMABLE_GAS);
+        // a zero output voltage gives an infinite resistance: sensor missing or not powered
+        if (!isfinite(measured.mq2_r0) || measured.mq2_r0 <= 0) {
+            ESP_LOGE(TAG, "calibration failed: MQ2 R0 %.1f ohm", measured.mq2_r0);
+            measured.mq2_r0 = calibration.mq2_r0;
+            failed = true;
+        }
+    }
+
+    if ((calibration_pending & SENSOR_MASK(SENSOR_CO)) && calibration_window_open(SENSOR_CO)) {
+        measured.mq7_r0 = measure_r0(MQ7, MQ7_CLEAN_AIR_RATIO);
+        calibration_pending &= ~SENSOR_MASK(SENSOR_CO);
+        if (!isfinite(measured.mq7_r0) || measured.mq7_r0 <= 0) {
+            ESP_LOGE(TAG, "calibration failed: MQ7 R0 %.1f ohm", measured.mq7_r0);
+            measured.mq7_r0 = calibration.mq7_r0;
+            failed = true;
+        }
+    }
+
+    if (memcmp(&measured, &calibration, sizeof(measured)) != 0) {
+        sensors_set_calibration(&measured);
+    }
+
+    if (failed) {
+        return ESP_FAIL;
+    }
+    if (calibration_pending) {
+        ESP_LOGI(TAG, "calibration of %s%s waits for the heater's valid window",
+                 (calibration_pending & SENSOR_MASK(SENSOR_FLAMMABLE_GAS)) ? "MQ2 " : "",
+                 (calibration_pending & SENSOR_MASK(SENSOR_CO)) ? "MQ7 " : "");
+        return ESP_ERR_NOT_FINISHED;
+    }
+    return ESP_OK;
+}
+
+// a scheduled read counts the reads its heater phase skips (mq_heater_check_read); an
+// on-demand one only checks the phase
+static bool gas_readable(sensor_channel_t channel, bool scheduled) {
+    return scheduled ? mq_heater_check_read(channel) : mq_heater_valid(channel, esp_timer_get_time());
+}
+
+static esp_err_t read_channels(uint32_t channel_mask, sensor_reading_t *reading, bool scheduled) {
+    int64_t start_us;
+
+    configASSERT((adc_mutex != NULL) && (i2c_mutex != NULL));
+
+    uint32_t acquired_rails = rails_acquire(channel_mask);
+
+    memset(reading, 0, sizeof(*reading));
+    reading->timestamp_us = esp_timer_get_time();
+
+    vPower_Acquire(ePowerLockSensors);
+
+    if (channel_mask & (SENSOR_MASK(SENSOR_FLAMMABLE_GAS) | SENSOR_MASK(SENSOR_CO))) {
+        xSemaphoreTake(adc_mutex, portMAX_DELAY);
+    }
+
+    // outside the valid window of its heater cycle, a gas channel is left out of the reading
+    if ((channel_mask & SENSOR_MASK(SENSOR_FLAMMABLE_GAS)) && gas_readable(SENSOR_FLAMMABLE_GAS, scheduled)) {
+        start_us = esp_timer_get_time();
+        reading->value[SENSOR_FLAMMABLE_GAS] = read_mq_ppm(MQ2, calibration.mq2_r0, MQ2_CURVE_A, MQ2_CURVE_K);
+        reading->latency_us[SENSOR_FLAMMABLE_GAS] = elapsed_us(start_us);
+        reading->valid_mask |= SENSOR_MASK(SENSOR_FLAMMABLE_GAS);
+        ESP_LOGD(MQ2TAG, "flammable gas (ppm): %0.2f", reading->value[SENSOR_FLAMMABLE_GAS]);
+    }
+
+    if ((channel_mask & SENSOR_MASK(SENSOR_CO)) && gas_readable(SENSOR_CO, scheduled)) {
+        start_us = esp_timer_get_time();
+        reading->value[SENSOR_CO] = read_mq_ppm(MQ7, calibration.mq7_r0, MQ7_CURVE_A, MQ7_CURVE_K);
+        reading->latency_us[SENSOR_CO] = elapsed_us(start_us);
+        reading->valid_mask |= SENSOR_MASK(SENSOR_CO);
+        ESP_LOGD(MQ7TAG, "co (ppm): %0.2f", reading->value[SENSOR_CO]);
+    }
+
+    if (scheduled && (calibration_pending & reading->valid_mask)) {
+        calibrate_pending();
+    }
+
+    if (channel_mask & (SENSOR_MASK(SENSOR_FLAMMABLE_GAS) | SENSOR_MASK(SENSOR_CO))) {
+        xSemaphoreGive(adc_mutex);
+    }
+
+    // read_th_average takes the I2C lock for each of its samples
+    if (channel_mask & (SENSOR_MASK(SENSOR_TEMPERATURE) | SENSOR_MASK(SENSOR_HUMIDITY))) {
+        float temperature, humidity;
+        start_us = esp_timer_get_time();
+        if (read_th_average(&temperature, &humidity) == ESP_OK) {
+            reading->value[SENSOR_TEMPERATURE] = temperature;
+            reading->value[SENSOR_HUMIDITY] = humidity;
+            reading->latency_us[SENSOR_TEMPERATURE] = elapsed_us(start_us);
+            reading->latency_us[SENSOR_HUMIDITY] = reading->latency_us[SENSOR_TEMPERATURE];
+            reading->valid_mask |= channel_mask & (SENSOR_MASK(SENSOR_TEMPERATURE) | SENSOR_MASK(SENSOR_HUMIDITY));
+            taskENTER_CRITICAL(&compensation_lock);
+            compensation_temperature = temperature;
+            compensation_humidity = humidity;
+            compensation_valid = true;
+            taskEXIT_CRITICAL(&compensation_lock);
+            ESP_LOGI("ADAFRUIT_SENSOR", "Temperature: %.2f °C, Humidity: %.2f %%", temperature, humidity);
+        }
+    }
+
+    if (channel_mask & SENSOR_MASK(SENSOR_BATTERY_VOLTAGE)) {
+        start_us = esp_timer_get_time();
+        xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+        esp_err_t vcell_ret = read_VCELL(&reading->value[SENSOR_BATTERY_VOLTAGE]);
+        xSemaphoreGive(i2c_mutex);
+        if (vcell_ret == ESP_OK) {
+            reading->latency_us[SENSOR_BATTERY_VOLTAGE] = elapsed_us(start_us);
+            reading->valid_mask |= SENSOR_MASK(SENSOR_BATTERY_VOLTAGE);
+        } else {
+            ESP_LOGE(TAG, "Failed to read battery voltage");
+        }
+    }
+
+    // with a data-ready line, only a new conversion is worth the bus traffic
+    if ((channel_mask & SENSOR_MASK(SENSOR_TVOC)) && scheduled && !sensors_data_fresh(SENSOR_TVOC)) {
+        ESP_LOGD(TVOC_TAG, "no new TVOC conversion");
+    } else if (channel_mask & SENSOR_MASK(SENSOR_TVOC)) {
+        start_us = esp_timer_get_time();
+        esp_err_t tvoc_ret = read_tvoc_with_compensation(&reading->value[SENSOR_TVOC], scheduled); // read tvoc
+        if (tvoc_ret == ESP_OK) {
+            reading->latency_us[SENSOR_TVOC] = elapsed_us(start_us);
+            reading->valid_mask |= SENSOR_MASK(SENSOR_TVOC);
+            ESP_LOGI(TVOC_TAG, "TVOC concentration: %.2f ppb", reading->value[SENSOR_TVOC]);
+        } else {
+            ESP_LOGE(TVOC_TAG, "Failed to read TVOC (err=0x%x: %s)",
+            tvoc_ret, esp_err_to_name(tvoc_ret));
+        }
+    }
+
+    vPower_Release(ePowerLockSensors);
+    rails_release(acquired_rails);
+
+    return (reading->valid_mask == channel_mask) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t sensors_read(uint32_t channel_mask, sensor_reading_t *reading) {
+    return read_channels(channel_mask, reading, true);
+}
+
+esp_err_t sensors_read_on_demand(uint32_t channel_mask, sensor_reading_t *reading) {
+    return read_channels(channel_mask, reading, false);
+}
+
+const char *sensors_channel_name(sensor_channel_t channel) {
+    return (channel < SENSOR_COUNT) ? channel_names[channel] : "unknown";
+}
+
+const sensor_calibration_t *sensors_get_calibration(void) {
+    return &calibration;
+}
+
+esp_err_t sensors_calibrate(sensor_calibration_t *result) {
+    esp_err_t ret;
+
+    xSemaphoreTake(adc_mutex, portMAX_DELAY);
+    calibration_pending = SENSOR_MASK(SENSOR_FLAMMABLE_GAS) | SENSOR_MASK(SENSOR_CO);
+    ret = calibrate_pending();
+    xSemaphoreGive(adc_mutex);
+
+    *result = calibration;
+    return ret;
+}
+
+void sensors_set_calibration(const sensor_calibration_t *new_calibration) {
+    calibration = *new_calibration;
+    ESP_LOGI(TAG, "calibration updated: MQ2 R0 %.1f ohm, MQ7 R0 %.1f ohm",
+             calibration.mq2_r0, calibration.mq7_r0);
+}
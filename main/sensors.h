@@ -0,0 +1,109 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// one entry per measured quantity, in telemetry order
+typedef enum {
+    SENSOR_TEMPERATURE = 0,  // C, SHTC3/AHT on 0x38
+    SENSOR_HUMIDITY,         // %RH, same sensor
+    SENSOR_FLAMMABLE_GAS,    // ppm, MQ2
+    SENSOR_TVOC,             // ppb, TVOC sensor on 0x1A
+    SENSOR_CO,               // ppm, MQ7
+    SENSOR_BATTERY_VOLTAGE,  // V, fuel gauge on 0x36
+    SENSOR_COUNT
+} sensor_channel_t;
+
+#define SENSOR_MASK(ch)     (1UL << (ch))
+#define SENSOR_MASK_ALL     ((1UL << SENSOR_COUNT) - 1)
+
+// one acquisition; only channels set in valid_mask hold a value
+typedef struct {
+    float value[SENSOR_COUNT];
+    uint32_t valid_mask;
+    int64_t timestamp_us;    // esp_timer time the acquisition started
+    uint32_t latency_us[SENSOR_COUNT]; // time spent reading each channel; shared by channels read together
+} sensor_reading_t;
+
+// switched supplies of the I2C sensors; a gated rail is powered only while in use
+typedef enum {
+    SENSOR_RAIL_TH = 0,      // temperature/humidity sensor
+    SENSOR_RAIL_TVOC,        // TVOC sensor
+    SENSOR_RAIL_COUNT,
+    SENSOR_RAIL_NONE = SENSOR_RAIL_COUNT  // channel on an always-on supply
+} sensor_rail_t;
+
+// power use of a rail since sensors_init
+typedef struct {
+    bool gated;
+    uint32_t power_cycles;   // times the rail was switched on
+    int64_t powered_us;
+    int64_t elapsed_us;
+    uint32_t average_ua;     // estimated average current of the rail
+    uint32_t always_on_ua;   // the same without gating
+} sensor_rail_stats_t;
+
+// MQ sensor baselines (clean-air resistance), kept in RTC memory across deep sleep
+typedef struct {
+    float mq2_r0;
+    float mq7_r0;
+} sensor_calibration_t;
+
+// call once after the ADC and I2C bus are initialised, before any task reads the sensors
+void sensors_init(void);
+
+// read the channels in channel_mask; channels that fail, or gas channels read outside the
+// valid window of their heater cycle (see mq_heater.h), are left out of valid_mask.
+// safe to call from several tasks: reads are serialised per bus (ADC, I2C), so a task
+// reading the gas channels never waits for one reading the I2C sensors
+esp_err_t sensors_read(uint32_t channel_mask, sensor_reading_t *reading);
+
+// sensors_read for a read outside the sampling schedule: the TVOC channel is read whether or
+// not a new conversion is ready, without taking it from the next scheduled read, and gas
+// channels outside their valid window are not counted as skipped reads
+esp_err_t sensors_read_on_demand(uint32_t channel_mask, sensor_reading_t *reading);
+
+const char *sensors_channel_name(sensor_channel_t channel);
+
+sensor_rail_t sensors_channel_rail(sensor_channel_t channel);
+
+const char *sensors_rail_name(sensor_rail_t rail);
+
+// time from switch-on to a valid read, 0 if the rail is not gated
+uint32_t sensors_rail_settle_ms(sensor_rail_t rail);
+
+// keep a gated rail powered, switching it on for the first user; does not wait for it to settle.
+// does not block, also callable from an esp_timer callback. sensors_read powers the rails it
+// needs by itself; acquiring ahead of time only saves it the settle wait
+void sensors_rail_acquire(sensor_rail_t rail);
+
+void sensors_rail_release(sensor_rail_t rail);
+
+void sensors_rail_stats(sensor_rail_t rail, sensor_rail_stats_t *stats);
+
+// with CONFIG_SAMPLE_IOT_TVOC_DATA_READY, the TVOC sensor signals each new conversion on a
+// GPIO; have its interrupt notify task with bits (eSetBits). false if the channel has no
+// data-ready line
+bool sensors_notify_data_ready(sensor_channel_t channel, TaskHandle_t task, uint32_t bits);
+
+// whether the channel has a conversion not read yet; always true for polled channels, and
+// for a channel whose data-ready line stays silent, which is then polled until it asserts.
+// sensors_read leaves a channel with a data-ready line out of the reading until it is fresh
+bool sensors_data_fresh(sensor_channel_t channel);
+
+float calculate_soc(float vcell);
+
+const sensor_calibration_t *sensors_get_calibration(void);
+
+void sensors_set_calibration(const sensor_calibration_t *calibration);
+
+// measure the MQ baselines, with the sensors warmed up in clean air; applies them and returns
+// the calibration in use. A sensor whose heater is outside its valid window is measured at its
+// next valid read instead: ESP_ERR_NOT_FINISHED until then
+esp_err_t sensors_calibrate(sensor_calibration_t *result);
+
+#endif // SENSORS_H
@@ -0,0 +1,362 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "transport_tls_session.h"
+
+/* Standard includes. */
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#include "sample_azure_iot_metrics.h"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Upper bound for the TCP connect plus TLS handshake.
+ */
+#define tlssessionCONNECT_TIMEOUT_MS    ( 10 * 1000U )
+
+/**
+ * @brief How long a receive waits for the socket to become readable.
+ *
+ * Receives are polled with this short wait instead of blocking for the full socket
+ * timeout, so an idle ProcessLoop returns promptly and the caller can block in select().
+ */
+#define tlssessionRECV_POLL_MS          ( 10U )
+
+/**
+ * @brief Longest host name for which a session is cached.
+ */
+#define tlssessionMAX_HOST_LENGTH       ( 128U )
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+#if defined( CONFIG_SAMPLE_IOT_TLS_SESSION_RESUMPTION ) && defined( CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS )
+    #define tlssessionRESUMPTION_ENABLED    1
+    static esp_tls_client_session_t * pxCachedSession = NULL;
+    static char cCachedHost[ tlssessionMAX_HOST_LENGTH ];
+
+    /* Master secret of the cached session: a resumed TLS 1.2 handshake keeps it, a full one
+     * derives a new one. The session itself is opaque behind esp_tls_client_session_t. */
+    static uint8_t ucCachedMaster[ sizeof( ( ( mbedtls_ssl_session * ) 0 )->MBEDTLS_PRIVATE( master ) ) ];
+#else
+    #define tlssessionRESUMPTION_ENABLED    0
+#endif
+/*-----------------------------------------------------------*/
+
+static void prvSetSocketTimeout( int lSocket,
+                                 int lOption,
+                                 uint32_t ulTimeoutMs )
+{
+    struct timeval xTimeout =
+    {
+        .tv_sec  = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+
+    ( void ) setsockopt( lSocket, SOL_SOCKET, lOption, &xTimeout, sizeof( xTimeout ) );
+}
+/*-----------------------------------------------------------*/
+
+#if tlssessionRESUMPTION_ENABLED
+
+/**
+ * @brief Copies the master secret of an established TLS 1.2 connection.
+ *
+ * @return bool false for another protocol version or if the session cannot be read.
+ */
+    static bool prvGetMasterSecret( esp_tls_t * pxTls,
+                                    uint8_t * pucMaster )
+    {
+        mbedtls_ssl_context * pxSsl = ( mbedtls_ssl_context * ) esp_tls_get_ssl_context( pxTls );
+        mbedtls_ssl_session xSession;
+        bool xFound = false;
+
+        if( ( pxSsl == NULL ) || ( mbedtls_ssl_get_version_number( pxSsl ) != MBEDTLS_SSL_VERSION_TLS1_2 ) )
+        {
+            return false;
+        }
+
+        mbedtls_ssl_session_init( &xSession );
+
+        if( mbedtls_ssl_get_session( pxSsl, &xSession ) == 0 )
+        {
+            ( void ) memcpy( pucMaster, xSession.MBEDTLS_PRIVATE( master ), sizeof( ucCachedMaster ) );
+            xFound = true;
+        }
+
+        mbedtls_ssl_session_free( &xSession );
+
+        return xFound;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* tlssessionRESUMPTION_ENABLED */
+
+static bool prvSocketReadable( int lSocket,
+                               uint32_t ulWaitMs )
+{
+    fd_set xReadSet;
+    struct timeval xTimeout =
+    {
+        .tv_sec  = ulWaitMs / 1000,
+        .tv_usec = ( ulWaitMs % 1000 ) * 1000
+    };
+
+    FD_ZERO( &xReadSet );
+    FD_SET( lSocket, &xReadSet );
+
+    /* Errors are reported as readable so that the following read surfaces them. */
+    return select( lSocket + 1, &xReadSet, NULL, NULL, &xTimeout ) != 0;
+}
+/*-----------------------------------------------------------*/
+
+TlsSessionStatus_t TLS_Session_Connect( NetworkContext_t * pxNetworkContext,
+                                        const char * pcHostName,
+                                        uint32_t ulPort,
+                                        const NetworkCredentials_t * pxNetworkCredentials,
+                                        uint32_t ulReceiveTimeoutMs,
+                                        uint32_t ulSendTimeoutMs )
+{
+    TlsSessionParams_t * pxParams;
+    esp_tls_cfg_t xConfig = { 0 };
+    int64_t llStartUs;
+    uint32_t ulElapsedMs;
+    int lSocket = -1;
+
+    if( ( pxNetworkContext == NULL ) || ( pxNetworkContext->pParams == NULL ) ||
+        ( pcHostName == NULL ) || ( pxNetworkCredentials == NULL ) )
+    {
+        return eTlsSessionInvalidParameter;
+    }
+
+    pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+    pxParams->xSessionOffered = false;
+    pxParams->xSessionResumed = false;
+
+    xConfig.cacert_buf = pxNetworkCredentials->pucRootCa;
+    xConfig.cacert_bytes = pxNetworkCredentials->xRootCaSize;
+    xConfig.clientcert_buf = pxNetworkCredentials->pucClientCert;
+    xConfig.clientcert_bytes = pxNetworkCredentials->xClientCertSize;
+    xConfig.clientkey_buf = pxNetworkCredentials->pucPrivateKey;
+    xConfig.clientkey_bytes = pxNetworkCredentials->xPrivateKeySize;
+    xConfig.timeout_ms = tlssessionCONNECT_TIMEOUT_MS;
+
+    #if tlssessionRESUMPTION_ENABLED
+        if( ( pxCachedSession != NULL ) &&
+            ( strncmp( cCachedHost, pcHostName, sizeof( cCachedHost ) ) == 0 ) )
+        {
+            xConfig.client_session = pxCachedSession;
+            pxParams->xSessionOffered = true;
+        }
+    #endif
+
+    pxParams->pxTls = esp_tls_init();
+
+    if( pxParams->pxTls == NULL )
+    {
+        return eTlsSessionInsufficientMemory;
+    }
+
+    llStartUs = esp_timer_get_time();
+
+    if( esp_tls_conn_new_sync( pcHostName, strlen( pcHostName ), ( int ) ulPort,
+                               &xConfig, pxParams->pxTls ) != 1 )
+    {
+        LogError( ( "TLS connection to %s failed.", pcHostName ) );
+        esp_tls_conn_destroy( pxParams->pxTls );
+        pxParams->pxTls = NULL;
+
+        #if tlssessionRESUMPTION_ENABLED
+            /* A stale ticket must not keep failing every subsequent attempt. */
+            if( pxParams->xSessionOffered )
+            {
+                TLS_Session_ClearCache();
+            }
+        #endif
+
+        return eTlsSessionConnectFailure;
+    }
+
+    ulElapsedMs = ( uint32_t ) ( ( esp_timer_get_time() - llStartUs ) / 1000 );
+
+    #if tlssessionRESUMPTION_ENABLED
+    {
+        uint8_t ucMaster[ sizeof( ucCachedMaster ) ];
+
+        /* The server may ignore the offered session and run a full handshake. */
+        pxParams->xSessionResumed = pxParams->xSessionOffered &&
+                                    prvGetMasterSecret( pxParams->pxTls, ucMaster ) &&
+                                    ( memcmp( ucMaster, ucCachedMaster, sizeof( ucMaster ) ) == 0 );
+    }
+    #endif
+
+    vSampleMetrics_Record( pxParams->xSessionResumed ? eSampleMetricTlsConnectResumedMs : eSampleMetricTlsConnectMs,
+                           ulElapsedMs );
+    LogInfo( ( "TLS connection established in %u ms (session %s).", ( unsigned ) ulElapsedMs,
+               pxParams->xSessionResumed ? "resumed" : ( pxParams->xSessionOffered ? "offered, not resumed" : "not cached" ) ) );
+
+    if( esp_tls_get_conn_sockfd( pxParams->pxTls, &lSocket ) == ESP_OK )
+    {
+        prvSetSocketTimeout( lSocket, SO_RCVTIMEO, ulReceiveTimeoutMs );
+        prvSetSocketTimeout( lSocket, SO_SNDTIMEO, ulSendTimeoutMs );
+    }
+
+    #if tlssessionRESUMPTION_ENABLED
+    {
+        esp_tls_client_session_t * pxSession = esp_tls_get_client_session( pxParams->pxTls );
+
+        if( pxSession != NULL )
+        {
+            if( pxCachedSession != NULL )
+            {
+                esp_tls_free_client_session( pxCachedSession );
+            }
+
+            pxCachedSession = pxSession;
+            ( void ) strncpy( cCachedHost, pcHostName, sizeof( cCachedHost ) - 1 );
+            cCachedHost[ sizeof( cCachedHost ) - 1 ] = '\0';
+
+            if( !prvGetMasterSecret( pxParams->pxTls, ucCachedMaster ) )
+            {
+                ( void ) memset( ucCachedMaster, 0, sizeof( ucCachedMaster ) );
+            }
+        }
+    }
+    #endif /* tlssessionRESUMPTION_ENABLED */
+
+    return eTlsSessionSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Session_Disconnect( NetworkContext_t * pxNetworkContext )
+{
+    TlsSessionParams_t * pxParams;
+
+    if( ( pxNetworkContext == NULL ) || ( pxNetworkContext->pParams == NULL ) )
+    {
+        return;
+    }
+
+    pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+
+    if( pxParams->pxTls != NULL )
+    {
+        esp_tls_conn_destroy( pxParams->pxTls );
+        pxParams->pxTls = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Session_Send( NetworkContext_t * pxNetworkContext,
+                          const void * pvBuffer,
+                          size_t xBytesToSend )
+{
+    TlsSessionParams_t * pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+    ssize_t xResult;
+
+    if( ( pxParams == NULL ) || ( pxParams->pxTls == NULL ) )
+    {
+        return -1;
+    }
+
+    xResult = esp_tls_conn_write( pxParams->pxTls, pvBuffer, xBytesToSend );
+
+    if( ( xResult == ESP_TLS_ERR_SSL_WANT_READ ) || ( xResult == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        xResult = 0;
+    }
+
+    return ( int32_t ) xResult;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Session_Recv( NetworkContext_t * pxNetworkContext,
+                          void * pvBuffer,
+                          size_t xBytesToRecv )
+{
+    TlsSessionParams_t * pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+    ssize_t xResult;
+    int lSocket;
+
+    if( ( pxParams == NULL ) || ( pxParams->pxTls == NULL ) )
+    {
+        return -1;
+    }
+
+    if( ( esp_tls_get_bytes_avail( pxParams->pxTls ) <= 0 ) &&
+        ( esp_tls_get_conn_sockfd( pxParams->pxTls, &lSocket ) == ESP_OK ) &&
+        !prvSocketReadable( lSocket, tlssessionRECV_POLL_MS ) )
+    {
+        return 0;
+    }
+
+    xResult = esp_tls_conn_read( pxParams->pxTls, pvBuffer, xBytesToRecv );
+
+    if( ( xResult == ESP_TLS_ERR_SSL_WANT_READ ) || ( xResult == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        /* Receive timeout: no data available. */
+        xResult = 0;
+    }
+    else if( xResult == 0 )
+    {
+        /* The peer closed the connection. */
+        xResult = -1;
+    }
+
+    return ( int32_t ) xResult;
+}
+/*-----------------------------------------------------------*/
+
+int TLS_Session_GetSocket( NetworkContext_t * pxNetworkContext )
+{
+    TlsSessionParams_t * pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+    int lSocket = -1;
+
+    if( ( pxParams == NULL ) || ( pxParams->pxTls == NULL ) ||
+        ( esp_tls_get_conn_sockfd( pxParams->pxTls, &lSocket ) != ESP_OK ) )
+    {
+        return -1;
+    }
+
+    return lSocket;
+}
+/*-----------------------------------------------------------*/
+
+bool TLS_Session_HasPendingData( NetworkContext_t * pxNetworkContext )
+{
+    TlsSessionParams_t * pxParams = ( TlsSessionParams_t * ) pxNetworkContext->pParams;
+
+    return ( pxParams != NULL ) && ( pxParams->pxTls != NULL ) &&
+           ( esp_tls_get_bytes_avail( pxParams->pxTls ) > 0 );
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Session_ClearCache( void )
+{
+    #if tlssessionRESUMPTION_ENABLED
+        if( pxCachedSession != NULL )
+        {
+            esp_tls_free_client_session( pxCachedSession );
+            pxCachedSession = NULL;
+        }
+
+        cCachedHost[ 0 ] = '\0';
+        ( void ) memset( ucCachedMaster, 0, sizeof( ucCachedMaster ) );
+    #endif
+}
+/*-----------------------------------------------------------*/
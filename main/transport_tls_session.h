@@ -0,0 +1,104 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief TLS transport built directly on esp-tls that keeps the last negotiated
+ *        TLS session (ticket or session ID) in RAM and offers it on the next
+ *        connection to the same host, turning reconnects into abbreviated handshakes.
+ *
+ * @remark The send and receive functions match the AzureIoTTransportInterface_t
+ *         signatures and can be plugged in place of TLS_Socket_Send/TLS_Socket_Recv.
+ */
+
+#ifndef TRANSPORT_TLS_SESSION_H
+#define TRANSPORT_TLS_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_tls.h"
+
+/* NetworkCredentials_t is shared with the sample TLS socket transport. */
+#include "transport_tls_socket.h"
+
+/**
+ * @brief Status returned by TLS_Session_Connect.
+ */
+typedef enum TlsSessionStatus
+{
+    eTlsSessionSuccess = 0,
+    eTlsSessionInvalidParameter,
+    eTlsSessionInsufficientMemory,
+    eTlsSessionConnectFailure
+} TlsSessionStatus_t;
+
+/**
+ * @brief Parameters stored in NetworkContext_t::pParams by this transport.
+ */
+typedef struct TlsSessionParams
+{
+    esp_tls_t * pxTls;
+    bool xSessionOffered; /**< A cached session was offered on the current connection. */
+    bool xSessionResumed; /**< The server accepted it: the handshake was abbreviated. */
+} TlsSessionParams_t;
+
+/**
+ * @brief Opens a TLS connection, offering the cached session when it belongs to the same host.
+ *
+ * @param[in] pxNetworkContext      Context whose pParams points to a TlsSessionParams_t.
+ * @param[in] pcHostName            Server host name.
+ * @param[in] ulPort                Server port.
+ * @param[in] pxNetworkCredentials  Root CA and optional client certificate.
+ * @param[in] ulReceiveTimeoutMs    Socket receive timeout.
+ * @param[in] ulSendTimeoutMs       Socket send timeout.
+ *
+ * @return TlsSessionStatus_t eTlsSessionSuccess if the connection was established.
+ */
+TlsSessionStatus_t TLS_Session_Connect( NetworkContext_t * pxNetworkContext,
+                                        const char * pcHostName,
+                                        uint32_t ulPort,
+                                        const NetworkCredentials_t * pxNetworkCredentials,
+                                        uint32_t ulReceiveTimeoutMs,
+                                        uint32_t ulSendTimeoutMs );
+
+/**
+ * @brief Closes the TLS connection. The cached session is kept for the next connect.
+ */
+void TLS_Session_Disconnect( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Transport interface send function.
+ */
+int32_t TLS_Session_Send( NetworkContext_t * pxNetworkContext,
+                          const void * pvBuffer,
+                          size_t xBytesToSend );
+
+/**
+ * @brief Transport interface receive function.
+ */
+int32_t TLS_Session_Recv( NetworkContext_t * pxNetworkContext,
+                          void * pvBuffer,
+                          size_t xBytesToRecv );
+
+/**
+ * @brief Gets the socket of the connection, for use with select().
+ *
+ * @return int The socket descriptor, or -1 when not connected.
+ */
+int TLS_Session_GetSocket( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Checks whether decrypted data is already buffered by the TLS layer.
+ *
+ * @remark Buffered data does not make the socket readable, so callers blocking
+ *         in select() must check this first.
+ */
+bool TLS_Session_HasPendingData( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Drops the cached session, forcing a full handshake on the next connect.
+ */
+void TLS_Session_ClearCache( void );
+
+#endif /* ifndef TRANSPORT_TLS_SESSION_H */
@@ -0,0 +1,341 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Host benchmark of xDesiredProperties_Parse against the two-pass parser it replaced
+ *        (AzureIoTHubClientProperties_GetPropertiesVersion, then
+ *        AzureIoTHubClientProperties_GetNextComponentProperty), on generated twin documents
+ *        of increasing size.
+ *
+ * @remark The two-pass parser calls the azure-sdk-for-c functions the middleware hub client
+ *         wraps, on the core reader of the middleware JSON reader, so that the benchmark does
+ *         not need the hub client and its MQTT dependencies.
+ */
+
+/* Standard includes. */
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Azure SDK for Embedded C includes. */
+#include "azure/az_iot.h"
+
+#include "sample_azure_iot_desired_properties.h"
+/*-----------------------------------------------------------*/
+
+#define benchmarkTARGET_TEMPERATURE       25.5
+#define benchmarkREPORTING_INTERVAL       60
+#define benchmarkDESIRED_VERSION          4242U
+#define benchmarkREPORTED_VERSION         77U
+
+/**
+ * @brief Bytes parsed by each parser per document size.
+ */
+#define benchmarkBYTES_PER_RUN            ( 64U * 1024U * 1024U )
+
+/**
+ * @brief Unknown desired properties, and reported properties, per document.
+ */
+static const uint32_t ulPropertyCounts[] = { 0, 16, 128, 512 };
+/*-----------------------------------------------------------*/
+
+typedef struct Document
+{
+    char * pcBuffer;
+    uint32_t ulLength;
+    uint32_t ulSize;
+} Document_t;
+
+typedef AzureIoTResult_t ( * Parser_t )( const uint8_t * pucPayload,
+                                         uint32_t ulPayloadLength,
+                                         bool xIsGetResponse,
+                                         WritableProperties_t * pxOutProperties,
+                                         uint32_t * pulOutVersion );
+/*-----------------------------------------------------------*/
+
+static az_iot_hub_client xHubClient;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief printf to the end of the document, growing it as needed.
+ */
+static void prvAppend( Document_t * pxDocument,
+                       const char * pcFormat,
+                       ... )
+{
+    va_list xArgs;
+    int lWritten;
+
+    for( ; ; )
+    {
+        va_start( xArgs, pcFormat );
+        lWritten = vsnprintf( pxDocument->pcBuffer + pxDocument->ulLength,
+                              pxDocument->ulSize - pxDocument->ulLength, pcFormat, xArgs );
+        va_end( xArgs );
+
+        if( ( lWritten >= 0 ) && ( ( uint32_t ) lWritten < pxDocument->ulSize - pxDocument->ulLength ) )
+        {
+            pxDocument->ulLength += ( uint32_t ) lWritten;
+            return;
+        }
+
+        pxDocument->ulSize = ( pxDocument->ulSize == 0 ) ? 4096U : pxDocument->ulSize * 2U;
+        pxDocument->pcBuffer = realloc( pxDocument->pcBuffer, pxDocument->ulSize );
+
+        if( pxDocument->pcBuffer == NULL )
+        {
+            fprintf( stderr, "Out of memory\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Appends the properties of a twin section: ulCount unknown properties with nested
+ *        values, the writable properties of this device if requested, and the metadata the
+ *        hub adds to each of them.
+ */
+static void prvAppendSection( Document_t * pxDocument,
+                              uint32_t ulCount,
+                              bool xWithWritable,
+                              uint32_t ulVersion )
+{
+    uint32_t i;
+
+    prvAppend( pxDocument, "{" );
+
+    for( i = 0; i < ulCount; i++ )
+    {
+        prvAppend( pxDocument,
+                   "\"setting%u\":{\"enabled\":%s,\"threshold\":%u.%u,\"label\":\"channel %u\",\"limits\":[%u,%u,%u]},",
+                   ( unsigned ) i, ( i & 1U ) ? "true" : "false", ( unsigned ) i, ( unsigned ) ( i % 10U ),
+                   ( unsigned ) i, ( unsigned ) i, ( unsigned ) i * 2U, ( unsigned ) i * 3U );
+    }
+
+    if( xWithWritable )
+    {
+        prvAppend( pxDocument, "\"%s\":%.1f,\"%s\":%d,",
+                   sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT, benchmarkTARGET_TEMPERATURE,
+                   sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT, benchmarkREPORTING_INTERVAL );
+    }
+
+    prvAppend( pxDocument, "\"$metadata\":{\"$lastUpdated\":\"2024-05-01T12:00:00.0000000Z\"" );
+
+    for( i = 0; i < ulCount; i++ )
+    {
+        prvAppend( pxDocument,
+                   ",\"setting%u\":{\"$lastUpdated\":\"2024-05-01T12:00:00.0000000Z\",\"$lastUpdatedVersion\":%u}",
+                   ( unsigned ) i, ( unsigned ) ulVersion );
+    }
+
+    prvAppend( pxDocument, "},\"$version\":%u}", ( unsigned ) ulVersion );
+}
+/*-----------------------------------------------------------*/
+
+static void prvGenerateDocument( Document_t * pxDocument,
+                                 uint32_t ulCount,
+                                 bool xIsGetResponse )
+{
+    pxDocument->ulLength = 0;
+
+    if( xIsGetResponse )
+    {
+        prvAppend( pxDocument, "{\"desired\":" );
+        prvAppendSection( pxDocument, ulCount, true, benchmarkDESIRED_VERSION );
+        prvAppend( pxDocument, ",\"reported\":" );
+        prvAppendSection( pxDocument, ulCount, false, benchmarkREPORTED_VERSION );
+        prvAppend( pxDocument, "}" );
+    }
+    else
+    {
+        prvAppendSection( pxDocument, ulCount, true, benchmarkDESIRED_VERSION );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The parser xDesiredProperties_Parse replaced: one pass for the version, then one
+ *        for the properties.
+ */
+static AzureIoTResult_t prvParseTwoPass( const uint8_t * pucPayload,
+                                         uint32_t ulPayloadLength,
+                                         bool xIsGetResponse,
+                                         WritableProperties_t * pxOutProperties,
+                                         uint32_t * pulOutVersion )
+{
+    az_iot_hub_client_properties_message_type xMessageType =
+        xIsGetResponse ? AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_GET_RESPONSE :
+        AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_WRITABLE_UPDATED;
+    AzureIoTJSONReader_t xReader;
+    az_json_reader * pxCoreReader = &xReader._internal.xCoreReader;
+    az_span xComponentName;
+    int32_t lVersion;
+    az_result xCoreResult;
+
+    ( void ) memset( pxOutProperties, 0, sizeof( *pxOutProperties ) );
+
+    if( ( AzureIoTJSONReader_Init( &xReader, pucPayload, ulPayloadLength ) != eAzureIoTSuccess ) ||
+        az_result_failed( az_iot_hub_client_properties_get_properties_version( &xHubClient, pxCoreReader,
+                                                                               xMessageType, &lVersion ) ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    *pulOutVersion = ( uint32_t ) lVersion;
+
+    if( AzureIoTJSONReader_Init( &xReader, pucPayload, ulPayloadLength ) != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    while( az_result_succeeded( xCoreResult = az_iot_hub_client_properties_get_next_component_property(
+                                    &xHubClient, pxCoreReader, xMessageType,
+                                    AZ_IOT_HUB_CLIENT_PROPERTY_WRITABLE, &xComponentName ) ) )
+    {
+        if( az_span_size( xComponentName ) > 0 )
+        {
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+            ( void ) AzureIoTJSONReader_SkipChildren( &xReader );
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+        }
+        else if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
+                                                      ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
+                                                      sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1 ) )
+        {
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+
+            if( AzureIoTJSONReader_GetTokenDouble( &xReader, &pxOutProperties->xTargetTemperature ) != eAzureIoTSuccess )
+            {
+                return eAzureIoTErrorFailed;
+            }
+
+            pxOutProperties->xHasTargetTemperature = true;
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+        }
+        else if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
+                                                      ( const uint8_t * ) sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT,
+                                                      sizeof( sampleazureiotPROPERTY_REPORTING_INTERVAL_TEXT ) - 1 ) )
+        {
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+
+            if( AzureIoTJSONReader_GetTokenInt32( &xReader, &pxOutProperties->lReportingIntervalSeconds ) != eAzureIoTSuccess )
+            {
+                pxOutProperties->lReportingIntervalSeconds = -1;
+            }
+
+            pxOutProperties->xHasReportingInterval = true;
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+        }
+        else
+        {
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+            ( void ) AzureIoTJSONReader_SkipChildren( &xReader );
+            ( void ) AzureIoTJSONReader_NextToken( &xReader );
+        }
+    }
+
+    return ( xCoreResult == AZ_ERROR_IOT_END_OF_PROPERTIES ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+static double prvNow( void )
+{
+    struct timespec xNow;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( double ) xNow.tv_sec + ( double ) xNow.tv_nsec / 1e9;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Checks the result of a parser on a document, then times it.
+ *
+ * @return Nanoseconds per parse, or a negative value if the parser got the document wrong.
+ */
+static double prvTimeParser( Parser_t xParser,
+                             const Document_t * pxDocument,
+                             bool xIsGetResponse )
+{
+    WritableProperties_t xProperties;
+    uint32_t ulVersion = 0;
+    uint32_t ulIterations = benchmarkBYTES_PER_RUN / pxDocument->ulLength + 1U;
+    uint32_t i;
+    double xStart;
+
+    if( ( xParser( ( const uint8_t * ) pxDocument->pcBuffer, pxDocument->ulLength, xIsGetResponse,
+                   &xProperties, &ulVersion ) != eAzureIoTSuccess ) ||
+        ( ulVersion != benchmarkDESIRED_VERSION ) ||
+        !xProperties.xHasTargetTemperature ||
+        ( xProperties.xTargetTemperature != benchmarkTARGET_TEMPERATURE ) ||
+        !xProperties.xHasReportingInterval ||
+        ( xProperties.lReportingIntervalSeconds != benchmarkREPORTING_INTERVAL ) )
+    {
+        return -1.0;
+    }
+
+    xStart = prvNow();
+
+    for( i = 0; i < ulIterations; i++ )
+    {
+        ( void ) xParser( ( const uint8_t * ) pxDocument->pcBuffer, pxDocument->ulLength, xIsGetResponse,
+                          &xProperties, &ulVersion );
+    }
+
+    return ( prvNow() - xStart ) * 1e9 / ( double ) ulIterations;
+}
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    Document_t xDocument = { 0 };
+    double xTwoPassNs;
+    double xSinglePassNs;
+    int lStatus = EXIT_SUCCESS;
+    uint32_t i;
+    int lIsGetResponse;
+
+    if( az_result_failed( az_iot_hub_client_init( &xHubClient, AZ_SPAN_FROM_STR( "host" ),
+                                                  AZ_SPAN_FROM_STR( "device" ), NULL ) ) )
+    {
+        fprintf( stderr, "Failed to initialize the hub client\n" );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%-16s %10s %10s %14s %14s %8s\n",
+            "document", "properties", "bytes", "two-pass ns", "single-pass ns", "speedup" );
+
+    for( lIsGetResponse = 0; lIsGetResponse <= 1; lIsGetResponse++ )
+    {
+        for( i = 0; i < sizeof( ulPropertyCounts ) / sizeof( ulPropertyCounts[ 0 ] ); i++ )
+        {
+            prvGenerateDocument( &xDocument, ulPropertyCounts[ i ], lIsGetResponse );
+
+            xTwoPassNs = prvTimeParser( prvParseTwoPass, &xDocument, lIsGetResponse );
+            xSinglePassNs = prvTimeParser( xDesiredProperties_Parse, &xDocument, lIsGetResponse );
+
+            if( ( xTwoPassNs < 0 ) || ( xSinglePassNs < 0 ) )
+            {
+                fprintf( stderr, "%s parser misread the %u property document\n",
+                         ( xTwoPassNs < 0 ) ? "Two-pass" : "Single-pass", ( unsigned ) ulPropertyCounts[ i ] );
+                lStatus = EXIT_FAILURE;
+                continue;
+            }
+
+            printf( "%-16s %10u %10u %14.0f %14.0f %7.2fx\n",
+                    lIsGetResponse ? "GET response" : "writable update",
+                    ( unsigned ) ulPropertyCounts[ i ], ( unsigned ) xDocument.ulLength,
+                    xTwoPassNs, xSinglePassNs, xTwoPassNs / xSinglePassNs );
+        }
+    }
+
+    free( xDocument.pcBuffer );
+
+    return lStatus;
+}
+/*-----------------------------------------------------------*/
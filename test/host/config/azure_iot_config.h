@@ -0,0 +1,11 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Host build of the middleware configuration: the defaults, without logging.
+ */
+
+#ifndef AZURE_IOT_CONFIG_H
+#define AZURE_IOT_CONFIG_H
+
+#endif /* AZURE_IOT_CONFIG_H */
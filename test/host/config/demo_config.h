@@ -0,0 +1,17 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Host build of the demo configuration: logging is compiled out so that the
+ *        benchmark measures parsing only.
+ */
+
+#ifndef DEMO_CONFIG_H
+#define DEMO_CONFIG_H
+
+#define LogError( message )
+#define LogWarn( message )
+#define LogInfo( message )
+#define LogDebug( message )
+
+#endif /* DEMO_CONFIG_H */